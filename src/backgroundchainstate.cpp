@@ -0,0 +1,305 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <backgroundchainstate.h>
+
+#include <chainstate.h>
+#include <coins.h>
+#include <coinstats.h>
+#include <consensus/validation.h>
+#include <issuedcolorids.h>
+#include <shutdown.h>
+#include <txdb.h>
+#include <util.h>
+#include <utilmemory.h>
+#include <validation.h>
+#include <file_io.h>
+
+std::unique_ptr<CBackgroundChainstate> g_background_chainstate;
+
+constexpr int64_t SYNC_LOG_INTERVAL = 30; // seconds
+
+/**
+ * ConnectBlock and ReplayBlocks stage colorId issuances in g_colorid_state.
+ * Point it at the background chainstate's set while they run on its coins.
+ */
+class ColorIdStateSwap
+{
+    std::unique_ptr<CIssuedColorIds>& m_state;
+public:
+    explicit ColorIdStateSwap(std::unique_ptr<CIssuedColorIds>& state) : m_state(state) { std::swap(g_colorid_state, m_state); }
+    ~ColorIdStateSwap() { std::swap(g_colorid_state, m_state); }
+};
+
+CBackgroundChainstate::CBackgroundChainstate(std::unique_ptr<CCoinsViewDB> coins_db, CBlockIndex* pindexSnapshotBase) :
+    m_coins_db(std::move(coins_db)),
+    m_snapshot_base(pindexSnapshotBase)
+{}
+
+CBackgroundChainstate::~CBackgroundChainstate()
+{
+    Interrupt();
+    Stop();
+}
+
+bool CBackgroundChainstate::Init(std::string& strError)
+{
+    AssertLockHeld(cs_main);
+
+    m_colorid_state = MakeUnique<CIssuedColorIds>();
+    m_coins_db->SetColorIdState(m_colorid_state.get());
+    {
+        ColorIdStateSwap swap(m_colorid_state);
+        if (!g_chainstate.ReplayBlocks(m_coins_db.get())) {
+            strError = "unable to replay blocks";
+            return false;
+        }
+    }
+
+    std::set<ColorIdentifier> colorIds;
+    if (!m_coins_db->LoadIssuedColorIds(colorIds)) {
+        strError = "failed to load the issued colorId set";
+        return false;
+    }
+    m_colorid_state->SetConfirmed(std::move(colorIds));
+
+    m_coins_catcher = MakeUnique<CCoinsViewErrorCatcher>(m_coins_db.get());
+    m_coins_cache = MakeUnique<CCoinsViewCache>(m_coins_catcher.get());
+
+    const uint256 hashBestBlock = m_coins_cache->GetBestBlock();
+    if (!hashBestBlock.IsNull()) {
+        CBlockIndex* pindexTip = LookupBlockIndex(hashBestBlock);
+        if (!pindexTip || m_snapshot_base->GetAncestor(pindexTip->nHeight) != pindexTip) {
+            strError = strprintf("chainstate tip %s is not an ancestor of the snapshot base", hashBestBlock.ToString());
+            return false;
+        }
+        m_chain.SetTip(pindexTip);
+    }
+
+    m_total_cache_usage = nCoinCacheUsage;
+    RebalanceCaches();
+    return true;
+}
+
+void CBackgroundChainstate::RebalanceCaches()
+{
+    AssertLockHeld(cs_main);
+
+    const int nPercent = IsInitialBlockDownload() ? BACKGROUND_COINS_CACHE_PERCENT_SYNCING : BACKGROUND_COINS_CACHE_PERCENT_SYNCED;
+    const size_t nCacheUsage = m_total_cache_usage / 100 * nPercent;
+    if (nCacheUsage == m_cache_usage)
+        return;
+
+    m_cache_usage = nCacheUsage;
+    nCoinCacheUsage = m_total_cache_usage - m_cache_usage;
+    LogPrintf("[snapshot] coins cache: %.1fMiB for the active chainstate, %.1fMiB for background validation\n",
+        nCoinCacheUsage * (1.0 / 1024 / 1024), m_cache_usage * (1.0 / 1024 / 1024));
+}
+
+bool CBackgroundChainstate::Flush()
+{
+    AssertLockHeld(cs_main);
+
+    if (!m_coins_cache)
+        return true;
+    // The undo data written by ConnectBlock must reach the disk before the coins do.
+    FlushBlockFile();
+    return m_coins_cache->Flush();
+}
+
+bool CBackgroundChainstate::ConnectBlock(const CBlock& block, CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    assert(pindex->pprev == m_chain.Tip());
+
+    CValidationState state;
+    {
+        CCoinsViewCache view(m_coins_cache.get());
+        bool rv;
+        {
+            ColorIdStateSwap swap(m_colorid_state);
+            rv = g_chainstate.ConnectBlock(block, state, pindex, view);
+        }
+        if (!rv) {
+            if (state.IsInvalid() && !state.CorruptionPossible()) {
+                pindex->nStatus |= BLOCK_FAILED_VALID;
+                setDirtyBlockIndex.insert(pindex);
+                InvalidateSnapshot(strprintf("block %s at height %d is invalid: %s",
+                    pindex->GetBlockHash().ToString(), pindex->nHeight, FormatStateMessage(state)));
+            } else if (!ShutdownRequested()) {
+                AbortNode(state, strprintf("Failed to connect block %s in background validation: %s",
+                    pindex->GetBlockHash().ToString(), FormatStateMessage(state)));
+            }
+            return false;
+        }
+        bool flushed = view.Flush();
+        assert(flushed);
+    }
+
+    if (pindex->IsAssumedValid()) {
+        pindex->nStatus &= ~BLOCK_ASSUMED_VALID;
+        setDirtyBlockIndex.insert(pindex);
+    }
+    m_chain.SetTip(pindex);
+
+    RebalanceCaches();
+    if (m_coins_cache->DynamicMemoryUsage() > m_cache_usage && !Flush()) {
+        return AbortNode("Failed to write to the background coin database");
+    }
+    return true;
+}
+
+void CBackgroundChainstate::ThreadSync()
+{
+    int64_t last_log_time = 0;
+    while (!m_interrupt) {
+        CBlockIndex* pindex;
+        int nBaseHeight;
+        {
+            LOCK(cs_main);
+            if (m_chain.Tip() == m_snapshot_base)
+                break;
+            nBaseHeight = m_snapshot_base->nHeight;
+            pindex = m_snapshot_base->GetAncestor(m_chain.Height() + 1);
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                pindex = nullptr;
+        }
+        if (!pindex) {
+            // Wait for the block to be downloaded, see FindNextHistoricalBlocksToDownload.
+            m_interrupt.sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
+        int64_t current_time = GetTime();
+        if (last_log_time + SYNC_LOG_INTERVAL < current_time) {
+            LogPrintf("[snapshot] background validation at height %d of %d\n", pindex->nHeight, nBaseHeight);
+            last_log_time = current_time;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex)) {
+            AbortNode(strprintf("Failed to read block %s for background validation", pindex->GetBlockHash().ToString()));
+            return;
+        }
+
+        LOCK(cs_main);
+        if (!ConnectBlock(block, pindex))
+            return;
+    }
+
+    if (!m_interrupt)
+        Complete();
+}
+
+void CBackgroundChainstate::Complete()
+{
+    uint256 hashExpected;
+    {
+        LOCK(cs_main);
+        if (!Flush()) {
+            AbortNode("Failed to write to the background coin database");
+            return;
+        }
+        hashExpected = pcoinsdbview->GetSnapshotUTXOHash();
+        LogPrintf("[snapshot] background validation reached the snapshot base at height %d, comparing UTXO sets\n",
+            m_snapshot_base->nHeight);
+    }
+
+    // Nothing else writes to m_coins_db any more, so the UTXO set can be hashed without holding cs_main.
+    CCoinsStats stats;
+    if (!GetUTXOStats(m_coins_db.get(), stats)) {
+        AbortNode("Failed to read the background coin database");
+        return;
+    }
+
+    LOCK(cs_main);
+    if (stats.hashSerialized != hashExpected) {
+        InvalidateSnapshot(strprintf("UTXO set hash %s at the snapshot base does not match the snapshot hash %s",
+            stats.hashSerialized.ToString(), hashExpected.ToString()));
+        return;
+    }
+    if (!pcoinsdbview->WriteSnapshotValidated()) {
+        AbortNode("Failed to write to the coin database");
+        return;
+    }
+
+    // A crash may have persisted the block index without the validity changes
+    // of blocks whose coins were already flushed.
+    for (CBlockIndex* pindex = m_snapshot_base; pindex != nullptr; pindex = pindex->pprev) {
+        if (pindex->IsAssumedValid()) {
+            pindex->nStatus &= ~BLOCK_ASSUMED_VALID;
+            pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+            setDirtyBlockIndex.insert(pindex);
+        }
+    }
+
+    LogPrintf("[snapshot] snapshot chainstate validated at height %d (%s)\n",
+        m_snapshot_base->nHeight, m_snapshot_base->GetBlockHash().ToString());
+    m_snapshot_base = nullptr;
+
+    m_coins_cache.reset();
+    m_coins_catcher.reset();
+    m_coins_db.reset();
+    m_colorid_state.reset();
+    nCoinCacheUsage = m_total_cache_usage;
+
+    const fs::path chainstate_dir = GetDataDir() / DEFAULT_CHAINSTATE_DIR;
+    try {
+        fs::remove_all(chainstate_dir);
+    } catch (const fs::filesystem_error& e) {
+        LogPrintf("[snapshot] failed to remove %s: %s\n", chainstate_dir.string(), e.what());
+    }
+}
+
+void CBackgroundChainstate::InvalidateSnapshot(const std::string& strReason)
+{
+    AssertLockHeld(cs_main);
+
+    LogPrintf("[snapshot] background validation failed: %s\n", strReason);
+    m_snapshot_base = nullptr;
+
+    // The background chainstate becomes the active one again on the next start;
+    // the snapshot chainstate is deleted then (see HaveSnapshotChainstate).
+    CValidationState state;
+    if (!Flush() || !pcoinsdbview->EraseSnapshotBase() || !FlushStateToDisk(state, FlushStateMode::ALWAYS)) {
+        AbortNode("Failed to discard the invalid UTXO snapshot");
+        return;
+    }
+    AbortNode("UTXO snapshot failed validation: " + strReason,
+        _("The loaded UTXO snapshot is invalid and has been discarded. Restart to continue syncing from the validated blocks."));
+}
+
+bool CBackgroundChainstate::Start()
+{
+    {
+        LOCK(cs_main);
+        std::string strError;
+        if (!Init(strError)) {
+            return error("%s: %s", __func__, strError);
+        }
+        LogPrintf("[snapshot] validating blocks %d to %d below the snapshot base in the background\n",
+            m_chain.Height() + 1, m_snapshot_base->nHeight);
+    }
+
+    m_thread_sync = std::thread(&TraceThread, "snapshotval",
+                                std::bind(&CBackgroundChainstate::ThreadSync, this));
+    return true;
+}
+
+void CBackgroundChainstate::Interrupt()
+{
+    m_interrupt();
+}
+
+void CBackgroundChainstate::Stop()
+{
+    if (m_thread_sync.joinable()) {
+        m_thread_sync.join();
+    }
+
+    LOCK(cs_main);
+    if (!Flush()) {
+        LogPrintf("%s: failed to write the background coin database\n", __func__);
+    }
+}
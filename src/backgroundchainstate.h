@@ -0,0 +1,110 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BACKGROUNDCHAINSTATE_H
+#define BITCOIN_BACKGROUNDCHAINSTATE_H
+
+#include <chain.h>
+#include <cs_main.h>
+#include <threadinterrupt.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+
+class CBlockIndex;
+class CCoinsViewCache;
+class CCoinsViewDB;
+class CCoinsViewErrorCatcher;
+class CIssuedColorIds;
+
+//! Share of the in-memory coins cache given to background validation while the snapshot chainstate syncs to the tip, in percent
+static const int BACKGROUND_COINS_CACHE_PERCENT_SYNCING = 10;
+//! Share of the in-memory coins cache given to background validation once the snapshot chainstate has caught up, in percent
+static const int BACKGROUND_COINS_CACHE_PERCENT_SYNCED = 90;
+
+/**
+ * Validates the blocks below the base of a loaded UTXO snapshot.
+ *
+ * After a snapshot is loaded, the active chainstate (pcoinsTip) follows the
+ * tip from the snapshot base while the blocks below the base are only assumed
+ * valid. This class keeps the chainstate that was active before the snapshot
+ * (the "chainstate" directory) and connects the blocks from its tip up to the
+ * snapshot base in its own thread, with its own coins cache and issued colorId
+ * set. The in-memory coins cache budget (-dbcache) is shared with the active
+ * chainstate, see BACKGROUND_COINS_CACHE_PERCENT_*.
+ *
+ * When the base is reached, the UTXO set built from the blocks is compared with
+ * the snapshot hash. If they match, the snapshot chainstate is marked validated
+ * and the background chainstate is deleted; the snapshot chainstate replaces it
+ * as "chainstate" on the next start. If they differ, or a block below the base
+ * is invalid, the snapshot chainstate is discarded and the node shuts down so
+ * that it restarts from the background chainstate.
+ */
+class CBackgroundChainstate
+{
+private:
+    std::unique_ptr<CCoinsViewDB> m_coins_db;
+    std::unique_ptr<CCoinsViewErrorCatcher> m_coins_catcher;
+    std::unique_ptr<CCoinsViewCache> m_coins_cache;
+    std::unique_ptr<CIssuedColorIds> m_colorid_state;
+
+    /** Blocks connected to m_coins_db, from genesis towards the snapshot base. */
+    CChain m_chain GUARDED_BY(cs_main);
+
+    /** Base block of the snapshot chainstate; nullptr once validation has finished. */
+    CBlockIndex* m_snapshot_base GUARDED_BY(cs_main) = nullptr;
+
+    /** Total in-memory coins cache budget, shared with the active chainstate. */
+    size_t m_total_cache_usage = 0;
+    /** Part of m_total_cache_usage used by m_coins_cache. */
+    size_t m_cache_usage GUARDED_BY(cs_main) = 0;
+
+    std::thread m_thread_sync;
+    CThreadInterrupt m_interrupt;
+
+    /** Replay an interrupted flush and set up m_chain and the colorId set from the database. */
+    bool Init(std::string& strError) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    /** Connect blocks up to the snapshot base. Runs in m_thread_sync until done or interrupted. */
+    void ThreadSync();
+
+    /** Connect pindex on top of m_chain. */
+    bool ConnectBlock(const CBlock& block, CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    /** Compare the UTXO set at the snapshot base with the snapshot and hand over to the snapshot chainstate. */
+    void Complete();
+
+    /** Discard the snapshot chainstate and shut down. */
+    void InvalidateSnapshot(const std::string& strReason) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    /** Split the in-memory coins cache budget between the two chainstates. */
+    void RebalanceCaches() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    bool Flush() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+public:
+    /** Take over coins_db, the chainstate built from blocks, for validation up to pindexSnapshotBase. */
+    CBackgroundChainstate(std::unique_ptr<CCoinsViewDB> coins_db, CBlockIndex* pindexSnapshotBase);
+    ~CBackgroundChainstate();
+
+    /** Initialize from the database and start validating in a new thread. */
+    bool Start();
+
+    void Interrupt();
+
+    /** Wait for the validation thread to exit and write the coins cache to disk. */
+    void Stop();
+
+    /** The snapshot base block while background validation is running, nullptr otherwise. */
+    const CBlockIndex* GetSnapshotBase() const EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return m_snapshot_base; }
+
+    /** The last block connected by background validation. */
+    const CBlockIndex* GetTip() const EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return m_chain.Tip(); }
+};
+
+/** Validation of the blocks below the base of a loaded UTXO snapshot, if one is running. */
+extern std::unique_ptr<CBackgroundChainstate> g_background_chainstate;
+
+#endif // BITCOIN_BACKGROUNDCHAINSTATE_H
@@ -0,0 +1,193 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockindexsnapshot.h>
+
+#include <chain.h>
+#include <clientversion.h>
+#include <hash.h>
+#include <random.h>
+#include <streams.h>
+#include <txdb.h>
+#include <util.h>
+#include <validation.h>
+
+#include <algorithm>
+#include <map>
+
+static const char BLOCK_INDEX_SNAPSHOT_MAGIC[4] = {'t', 'p', 'b', 'i'};
+static const uint32_t BLOCK_INDEX_SNAPSHOT_VERSION = 2;
+
+/** Size of an entry: hash, parent position, 7 numbers, the merkle roots, time and xfield. */
+static const size_t BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE = 32 + 4 + 7 * 4 + 32 + 32 + 4 + 4;
+
+//! Parent position of an entry without a parent.
+static const uint32_t NO_PARENT = std::numeric_limits<uint32_t>::max();
+
+fs::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blockindex.dat";
+}
+
+/**
+ * The last block file and the records of all block files in blocktree, serialized. A binary
+ * that does not know the snapshot id leaves it in place when it writes block index entries,
+ * but it updates these records whenever it stores or prunes blocks.
+ */
+static std::vector<unsigned char> GetBlockFilesState(CBlockTreeDB& blocktree)
+{
+    int nLastFile = -1;
+    if (!blocktree.ReadLastBlockFile(nLastFile)) {
+        nLastFile = -1;
+    }
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << nLastFile;
+    for (int nFile = 0; nFile <= nLastFile; nFile++) {
+        CBlockFileInfo info;
+        if (!blocktree.ReadBlockFileInfo(nFile, info)) {
+            info.SetNull();
+        }
+        ss << info;
+    }
+    return std::vector<unsigned char>(ss.begin(), ss.end());
+}
+
+bool WriteBlockIndexSnapshot(CBlockTreeDB& blocktree, const fs::path& path)
+{
+    AssertLockHeld(cs_main);
+    if (!setDirtyBlockIndex.empty()) {
+        return error("%s: the block index is not flushed", __func__);
+    }
+    int64_t nStart = GetTimeMillis();
+
+    std::vector<const CBlockIndex*> vSorted;
+    vSorted.reserve(mapBlockIndex.size());
+    for (const auto& item : mapBlockIndex) {
+        vSorted.push_back(item.second);
+    }
+    std::sort(vSorted.begin(), vSorted.end(), [](const CBlockIndex* a, const CBlockIndex* b) { return a->nHeight < b->nHeight; });
+
+    std::map<const CBlockIndex*, uint32_t> positions;
+    std::map<uint32_t, uint32_t> xfieldIds;
+    std::vector<CXField> xfields;
+    for (const CBlockIndex* pindex : vSorted) {
+        positions.emplace(pindex, positions.size());
+        if (xfieldIds.emplace(pindex->nXFieldId, xfields.size()).second) {
+            xfields.push_back(pindex->GetXField());
+        }
+    }
+
+    const uint256 id = GetRandHash();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.reserve(vSorted.size() * BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE + 1024);
+    ss << BLOCK_INDEX_SNAPSHOT_MAGIC << BLOCK_INDEX_SNAPSHOT_VERSION << id << GetBlockFilesState(blocktree) << (uint64_t)vSorted.size() << xfields;
+    for (const CBlockIndex* pindex : vSorted) {
+        const uint32_t nPrev = pindex->pprev ? positions.at(pindex->pprev) : NO_PARENT;
+        ss << pindex->GetBlockHash() << nPrev << pindex->nHeight << pindex->nFile << pindex->nDataPos << pindex->nUndoPos
+           << pindex->nTx << pindex->nStatus << pindex->nFeatures << pindex->hashMerkleRoot << pindex->hashImMerkleRoot
+           << pindex->nTime << xfieldIds.at(pindex->nXFieldId);
+    }
+    ss << Hash(ss.begin(), ss.end());
+
+    try {
+        const fs::path pathTmp = path.string() + ".new";
+        CAutoFile file(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull()) {
+            return error("%s: failed to open %s", __func__, pathTmp.string());
+        }
+        file.write(ss.data(), ss.size());
+        if (!FileCommit(file.Get()))
+            throw std::runtime_error("FileCommit failed");
+        file.fclose();
+        RenameOver(pathTmp, path);
+    } catch (const std::exception& e) {
+        return error("%s: failed to write the block index snapshot: %s", __func__, e.what());
+    }
+    // Only now the snapshot may be used.
+    if (!blocktree.WriteBlockIndexSnapshotId(id)) {
+        return error("%s: failed to write the block index snapshot id", __func__);
+    }
+    LogPrintf("Wrote a snapshot of %u block index entries in %dms\n", vSorted.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool ReadBlockIndexSnapshot(CBlockTreeDB& blocktree, const fs::path& path,
+                            std::vector<std::pair<uint256, std::unique_ptr<CBlockIndex>>>& entries)
+{
+    int64_t nStart = GetTimeMillis();
+    std::vector<uint8_t> data;
+    try {
+        if (!fs::exists(path))
+            return false;
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            return false;
+        data.resize(fs::file_size(path));
+        file.read((char*)data.data(), data.size());
+    } catch (const std::exception& e) {
+        LogPrintf("%s: failed to read the block index snapshot: %s\n", __func__, e.what());
+        return false;
+    }
+
+    if (data.size() < 32 || Hash(data.begin(), data.end() - 32) != uint256(std::vector<unsigned char>(data.end() - 32, data.end()))) {
+        LogPrintf("%s: the block index snapshot is damaged\n", __func__);
+        return false;
+    }
+
+    std::vector<std::pair<uint256, std::unique_ptr<CBlockIndex>>> loaded;
+    try {
+        SpanReader stream(SER_DISK, CLIENT_VERSION, data);
+        char magic[4];
+        uint32_t nVersion;
+        uint256 id, dbId;
+        std::vector<unsigned char> blockFilesState;
+        uint64_t nEntries;
+        std::vector<CXField> xfields;
+        stream >> magic >> nVersion;
+        if (memcmp(magic, BLOCK_INDEX_SNAPSHOT_MAGIC, sizeof(magic)) || nVersion != BLOCK_INDEX_SNAPSHOT_VERSION) {
+            LogPrintf("%s: unknown block index snapshot format\n", __func__);
+            return false;
+        }
+        stream >> id >> blockFilesState;
+        if (!blocktree.ReadBlockIndexSnapshotId(dbId) || dbId != id || blockFilesState != GetBlockFilesState(blocktree)) {
+            LogPrintf("%s: the block index snapshot does not match the block tree database\n", __func__);
+            return false;
+        }
+        stream >> nEntries >> xfields;
+
+        // Each distinct xfield is added to the xfield table once.
+        std::vector<uint32_t> xfieldIds;
+        xfieldIds.reserve(xfields.size());
+        for (const CXField& xfield : xfields) {
+            CBlockIndex index;
+            index.SetXField(xfield);
+            xfieldIds.push_back(index.nXFieldId);
+        }
+
+        loaded.reserve(nEntries);
+        for (uint64_t i = 0; i < nEntries; i++) {
+            uint256 hash;
+            uint32_t nPrev, nXField;
+            std::unique_ptr<CBlockIndex> pindex = MakeUnique<CBlockIndex>();
+            stream >> hash >> nPrev >> pindex->nHeight >> pindex->nFile >> pindex->nDataPos >> pindex->nUndoPos
+                   >> pindex->nTx >> pindex->nStatus >> pindex->nFeatures >> pindex->hashMerkleRoot >> pindex->hashImMerkleRoot
+                   >> pindex->nTime >> nXField;
+            // Parents come first.
+            if ((nPrev != NO_PARENT && nPrev >= i) || nXField >= xfieldIds.size()) {
+                LogPrintf("%s: the block index snapshot is inconsistent\n", __func__);
+                return false;
+            }
+            pindex->pprev = nPrev == NO_PARENT ? nullptr : loaded[nPrev].second.get();
+            pindex->nXFieldId = xfieldIds[nXField];
+            loaded.emplace_back(hash, std::move(pindex));
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: failed to read the block index snapshot: %s\n", __func__, e.what());
+        return false;
+    }
+
+    entries = std::move(loaded);
+    LogPrintf("Read a snapshot of %u block index entries in %dms\n", entries.size(), GetTimeMillis() - nStart);
+    return true;
+}
@@ -0,0 +1,44 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TAPYRUS_BLOCKINDEXSNAPSHOT_H
+#define TAPYRUS_BLOCKINDEXSNAPSHOT_H
+
+#include <fs.h>
+#include <uint256.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+class CBlockIndex;
+class CBlockTreeDB;
+
+/** Default for -blockindexsnapshot */
+static const bool DEFAULT_BLOCK_INDEX_SNAPSHOT = false;
+
+/** Where the snapshot of the block index is written at shutdown */
+fs::path GetBlockIndexSnapshotPath();
+
+/**
+ * Write the whole block index to a flat file at path, ordered by height, with fixed
+ * size entries that refer to their parent by position. The snapshot gets a random id
+ * that is written to blocktree too; writing any block index entry to blocktree erases
+ * it, so the snapshot is only used while it matches the database. Since older binaries
+ * do not erase the id, the snapshot also records the block file records of blocktree
+ * (the last block file and the information on each file), which must match as well.
+ * Must be called after the block index was flushed. Requires cs_main.
+ */
+bool WriteBlockIndexSnapshot(CBlockTreeDB& blocktree, const fs::path& path);
+
+/**
+ * Read the block index from the snapshot at path if it is intact and matches
+ * blocktree. The entries are returned with their hashes, ordered by height, and
+ * linked to their parents; phashBlock is left for the caller to set when it adds
+ * them to the block index. Nothing is returned if false is returned.
+ */
+bool ReadBlockIndexSnapshot(CBlockTreeDB& blocktree, const fs::path& path,
+                            std::vector<std::pair<uint256, std::unique_ptr<CBlockIndex>>>& entries);
+
+#endif // TAPYRUS_BLOCKINDEXSNAPSHOT_H
@@ -0,0 +1,91 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockproofbatch.h>
+
+#include <chainstate.h>
+#include <checkqueue.h>
+#include <primitives/block.h>
+#include <validation.h>
+#include <xfieldhistory.h>
+
+void CBlockProofBatch::Add(const CBlockHeader& header, int nHeight, CXFieldHistoryMap* pxfieldHistory)
+{
+    const uint256 hash = header.GetHashForSign();
+    if (m_positions.count(hash)) {
+        return;
+    }
+
+    // Same lookup as CheckBlockHeader: an unknown height uses the latest aggregate key.
+    const uint32_t uHeight = (nHeight >= 0) ? static_cast<uint32_t>(nHeight) : UINT32_MAX;
+    const XFieldChange change = pxfieldHistory ? pxfieldHistory->Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, uHeight)
+                                               : CXFieldHistory().Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, uHeight);
+    CPubKey pubkey = std::get<XFieldAggPubKey>(change.xfieldValue).getPubKey();
+
+    // The history does not know yet about the key changes of the headers earlier in this run.
+    if (nHeight >= 0) {
+        auto it = m_key_changes.upper_bound(nHeight);
+        if (it != m_key_changes.begin() && std::prev(it)->first > static_cast<int>(change.height)) {
+            pubkey = std::prev(it)->second;
+        }
+        if (header.xfield.xfieldType == TAPYRUS_XFIELDTYPES::AGGPUBKEY && header.xfield.IsValid()) {
+            m_key_changes[nHeight + 1] = std::get<XFieldAggPubKey>(header.xfield.xfieldValue).getPubKey();
+        }
+    }
+
+    m_positions.emplace(hash, m_entries.size());
+    Entry entry;
+    entry.hash = hash;
+    entry.pubkey = pubkey;
+    entry.proof = header.proof;
+    m_entries.push_back(std::move(entry));
+}
+
+std::optional<uint256> CBlockProofCheck::operator()()
+{
+    m_entry->valid = m_entry->pubkey.Verify_Schnorr(m_entry->hash, m_entry->proof);
+    if (!m_entry->valid) {
+        return m_entry->hash;
+    }
+    return std::nullopt;
+}
+
+bool CBlockProofBatch::Verify()
+{
+    if (m_entries.empty()) {
+        return true;
+    }
+
+    // A peer sending bad proofs should not get more than one of them checked.
+    if (CBlockProofCheck(&m_entries[0])().has_value()) {
+        return false;
+    }
+
+    // The queue stops handing out proofs once one is invalid. The proofs left
+    // unchecked are checked again by CheckBlockHeader.
+    std::vector<CBlockProofCheck> vChecks;
+    vChecks.reserve(m_entries.size() - 1);
+    for (size_t i = 1; i < m_entries.size(); ++i) {
+        vChecks.emplace_back(&m_entries[i]);
+    }
+    if (!g_chainstate.blockproofcheckqueue) {
+        for (CBlockProofCheck& check : vChecks) {
+            if (check().has_value()) return false;
+        }
+        return true;
+    }
+    CCheckQueueControl<CBlockProofCheck> control(g_chainstate.blockproofcheckqueue.get());
+    control.Add(std::move(vChecks));
+    return !control.Complete().has_value();
+}
+
+bool CBlockProofBatch::IsVerified(const uint256& hash, const CPubKey& pubkey, const std::vector<unsigned char>& proof) const
+{
+    auto it = m_positions.find(hash);
+    if (it == m_positions.end()) {
+        return false;
+    }
+    const Entry& entry = m_entries[it->second];
+    return entry.valid && entry.pubkey == pubkey && entry.proof == proof;
+}
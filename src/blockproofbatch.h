@@ -0,0 +1,77 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TAPYRUS_BLOCKPROOFBATCH_H
+#define TAPYRUS_BLOCKPROOFBATCH_H
+
+#include <pubkey.h>
+#include <uint256.h>
+
+#include <map>
+#include <optional>
+#include <vector>
+
+class CBlockHeader;
+class CXFieldHistoryMap;
+
+/** Headers below this count are not worth verifying on several threads */
+static const size_t MIN_BLOCK_PROOF_BATCH_SIZE = 16;
+
+/**
+ * Verifies the proofs of a run of block headers together, before the headers are
+ * accepted one by one. The proofs are checked on the block proof check queue and
+ * the calling thread, instead of serially in CheckBlockHeader. The first proof is
+ * checked alone and the queue stops at the first invalid proof, so a run of bad
+ * proofs costs about as much as checking them one by one.
+ *
+ * The aggregate public key of each header is predicted from the xfield history and
+ * from the aggregate public key changes earlier in the run. CheckBlockHeader still
+ * derives the key itself, and only skips the signature check if the batch verified
+ * the same header, proof and key. A proof that is invalid, or that was checked
+ * against a key that turns out to be wrong, is checked again by CheckBlockHeader.
+ */
+class CBlockProofBatch
+{
+public:
+    struct Entry {
+        uint256 hash;
+        CPubKey pubkey;
+        std::vector<unsigned char> proof;
+        bool valid{false};
+    };
+
+private:
+    std::vector<Entry> m_entries;
+    //! Position of each header in m_entries, by hash for signing
+    std::map<uint256, size_t> m_positions;
+    //! Aggregate public keys set by the headers of the run, by the height they apply from
+    std::map<int, CPubKey> m_key_changes;
+
+public:
+    /** Add a header at nHeight, whose aggregate public key is looked up in pxfieldHistory. */
+    void Add(const CBlockHeader& header, int nHeight, CXFieldHistoryMap* pxfieldHistory);
+
+    /** Verify the added proofs. Returns false if any of them is invalid. */
+    bool Verify();
+
+    /** Whether the proof of the header with the given hash for signing was verified against pubkey. */
+    bool IsVerified(const uint256& hash, const CPubKey& pubkey, const std::vector<unsigned char>& proof) const;
+
+    size_t size() const { return m_entries.size(); }
+};
+
+/** Closure representing one block proof check, run on the block proof check queue. */
+class CBlockProofCheck
+{
+private:
+    CBlockProofBatch::Entry* m_entry;
+
+public:
+    explicit CBlockProofCheck(CBlockProofBatch::Entry* entry) : m_entry(entry) {}
+
+    /** Returns the hash for signing of the header if its proof is invalid. */
+    std::optional<uint256> operator()();
+};
+
+#endif // TAPYRUS_BLOCKPROOFBATCH_H
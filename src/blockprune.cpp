@@ -5,6 +5,7 @@
 #include <validation.h>
 #include <cs_main.h>
 #include <blockprune.h>
+#include <backgroundchainstate.h>
 #include <file_io.h>
 
 
@@ -69,6 +70,15 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
     }
 }
 
+/** Blocks above the background chainstate tip are still needed to validate a loaded UTXO snapshot. */
+static unsigned int LastBlockBackgroundValidationAllowsToPrune(unsigned int nLastBlockWeCanPrune) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (!g_background_chainstate || !g_background_chainstate->GetSnapshotBase())
+        return nLastBlockWeCanPrune;
+    const CBlockIndex* pindexTip = g_background_chainstate->GetTip();
+    return std::min(nLastBlockWeCanPrune, pindexTip ? static_cast<unsigned int>(pindexTip->nHeight) : 0u);
+}
+
 void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight)
 {
     assert(fPruneMode && nManualPruneHeight > 0);
@@ -79,6 +89,7 @@ void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeig
 
     // last block to prune is the lesser of (user-specified height, MIN_BLOCKS_TO_KEEP from the tip)
     unsigned int nLastBlockWeCanPrune = std::min(static_cast<unsigned int>(nManualPruneHeight), static_cast<unsigned int>(chainActive.Tip()->nHeight) - MIN_BLOCKS_TO_KEEP);
+    nLastBlockWeCanPrune = LastBlockBackgroundValidationAllowsToPrune(nLastBlockWeCanPrune);
     int count=0;
     for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
         if (vinfoBlockFile[fileNumber].nSize == 0 || vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
@@ -109,7 +120,7 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint32_t nPruneAfterHeight
         return;
     }
 
-    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    unsigned int nLastBlockWeCanPrune = LastBlockBackgroundValidationAllowsToPrune(chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP);
     uint64_t nCurrentUsage = CalculateCurrentUsage();
     // We don't check to prune until after we've allocated new space for files
     // So we should leave a buffer under our target to account for another allocation
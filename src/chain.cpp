@@ -6,6 +6,32 @@
 
 #include <chain.h>
 
+#include <sync.h>
+
+#include <algorithm>
+
+namespace {
+//! The distinct xfields of the headers in the block index. Entry 0 is the empty xfield.
+Mutex g_xfield_table_mutex;
+std::vector<CXField> g_xfield_table GUARDED_BY(g_xfield_table_mutex){CXField()};
+} // namespace
+
+CXField CBlockIndex::GetXField() const
+{
+    LOCK(g_xfield_table_mutex);
+    return g_xfield_table[nXFieldId];
+}
+
+void CBlockIndex::SetXField(const CXField& xfield)
+{
+    LOCK(g_xfield_table_mutex);
+    auto it = std::find_if(g_xfield_table.begin(), g_xfield_table.end(), [&](CXField& entry) { return entry == xfield; });
+    nXFieldId = it - g_xfield_table.begin();
+    if (it == g_xfield_table.end()) {
+        g_xfield_table.push_back(xfield);
+    }
+}
+
 /**
  * CChain implementation
  */
@@ -160,6 +160,10 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_VALID       =   32, //!< stage after last reached validness failed
     BLOCK_FAILED_CHILD       =   64, //!< descends from failed block
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
+
+    //! Block is an ancestor of a loaded UTXO snapshot base and has not been validated yet.
+    //! nTx is a placeholder until the block is connected by background validation.
+    BLOCK_ASSUMED_VALID      =  128,
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -208,8 +212,10 @@ public:
     uint256 hashMerkleRoot;
     uint256 hashImMerkleRoot;
     uint32_t nTime;
-    CXField xfield;
-    std::vector<unsigned char> proof;
+    //! The xfield, as its position in a table of the distinct xfields of all headers,
+    //! since xfield changes are rare. 0 is the empty xfield. See GetXField().
+    //! The proof is not kept in memory, see CBlockTreeDB::ReadBlockProof().
+    uint32_t nXFieldId;
 
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     int32_t nSequenceId;
@@ -235,8 +241,7 @@ public:
         nFeatures       = 0;
         hashMerkleRoot = uint256();
         nTime          = 0;
-        xfield.clear();
-        proof.clear();
+        nXFieldId      = 0;
     }
 
     CBlockIndex()
@@ -252,8 +257,7 @@ public:
         hashMerkleRoot = block.hashMerkleRoot;
         hashImMerkleRoot = block.hashImMerkleRoot;
         nTime          = block.nTime;
-        proof          = block.proof;
-        xfield.operator=(block.xfield);
+        SetXField(block.xfield);
     }
 
     CDiskBlockPos GetBlockPos() const {
@@ -274,6 +278,11 @@ public:
         return ret;
     }
 
+    CXField GetXField() const;
+    void SetXField(const CXField& xfield);
+
+    //! The header without its proof, which is not kept in memory. Use
+    //! GetBlockHeaderWithProof() to relay or serve the header.
     CBlockHeader GetBlockHeader() const
     {
         CBlockHeader block;
@@ -283,9 +292,8 @@ public:
         block.hashMerkleRoot = hashMerkleRoot;
         block.hashImMerkleRoot = hashImMerkleRoot;
         block.nTime          = nTime;
-        block.proof          = proof;
 
-        block.xfield.operator=(xfield);
+        block.xfield = GetXField();
         return block;
     }
 
@@ -322,13 +330,12 @@ public:
 
     std::string ToString() const
     {
-        return strprintf("CBlockIndex(pprev=%p, nHeight=%d, merkle=%s, Immerkle=%s, nTime=%u, xfield=%s, proof={%s})hashBlock=%s",
+        return strprintf("CBlockIndex(pprev=%p, nHeight=%d, merkle=%s, Immerkle=%s, nTime=%u, xfield=%s)hashBlock=%s",
             pprev, nHeight,
             hashMerkleRoot.ToString(),
             hashImMerkleRoot.ToString(),
             nTime,
-            xfield.ToString(),
-            HexStr(proof),
+            GetXField().ToString(),
             GetBlockHash().ToString());
     }
 
@@ -341,6 +348,9 @@ public:
         return ((nStatus & BLOCK_VALID_MASK) >= nUpTo);
     }
 
+    //! Check whether this block is below a UTXO snapshot base and still awaits background validation.
+    bool IsAssumedValid() const { return nStatus & BLOCK_ASSUMED_VALID; }
+
     //! Raise the validity level of this block index entry.
     //! Returns true if the validity was changed.
     bool RaiseValidity(enum BlockStatus nUpTo)
@@ -372,12 +382,14 @@ class CDiskBlockIndex : public CBlockIndex
 {
 public:
     uint256 hashPrev;
+    CXField xfield;
+    std::vector<unsigned char> proof;
 
     CDiskBlockIndex() {
         hashPrev = uint256();
     }
 
-    explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
+    CDiskBlockIndex(const CBlockIndex* pindex, const std::vector<unsigned char>& proofIn) : CBlockIndex(*pindex), xfield(pindex->GetXField()), proof(proofIn) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
     }
 
@@ -16,6 +16,9 @@
 #include <warnings.h>
 #include <file_io.h>
 #include <blockprune.h>
+#include <blockindexsnapshot.h>
+#include <coinsprefetch.h>
+#include <txdb.h>
 
 #include <deque>
 #include <boost/algorithm/string/replace.hpp>
@@ -417,7 +420,7 @@ void static UpdateTip(const CBlockIndex *pindexNew)
 
     LogPrintf("%s: new best=%s height=%d version=0x%08x xfield=%s tx=%lu date='%s' progress=%f cache=%.1fMiB(%utxo)", __func__, /* Continued */
       pindexNew->GetBlockHash().ToString(), pindexNew->nHeight, pindexNew->nFeatures,
-      pindexNew->xfield.ToString(),
+      pindexNew->GetXField().ToString(),
       (unsigned long)pindexNew->nChainTx, FormatISO8601DateTime(pindexNew->GetBlockTime()),
       GuessVerificationProgress(Params().TxData(), pindexNew), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)), pcoinsTip->GetCacheSize());
     LogPrintf("\n");
@@ -502,7 +505,7 @@ static void UpdateMempoolForReorg(DisconnectedBlockTransactions &disconnectpool,
     // previously-confirmed transactions back to the mempool.
     // UpdateTransactionsFromBlock finds descendants of any transactions in
     // the disconnectpool that were added back and cleans up the mempool state.
-    mempool.UpdateTransactionsFromBlock(vHashUpdate);
+    mempool.UpdateTransactionsFromBlock(vHashUpdate, gArgs.GetArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT));
 
     // We also need to remove any now-immature transactions
     mempool.removeForReorg(pcoinsTip.get(), chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
@@ -599,8 +602,16 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     int nInputs = 0;
     int64_t nSigOpsCost = 0;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
 
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? scriptcheckqueue.get() : nullptr);
+    // The signatures the scripts need are verified on their own queue once the scripts
+    // ran, so that inputs carrying many of them do not hold up a single script check
+    // thread. The checks are kept to be run again if one of their signatures is invalid.
+    const bool fDeferSignatures = fScriptChecks && nScriptCheckThreads && sigcheckqueue;
+    CSignatureBatch sigbatch;
+    std::vector<CScriptCheck> vDeferringChecks;
     // Accumulate new NON_REISSUABLE/NFT issuances across the whole block.
     // Staged into g_colorid_state and committed to LevelDB atomically with
     // DB_BEST_BLOCK only after control.Wait() succeeds, so a late script-check
@@ -653,11 +664,20 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             return state.DoS(100, error("ConnectBlock(): too many sigops"),
                              REJECT_INVALID, "bad-blk-sigops");
 
+        // The colors of the coins spent by tx for the token checks below, taken from the
+        // script execution cache when tx is found there.
+        std::vector<ColorIdentifier> inputColors;
         if (!tx.IsCoinBase())
         {
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, GetBlockScriptFlags(pindex), fCacheResults, fCacheResults, nScriptCheckThreads ? &vChecks : nullptr, GetBlockScriptFlags(pindex)))
+            // A single input has nothing to share with other inputs.
+            const PrecomputedTransactionData* ptxdata = nullptr;
+            if (fScriptChecks && tx.vin.size() > 1) {
+                txdata.emplace_back(tx);
+                ptxdata = &txdata.back();
+            }
+            if (!CheckInputs(tx, state, view, fScriptChecks, GetBlockScriptFlags(pindex), fCacheResults, fCacheResults, nScriptCheckThreads ? &vChecks : nullptr, GetBlockScriptFlags(pindex), ptxdata, &inputColors))
                 // FormatStateMessage is evaluated before DoS() re-sets state, preserving
                 // the per-input detail in the log.  state.GetRejectReason() already holds
                 // the specific error string set by CheckInputs, so it is propagated as-is.
@@ -676,17 +696,23 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
                 return state.DoS(100, error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHashMalFix().ToString(), FormatStateMessage(state)),
                     REJECT_INVALID, state.GetRejectReason());
+            if (fDeferSignatures) {
+                for (CScriptCheck& check : vChecks) {
+                    vDeferringChecks.push_back(check);
+                    check.DeferSignatures(&sigbatch, vDeferringChecks.size() - 1);
+                }
+            }
             control.Add(std::move(vChecks));
         }
 
         //if there are colored coins in the output verify their colorids
-        if(!CheckColorIdentifierValidity(tx, state, view, pindex->nHeight))
+        if(!CheckColorIdentifierValidity(tx, state, view, pindex->nHeight, tx.IsCoinBase() ? nullptr : &inputColors))
             return false;
 
         //verify token balances (coinbase has no real inputs so balance check does not apply)
         if (!tx.IsCoinBase()) {
             std::set<ColorIdentifier> newIssuances;
-            if (!VerifyTokenBalances(tx, state, view, txfee, !fJustCheck ? &newIssuances : nullptr, pindex->nHeight))
+            if (!VerifyTokenBalances(tx, state, view, txfee, !fJustCheck ? &newIssuances : nullptr, pindex->nHeight, &inputColors))
                 // FormatStateMessage is evaluated before DoS() overwrites state, preserving
                 // the per-tx detail in the log while enforcing DoS 100 at the block level.
                 return state.DoS(100, error("ConnectBlock(): VerifyTokenBalances on %s failed with %s",
@@ -714,6 +740,16 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (auto scriptErr = control.Complete())
         return state.DoS(100, error("%s: parallel script check failed: %s", __func__, ScriptErrorString(*scriptErr)),
             REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(*scriptErr)));
+    if (sigbatch.size()) {
+        CCheckQueueControl<CSignatureCheck> sigcontrol(sigcheckqueue.get());
+        sigcontrol.Add(sigbatch.GetChecks());
+        sigcontrol.Complete();
+        for (size_t origin : sigbatch.GetInvalidOrigins()) {
+            if (auto scriptErr = vDeferringChecks[origin]())
+                return state.DoS(100, error("%s: parallel script check failed: %s", __func__, ScriptErrorString(*scriptErr)),
+                    REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(*scriptErr)));
+        }
+    }
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
     LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs (%.2fms/blk)]\n", nInputs - 1, MILLI * (nTime4 - nTime2), nInputs <= 1 ? 0 : MILLI * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * MICRO, nTimeVerify * MILLI / nBlocksTotal);
 
@@ -834,25 +870,39 @@ bool CChainState::DisconnectTip(CValidationState& state, DisconnectedBlockTransa
 
 /**
  * Connect a new block to chainActive. pblock is either nullptr or a pointer to a CBlock
- * corresponding to pindexNew, to bypass loading it again from disk.
+ * corresponding to pindexNew, to bypass loading it again from disk. prefetch, if not
+ * null, holds the coins spent by pindexNew, read in advance, and the block itself if
+ * pblock is null.
  *
  * The block is added to connectTrace if connection succeeds.
  */
-bool CChainState::ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool)
+bool CChainState::ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool, CCoinsPrefetch* prefetch)
 {
     AssertLockHeld(cs_main);
 
     assert(pindexNew->pprev == chainActive.Tip());
-    // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
-    std::shared_ptr<const CBlock> pthisBlock;
-    if (!pblock) {
+    std::shared_ptr<const CBlock> pthisBlock = pblock;
+    if (prefetch) {
+        assert(prefetch->GetBlockHash() == pindexNew->GetBlockHash());
+        const size_t nPrefetched = prefetch->Apply(*pcoinsTip);
+        const int64_t nTimePrefetch = GetTimeMicros();
+        LogPrint(BCLog::BENCH, "  - Add prefetched coins: %.2fms (%u coins)\n", (nTimePrefetch - nTime1) * MILLI, nPrefetched);
+        nTime1 = nTimePrefetch;
+        if (!pthisBlock && prefetch->GetBlock()) {
+            pthisBlock = prefetch->GetBlock();
+            // The prefetch only deserialized the block, so check its header like ReadBlockFromDisk.
+            CValidationState stateHeader;
+            if (!CheckBlockHeader(pthisBlock->GetBlockHeader(), stateHeader, nullptr, pindexNew->nHeight, true))
+                return AbortNode(state, "Failed to read block");
+        }
+    }
+    // Read block from disk.
+    if (!pthisBlock) {
         std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
         if (!ReadBlockFromDisk(*pblockNew, pindexNew))
             return AbortNode(state, "Failed to read block");
         pthisBlock = pblockNew;
-    } else {
-        pthisBlock = pblock;
     }
     const CBlock& blockConnecting = *pthisBlock;
     // Apply the block atomically to the chain state.
@@ -1041,7 +1091,20 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, CBlockIndex* pi
         // Connect new blocks.
         for (auto it = vpindexToConnect.rbegin(); it != vpindexToConnect.rend(); ++it) {
             CBlockIndex *pindexConnect = *it;
-            if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
+            std::unique_ptr<CCoinsPrefetch> prefetch = std::move(m_coins_prefetch);
+            if (prefetch && prefetch->GetBlockHash() != pindexConnect->GetBlockHash()) {
+                prefetch.reset();
+            }
+            // Read the coins of the next block while this one is connected.
+            if (nPrefetchThreads > 0 && pindexConnect != pindexMostWork) {
+                const CBlockIndex* pindexNext = pindexMostWork->GetAncestor(pindexConnect->nHeight + 1);
+                if (!m_coins_prefetch_threads) {
+                    m_coins_prefetch_threads = MakeUnique<CCoinsPrefetchThreads>(nPrefetchThreads);
+                }
+                m_coins_prefetch = MakeUnique<CCoinsPrefetch>(pindexNext, pindexNext == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(),
+                                                              *pcoinsdbview, *m_coins_prefetch_threads);
+            }
+            if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool, prefetch.get())) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible()) {
@@ -1302,8 +1365,9 @@ CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block)
     if (it != mapBlockIndex.end())
         return it->second;
 
-    // Construct new block index object
+    // Construct new block index object. It does not keep the proof.
     CBlockIndex* pindexNew = new CBlockIndex(block);
+    pblocktree->AddBlockProof(hash, block.proof);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -1372,7 +1436,7 @@ void CChainState::ReceivedBlockTransactions(const CBlock& block, CBlockIndex* pi
 }
 
 
-bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, CXFieldHistoryMap* pxfieldHistory)
+bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, CXFieldHistoryMap* pxfieldHistory, const CBlockProofBatch* proofs)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -1400,7 +1464,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
         }
         int nBlockHeight = pindexPrev ? pindexPrev->nHeight + 1 : -1;
 
-        if (!CheckBlockHeader(block, state, pxfieldHistory, nBlockHeight))
+        if (!CheckBlockHeader(block, state, pxfieldHistory, nBlockHeight, true, proofs))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         if (!pindexPrev)
@@ -1451,7 +1515,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
 
 
 /** Store block on disk. If dbp is non-nullptr, the file is known to already reside on disk */
-bool CChainState::AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, CXFieldHistoryMap* pxfieldHistory)
+bool CChainState::AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, CXFieldHistoryMap* pxfieldHistory, const CBlockProofBatch* proofs)
 {
     const CBlock& block = *pblock;
 
@@ -1461,7 +1525,7 @@ bool CChainState::AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CVali
     CBlockIndex *pindexDummy = nullptr;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, &pindex, pxfieldHistory))
+    if (!AcceptBlockHeader(block, state, &pindex, pxfieldHistory, proofs))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -1547,17 +1611,35 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
 
 bool CChainState::LoadBlockIndex(CBlockTreeDB& blocktree)
 {
-    if (!blocktree.LoadBlockIndexGuts([this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }))
-        return false;
-
     std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
+    std::vector<std::pair<uint256, std::unique_ptr<CBlockIndex>>> snapshot;
+    if (fBlockIndexSnapshot && ReadBlockIndexSnapshot(blocktree, GetBlockIndexSnapshotPath(), snapshot)) {
+        // The snapshot is ordered by height already.
+        mapBlockIndex.reserve(snapshot.size());
+        vSortedByHeight.reserve(snapshot.size());
+        for (auto& entry : snapshot) {
+            CBlockIndex* pindex = entry.second.release();
+            BlockMap::iterator mi = mapBlockIndex.emplace(entry.first, pindex).first;
+            pindex->phashBlock = &mi->first;
+            vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
+        }
+    } else {
+        if (!blocktree.LoadBlockIndexGuts([this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }))
+            return false;
+
+        vSortedByHeight.reserve(mapBlockIndex.size());
+        for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
+        {
+            CBlockIndex* pindex = item.second;
+            // Every entry in the database is at least BLOCK_VALID_TREE. One that is not was
+            // only added as the parent of another entry, and has neither a record nor a
+            // proof that a later flush of it could write.
+            if ((pindex->nStatus & BLOCK_VALID_MASK) == BLOCK_VALID_UNKNOWN)
+                return error("%s: no block index entry for block %s", __func__, item.first.ToString());
+            vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
+        }
+        sort(vSortedByHeight.begin(), vSortedByHeight.end());
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
     for (const std::pair<int, CBlockIndex*>& item : vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
@@ -1745,9 +1827,72 @@ bool CChainState::RewindBlockIndex()
     return true;
 }
 
+void CChainState::ActivateSnapshotTip(CBlockIndex* pindexBase)
+{
+    AssertLockHeld(cs_main);
+    assert(pindexBase && pindexBase->pprev);
+
+    std::vector<CBlockIndex*> vChain;
+    for (CBlockIndex* pindex = pindexBase; pindex->pprev != nullptr; pindex = pindex->pprev) {
+        vChain.push_back(pindex);
+    }
+
+    for (auto it = vChain.rbegin(); it != vChain.rend(); ++it) {
+        CBlockIndex* pindex = *it;
+        if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
+            // Cleared again once the block is connected by background validation.
+            pindex->nStatus |= BLOCK_ASSUMED_VALID;
+        }
+        if (pindex->nTx == 0) {
+            pindex->nTx = 1;
+        }
+        pindex->RaiseValidity(BLOCK_VALID_TRANSACTIONS);
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+        setDirtyBlockIndex.insert(pindex);
+    }
+
+    chainActive.SetTip(pindexBase);
+    setBlockIndexCandidates.insert(pindexBase);
+
+    // Blocks downloaded before the snapshot was loaded could not be linked
+    // because their parents had no data. Link them now, as ReceivedBlockTransactions would.
+    std::deque<CBlockIndex*> queue(vChain.begin(), vChain.end());
+    while (!queue.empty()) {
+        CBlockIndex *pindex = queue.front();
+        queue.pop_front();
+        auto range = mapBlocksUnlinked.equal_range(pindex);
+        while (range.first != range.second) {
+            CBlockIndex* pindexChild = range.first->second;
+            if (!chainActive.Contains(pindexChild)) {
+                pindexChild->nChainTx = pindex->nChainTx + pindexChild->nTx;
+                {
+                    LOCK(cs_nBlockSequenceId);
+                    pindexChild->nSequenceId = nBlockSequenceId++;
+                }
+                if (!setBlockIndexCandidates.value_comp()(pindexChild, chainActive.Tip())) {
+                    setBlockIndexCandidates.insert(pindexChild);
+                }
+                queue.push_back(pindexChild);
+            }
+            range.first = mapBlocksUnlinked.erase(range.first);
+        }
+    }
+
+    PruneBlockIndexCandidates();
+    CheckBlockIndex();
+}
+
+void CChainState::ResetCoinsPrefetch()
+{
+    AssertLockHeld(::cs_main);
+    m_coins_prefetch.reset();
+    m_coins_prefetch_threads.reset();
+}
+
 void CChainState::UnloadBlockIndex()
 {
     AssertLockHeld(::cs_main);
+    ResetCoinsPrefetch();
     nBlockSequenceId = 1;
     m_failed_blocks.clear();
     setBlockIndexCandidates.clear();
@@ -1837,6 +1982,7 @@ void CChainState::CheckBlockIndex()
     CBlockIndex* pindexFirstNotTransactionsValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_TRANSACTIONS (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
+    CBlockIndex* pindexFirstAssumedValid = nullptr; // Oldest ancestor of pindex which is BLOCK_ASSUMED_VALID (below a UTXO snapshot base).
     while (pindex != nullptr) {
         nNodes++;
         if (pindexFirstInvalid == nullptr && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
@@ -1846,6 +1992,7 @@ void CChainState::CheckBlockIndex()
         if (pindex->pprev != nullptr && pindexFirstNotTransactionsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotChainValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotScriptsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
+        if (pindexFirstAssumedValid == nullptr && pindex->IsAssumedValid()) pindexFirstAssumedValid = pindex;
 
         // Begin: actual consistency checks.
         if (pindex->pprev == nullptr) {
@@ -1855,8 +2002,9 @@ void CChainState::CheckBlockIndex()
         }
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId <= 0);  // nSequenceId can't be set positive for blocks that aren't linked (negative is used for preciousblock)
         // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
-        // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
-        if (!fHavePruned) {
+        // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred
+        // and no ancestor is assumed valid from a UTXO snapshot (those have nTx set but no data).
+        if (!fHavePruned && pindexFirstAssumedValid == nullptr) {
             // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
             assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
             assert(pindexFirstMissing == pindexFirstNeverProcessed);
@@ -1915,7 +2063,7 @@ void CChainState::CheckBlockIndex()
         if (pindexFirstMissing == nullptr) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
         if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == nullptr && pindexFirstMissing != nullptr) {
             // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
-            assert(fHavePruned); // We must have pruned.
+            assert(fHavePruned || pindexFirstAssumedValid != nullptr); // We must have pruned, or loaded a UTXO snapshot.
             // This block may have entered mapBlocksUnlinked if:
             //  - it has a descendant that at some point had more work than the
             //    tip, and
@@ -1953,6 +2101,7 @@ void CChainState::CheckBlockIndex()
             if (pindex == pindexFirstNotTransactionsValid) pindexFirstNotTransactionsValid = nullptr;
             if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = nullptr;
             if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = nullptr;
+            if (pindex == pindexFirstAssumedValid) pindexFirstAssumedValid = nullptr;
             // Find our parent.
             CBlockIndex* pindexPar = pindex->pprev;
             // Find which child we just visited.
@@ -8,6 +8,7 @@
 #include <connecttrace.h>
 #include <cs_main.h>
 
+#include <blockproofbatch.h>
 #include <checkqueue.h>
 #include <coins.h>
 #include <sync.h>
@@ -15,9 +16,26 @@
 #include <xfieldhistory.h>
 #include <undo.h>
 #include <scriptcheck.h>
+#include <script/sigcache.h>
 #include <map>
 #include <set>
 
+class CCoinsPrefetch;
+class CCoinsPrefetchThreads;
+
+
+/** Closure checking the merkle root and transactions of a block read ahead, run on the block check queue. */
+class CBlockTransactionsCheck
+{
+private:
+    const CBlock* m_block;
+
+public:
+    explicit CBlockTransactionsCheck(const CBlock* block) : m_block(block) {}
+
+    /** Returns the hash of the block if it fails; AcceptBlock then checks it again and reports it. */
+    std::optional<uint256> operator()();
+};
 
 enum DisconnectResult
 {
@@ -116,6 +134,14 @@ private:
      */
     Mutex m_cs_chainstate;
 
+    //! The threads of the prefetches, started by the first one.
+    std::unique_ptr<CCoinsPrefetchThreads> m_coins_prefetch_threads GUARDED_BY(cs_main);
+    /**
+     * The coins of the next block to connect, read while the current one is connected.
+     * It reads pcoinsdbview, so it must be reset before pcoinsdbview is replaced.
+     */
+    std::unique_ptr<CCoinsPrefetch> m_coins_prefetch GUARDED_BY(cs_main);
+
 public:
     CChain chainActive;
     BlockMap mapBlockIndex;
@@ -123,6 +149,9 @@ public:
     CBlockIndex *pindexBestInvalid = nullptr;
 
     std::unique_ptr< CCheckQueue<CScriptCheck> >scriptcheckqueue;
+    std::unique_ptr< CCheckQueue<CBlockProofCheck> >blockproofcheckqueue;
+    std::unique_ptr< CCheckQueue<CSignatureCheck> >sigcheckqueue;
+    std::unique_ptr< CCheckQueue<CBlockTransactionsCheck> >blockcheckqueue;
 
     bool LoadBlockIndex(CBlockTreeDB& blocktree) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
@@ -132,8 +161,8 @@ public:
      * If a block header hasn't already been seen, call CheckBlockHeader on it, ensure
      * that it doesn't descend from an invalid block, and then add it to mapBlockIndex.
      */
-    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, CXFieldHistoryMap* pxfieldHistory = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
-    bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, CXFieldHistoryMap* pxfieldHistory = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, CXFieldHistoryMap* pxfieldHistory = nullptr, const CBlockProofBatch* proofs = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, CXFieldHistoryMap* pxfieldHistory = nullptr, const CBlockProofBatch* proofs = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     // Block (dis)connection on a given view:
     DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, bool fDryRun = false) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
@@ -154,11 +183,22 @@ public:
 
     void PruneBlockIndexCandidates();
 
+    /**
+     * Make pindexBase, the base block of a verified UTXO snapshot, the tip of
+     * chainActive without connecting its ancestors. Ancestors that were never
+     * validated are marked BLOCK_ASSUMED_VALID and get a placeholder nTx so that
+     * nChainTx is set along the whole chain, like on a pruned node.
+     */
+    void ActivateSnapshotTip(CBlockIndex* pindexBase) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
     void UnloadBlockIndex();
 
+    /** Stop reading the coins of the next block, and the prefetch threads. Call before replacing pcoinsdbview. */
+    void ResetCoinsPrefetch() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 private:
     bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace);
-    bool ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool);
+    bool ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool, CCoinsPrefetch* prefetch = nullptr);
 
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     /** Create a new block index entry for a given block hash */
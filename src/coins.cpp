@@ -9,6 +9,8 @@
 #include <random.h>
 #include <trace.h>
 
+#include <algorithm>
+
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
@@ -33,25 +35,130 @@ size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn),
-    cacheCoins(0, SaltedOutpointHasher{}, CCoinsMap::key_equal{}, &m_cache_coins_memory_resource),
-    cachedCoinsUsage(0)
+void CCoinsMap::Rehash(size_t new_capacity) noexcept
+{
+    assert(new_capacity >= MIN_CAPACITY && (new_capacity & (new_capacity - 1)) == 0);
+    const std::unique_ptr<unsigned char[]> old_storage = std::move(m_storage);
+    const uint8_t* const old_ctrl = m_ctrl;
+    const size_t old_capacity = m_capacity;
+    auto old_slot = [&](size_t i) {
+        return std::launder(reinterpret_cast<CoinsCachePair*>(old_storage.get() + i * sizeof(CoinsCachePair)));
+    };
+    // Keep EraseCircular going on from the entry the hand points at (or the next one
+    // after it) rather than from the start of the new table.
+    size_t hand_slot = old_capacity;
+    for (size_t n = 0; n < old_capacity; ++n) {
+        const size_t i = (m_clock_hand + n) & (old_capacity - 1);
+        if (IsFull(old_ctrl[i])) {
+            hand_slot = i;
+            break;
+        }
+    }
+
+    m_storage.reset(new unsigned char[new_capacity * (sizeof(CoinsCachePair) + 1)]);
+    m_ctrl = reinterpret_cast<uint8_t*>(m_storage.get() + new_capacity * sizeof(CoinsCachePair));
+    std::fill_n(m_ctrl, new_capacity, CTRL_EMPTY);
+    m_capacity = new_capacity;
+    m_growth_left = new_capacity - new_capacity / 8 - m_size;
+    m_clock_hand = 0;
+
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (!IsFull(old_ctrl[i])) continue;
+        CoinsCachePair& old_entry = *old_slot(i);
+        const size_t hash = m_hasher(old_entry.first);
+        const size_t j = FindFreeSlot(hash);
+        CoinsCachePair* entry = ::new (SlotAt(j)) CoinsCachePair(std::piecewise_construct,
+            std::forward_as_tuple(old_entry.first), std::forward_as_tuple(std::move(old_entry.second.coin)));
+        entry->second.Relocate(old_entry.second, *entry);
+        old_entry.~CoinsCachePair();
+        m_ctrl[j] = Tag(hash);
+        if (i == hand_slot) m_clock_hand = j;
+    }
+}
+
+void CCoinsMap::Grow() noexcept
+{
+    // Double the table if it would be more than 7/16 full afterwards; otherwise only
+    // drop the DELETED slots, which are what filled it up.
+    size_t new_capacity = std::max(m_capacity, MIN_CAPACITY);
+    if (m_size + 1 > new_capacity / 16 * 7) new_capacity *= 2;
+    Rehash(new_capacity);
+}
+
+size_t CCoinsMap::CapacityForSize(size_t n) noexcept
+{
+    size_t capacity = MIN_CAPACITY;
+    while (n > capacity / 16 * 7) capacity *= 2;
+    return capacity;
+}
+
+void CCoinsMap::Shrink() noexcept
+{
+    if (m_size == 0) {
+        clear();
+        return;
+    }
+    const size_t new_capacity = CapacityForSize(m_size);
+    if (new_capacity < m_capacity) Rehash(new_capacity);
+}
+
+void CCoinsMap::erase(const_iterator it) noexcept
+{
+    const size_t i = it.m_index;
+    assert(i < m_capacity && IsFull(m_ctrl[i]));
+    // The destructor removes a flagged entry from the linked list.
+    SlotAt(i)->~CoinsCachePair();
+    --m_size;
+    // A group with an EMPTY slot was never full, so no probe sequence continues past it.
+    if (MatchEmpty(LoadGroup(i / GROUP_SIZE))) {
+        m_ctrl[i] = CTRL_EMPTY;
+        ++m_growth_left;
+    } else {
+        m_ctrl[i] = CTRL_DELETED;
+    }
+}
+
+size_t CCoinsMap::erase(const COutPoint& key) noexcept
+{
+    const size_t i = FindSlot(key, m_hasher(key));
+    if (i == m_capacity) return 0;
+    erase(const_iterator(this, i));
+    return 1;
+}
+
+void CCoinsMap::clear() noexcept
+{
+    for (size_t i = 0; i < m_capacity; ++i) {
+        if (IsFull(m_ctrl[i])) SlotAt(i)->~CoinsCachePair();
+    }
+    m_storage.reset();
+    m_ctrl = nullptr;
+    m_capacity = 0;
+    m_size = 0;
+    m_growth_left = 0;
+    m_clock_hand = 0;
+}
+
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0)
 {
     m_sentinel.second.SelfRef(m_sentinel);
 }
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
-    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
+    return cacheCoins.DynamicMemoryUsage() + cachedCoinsUsage;
 }
 
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        it->second.used = true;
         return it;
+    }
     Coin tmp;
     if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
-    CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
+    CCoinsMap::iterator ret = cacheCoins.try_emplace(outpoint, std::move(tmp)).first;
+    ret->second.used = true;
     if (ret->second.coin.IsSpent()) {
         // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
@@ -75,7 +182,7 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
     if (coin.out.scriptPubKey.IsUnspendable()) return;
     CCoinsMap::iterator it;
     bool inserted;
-    std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::tuple<>());
+    std::tie(it, inserted) = cacheCoins.try_emplace(outpoint);
     bool fresh = false;
     if (!inserted) {
         cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
@@ -99,6 +206,15 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
         (bool)it->second.coin.IsCoinBase());
 }
 
+bool CCoinsViewCache::PrimeCoin(const COutPoint& outpoint, Coin&& coin) {
+    assert(!coin.IsSpent());
+    auto [it, inserted] = cacheCoins.try_emplace(outpoint, std::move(coin));
+    if (inserted) {
+        cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    }
+    return inserted;
+}
+
 void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool check) {
     bool fCoinbase = tx.IsCoinBase();
     const uint256& txid = tx.GetHashMalFix();
@@ -238,33 +354,33 @@ bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cursor, hashBlock);
     if (fOk) {
         // With will_erase=true the cursor does not touch the map during iteration;
-        // entries (dirty and clean) are still present. Clear them all now so their
-        // CCoinsCacheEntry destructors call ClearFlags(), emptying the linked list
-        // before ReallocateCache() reconstructs the pool.
+        // entries (dirty and clean) are still present. Clearing them all empties
+        // the linked list and returns the table's memory to the OS, so the next
+        // flush cycle starts with a small table.
         cacheCoins.clear();
-        ReallocateCache();
     }
     cachedCoinsUsage = 0;
     return fOk;
 }
 
-void CCoinsViewCache::ReallocateCache()
+size_t CCoinsViewCache::Evict(size_t max_usage)
 {
-    // After Flush(), the pool resource still holds all chunks that were used
-    // during this flush cycle. We want to return that memory to the OS so the
-    // next flush cycle starts clean. We can't simply reset the resource because
-    // cacheCoins's allocator holds a pointer to it — so we tear down both objects
-    // and reconstruct them in place. The member addresses are preserved, so any
-    // references held elsewhere (there should be none, but defensively) remain
-    // valid.
-    //
-    // Order matters: cacheCoins must be destroyed before the resource it
-    // allocates from, and reconstructed after the new resource is in place.
-    assert(cacheCoins.size() == 0);
-    cacheCoins.~CCoinsMap();
-    m_cache_coins_memory_resource.~CCoinsMapMemoryResource();
-    ::new (&m_cache_coins_memory_resource) CCoinsMapMemoryResource{};
-    ::new (&cacheCoins) CCoinsMap{0, SaltedOutpointHasher{}, CCoinsMap::key_equal{}, &m_cache_coins_memory_resource};
+    size_t evicted = 0;
+    cacheCoins.EraseCircular([&](CoinsCachePair& entry) {
+        // Flagged entries are not in the base view yet.
+        if (entry.second.GetFlags()) return false;
+        if (entry.second.used) {
+            entry.second.used = false;
+            return false;
+        }
+        cachedCoinsUsage -= entry.second.coin.DynamicMemoryUsage();
+        ++evicted;
+        return true;
+    }, [&] {
+        return CCoinsMap::UsageForSize(cacheCoins.size()) + cachedCoinsUsage <= max_usage;
+    });
+    cacheCoins.Shrink();
+    return evicted;
 }
 
 bool CCoinsViewCache::Sync()
@@ -10,6 +10,7 @@
 #include <primitives/transaction.h>
 #include <compressor.h>
 #include <core_memusage.h>
+#include <crypto/common.h>
 #include <hash.h>
 #include <memusage.h>
 #include <serialize.h>
@@ -19,8 +20,12 @@
 #include <assert.h>
 #include <stdint.h>
 
-#include <support/allocators/pool.h>
-
+#include <bit>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
 
 /**
@@ -136,6 +141,9 @@ private:
 
 public:
     Coin coin; // The actual cached data.
+    //! Set when the coin is looked up, and cleared by CCoinsViewCache::Evict,
+    //! which only evicts a clean entry that was not used since its last pass.
+    bool used{false};
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
@@ -202,6 +210,22 @@ public:
         return m_prev;
     }
 
+    //! Only for CCoinsMap, when it moves the entry other to self: take over the
+    //! flags of other and its place in the linked list. other is left without
+    //! flags, so destroying it does not unlink self.
+    inline void Relocate(CCoinsCacheEntry& other, CoinsCachePair& self) noexcept
+    {
+        assert(&self.second == this && !m_flags);
+        used = other.used;
+        if (!other.m_flags) return;
+        m_prev = other.m_prev;
+        m_next = other.m_next;
+        m_flags = other.m_flags;
+        m_prev->second.m_next = &self;
+        m_next->second.m_prev = &self;
+        other.m_flags = 0;
+    }
+
     //! Only use this for initializing the linked list sentinel.
     //! Sets m_prev and m_next to point to self, and sets m_flags to DIRTY
     //! so that Next() can be called on the sentinel.
@@ -215,22 +239,248 @@ public:
 };
 
 /**
- * PoolAllocator's MAX_BLOCK_SIZE_BYTES parameter here uses sizeof the data, and adds the size
- * of 4 pointers. We do not know the exact node size used in the std::unordered_map implementation
- * because it is implementation defined. Most implementations have an overhead of 1 or 2 pointers,
- * so nodes can be connected in a linked list, and in some cases the hash value is stored as well.
- * Using an additional sizeof(void*)*4 for MAX_BLOCK_SIZE_BYTES should thus be sufficient so that
- * all implementations can allocate the nodes from the PoolAllocator.
+ * The coins of one CCoinsViewCache: an open-addressing hash table which stores the
+ * CoinsCachePair entries inline, in a single allocation together with one control
+ * byte per slot.
+ *
+ * A control byte is either EMPTY, DELETED, or the low 7 bits of the hash of the key
+ * stored in the slot. Slots are probed in groups of 8, whose control bytes are matched
+ * against the key's all at once, so a lookup only compares the keys of the slots whose
+ * 7 bits match. The table grows to keep at most 7/8 of its slots in use.
+ *
+ * An erased slot becomes DELETED, or EMPTY if its group still has an EMPTY slot, which
+ * no probe passes over. Entries therefore only move when an insertion rebuilds the
+ * table; the flagged entries are then relinked at their new address, see
+ * CCoinsCacheEntry::Relocate. Any insertion may invalidate all iterators, pointers and
+ * references into the map, but erasing only invalidates those to the erased entry.
  */
-using CCoinsMap = std::unordered_map<COutPoint,
-                                     CCoinsCacheEntry,
-                                     SaltedOutpointHasher,
-                                     std::equal_to<COutPoint>,
-                                     PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
-                                                   sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4,
-                                                   alignof(void*)>>;
+class CCoinsMap
+{
+public:
+    using key_type = COutPoint;
+    using mapped_type = CCoinsCacheEntry;
+    using value_type = CoinsCachePair;
+    using hasher = SaltedOutpointHasher;
+    using key_equal = std::equal_to<COutPoint>;
+    using size_type = size_t;
+
+private:
+    static constexpr size_t GROUP_SIZE = 8;
+    static constexpr size_t MIN_CAPACITY = 16;
+    static constexpr uint8_t CTRL_EMPTY = 0x80;
+    static constexpr uint8_t CTRL_DELETED = 0xFE;
+    static constexpr uint64_t LSBS = 0x0101010101010101ULL;
+    static constexpr uint64_t MSBS = 0x8080808080808080ULL;
+
+    static_assert(alignof(CoinsCachePair) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+    hasher m_hasher;
+    //! The slots, followed by their control bytes
+    std::unique_ptr<unsigned char[]> m_storage;
+    uint8_t* m_ctrl{nullptr};
+    size_t m_capacity{0};
+    size_t m_size{0};
+    //! The number of EMPTY slots that may still be filled before the table is rebuilt
+    size_t m_growth_left{0};
+    //! The next slot visited by EraseCircular; Rehash moves it along with the entry there
+    size_t m_clock_hand{0};
+
+    CoinsCachePair* SlotAt(size_t i) noexcept
+    {
+        return std::launder(reinterpret_cast<CoinsCachePair*>(m_storage.get() + i * sizeof(CoinsCachePair)));
+    }
+    const CoinsCachePair* SlotAt(size_t i) const noexcept
+    {
+        return std::launder(reinterpret_cast<const CoinsCachePair*>(m_storage.get() + i * sizeof(CoinsCachePair)));
+    }
+
+    static bool IsFull(uint8_t ctrl) noexcept { return !(ctrl & 0x80); }
+    static uint8_t Tag(size_t hash) noexcept { return hash & 0x7F; }
+    uint64_t LoadGroup(size_t group) const noexcept { return ReadLE64(m_ctrl + group * GROUP_SIZE); }
+    //! Bytes of a group of control bytes that are EMPTY: those with bit 7 set and bit 1 clear
+    static uint64_t MatchEmpty(uint64_t ctrl) noexcept { return ctrl & ~(ctrl << 6) & MSBS; }
+    //! Bytes of a group of control bytes that are EMPTY or DELETED
+    static uint64_t MatchFree(uint64_t ctrl) noexcept { return ctrl & MSBS; }
+    //! Bytes of a group of control bytes that may equal tag. There can be false positives, but
+    //! only on FULL bytes.
+    static uint64_t MatchTag(uint64_t ctrl, uint8_t tag) noexcept
+    {
+        const uint64_t x = ctrl ^ (LSBS * tag);
+        return (x - LSBS) & ~x & MSBS;
+    }
+
+    //! Return the slot holding key, or m_capacity if there is none.
+    size_t FindSlot(const COutPoint& key, size_t hash) const noexcept
+    {
+        if (m_capacity == 0) return 0;
+        const size_t group_mask = m_capacity / GROUP_SIZE - 1;
+        size_t group = (hash >> 7) & group_mask;
+        for (size_t step = 1;; ++step) {
+            const uint64_t ctrl = LoadGroup(group);
+            for (uint64_t match = MatchTag(ctrl, Tag(hash)); match; match &= match - 1) {
+                const size_t i = group * GROUP_SIZE + std::countr_zero(match) / 8;
+                if (SlotAt(i)->first == key) return i;
+            }
+            if (MatchEmpty(ctrl)) return m_capacity;
+            group = (group + step) & group_mask;
+        }
+    }
+
+    //! Return the first EMPTY or DELETED slot on the probe sequence of hash.
+    size_t FindFreeSlot(size_t hash) const noexcept
+    {
+        const size_t group_mask = m_capacity / GROUP_SIZE - 1;
+        size_t group = (hash >> 7) & group_mask;
+        for (size_t step = 1;; ++step) {
+            const uint64_t match = MatchFree(LoadGroup(group));
+            if (match) return group * GROUP_SIZE + std::countr_zero(match) / 8;
+            group = (group + step) & group_mask;
+        }
+    }
+
+    //! Move all entries to a new table of new_capacity slots, dropping the DELETED slots.
+    void Rehash(size_t new_capacity) noexcept;
+    //! Rebuild the table before filling one more EMPTY slot.
+    void Grow() noexcept;
+    //! The capacity of a table rebuilt for n entries, which is at most 7/16 full.
+    static size_t CapacityForSize(size_t n) noexcept;
+
+    template <bool Const>
+    class Iterator
+    {
+        using Map = std::conditional_t<Const, const CCoinsMap, CCoinsMap>;
+        Map* m_map{nullptr};
+        size_t m_index{0};
+
+        void SkipFree() noexcept
+        {
+            while (m_index < m_map->m_capacity && !IsFull(m_map->m_ctrl[m_index])) ++m_index;
+        }
+
+        friend class CCoinsMap;
+        friend class Iterator<!Const>;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = CoinsCachePair;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const CoinsCachePair*, CoinsCachePair*>;
+        using reference = std::conditional_t<Const, const CoinsCachePair&, CoinsCachePair&>;
+
+        Iterator() noexcept = default;
+        Iterator(Map* map, size_t index) noexcept : m_map(map), m_index(index) {}
+        template <bool OtherConst> requires (Const && !OtherConst)
+        Iterator(const Iterator<OtherConst>& other) noexcept : m_map(other.m_map), m_index(other.m_index) {}
+
+        reference operator*() const noexcept { return *m_map->SlotAt(m_index); }
+        pointer operator->() const noexcept { return m_map->SlotAt(m_index); }
+        Iterator& operator++() noexcept
+        {
+            ++m_index;
+            SkipFree();
+            return *this;
+        }
+        Iterator operator++(int) noexcept
+        {
+            Iterator ret = *this;
+            ++*this;
+            return ret;
+        }
+        bool operator==(const Iterator& other) const noexcept { return m_index == other.m_index; }
+    };
+
+public:
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    CCoinsMap() noexcept = default;
+    ~CCoinsMap() { clear(); }
+
+    //! The entries are linked to each other by address, so the map cannot be copied or moved.
+    CCoinsMap(const CCoinsMap&) = delete;
+    CCoinsMap& operator=(const CCoinsMap&) = delete;
+
+    iterator begin() noexcept
+    {
+        iterator it(this, 0);
+        if (m_capacity) it.SkipFree();
+        return it;
+    }
+    iterator end() noexcept { return iterator(this, m_capacity); }
+    const_iterator begin() const noexcept
+    {
+        const_iterator it(this, 0);
+        if (m_capacity) it.SkipFree();
+        return it;
+    }
+    const_iterator end() const noexcept { return const_iterator(this, m_capacity); }
+
+    iterator find(const COutPoint& key) noexcept { return iterator(this, FindSlot(key, m_hasher(key))); }
+    const_iterator find(const COutPoint& key) const noexcept { return const_iterator(this, FindSlot(key, m_hasher(key))); }
+
+    //! Insert an entry constructed from args for key if there is none yet.
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const COutPoint& key, Args&&... args)
+    {
+        const size_t hash = m_hasher(key);
+        size_t i = FindSlot(key, hash);
+        if (i != m_capacity) return {iterator(this, i), false};
+
+        if (m_capacity == 0) Grow();
+        i = FindFreeSlot(hash);
+        const bool fill_empty = m_ctrl[i] == CTRL_EMPTY;
+        if (fill_empty && m_growth_left == 0) {
+            Grow();
+            i = FindFreeSlot(hash);
+        }
+        ::new (SlotAt(i)) CoinsCachePair(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+        if (fill_empty) --m_growth_left;
+        m_ctrl[i] = Tag(hash);
+        ++m_size;
+        return {iterator(this, i), true};
+    }
+
+    void erase(const_iterator it) noexcept;
+    size_t erase(const COutPoint& key) noexcept;
+
+    //! Destroy all entries and release the table.
+    void clear() noexcept;
 
-using CCoinsMapMemoryResource = CCoinsMap::allocator_type::ResourceType;
+    /**
+     * Visit the entries in slot order, going on from where the previous call stopped
+     * and wrapping around, and erase those for which evict returns true. Stops once
+     * done returns true, or after visiting every slot twice so that evict can give
+     * each entry a second chance.
+     */
+    template <typename Evict, typename Done>
+    void EraseCircular(Evict&& evict, Done&& done)
+    {
+        for (size_t n = 0; n < 2 * m_capacity && !done(); ++n) {
+            const size_t i = m_clock_hand;
+            m_clock_hand = (m_clock_hand + 1) & (m_capacity - 1);
+            if (IsFull(m_ctrl[i]) && evict(*SlotAt(i))) erase(const_iterator(this, i));
+        }
+    }
+
+    //! Rebuild the table with a smaller capacity if it has room for its entries.
+    void Shrink() noexcept;
+
+    //! The memory used by a table rebuilt by Shrink() with n entries.
+    static size_t UsageForSize(size_t n) noexcept
+    {
+        return memusage::MallocUsage(CapacityForSize(n) * (sizeof(CoinsCachePair) + 1));
+    }
+
+    size_t size() const noexcept { return m_size; }
+    bool empty() const noexcept { return m_size == 0; }
+    size_t capacity() const noexcept { return m_capacity; }
+
+    //! The memory allocated for the table, including the slots that are not in use.
+    size_t DynamicMemoryUsage() const noexcept
+    {
+        return m_capacity ? memusage::MallocUsage(m_capacity * (sizeof(CoinsCachePair) + 1)) : 0;
+    }
+};
 
 /**
  * Cursor for iterating over the linked list of flagged entries in CCoinsViewCache.
@@ -372,14 +622,9 @@ protected:
      * declared as "const".
      */
     mutable uint256 hashBlock;
-    // Note: declaration order is load-bearing. m_cache_coins_memory_resource
-    // must precede cacheCoins because cacheCoins's allocator stores a pointer
-    // to it, which is dereferenced from cacheCoins's destructor (and from
-    // every allocate/deallocate). Reordering these is undefined behavior.
-    mutable CCoinsMapMemoryResource m_cache_coins_memory_resource{};
-    // cacheCoins, m_sentinel (and the underlying memory resource) must only be
-    // accessed while cs_main is held. PoolResource is not thread-safe — concurrent
-    // access from multiple threads is undefined behavior.
+    // cacheCoins and m_sentinel must only be accessed while cs_main is held.
+    // Note: m_sentinel must precede cacheCoins, because destroying cacheCoins
+    // unlinks its flagged entries from the list.
     /* The starting sentinel of the flagged entry circular doubly linked list. */
     mutable CoinsCachePair m_sentinel;
     mutable CCoinsMap cacheCoins;
@@ -416,11 +661,9 @@ public:
      * Return a reference to Coin in the cache, or a pruned one if not found. This is
      * more efficient than GetCoin.
      *
-     * Generally, do not hold the reference returned for more than a short scope.
-     * While the current implementation allows for modifications to the contents
-     * of the cache while holding the reference, this behavior should not be relied
-     * on! To be safe, best to not hold the returned reference through any other
-     * calls to this cache.
+     * Do not hold the reference returned for more than a short scope. Any call
+     * that adds an entry to the cache, including AccessCoin itself, may move the
+     * cached coins and invalidate the reference.
      */
     const Coin& AccessCoin(const COutPoint &output) const;
 
@@ -430,6 +673,12 @@ public:
      */
     void AddCoin(const COutPoint& outpoint, Coin&& coin, bool potential_overwrite);
 
+    /**
+     * Add coin, read from the base view, as a clean entry unless the cache already has
+     * an entry for outpoint. Returns whether it was added.
+     */
+    bool PrimeCoin(const COutPoint& outpoint, Coin&& coin);
+
     /**
      * Spend a coin. Pass moveto in order to get the deleted data.
      * If no unspent output exists for the passed outpoint, this call
@@ -446,11 +695,13 @@ public:
     bool Flush();
 
     /**
-     * Destructively reset the contents of this cache to a fresh, empty state.
-     * Used after Flush() to return pre-allocated memory to the OS and start
-     * the next IBD flush cycle with a clean pool.
+     * Evict clean coins until the memory usage of this cache is at most max_usage,
+     * or no more clean coins can be evicted. A coin that was looked up since the
+     * previous pass over it is kept, so the coins used by recent blocks stay in
+     * memory. Call it after Sync(), which leaves all coins clean.
+     * Returns the number of evicted coins.
      */
-    void ReallocateCache();
+    size_t Evict(size_t max_usage);
 
     /**
      * Push the modifications applied to this cache to its base while retaining
@@ -0,0 +1,185 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinsprefetch.h>
+
+#include <clientversion.h>
+#include <streams.h>
+#include <txdb.h>
+#include <validation.h>
+#include <file_io.h>
+
+#include <algorithm>
+#include <set>
+
+CCoinsPrefetchThreads::CCoinsPrefetchThreads(int n_threads) : m_stop(false)
+{
+    for (int n = 0; n < std::max(n_threads, 1); ++n) {
+        m_threads.emplace_back([this, n]() {
+            RenameThread(strprintf("prefetch.%i", n));
+            Loop();
+        });
+    }
+}
+
+CCoinsPrefetchThreads::~CCoinsPrefetchThreads()
+{
+    {
+        WaitableLock lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    for (std::thread& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void CCoinsPrefetchThreads::Loop()
+{
+    while (true) {
+        std::function<void()> task;
+        {
+            WaitableLock lock(m_mutex);
+            m_cond.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+            if (m_tasks.empty()) {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void CCoinsPrefetchThreads::Post(std::function<void()> task)
+{
+    {
+        WaitableLock lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_cond.notify_one();
+}
+
+CCoinsPrefetch::CCoinsPrefetch(const CBlockIndex* pindex, const std::shared_ptr<const CBlock>& pblock,
+                               const CCoinsViewDB& db, CCoinsPrefetchThreads& threads)
+    : m_block_hash(pindex->GetBlockHash()), m_db(db), m_db_writes(db.GetWriteCount()), m_block(pblock),
+      m_block_pos(pindex->GetBlockPos()), m_threads(threads), m_pending(0)
+{
+    AssertLockHeld(cs_main);
+    Post(&CCoinsPrefetch::Run);
+}
+
+CCoinsPrefetch::~CCoinsPrefetch()
+{
+    m_interrupt = true;
+    Wait();
+}
+
+void CCoinsPrefetch::Post(void (CCoinsPrefetch::*task)())
+{
+    {
+        WaitableLock lock(m_mutex);
+        ++m_pending;
+    }
+    m_threads.Post([this, task]() {
+        (this->*task)();
+        // Notified under the lock, as the prefetch may be destroyed once it is released.
+        WaitableLock lock(m_mutex);
+        if (--m_pending == 0) {
+            m_cond.notify_all();
+        }
+    });
+}
+
+void CCoinsPrefetch::Wait()
+{
+    WaitableLock lock(m_mutex);
+    m_cond.wait(lock, [this] { return m_pending == 0; });
+}
+
+void CCoinsPrefetch::ReadCoins()
+{
+    try {
+        for (size_t i = m_next++; i < m_outpoints.size() && !m_interrupt; i = m_next++) {
+            Coin coin;
+            if (m_db.GetCoin(m_outpoints[i], coin)) {
+                m_coins[i] = std::move(coin);
+            }
+        }
+    } catch (const std::exception&) {
+        // ConnectBlock reads the coin again and reports the error.
+    }
+}
+
+void CCoinsPrefetch::Run()
+{
+    // A block that is given may be used by other threads, so only a block read here
+    // is checked here.
+    std::shared_ptr<const CBlock> pblockRead;
+    if (!m_block) {
+        // The header is checked again when the block is connected, so it is only
+        // deserialized here.
+        std::vector<uint8_t> block_data;
+        if (!ReadRawBlockFromDisk(block_data, m_block_pos, FederationParams().MessageStart())) {
+            return;
+        }
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        try {
+            SpanReader spanreader(SER_DISK, CLIENT_VERSION, block_data);
+            spanreader >> *pblock;
+        } catch (const std::exception&) {
+            return;
+        }
+        if (pblock->GetHash() != m_block_hash) {
+            return;
+        }
+        m_block = pblockRead = pblock;
+    }
+
+    // The outputs of the block itself are not in the database yet.
+    std::set<uint256> txids;
+    for (const CTransactionRef& tx : m_block->vtx) {
+        txids.insert(tx->GetHashMalFix());
+    }
+    for (const CTransactionRef& tx : m_block->vtx) {
+        if (tx->IsCoinBase()) continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (!txids.count(txin.prevout.hashMalFix)) {
+                m_outpoints.push_back(txin.prevout);
+            }
+        }
+    }
+    m_coins.resize(m_outpoints.size());
+
+    // This task reads coins too, so no other thread helps with a short block.
+    const size_t n_helpers = std::min<size_t>(m_threads.size() - 1, m_outpoints.size() / MIN_COINS_PREFETCH_PER_THREAD);
+    for (size_t i = 0; i < n_helpers; ++i) {
+        Post(&CCoinsPrefetch::ReadCoins);
+    }
+    if (pblockRead && !m_interrupt) {
+        // A failure is reported when the block is connected.
+        CValidationState state;
+        CheckBlockTransactions(*pblockRead, state);
+    }
+    ReadCoins();
+}
+
+size_t CCoinsPrefetch::Apply(CCoinsViewCache& cache)
+{
+    AssertLockHeld(cs_main);
+    Wait();
+    // A coin read before a write of the database may be stale.
+    if (m_db.GetWriteCount() != m_db_writes) {
+        return 0;
+    }
+
+    size_t added = 0;
+    for (size_t i = 0; i < m_coins.size(); ++i) {
+        if (m_coins[i] && cache.PrimeCoin(m_outpoints[i], std::move(*m_coins[i]))) {
+            ++added;
+        }
+    }
+    m_coins.clear();
+    return added;
+}
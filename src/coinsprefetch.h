@@ -0,0 +1,125 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TAPYRUS_COINSPREFETCH_H
+#define TAPYRUS_COINSPREFETCH_H
+
+#include <chain.h>
+#include <coins.h>
+#include <primitives/block.h>
+#include <sync.h>
+#include <uint256.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+class CCoinsViewDB;
+
+/** Inputs below this count are read on a single thread */
+static const size_t MIN_COINS_PREFETCH_PER_THREAD = 64;
+
+/**
+ * Long-lived threads running the reads of CCoinsPrefetch, so that no thread is
+ * started for each block. Tasks never wait for each other, so any number of
+ * prefetches can share the threads.
+ */
+class CCoinsPrefetchThreads
+{
+private:
+    Mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<std::function<void()>> m_tasks GUARDED_BY(m_mutex);
+    bool m_stop GUARDED_BY(m_mutex);
+    std::vector<std::thread> m_threads;
+
+    void Loop();
+
+public:
+    explicit CCoinsPrefetchThreads(int n_threads);
+    //! Runs the tasks that were posted, and stops the threads.
+    ~CCoinsPrefetchThreads();
+
+    CCoinsPrefetchThreads(const CCoinsPrefetchThreads&) = delete;
+    CCoinsPrefetchThreads& operator=(const CCoinsPrefetchThreads&) = delete;
+
+    void Post(std::function<void()> task);
+    int size() const { return m_threads.size(); }
+};
+
+/**
+ * Reads the coins spent by a block from the coins database on background threads,
+ * while the validation thread is still connecting the previous block. The block is
+ * read from disk too if it is not given, and then checked with CheckBlockTransactions
+ * while the coins are read. Apply() then adds the coins to the coins cache, so that
+ * ConnectBlock does not wait for the disk for each input, and GetBlock() hands the
+ * block over so that ConnectTip neither reads nor checks it again.
+ *
+ * The coins are read without cs_main. They are only added to the cache if the
+ * database was not written since the prefetch started, and only for outpoints the
+ * cache has no entry for, so they are exactly the coins the cache would read itself.
+ * The database must outlive the prefetch. The chainstate keeps the prefetch of the
+ * next block across ActivateBestChainStep calls, so CChainState::ResetCoinsPrefetch()
+ * drops it before the database is replaced or closed.
+ */
+class CCoinsPrefetch
+{
+private:
+    const uint256 m_block_hash;
+    const CCoinsViewDB& m_db;
+    const uint64_t m_db_writes;
+    std::shared_ptr<const CBlock> m_block;
+    CDiskBlockPos m_block_pos;
+    CCoinsPrefetchThreads& m_threads;
+
+    std::vector<COutPoint> m_outpoints;
+    std::vector<std::optional<Coin>> m_coins;
+    std::atomic<size_t> m_next{0};
+    std::atomic<bool> m_interrupt{false};
+
+    Mutex m_mutex;
+    std::condition_variable m_cond;
+    //! Tasks posted to m_threads which did not finish yet
+    int m_pending GUARDED_BY(m_mutex);
+
+    void Run();
+    void ReadCoins();
+    void Post(void (CCoinsPrefetch::*task)());
+    void Wait();
+
+public:
+    /**
+     * Start reading the coins spent by the block of pindex from db on threads.
+     * pblock is the block if it is already in memory. Requires cs_main.
+     */
+    CCoinsPrefetch(const CBlockIndex* pindex, const std::shared_ptr<const CBlock>& pblock,
+                   const CCoinsViewDB& db, CCoinsPrefetchThreads& threads);
+
+    //! Stops the reads that did not start yet and waits for the others.
+    ~CCoinsPrefetch();
+
+    CCoinsPrefetch(const CCoinsPrefetch&) = delete;
+    CCoinsPrefetch& operator=(const CCoinsPrefetch&) = delete;
+
+    const uint256& GetBlockHash() const { return m_block_hash; }
+
+    /**
+     * Wait for the reads, and add the coins that were found to cache, which must be
+     * backed by the database. Returns the number of coins added. Requires cs_main.
+     */
+    size_t Apply(CCoinsViewCache& cache);
+
+    /**
+     * The block, or null if it could not be read. Its header is not checked yet.
+     * Only valid after Apply().
+     */
+    std::shared_ptr<const CBlock> GetBlock() const { return m_block; }
+};
+
+#endif // TAPYRUS_COINSPREFETCH_H
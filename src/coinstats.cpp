@@ -0,0 +1,223 @@
+// Copyright (c) 2010 Satoshi Nakamoto
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2019-2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinstats.h>
+
+#include <coins.h>
+#include <crypto/muhash.h>
+#include <cs_main.h>
+#include <hash.h>
+#include <serialize.h>
+#include <streams.h>
+#include <txdb.h>
+#include <util.h>
+#include <validation.h>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+uint64_t GetBogoSize(const CScript& scriptPubKey)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + scriptPubKey.size() /* scriptPubKey */;
+}
+
+static std::vector<unsigned char> TxOutSer(const COutPoint& outpoint, const Coin& coin)
+{
+    std::vector<unsigned char> vch;
+    CVectorWriter ss(SER_DISK, PROTOCOL_VERSION, vch, 0);
+    ss << outpoint;
+    ss << static_cast<uint32_t>(coin.nHeight * 2 + (coin.fCoinBase ? 1u : 0u));
+    ss << coin.out;
+    return vch;
+}
+
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    const std::vector<unsigned char> vch = TxOutSer(outpoint, coin);
+    muhash.Insert(Span<const unsigned char>(vch.data(), vch.size()));
+}
+
+void RemoveCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    const std::vector<unsigned char> vch = TxOutSer(outpoint, coin);
+    muhash.Remove(Span<const unsigned char>(vch.data(), vch.size()));
+}
+
+namespace {
+
+/** Statistics of one txid range, combined in key order by GetUTXOStats. */
+struct RangeStats
+{
+    CCoinsStats stats;
+    //! Data the range contributes to hash_serialized_3
+    std::vector<unsigned char> vSerialized;
+    MuHash3072 muhash;
+    bool fDone = false;
+    bool fOk = false;
+};
+
+void SerializeTx(std::vector<unsigned char>& vSerialized, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    CVectorWriter ss(SER_GETHASH, PROTOCOL_VERSION, vSerialized, vSerialized.size());
+    ss << hash;
+    ss << VARINT(outputs.begin()->second.nHeight * 2 + (outputs.begin()->second.fCoinBase ? 1u : 0u));
+    for (const auto& output : outputs) {
+        ss << VARINT(output.first + 1);
+        ss << output.second.out.scriptPubKey;
+        ss << VARINT_MODE(output.second.out.nValue, VarIntMode::NONNEGATIVE_SIGNED);
+    }
+    ss << VARINT(0u);
+}
+
+void InsertTx(MuHash3072& muhash, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    for (const auto& output : outputs) {
+        ApplyCoinHash(muhash, COutPoint(hash, output.first), output.second);
+    }
+}
+
+void ApplyStats(RangeStats& range, CoinStatsHashType hash_type, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    CCoinsStats& stats = range.stats;
+    if (hash_type == CoinStatsHashType::HASH_SERIALIZED) {
+        SerializeTx(range.vSerialized, hash, outputs);
+    } else if (hash_type == CoinStatsHashType::MUHASH) {
+        InsertTx(range.muhash, hash, outputs);
+    }
+    stats.nTransactions++;
+    for (const auto& output : outputs) {
+        stats.nTransactionOutputs++;
+        stats.mTotalAmount[GetColorIdFromScript(output.second.out.scriptPubKey)] += output.second.out.nValue;
+        stats.nBogoSize += GetBogoSize(output.second.out.scriptPubKey);
+    }
+}
+
+bool ScanRange(CCoinsViewCursor* pcursor, CoinStatsHashType hash_type, RangeStats& range)
+{
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    while (pcursor->Valid()) {
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            if (!outputs.empty() && key.hashMalFix != prevkey) {
+                ApplyStats(range, hash_type, prevkey, outputs);
+                outputs.clear();
+            }
+            prevkey = key.hashMalFix;
+            outputs.emplace(key.n, coin);
+        } else {
+            return error("%s: unable to read value", __func__);
+        }
+        pcursor->Next();
+    }
+    if (!outputs.empty()) {
+        ApplyStats(range, hash_type, prevkey, outputs);
+    }
+    return true;
+}
+
+} // namespace
+
+bool GetUTXOStats(CCoinsViewDB *view, CCoinsStats &stats, CoinStatsHashType hash_type)
+{
+    std::vector<std::unique_ptr<CCoinsViewCursor>> cursors = view->RangeCursors(UTXO_STATS_RANGES);
+    stats.hashBlock = cursors.front()->GetBestBlock();
+    {
+        LOCK(cs_main);
+        stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
+    }
+
+    // Workers take the next range to scan; the calling thread combines the scanned ranges
+    // in key order. Workers stay within nWindow ranges of the last combined one, which
+    // bounds the serialized data buffered for hash_serialized_3.
+    const int nThreads = std::max(1, std::min(GetNumCores(), MAX_UTXO_STATS_THREADS));
+    const size_t nWindow = 2 * nThreads;
+    std::vector<RangeStats> ranges(cursors.size());
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t nNextRange = 0;
+    size_t nCombined = 0;
+
+    auto worker = [&]() {
+        RenameThread("bitcoin-utxostats");
+        while (true) {
+            size_t n;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&] { return nNextRange == ranges.size() || nNextRange < nCombined + nWindow; });
+                if (nNextRange == ranges.size())
+                    return;
+                n = nNextRange++;
+            }
+            bool fOk;
+            try {
+                fOk = ScanRange(cursors[n].get(), hash_type, ranges[n]);
+            } catch (const std::exception& e) {
+                fOk = error("%s: %s", __func__, e.what());
+            }
+            cursors[n].reset();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ranges[n].fOk = fOk;
+                ranges[n].fDone = true;
+            }
+            cond.notify_all();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back(worker);
+    }
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << stats.hashBlock;
+    MuHash3072 muhash;
+    bool fOk = true;
+    for (size_t n = 0; n < ranges.size(); n++) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&] { return ranges[n].fDone; });
+        }
+        RangeStats& range = ranges[n];
+        fOk &= range.fOk;
+        stats.nTransactions += range.stats.nTransactions;
+        stats.nTransactionOutputs += range.stats.nTransactionOutputs;
+        stats.nBogoSize += range.stats.nBogoSize;
+        for (const auto& amount : range.stats.mTotalAmount) {
+            stats.mTotalAmount[amount.first] += amount.second;
+        }
+        if (hash_type == CoinStatsHashType::HASH_SERIALIZED) {
+            ss.write(reinterpret_cast<const char*>(range.vSerialized.data()), range.vSerialized.size());
+            std::vector<unsigned char>().swap(range.vSerialized);
+        } else if (hash_type == CoinStatsHashType::MUHASH) {
+            muhash *= range.muhash;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            nCombined = n + 1;
+        }
+        cond.notify_all();
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    if (!fOk) {
+        return false;
+    }
+
+    if (hash_type == CoinStatsHashType::HASH_SERIALIZED) {
+        stats.hashSerialized = ss.GetHash();
+    } else if (hash_type == CoinStatsHashType::MUHASH) {
+        muhash.Finalize(stats.hashMuHash);
+    }
+    stats.nDiskSize = view->EstimateSize();
+    return true;
+}
@@ -0,0 +1,66 @@
+// Copyright (c) 2010 Satoshi Nakamoto
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2019-2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATS_H
+#define BITCOIN_COINSTATS_H
+
+#include <amount.h>
+#include <coloridentifier.h>
+#include <uint256.h>
+
+#include <stdint.h>
+
+class CCoinsViewDB;
+class COutPoint;
+class CScript;
+class Coin;
+class MuHash3072;
+
+//! Number of txid ranges the coins database is split into by GetUTXOStats
+static const int UTXO_STATS_RANGES = 256;
+//! Maximum number of threads GetUTXOStats scans the ranges with
+static const int MAX_UTXO_STATS_THREADS = 16;
+
+enum class CoinStatsHashType {
+    HASH_SERIALIZED, //!< hash_serialized_3: SHA256d of the coins serialized in key order, used by UTXO snapshots
+    MUHASH,          //!< MuHash3072 of the set of coins, independent of their order
+    NONE,
+};
+
+/** Statistics about the unspent transaction output set, as reported by gettxoutsetinfo */
+struct CCoinsStats
+{
+    int nHeight;
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    uint256 hashSerialized;
+    uint256 hashMuHash;
+    uint64_t nDiskSize;
+    TxColoredCoinBalancesMap mTotalAmount;
+
+    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0){ mTotalAmount[ColorIdentifier()] = 0; }
+};
+
+//! Size of an unspent output in the bogosize metric
+uint64_t GetBogoSize(const CScript& scriptPubKey);
+
+//! Add a coin to a MuHash of the UTXO set, serialized the way GetUTXOStats does
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+//! Remove a coin from a MuHash of the UTXO set
+void RemoveCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+
+/**
+ * Calculate statistics about the unspent transaction output set.
+ *
+ * The coins are scanned in UTXO_STATS_RANGES txid ranges by up to MAX_UTXO_STATS_THREADS
+ * threads, all reading the same database snapshot, and the partial results are combined
+ * in key order. Only the hash selected by hash_type is computed.
+ */
+bool GetUTXOStats(CCoinsViewDB *view, CCoinsStats &stats, CoinStatsHashType hash_type = CoinStatsHashType::HASH_SERIALIZED);
+
+#endif // BITCOIN_COINSTATS_H
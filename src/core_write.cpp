@@ -12,6 +12,7 @@
 #include <script/standard.h>
 #include <serialize.h>
 #include <streams.h>
+#include <undo.h>
 #include <univalue.h>
 #include <util.h>
 #include <utilmoneystr.h>
@@ -180,8 +181,13 @@ void ScriptPubKeyToUniv(const CScript& scriptPubKey,
     out.pushKV("addresses", a);
 }
 
-void TxToUniv(const CTransaction& tx, const uint256& hashBlock, UniValue& entry, bool include_hex, int serialize_flags)
+void TxToUniv(const CTransaction& tx, const uint256& hashBlock, UniValue& entry, bool include_hex, int serialize_flags, const CTxUndo* txundo)
 {
+    // The spent outputs are only known from the undo data of the block containing the transaction.
+    const bool have_undo = txundo != nullptr && !tx.IsCoinBase();
+    CAmount amt_total_in = 0;
+    CAmount amt_total_out = 0;
+
     entry.pushKV("txid", tx.GetHashMalFix().GetHex());
     entry.pushKV("hash", tx.GetHash().GetHex());
     entry.pushKV("features", tx.nFeatures);
@@ -201,6 +207,24 @@ void TxToUniv(const CTransaction& tx, const uint256& hashBlock, UniValue& entry,
             o.pushKV("asm", ScriptToAsmStr(txin.scriptSig, true));
             o.pushKV("hex", HexStr(txin.scriptSig.begin(), txin.scriptSig.end()));
             in.pushKV("scriptSig", o);
+            if (have_undo) {
+                const Coin& prev_coin = txundo->vprevout[i];
+                const CTxOut& prev_txout = prev_coin.out;
+                ColorIdentifier colorId(GetColorIdFromScript(prev_txout.scriptPubKey));
+                if (colorId.type == TokenTypes::NONE) {
+                    amt_total_in += prev_txout.nValue;
+                }
+
+                UniValue p(UniValue::VOBJ);
+                p.pushKV("generated", bool(prev_coin.fCoinBase));
+                p.pushKV("height", uint64_t(prev_coin.nHeight));
+                p.pushKV("token", colorId.toHexString());
+                p.pushKV("value", (colorId.type == TokenTypes::NONE ? ValueFromAmount(prev_txout.nValue) : prev_txout.nValue ));
+                UniValue o_script_pub_key(UniValue::VOBJ);
+                ScriptPubKeyToUniv(prev_txout.scriptPubKey, o_script_pub_key, true);
+                p.pushKV("scriptPubKey", o_script_pub_key);
+                in.pushKV("prevout", p);
+            }
         }
         in.pushKV("sequence", (int64_t)txin.nSequence);
         vin.push_back(in);
@@ -222,9 +246,18 @@ void TxToUniv(const CTransaction& tx, const uint256& hashBlock, UniValue& entry,
         ScriptPubKeyToUniv(txout.scriptPubKey, o, true);
         out.pushKV("scriptPubKey", o);
         vout.push_back(out);
+
+        if (have_undo && colorId.type == TokenTypes::NONE) {
+            amt_total_out += txout.nValue;
+        }
     }
     entry.pushKV("vout", vout);
 
+    if (have_undo) {
+        // Fees are paid in TPC only.
+        entry.pushKV("fee", ValueFromAmount(amt_total_in - amt_total_out));
+    }
+
     if (!hashBlock.IsNull())
         entry.pushKV("blockhash", hashBlock.GetHex());
 
@@ -198,6 +198,12 @@ bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
     return true;
 }
 
+CDBWrapper::Snapshot CDBWrapper::GetSnapshot() const
+{
+    leveldb::DB* db = pdb;
+    return Snapshot(db->GetSnapshot(), [db](const leveldb::Snapshot* snapshot) { db->ReleaseSnapshot(snapshot); });
+}
+
 size_t CDBWrapper::DynamicMemoryUsage() const {
     std::string memory;
     if (!pdb->GetProperty("leveldb.approximate-memory-usage", &memory)) {
@@ -16,6 +16,8 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+#include <memory>
+
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 
@@ -231,16 +233,23 @@ public:
     CDBWrapper(const CDBWrapper&) = delete;
     CDBWrapper& operator=(const CDBWrapper&) = delete;
 
+    //! A consistent view of the database as of GetSnapshot(), released when the last reference goes away.
+    using Snapshot = std::shared_ptr<const leveldb::Snapshot>;
+
+    Snapshot GetSnapshot() const;
+
     template <typename K, typename V>
-    bool Read(const K& key, V& value) const
+    bool Read(const K& key, V& value, const Snapshot& snapshot = nullptr) const
     {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
         ssKey << key;
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
+        leveldb::ReadOptions options = readoptions;
+        options.snapshot = snapshot.get();
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(options, slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -309,9 +318,12 @@ public:
         return WriteBatch(batch, true);
     }
 
-    CDBIterator *NewIterator()
+    //! The snapshot, if given, must be kept alive as long as the iterator.
+    CDBIterator *NewIterator(const Snapshot& snapshot = nullptr)
     {
-        return new CDBIterator(*this, pdb->NewIterator(iteroptions));
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = snapshot.get();
+        return new CDBIterator(*this, pdb->NewIterator(options));
     }
 
     /**
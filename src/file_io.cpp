@@ -6,9 +6,13 @@
 #include <shutdown.h>
 #include <trace.h>
 #include <blockprune.h>
+#include <blockproofbatch.h>
+#include <checkqueue.h>
 #include <validation.h>
 #include <file_io.h>
+#include <algorithm>
 #include <deque>
+#include <set>
 
 static const uint64_t MEMPOOL_DUMP_VERSION = 1;
 
@@ -195,6 +199,56 @@ static bool FindBlockPos(CDiskBlockPos &pos, unsigned int nAddSize, unsigned int
     return true;
 }
 
+//! Blocks read ahead, with their position on disk if they are reindexed.
+using PendingBlocks = std::vector<std::pair<std::shared_ptr<CBlock>, CDiskBlockPos>>;
+
+/**
+ * Verify the proofs of a run of blocks together into proofs, and check their merkle
+ * roots and transactions on the block check queue, so that AcceptBlock does not check
+ * them again. A block that fails, or that the queue left unchecked after a failure, is
+ * checked again by AcceptBlock, which reports it.
+ */
+static void PrecheckPendingBlocks(const PendingBlocks& vPending, CBlockProofBatch& proofs, CXFieldHistoryMap* pxfieldHistory)
+{
+    {
+        LOCK(cs_main);
+        std::map<uint256, int> heights;
+        for (const auto& pending : vPending) {
+            const CBlock& block = *pending.first;
+            const uint256 hash = block.GetHash();
+            const CBlockIndex* pindex = LookupBlockIndex(hash);
+            if (pindex && (pindex->nStatus & BLOCK_HAVE_DATA)) continue;
+
+            int nHeight = -1;
+            auto it = heights.find(block.hashPrevBlock);
+            if (it != heights.end()) {
+                nHeight = it->second + 1;
+            } else if (const CBlockIndex* pindexPrev = LookupBlockIndex(block.hashPrevBlock)) {
+                nHeight = pindexPrev->nHeight + 1;
+            }
+            if (nHeight < 0) continue;
+            heights.emplace(hash, nHeight);
+            proofs.Add(block, nHeight, pxfieldHistory);
+        }
+    }
+    if (proofs.size() >= MIN_BLOCK_PROOF_BATCH_SIZE && !proofs.Verify()) {
+        LogPrint(BCLog::REINDEX, "%s: batch verification of %u block proofs failed, checking them one by one\n", __func__, proofs.size());
+    }
+
+    if (!nScriptCheckThreads || !g_chainstate.blockcheckqueue)
+        return;
+    std::vector<CBlockTransactionsCheck> vChecks;
+    vChecks.reserve(vPending.size());
+    for (const auto& pending : vPending) {
+        vChecks.emplace_back(pending.first.get());
+    }
+    CCheckQueueControl<CBlockTransactionsCheck> control(g_chainstate.blockcheckqueue.get());
+    control.Add(std::move(vChecks));
+    if (auto hash = control.Complete()) {
+        LogPrint(BCLog::REINDEX, "%s: block %s failed its transaction checks\n", __func__, hash->ToString());
+    }
+}
+
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp, CXFieldHistoryMap* pxfieldHistory)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
@@ -213,10 +267,108 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp, CXFieldHistoryMap*
     }
 
     int nLoaded = 0;
+
+    // Blocks are read ahead in runs, so that their proofs are verified together before
+    // they are accepted one by one in the order they were read.
+    PendingBlocks vPending;
+    size_t nPendingSize = 0;
+
+    // Returns false if loading must stop.
+    auto processBlock = [&](const std::shared_ptr<CBlock>& pblock, CDiskBlockPos* pos, const CBlockProofBatch& proofs) -> bool {
+        const CBlock& block = *pblock;
+        uint256 hash = block.GetHash();
+        {
+            LOCK(cs_main);
+            // detect out of order blocks, and store them for later
+            if (hash != FederationParams().GenesisBlock().GetHash() && !LookupBlockIndex(block.hashPrevBlock)) {
+                LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                        block.hashPrevBlock.ToString());
+                if (pos)
+                    mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *pos));
+                return true;
+            }
+
+            // process in case the block isn't known yet
+            CBlockIndex* pindex = LookupBlockIndex(hash);
+            if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
+                CValidationState state;
+                if (g_chainstate.AcceptBlock(pblock, state, nullptr, true, pos, nullptr, pxfieldHistory, &proofs)) {
+                    nLoaded++;
+                }
+                if (state.IsError()) {
+                    return false;
+                }
+            } else if (hash != FederationParams().GenesisBlock().GetHash() && pindex->nHeight % 1000 == 0) {
+                LogPrint(BCLog::REINDEX, "%s Block Import: already had block %s at height %d\n", __func__, hash.ToString(), pindex->nHeight);
+            }
+        }
+
+        // Activate the genesis block so normal node progress can continue
+        if (hash == FederationParams().GenesisBlock().GetHash()) {
+            CValidationState state;
+            if (!ActivateBestChain(state)) {
+                return false;
+            }
+        }
+
+        NotifyHeaderTip();
+
+        // Recursively process earlier encountered successors of this block
+        std::deque<uint256> queue;
+        queue.push_back(hash);
+        while (!queue.empty()) {
+            uint256 head = queue.front();
+            queue.pop_front();
+            std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+            while (range.first != range.second) {
+                std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+                std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
+                if (ReadBlockFromDisk(*pblockrecursive, it->second, pxfieldHistory))
+                {
+                    LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
+                            head.ToString());
+                    LOCK(cs_main);
+                    CValidationState dummy;
+                    if (g_chainstate.AcceptBlock(pblockrecursive, dummy, nullptr, true, &it->second, nullptr, pxfieldHistory))
+                    {
+                        nLoaded++;
+                        queue.push_back(pblockrecursive->GetHash());
+                    }
+                }
+                range.first++;
+                mapBlocksUnknownParent.erase(it);
+                NotifyHeaderTip();
+            }
+        }
+        return true;
+    };
+
+    // Returns false if loading must stop.
+    auto processPending = [&]() -> bool {
+        CBlockProofBatch proofs;
+        PrecheckPendingBlocks(vPending, proofs, pxfieldHistory);
+
+        bool fContinue = true;
+        for (auto& pending : vPending) {
+            try {
+                if (!processBlock(pending.first, dbp ? &pending.second : nullptr, proofs)) {
+                    fContinue = false;
+                    break;
+                }
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+        vPending.clear();
+        nPendingSize = 0;
+        return fContinue;
+    };
+
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*bufferSize, bufferSize+8, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
+        bool fStopped = false;
         while (!blkdat.eof()) {
             blkdat.SetPos(nRewind);
             nRewind++; // start one byte further next time, in case of failure
@@ -267,74 +419,21 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp, CXFieldHistoryMap*
                 blkdat >> block;
                 nRewind = blkdat.GetPos();
 
-                uint256 hash = block.GetHash();
-                {
-                    LOCK(cs_main);
-                    // detect out of order blocks, and store them for later
-                    if (hash != FederationParams().GenesisBlock().GetHash() && !LookupBlockIndex(block.hashPrevBlock)) {
-                        LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                                block.hashPrevBlock.ToString());
-                        if (dbp)
-                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                        continue;
-                    }
-
-                    // process in case the block isn't known yet
-                    CBlockIndex* pindex = LookupBlockIndex(hash);
-                    if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
-                        CValidationState state;
-                        if (g_chainstate.AcceptBlock(pblock, state, nullptr, true, dbp, nullptr, pxfieldHistory)) {
-                            nLoaded++;
-                        }
-                        if (state.IsError()) {
-                          break;
-                      }
-                    } else if (hash != FederationParams().GenesisBlock().GetHash() && pindex->nHeight % 1000 == 0) {
-                      LogPrint(BCLog::REINDEX, "%s Block Import: already had block %s at height %d\n", __func__, hash.ToString(), pindex->nHeight);
-                    }
-                }
-
-                // Activate the genesis block so normal node progress can continue
-                if (hash == FederationParams().GenesisBlock().GetHash()) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state)) {
+                vPending.emplace_back(pblock, dbp ? *dbp : CDiskBlockPos());
+                nPendingSize += nSize;
+                if (vPending.size() >= REINDEX_PROOF_BATCH_BLOCKS || nPendingSize >= REINDEX_BUFFER_SIZE) {
+                    if (!processPending()) {
+                        fStopped = true;
                         break;
                     }
                 }
-
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, pxfieldHistory))
-                        {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (g_chainstate.AcceptBlock(pblockrecursive, dummy, nullptr, true, &it->second, nullptr, pxfieldHistory))
-                            {
-                                nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
-                    }
-                }
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
+        if (!fStopped) {
+            processPending();
+        }
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
@@ -343,6 +442,232 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp, CXFieldHistoryMap*
     return nLoaded > 0;
 }
 
+namespace {
+//! A block found by ScanBlockFile.
+struct ScannedBlock {
+    uint256 hash;
+    uint256 hashPrevBlock;
+    CDiskBlockPos pos;
+};
+} // namespace
+
+/** Find the blocks in a block file. Only their headers are read. */
+static void ScanBlockFile(int nFile, std::vector<ScannedBlock>& blocks)
+{
+    FILE* file = OpenBlockFile(CDiskBlockPos(nFile, 0), true);
+    if (!file)
+        return; // This error is logged in OpenBlockFile
+    try {
+        // This takes over file and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(file, 2 * REINDEX_SCAN_BUFFER_SIZE, REINDEX_SCAN_BUFFER_SIZE, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        while (!blkdat.eof() && !ShutdownRequested()) {
+            blkdat.SetPos(nRewind);
+            nRewind++; // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+                blkdat.FindByte(FederationParams().MessageStart()[0]);
+                nRewind = blkdat.GetPos()+1;
+                blkdat >> buf;
+                if (memcmp(buf, FederationParams().MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                    continue;
+                // read size
+                blkdat >> nSize;
+                if (nSize < 80 || nSize > REINDEX_BUFFER_SIZE)
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain
+                break;
+            }
+            try {
+                // read the header, and skip the transactions
+                uint64_t nBlockPos = blkdat.GetPos();
+                blkdat.SetLimit(nBlockPos + nSize);
+                CBlockHeader header;
+                blkdat >> header;
+                blocks.push_back({header.GetHash(), header.hashPrevBlock, CDiskBlockPos(nFile, nBlockPos)});
+                blkdat.SetLimit();
+                // Move within the buffer when the next block was read into it
+                // already, and only seek past blocks reaching beyond it.
+                const uint64_t nNextPos = nBlockPos + nSize;
+                if (!blkdat.SetPos(nNextPos) && !blkdat.Seek(nNextPos))
+                    break;
+                nRewind = nNextPos;
+            } catch (const std::exception& e) {
+                LogPrint(BCLog::REINDEX, "%s: Deserialize or I/O error - %s in blk%05u.dat\n", __func__, e.what(), (unsigned int)nFile);
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+}
+
+/** Read the block found by ScanBlockFile at scanned into read, unless it cannot be read. */
+static void ReadScannedBlock(const ScannedBlock& scanned, PendingBlocks::value_type& read)
+{
+    std::vector<uint8_t> block_data;
+    if (!ReadRawBlockFromDisk(block_data, scanned.pos, FederationParams().MessageStart()))
+        return;
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    try {
+        SpanReader spanreader(SER_DISK, CLIENT_VERSION, block_data);
+        spanreader >> *pblock;
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Deserialize or I/O error - %s at %s\n", __func__, e.what(), scanned.pos.ToString());
+        return;
+    }
+    if (pblock->GetHash() == scanned.hash) {
+        read = std::make_pair(pblock, scanned.pos);
+    }
+}
+
+namespace {
+/** Closure finding the blocks of a block file, or reading one of them, run on the reindex queue. */
+class CReindexTask
+{
+private:
+    int m_file{-1};
+    std::vector<ScannedBlock>* m_blocks{nullptr};
+    const ScannedBlock* m_scanned{nullptr};
+    PendingBlocks::value_type* m_read{nullptr};
+
+public:
+    CReindexTask(int nFile, std::vector<ScannedBlock>& blocks) : m_file(nFile), m_blocks(&blocks) {}
+    CReindexTask(const ScannedBlock& scanned, PendingBlocks::value_type& read) : m_scanned(&scanned), m_read(&read) {}
+
+    /** Never fails, so that every task runs; what cannot be read is left out. */
+    std::optional<bool> operator()()
+    {
+        if (m_blocks) {
+            if (!ShutdownRequested()) ScanBlockFile(m_file, *m_blocks);
+        } else {
+            ReadScannedBlock(*m_scanned, *m_read);
+        }
+        return std::nullopt;
+    }
+};
+} // namespace
+
+bool LoadBlockFiles(int nThreads, CXFieldHistoryMap* pxfieldHistory)
+{
+    int64_t nStart = GetTimeMillis();
+
+    int nFiles = 0;
+    while (fs::exists(GetBlockPosFilename(CDiskBlockPos(nFiles, 0), "blk"))) {
+        nFiles++;
+    }
+
+    // The files are scanned and the blocks read on nThreads threads, started once for
+    // the whole reindex. This thread is one of them.
+    CCheckQueue<CReindexTask> readqueue(1, nThreads - 1);
+
+    // Find the blocks of all files in parallel.
+    std::vector<std::vector<ScannedBlock>> vFileBlocks(nFiles);
+    {
+        std::vector<CReindexTask> vTasks;
+        vTasks.reserve(nFiles);
+        for (int nFile = 0; nFile < nFiles; ++nFile) {
+            vTasks.emplace_back(nFile, vFileBlocks[nFile]);
+        }
+        CCheckQueueControl<CReindexTask> control(&readqueue);
+        control.Add(std::move(vTasks));
+        control.Complete();
+    }
+    if (ShutdownRequested())
+        return false;
+
+    // Order the blocks so that each comes after its parent. Blocks whose parent was
+    // not found are left out, like the serial reindex leaves them unconnected.
+    std::multimap<uint256, const ScannedBlock*> mapChildren;
+    size_t nScanned = 0;
+    for (const auto& blocks : vFileBlocks) {
+        nScanned += blocks.size();
+        for (const ScannedBlock& block : blocks) {
+            mapChildren.emplace(block.hashPrevBlock, &block);
+        }
+    }
+    LogPrintf("Scanned %u blocks in %d block files in %dms\n", nScanned, nFiles, GetTimeMillis() - nStart);
+
+    std::vector<const ScannedBlock*> vOrdered;
+    vOrdered.reserve(nScanned);
+    std::set<uint256> setSeen{FederationParams().GenesisBlock().GetHash()};
+    std::deque<uint256> queue{FederationParams().GenesisBlock().GetHash()};
+    while (!queue.empty()) {
+        auto range = mapChildren.equal_range(queue.front());
+        queue.pop_front();
+        for (auto it = range.first; it != range.second; ++it) {
+            if (setSeen.insert(it->second->hash).second) {
+                vOrdered.push_back(it->second);
+                queue.push_back(it->second->hash);
+            }
+        }
+    }
+    mapChildren.clear();
+
+    // Activate the genesis block so normal node progress can continue
+    {
+        CValidationState state;
+        if (!ActivateBestChain(state))
+            return false;
+    }
+
+    // Accept the blocks in runs: the blocks of a run are read in parallel, and their
+    // proofs and transactions are checked together before they are accepted in order.
+    int nLoaded = 0;
+    int nMaxFile = -1;
+    for (size_t nRunStart = 0; nRunStart < vOrdered.size() && !ShutdownRequested(); nRunStart += REINDEX_PROOF_BATCH_BLOCKS) {
+        const size_t nRunSize = std::min(REINDEX_PROOF_BATCH_BLOCKS, vOrdered.size() - nRunStart);
+        PendingBlocks vRun(nRunSize);
+        {
+            std::vector<CReindexTask> vTasks;
+            vTasks.reserve(nRunSize);
+            for (size_t i = 0; i < nRunSize; ++i) {
+                vTasks.emplace_back(*vOrdered[nRunStart + i], vRun[i]);
+            }
+            CCheckQueueControl<CReindexTask> control(&readqueue);
+            control.Add(std::move(vTasks));
+            control.Complete();
+        }
+        vRun.erase(std::remove_if(vRun.begin(), vRun.end(), [](const PendingBlocks::value_type& pending) { return !pending.first; }), vRun.end());
+
+        CBlockProofBatch proofs;
+        PrecheckPendingBlocks(vRun, proofs, pxfieldHistory);
+
+        for (auto& pending : vRun) {
+            {
+                LOCK(cs_main);
+                CBlockIndex* pindex = LookupBlockIndex(pending.first->GetHash());
+                if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
+                    CValidationState state;
+                    if (g_chainstate.AcceptBlock(pending.first, state, nullptr, true, &pending.second, nullptr, pxfieldHistory, &proofs)) {
+                        nLoaded++;
+                        nMaxFile = std::max(nMaxFile, pending.second.nFile);
+                    }
+                    if (state.IsError())
+                        return false;
+                }
+            }
+            NotifyHeaderTip();
+        }
+    }
+
+    // The blocks were accepted in chain order rather than in file order, so make sure
+    // new blocks are appended after the last file with an accepted block.
+    {
+        LOCK(cs_LastBlockFile);
+        if (nMaxFile > nLastBlockFile) {
+            FlushBlockFile();
+            nLastBlockFile = nMaxFile;
+        }
+    }
+
+    LogPrintf("Loaded %i blocks from %d block files in %dms\n", nLoaded, nFiles, GetTimeMillis() - nStart);
+    return !ShutdownRequested();
+}
+
 static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
@@ -441,11 +766,15 @@ bool FlushStateToDisk(CValidationState &state, FlushStateMode mode, int nManualP
         // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
         bool fPeriodicFlush = mode == FlushStateMode::PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
         // Combine all conditions that result in a full cache flush.
-        // fFlushForPrune is excluded from fDoFullFlush so that a prune flush uses
-        // Sync() (writes dirty entries, keeps the cache warm) rather than Flush()
-        // (wipes the cache entirely). fFlushForPrune is kept in the outer gate below
-        // so that UnlinkPrunedFiles() and the block-index write still run on prune.
+        // fFlushForPrune is excluded from fDoFullFlush so that a prune flush does not
+        // count as a full flush for ChainStateFlushed. fFlushForPrune is kept in the outer
+        // gate below so that UnlinkPrunedFiles() and the block-index write still run on prune.
         fDoFullFlush = (mode == FlushStateMode::ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush;
+        // Only an explicit flush wipes the cache. Otherwise Sync() writes the dirty entries and
+        // keeps the clean ones, and a cache over the limit only evicts its least recently used
+        // coins, so that the blocks connected after the flush do not run against a cold cache.
+        const bool fWipeCache = mode == FlushStateMode::ALWAYS;
+        const bool fEvict = fCacheLarge || fCacheCritical;
         // Write blocks and block index to disk.
         if (fDoFullFlush || fFlushForPrune || fPeriodicWrite) {
             // Depend on nMinDiskSpace to ensure we can write block index
@@ -485,10 +814,13 @@ bool FlushStateToDisk(CValidationState &state, FlushStateMode mode, int nManualP
             // overwrite one. Still, use a conservative safety factor of 2.
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
-            // For a full flush, wipe the entire cache; for a prune flush, use Sync()
-            // to write dirty entries while keeping the cache warm for faster block connection.
-            if (fDoFullFlush ? !pcoinsTip->Flush() : !pcoinsTip->Sync())
+            if (fWipeCache ? !pcoinsTip->Flush() : !pcoinsTip->Sync())
                 return AbortNode(state, "Failed to write to coin database");
+            if (fEvict) {
+                const size_t nEvicted = pcoinsTip->Evict(nTotalSpace * COINS_CACHE_EVICT_TARGET_PERCENT / 100);
+                LogPrint(BCLog::COINDB, "Evicted %u coins from the cache (%u remaining, %.1fMiB)\n",
+                    nEvicted, pcoinsTip->GetCacheSize(), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)));
+            }
             nLastFlush = nNow;
             full_flush_completed = fDoFullFlush;
             TRACE5(utxocache, utxocache_flush,
@@ -6,6 +6,11 @@
 #define BITCOIN_FILE_IO_H
 
 constexpr size_t REINDEX_BUFFER_SIZE = 32 * 1000000;  //  use large 32MB buffer to handle any block size
+constexpr size_t REINDEX_PROOF_BATCH_BLOCKS = 256;     //  blocks read ahead to verify their proofs together
+constexpr size_t REINDEX_CHECK_BATCH_SIZE = 8;         //  blocks read ahead a thread takes at once to check their transactions
+constexpr size_t REINDEX_SCAN_BUFFER_SIZE = 1000000;   //  buffer of a thread finding the blocks of a block file
+constexpr int DEFAULT_REINDEX_THREADS = 0;             //  0 = reindex the block files one by one
+constexpr int MAX_REINDEX_THREADS = 16;
 enum class FlushStateMode {
     NONE,
     IF_NEEDED,
@@ -22,6 +27,14 @@ bool DumpMempool();
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = nullptr, CXFieldHistoryMap* pxfieldHistory = nullptr);
 
+/**
+ * Reindex the blk*.dat files: find the blocks of all files on nThreads threads,
+ * reading only their headers, then accept the blocks in chain order. Blocks are read
+ * and checked in parallel in runs, like LoadExternalBlockFile does. Returns false if
+ * the reindex did not finish.
+ */
+bool LoadBlockFiles(int nThreads, CXFieldHistoryMap* pxfieldHistory = nullptr);
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
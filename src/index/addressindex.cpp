@@ -0,0 +1,328 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <map>
+
+#include <chainstate.h>
+#include <file_io.h>
+#include <hash.h>
+#include <index/addressindex.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+/* The index database stores three kinds of entries for each script, keyed by the hash of the
+ * uncolored script and the color identifier:
+ *
+ * - [DB_OUTPUT, script hash, color, height (BE), txid, n (BE)] -> DBOutputValue for every output
+ *   paying to the script, updated with the spending input when it is spent.
+ * - [DB_UNSPENT, script hash, color, height (BE), txid, n (BE)] -> amount for every output that is
+ *   still unspent.
+ * - [DB_BALANCE, script hash, color] -> DBBalance.
+ *
+ * Heights and output indexes are big-endian so that the outputs of a script are iterated in the
+ * order they were confirmed.
+ */
+constexpr char DB_OUTPUT = 'o';
+constexpr char DB_UNSPENT = 'u';
+constexpr char DB_BALANCE = 'b';
+
+std::unique_ptr<AddressIndex> g_address_index;
+
+namespace {
+
+struct DBOutputKey {
+    char prefix;
+    uint256 script_hash;
+    ColorIdentifier color;
+    int height;
+    COutPoint outpoint;
+
+    DBOutputKey() : prefix(DB_OUTPUT), height(0) {}
+    DBOutputKey(char prefix_in, const uint256& script_hash_in, const ColorIdentifier& color_in,
+                int height_in, const COutPoint& outpoint_in)
+        : prefix(prefix_in), script_hash(script_hash_in), color(color_in), height(height_in), outpoint(outpoint_in) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, prefix);
+        s << script_hash << color;
+        ser_writedata32be(s, height);
+        s << outpoint.hashMalFix;
+        ser_writedata32be(s, outpoint.n);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        char prefix_in = ser_readdata8(s);
+        if (prefix_in != prefix) {
+            throw std::ios_base::failure("Invalid format for address index DB output key");
+        }
+        s >> script_hash >> color;
+        height = ser_readdata32be(s);
+        s >> outpoint.hashMalFix;
+        outpoint.n = ser_readdata32be(s);
+    }
+};
+
+struct DBOutputValue {
+    CAmount amount;
+    uint256 spent_txid;
+    uint32_t spent_index;
+    int spent_height;
+
+    DBOutputValue() : amount(0), spent_index(0), spent_height(0) {}
+    explicit DBOutputValue(CAmount amount_in) : amount(amount_in), spent_index(0), spent_height(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(amount);
+        READWRITE(spent_txid);
+        READWRITE(spent_index);
+        READWRITE(spent_height);
+    }
+};
+
+struct DBBalance {
+    CAmount balance;
+    CAmount received;
+
+    DBBalance() : balance(0), received(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(balance);
+        READWRITE(received);
+    }
+};
+
+using ScriptColor = std::pair<uint256, ColorIdentifier>;
+
+std::pair<char, ScriptColor> DBBalanceKey(const ScriptColor& key) { return std::make_pair(DB_BALANCE, key); }
+
+/** Split a script into the hash of its uncolored part and its color identifier. */
+ScriptColor GetScriptColor(const CScript& script)
+{
+    const ColorIdentifier color = GetColorIdFromScript(script);
+    if (color.type == TokenTypes::NONE) {
+        return std::make_pair(Hash(script.begin(), script.end()), color);
+    }
+    // <COLOR identifier> OP_COLOR <script>
+    CScript::const_iterator begin = script.begin() + 1 + COLOR_IDENTIFIER_SIZE + 1;
+    return std::make_pair(Hash(begin, script.end()), color);
+}
+
+} // namespace
+
+/**
+ * Access to the address index database (indexes/addressindex/)
+ */
+class AddressIndex::DB : public BaseIndex::DB
+{
+public:
+    explicit DB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+};
+
+AddressIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "addressindex", n_cache_size, f_memory, f_wipe)
+{}
+
+AddressIndex::AddressIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<AddressIndex::DB>(n_cache_size, f_memory, f_wipe))
+{}
+
+AddressIndex::~AddressIndex() {}
+
+bool AddressIndex::UpdateBlock(const CBlock& block, const CBlockIndex* pindex, bool undo)
+{
+    // The outputs of the genesis block are not added to the UTXO set.
+    if (pindex->nHeight == 0) {
+        return true;
+    }
+
+    CBlockUndo block_undo;
+    if (!UndoReadFromDisk(block_undo, pindex)) {
+        return error("%s: cannot read the undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    CDBBatch batch(*m_db);
+    // Balances touched by this block, read once and written back at the end.
+    std::map<ScriptColor, DBBalance> balances;
+    auto get_balance = [&](const ScriptColor& key) -> DBBalance& {
+        auto it = balances.find(key);
+        if (it == balances.end()) {
+            DBBalance value;
+            m_db->Read(DBBalanceKey(key), value);
+            it = balances.emplace(key, value).first;
+        }
+        return it->second;
+    };
+
+    // A block is reverted in the opposite order, so that outputs spent within the
+    // block are restored before they are removed.
+    for (size_t k = 0; k < block.vtx.size(); ++k) {
+        const size_t i = undo ? block.vtx.size() - 1 - k : k;
+        const CTransaction& tx = *block.vtx[i];
+        const uint256 txid = tx.GetHashMalFix();
+
+        if (!tx.IsCoinBase()) {
+            const CTxUndo& tx_undo = block_undo.vtxundo.at(i - 1);
+            for (uint32_t j = 0; j < tx.vin.size(); ++j) {
+                const Coin& coin = tx_undo.vprevout.at(j);
+                const ScriptColor key = GetScriptColor(coin.out.scriptPubKey);
+                const COutPoint& prevout = tx.vin[j].prevout;
+
+                DBOutputValue value(coin.out.nValue);
+                if (!undo) {
+                    value.spent_txid = txid;
+                    value.spent_index = j;
+                    value.spent_height = pindex->nHeight;
+                }
+                batch.Write(DBOutputKey(DB_OUTPUT, key.first, key.second, coin.nHeight, prevout), value);
+                if (undo) {
+                    batch.Write(DBOutputKey(DB_UNSPENT, key.first, key.second, coin.nHeight, prevout), coin.out.nValue);
+                } else {
+                    batch.Erase(DBOutputKey(DB_UNSPENT, key.first, key.second, coin.nHeight, prevout));
+                }
+                get_balance(key).balance += undo ? coin.out.nValue : -coin.out.nValue;
+            }
+        }
+
+        for (uint32_t j = 0; j < tx.vout.size(); ++j) {
+            const CTxOut& out = tx.vout[j];
+            if (out.scriptPubKey.IsUnspendable()) {
+                continue;
+            }
+            const ScriptColor key = GetScriptColor(out.scriptPubKey);
+            const COutPoint outpoint(txid, j);
+
+            if (undo) {
+                batch.Erase(DBOutputKey(DB_OUTPUT, key.first, key.second, pindex->nHeight, outpoint));
+                batch.Erase(DBOutputKey(DB_UNSPENT, key.first, key.second, pindex->nHeight, outpoint));
+            } else {
+                batch.Write(DBOutputKey(DB_OUTPUT, key.first, key.second, pindex->nHeight, outpoint), DBOutputValue(out.nValue));
+                batch.Write(DBOutputKey(DB_UNSPENT, key.first, key.second, pindex->nHeight, outpoint), out.nValue);
+            }
+            DBBalance& balance = get_balance(key);
+            balance.balance += undo ? -out.nValue : out.nValue;
+            balance.received += undo ? -out.nValue : out.nValue;
+        }
+    }
+
+    for (const auto& entry : balances) {
+        if (entry.second.received == 0) {
+            batch.Erase(DBBalanceKey(entry.first));
+        } else {
+            batch.Write(DBBalanceKey(entry.first), entry.second);
+        }
+    }
+    return m_db->WriteBatch(batch);
+}
+
+bool AddressIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    return UpdateBlock(block, pindex, false);
+}
+
+bool AddressIndex::Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip)
+{
+    assert(current_tip->GetAncestor(new_tip->nHeight) == new_tip);
+
+    for (const CBlockIndex* pindex = current_tip; pindex != new_tip; pindex = pindex->pprev) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex)) {
+            return error("%s: cannot read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+        }
+        if (!UpdateBlock(block, pindex, true)) {
+            return false;
+        }
+    }
+    return BaseIndex::Rewind(current_tip, new_tip);
+}
+
+BaseIndex::DB& AddressIndex::GetDB() const { return *m_db; }
+
+bool AddressIndex::LookupBalances(const CScript& script, const std::optional<ColorIdentifier>& color,
+                                  std::vector<AddressBalance>& balances) const
+{
+    const ScriptColor key = GetScriptColor(script);
+
+    std::unique_ptr<CDBIterator> db_it(m_db->NewIterator());
+    if (color) {
+        db_it->Seek(DBBalanceKey(std::make_pair(key.first, *color)));
+    } else {
+        db_it->Seek(std::make_pair(DB_BALANCE, key.first));
+    }
+
+    for (; db_it->Valid(); db_it->Next()) {
+        std::pair<char, ScriptColor> db_key;
+        if (!db_it->GetKey(db_key) || db_key.first != DB_BALANCE || db_key.second.first != key.first) break;
+        if (color && db_key.second.second != *color) break;
+
+        DBBalance value;
+        if (!db_it->GetValue(value)) {
+            return error("%s: cannot read the balance of a script in %s", __func__, GetName());
+        }
+        AddressBalance balance;
+        balance.color = db_key.second.second;
+        balance.balance = value.balance;
+        balance.received = value.received;
+        balances.push_back(balance);
+    }
+    return true;
+}
+
+bool AddressIndex::LookupOutputs(const CScript& script, const std::optional<ColorIdentifier>& color,
+                                 bool unspent_only, size_t skip, size_t count,
+                                 std::vector<AddressOutput>& outputs) const
+{
+    const ScriptColor key = GetScriptColor(script);
+    const char prefix = unspent_only ? DB_UNSPENT : DB_OUTPUT;
+
+    std::unique_ptr<CDBIterator> db_it(m_db->NewIterator());
+    if (color) {
+        db_it->Seek(std::make_pair(prefix, std::make_pair(key.first, *color)));
+    } else {
+        db_it->Seek(std::make_pair(prefix, key.first));
+    }
+
+    for (; db_it->Valid() && outputs.size() < count; db_it->Next()) {
+        DBOutputKey db_key;
+        db_key.prefix = prefix;
+        if (!db_it->GetKey(db_key) || db_key.script_hash != key.first) break;
+        if (color && db_key.color != *color) break;
+
+        if (skip > 0) {
+            --skip;
+            continue;
+        }
+
+        AddressOutput output;
+        output.color = db_key.color;
+        output.outpoint = db_key.outpoint;
+        output.height = db_key.height;
+        if (unspent_only) {
+            if (!db_it->GetValue(output.amount)) {
+                return error("%s: cannot read an unspent output in %s", __func__, GetName());
+            }
+        } else {
+            DBOutputValue value;
+            if (!db_it->GetValue(value)) {
+                return error("%s: cannot read an output in %s", __func__, GetName());
+            }
+            output.amount = value.amount;
+            output.spent_txid = value.spent_txid;
+            output.spent_index = value.spent_index;
+            output.spent_height = value.spent_height;
+        }
+        outputs.push_back(output);
+    }
+    return true;
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_ADDRESSINDEX_H
+#define BITCOIN_INDEX_ADDRESSINDEX_H
+
+#include <amount.h>
+#include <chain.h>
+#include <coloridentifier.h>
+#include <index/base.h>
+#include <primitives/transaction.h>
+#include <script/script.h>
+#include <uint256.h>
+
+#include <optional>
+#include <vector>
+
+static const bool DEFAULT_ADDRESSINDEX = false;
+
+/** An output paying to an indexed script, and the input spending it if any. */
+struct AddressOutput
+{
+    ColorIdentifier color;
+    COutPoint outpoint;
+    int height{0};
+    CAmount amount{0};
+
+    //! Null if the output is unspent
+    uint256 spent_txid;
+    uint32_t spent_index{0};
+    int spent_height{0};
+
+    bool IsSpent() const { return !spent_txid.IsNull(); }
+};
+
+/** The balance of one color held by an indexed script. */
+struct AddressBalance
+{
+    ColorIdentifier color;
+    CAmount balance{0};
+    CAmount received{0};
+};
+
+/**
+ * AddressIndex records, for every script on the active chain, the outputs paying to
+ * it together with the transaction spending them, the unspent outputs, and the balance
+ * of each color. Colored outputs are indexed under their uncolored script and their
+ * color identifier, so the outputs of all colors sent to one address are found together.
+ *
+ * This replaces scanning the UTXO set and fetching transactions with point reads and
+ * short range scans.
+ */
+class AddressIndex final : public BaseIndex
+{
+protected:
+    class DB;
+
+private:
+    const std::unique_ptr<DB> m_db;
+
+    /// Read or write the entries of one block; undo reverses a block that was connected before.
+    bool UpdateBlock(const CBlock& block, const CBlockIndex* pindex, bool undo);
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    bool Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip) override;
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "addressindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit AddressIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    // Destructor is declared because this class contains a unique_ptr to an incomplete type.
+    virtual ~AddressIndex() override;
+
+    /// Look up the balance of each color held by script, which is looked up by its uncolored
+    /// part if it is colored. If color is set, only that color is returned.
+    bool LookupBalances(const CScript& script, const std::optional<ColorIdentifier>& color,
+                        std::vector<AddressBalance>& balances) const;
+
+    /// Look up the outputs paying to script, ordered by color and height, skipping the first
+    /// skip entries and returning at most count. If unspent_only is set, spent outputs are left out.
+    bool LookupOutputs(const CScript& script, const std::optional<ColorIdentifier>& color,
+                       bool unspent_only, size_t skip, size_t count,
+                       std::vector<AddressOutput>& outputs) const;
+};
+
+/// The global address index, used by the address RPCs. May be null.
+extern std::unique_ptr<AddressIndex> g_address_index;
+
+#endif // BITCOIN_INDEX_ADDRESSINDEX_H
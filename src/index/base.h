@@ -69,8 +69,15 @@ protected:
     /// Write update index entries for a newly connected block.
     virtual bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) { return true; }
 
+    /// Rewind the index from current_tip back to new_tip, an ancestor of it, after a reorg.
+    /// Indices whose state depends on the blocks that were disconnected must override this.
+    virtual bool Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip);
+
     virtual DB& GetDB() const = 0;
 
+    /// The last block the index is in sync with.
+    const CBlockIndex* CurrentIndex() const { return m_best_block_index.load(); }
+
     /// Get the name of the index for display in logs.
     virtual const char* GetName() const = 0;
 
@@ -0,0 +1,197 @@
+// Copyright (c) 2020-2021 The Bitcoin Core developers
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/coinstatsindex.h>
+#include <chainstate.h>
+#include <coins.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+constexpr char DB_BLOCK_HEIGHT = 't';
+
+std::unique_ptr<CoinStatsIndex> g_coin_stats_index;
+
+namespace {
+
+/** UTXO set statistics after a block was connected, stored by height. */
+struct DBVal
+{
+    uint256 block_hash;
+    uint256 muhash;
+    //! Running MuHash the index continues from, e.g. after a restart or a reorg
+    MuHash3072 muhash_state;
+    uint64_t transaction_output_count;
+    uint64_t bogo_size;
+    TxColoredCoinBalancesMap total_amount;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(block_hash);
+        READWRITE(muhash);
+        READWRITE(muhash_state);
+        READWRITE(transaction_output_count);
+        READWRITE(bogo_size);
+        READWRITE(total_amount);
+    }
+};
+
+void ApplyAmount(TxColoredCoinBalancesMap& total_amount, const CTxOut& out, bool fSpent)
+{
+    const ColorIdentifier colorId = GetColorIdFromScript(out.scriptPubKey);
+    CAmount& amount = total_amount[colorId];
+    amount += fSpent ? -out.nValue : out.nValue;
+    // Like gettxoutsetinfo, only report colors that have unspent outputs.
+    if (amount == 0 && colorId.type != TokenTypes::NONE) {
+        total_amount.erase(colorId);
+    }
+}
+
+} // namespace
+
+/**
+ * Access to the coinstats database (indexes/coinstats/)
+ *
+ * Besides the block locator of BaseIndex::DB, the database holds one DBVal for
+ * each height of the chain the index is synced to. Records above the synced
+ * height may belong to a stale chain and are overwritten when the index
+ * advances, so readers compare the block hash of the record.
+ */
+class CoinStatsIndex::DB : public BaseIndex::DB
+{
+public:
+    explicit DB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    bool ReadStats(const CBlockIndex* pindex, DBVal& value) const;
+    bool WriteStats(int nHeight, const DBVal& value);
+};
+
+CoinStatsIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "coinstats", n_cache_size, f_memory, f_wipe)
+{}
+
+bool CoinStatsIndex::DB::ReadStats(const CBlockIndex* pindex, DBVal& value) const
+{
+    return Read(std::make_pair(DB_BLOCK_HEIGHT, pindex->nHeight), value) && value.block_hash == pindex->GetBlockHash();
+}
+
+bool CoinStatsIndex::DB::WriteStats(int nHeight, const DBVal& value)
+{
+    return Write(std::make_pair(DB_BLOCK_HEIGHT, nHeight), value);
+}
+
+CoinStatsIndex::CoinStatsIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<CoinStatsIndex::DB>(n_cache_size, f_memory, f_wipe))
+{}
+
+CoinStatsIndex::~CoinStatsIndex() {}
+
+bool CoinStatsIndex::LoadStats(const CBlockIndex* pindex)
+{
+    if (!pindex) {
+        m_muhash = MuHash3072();
+        m_transaction_output_count = 0;
+        m_bogo_size = 0;
+        m_total_amount.clear();
+        m_total_amount[ColorIdentifier()] = 0;
+        return true;
+    }
+
+    DBVal value;
+    if (!m_db->ReadStats(pindex, value)) {
+        return error("%s: cannot read the statistics of block %s at height %d",
+                     __func__, pindex->GetBlockHash().ToString(), pindex->nHeight);
+    }
+    m_muhash = value.muhash_state;
+    m_transaction_output_count = value.transaction_output_count;
+    m_bogo_size = value.bogo_size;
+    m_total_amount = std::move(value.total_amount);
+    return true;
+}
+
+bool CoinStatsIndex::Init()
+{
+    if (!BaseIndex::Init()) {
+        return false;
+    }
+    return LoadStats(CurrentIndex());
+}
+
+bool CoinStatsIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    // The outputs of the genesis block are not added to the UTXO set.
+    if (pindex->nHeight > 0) {
+        CBlockUndo block_undo;
+        if (!UndoReadFromDisk(block_undo, pindex)) {
+            return error("%s: cannot read the undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+        }
+
+        for (size_t i = 0; i < block.vtx.size(); ++i) {
+            const CTransaction& tx = *block.vtx[i];
+
+            for (uint32_t j = 0; j < tx.vout.size(); ++j) {
+                const CTxOut& out = tx.vout[j];
+                if (out.scriptPubKey.IsUnspendable()) {
+                    continue;
+                }
+                ApplyCoinHash(m_muhash, COutPoint(tx.GetHashMalFix(), j), Coin(out, pindex->nHeight, tx.IsCoinBase()));
+                m_transaction_output_count++;
+                m_bogo_size += GetBogoSize(out.scriptPubKey);
+                ApplyAmount(m_total_amount, out, false);
+            }
+
+            if (tx.IsCoinBase()) {
+                continue;
+            }
+            const CTxUndo& tx_undo = block_undo.vtxundo.at(i - 1);
+            for (size_t j = 0; j < tx.vin.size(); ++j) {
+                const Coin& coin = tx_undo.vprevout.at(j);
+                RemoveCoinHash(m_muhash, tx.vin[j].prevout, coin);
+                m_transaction_output_count--;
+                m_bogo_size -= GetBogoSize(coin.out.scriptPubKey);
+                ApplyAmount(m_total_amount, coin.out, true);
+            }
+        }
+    }
+
+    DBVal value;
+    value.block_hash = pindex->GetBlockHash();
+    MuHash3072 muhash = m_muhash;
+    muhash.Finalize(value.muhash);
+    value.muhash_state = m_muhash;
+    value.transaction_output_count = m_transaction_output_count;
+    value.bogo_size = m_bogo_size;
+    value.total_amount = m_total_amount;
+    return m_db->WriteStats(pindex->nHeight, value);
+}
+
+bool CoinStatsIndex::Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip)
+{
+    // Every height up to new_tip still holds the record of the block on the active chain.
+    if (!LoadStats(new_tip)) {
+        return false;
+    }
+    return BaseIndex::Rewind(current_tip, new_tip);
+}
+
+BaseIndex::DB& CoinStatsIndex::GetDB() const { return *m_db; }
+
+bool CoinStatsIndex::LookUpStats(const CBlockIndex* pindex, CCoinsStats& stats) const
+{
+    DBVal value;
+    if (!m_db->ReadStats(pindex, value)) {
+        return false;
+    }
+
+    stats.nHeight = pindex->nHeight;
+    stats.hashBlock = value.block_hash;
+    stats.hashMuHash = value.muhash;
+    stats.nTransactionOutputs = value.transaction_output_count;
+    stats.nBogoSize = value.bogo_size;
+    stats.mTotalAmount = std::move(value.total_amount);
+    return true;
+}
@@ -0,0 +1,65 @@
+// Copyright (c) 2020-2021 The Bitcoin Core developers
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_COINSTATSINDEX_H
+#define BITCOIN_INDEX_COINSTATSINDEX_H
+
+#include <chain.h>
+#include <coinstats.h>
+#include <crypto/muhash.h>
+#include <index/base.h>
+
+static const bool DEFAULT_COINSTATSINDEX = false;
+
+/**
+ * CoinStatsIndex maintains the statistics of the UTXO set reported by
+ * gettxoutsetinfo for every block of the active chain: a MuHash of the set,
+ * the number of outputs, the bogosize and the total amount of each color.
+ * The statistics are updated from each block and its undo data, so they can
+ * be looked up at any height without scanning the coins database.
+ */
+class CoinStatsIndex final : public BaseIndex
+{
+protected:
+    class DB;
+
+private:
+    const std::unique_ptr<DB> m_db;
+
+    MuHash3072 m_muhash;
+    uint64_t m_transaction_output_count{0};
+    uint64_t m_bogo_size{0};
+    TxColoredCoinBalancesMap m_total_amount;
+
+    /// Reset the running statistics to those recorded for pindex, or to the empty set if pindex is null.
+    bool LoadStats(const CBlockIndex* pindex);
+
+protected:
+    bool Init() override;
+
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    bool Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip) override;
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "coinstatsindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit CoinStatsIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    // Destructor is declared because this class contains a unique_ptr to an incomplete type.
+    virtual ~CoinStatsIndex() override;
+
+    /// Look up the UTXO set statistics after pindex was connected. hashSerialized and
+    /// nTransactions are not available from the index; hashMuHash is set instead.
+    bool LookUpStats(const CBlockIndex* pindex, CCoinsStats& stats) const;
+};
+
+/// The global UTXO set statistics index, used by gettxoutsetinfo. May be null.
+extern std::unique_ptr<CoinStatsIndex> g_coin_stats_index;
+
+#endif // BITCOIN_INDEX_COINSTATSINDEX_H
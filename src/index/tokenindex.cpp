@@ -0,0 +1,362 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <limits>
+#include <map>
+
+#include <chainstate.h>
+#include <file_io.h>
+#include <hash.h>
+#include <index/tokenindex.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+/* The index database stores three kinds of entries for each token:
+ *
+ * - [DB_TOKEN, color] -> DBTokenInfo.
+ * - [DB_EVENT, color, ~height (BE), ~position in block (BE)] -> DBEvent for every transaction
+ *   changing the supply. The height and position are inverted so that the events are iterated
+ *   from the most recent, and the supply at a height is the first event found from it.
+ * - [DB_HOLDER, color, script hash] -> DBHolder for every script holding the token.
+ */
+constexpr char DB_TOKEN = 'i';
+constexpr char DB_EVENT = 'e';
+constexpr char DB_HOLDER = 'h';
+
+std::unique_ptr<TokenIndex> g_token_index;
+
+namespace {
+
+struct DBTokenInfo {
+    uint256 issuance_txid;
+    int issuance_height;
+    CAmount supply;
+    uint64_t holder_count;
+    uint64_t event_count;
+
+    DBTokenInfo() : issuance_height(0), supply(0), holder_count(0), event_count(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(issuance_txid);
+        READWRITE(issuance_height);
+        READWRITE(supply);
+        READWRITE(holder_count);
+        READWRITE(event_count);
+    }
+};
+
+struct DBEventKey {
+    ColorIdentifier color;
+    int height;
+    uint32_t position;
+
+    DBEventKey() : height(0), position(0) {}
+    DBEventKey(const ColorIdentifier& color_in, int height_in, uint32_t position_in)
+        : color(color_in), height(height_in), position(position_in) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, DB_EVENT);
+        s << color;
+        ser_writedata32be(s, ~static_cast<uint32_t>(height));
+        ser_writedata32be(s, ~position);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        char prefix = ser_readdata8(s);
+        if (prefix != DB_EVENT) {
+            throw std::ios_base::failure("Invalid format for token index DB event key");
+        }
+        s >> color;
+        height = static_cast<int>(~ser_readdata32be(s));
+        position = ~ser_readdata32be(s);
+    }
+};
+
+struct DBEvent {
+    uint256 txid;
+    CAmount delta;
+    CAmount supply;
+
+    DBEvent() : delta(0), supply(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(delta);
+        READWRITE(supply);
+    }
+};
+
+struct DBHolder {
+    CScript script;
+    CAmount amount;
+
+    DBHolder() : amount(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(script);
+        READWRITE(amount);
+    }
+};
+
+using HolderKey = std::pair<ColorIdentifier, uint256>;
+
+std::pair<char, ColorIdentifier> DBTokenKey(const ColorIdentifier& color) { return std::make_pair(DB_TOKEN, color); }
+
+std::pair<char, HolderKey> DBHolderKey(const HolderKey& key) { return std::make_pair(DB_HOLDER, key); }
+
+} // namespace
+
+/**
+ * Access to the token index database (indexes/tokenindex/)
+ */
+class TokenIndex::DB : public BaseIndex::DB
+{
+public:
+    explicit DB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+};
+
+TokenIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "tokenindex", n_cache_size, f_memory, f_wipe)
+{}
+
+TokenIndex::TokenIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<TokenIndex::DB>(n_cache_size, f_memory, f_wipe))
+{}
+
+TokenIndex::~TokenIndex() {}
+
+bool TokenIndex::UpdateBlock(const CBlock& block, const CBlockIndex* pindex, bool undo)
+{
+    // The outputs of the genesis block are not added to the UTXO set.
+    if (pindex->nHeight == 0) {
+        return true;
+    }
+
+    CBlockUndo block_undo;
+    if (!UndoReadFromDisk(block_undo, pindex)) {
+        return error("%s: cannot read the undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    // Tokens and holders touched by this block, read once and written back at the end.
+    std::map<ColorIdentifier, DBTokenInfo> infos;
+    std::map<HolderKey, DBHolder> holders;
+    auto get_info = [&](const ColorIdentifier& color) -> DBTokenInfo& {
+        auto it = infos.find(color);
+        if (it == infos.end()) {
+            DBTokenInfo value;
+            m_db->Read(DBTokenKey(color), value);
+            it = infos.emplace(color, value).first;
+        }
+        return it->second;
+    };
+    auto update_holder = [&](const ColorIdentifier& color, const CScript& script, CAmount amount) {
+        const HolderKey key(color, Hash(script.begin(), script.end()));
+        auto it = holders.find(key);
+        if (it == holders.end()) {
+            DBHolder value;
+            if (!m_db->Read(DBHolderKey(key), value)) {
+                value.script = script;
+            }
+            it = holders.emplace(key, value).first;
+        }
+        DBHolder& holder = it->second;
+        const bool held = holder.amount > 0;
+        holder.amount += undo ? -amount : amount;
+        if (!held && holder.amount > 0) {
+            get_info(color).holder_count++;
+        } else if (held && holder.amount <= 0) {
+            get_info(color).holder_count--;
+        }
+    };
+
+    CDBBatch batch(*m_db);
+    for (size_t i = 0; i < block.vtx.size(); ++i) {
+        const CTransaction& tx = *block.vtx[i];
+
+        // The change of the supply of each token in this transaction.
+        TxColoredCoinBalancesMap deltas;
+        for (const CTxOut& out : tx.vout) {
+            const ColorIdentifier color = GetColorIdFromScript(out.scriptPubKey);
+            if (color.type == TokenTypes::NONE) continue;
+            deltas[color] += out.nValue;
+            update_holder(color, out.scriptPubKey, out.nValue);
+        }
+        if (!tx.IsCoinBase()) {
+            for (const Coin& coin : block_undo.vtxundo.at(i - 1).vprevout) {
+                const ColorIdentifier color = GetColorIdFromScript(coin.out.scriptPubKey);
+                if (color.type == TokenTypes::NONE) continue;
+                deltas[color] -= coin.out.nValue;
+                update_holder(color, coin.out.scriptPubKey, -coin.out.nValue);
+            }
+        }
+
+        for (const auto& entry : deltas) {
+            if (entry.second == 0) continue;
+            const DBEventKey key(entry.first, pindex->nHeight, i);
+            DBTokenInfo& info = get_info(entry.first);
+            if (undo) {
+                info.supply -= entry.second;
+                info.event_count--;
+                batch.Erase(key);
+                continue;
+            }
+            if (info.event_count == 0) {
+                info.issuance_txid = tx.GetHashMalFix();
+                info.issuance_height = pindex->nHeight;
+            }
+            info.supply += entry.second;
+            info.event_count++;
+
+            DBEvent event;
+            event.txid = tx.GetHashMalFix();
+            event.delta = entry.second;
+            event.supply = info.supply;
+            batch.Write(key, event);
+        }
+    }
+
+    for (const auto& entry : holders) {
+        if (entry.second.amount <= 0) {
+            batch.Erase(DBHolderKey(entry.first));
+        } else {
+            batch.Write(DBHolderKey(entry.first), entry.second);
+        }
+    }
+    for (const auto& entry : infos) {
+        if (entry.second.event_count == 0) {
+            batch.Erase(DBTokenKey(entry.first));
+        } else {
+            batch.Write(DBTokenKey(entry.first), entry.second);
+        }
+    }
+    return m_db->WriteBatch(batch);
+}
+
+bool TokenIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    return UpdateBlock(block, pindex, false);
+}
+
+bool TokenIndex::Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip)
+{
+    assert(current_tip->GetAncestor(new_tip->nHeight) == new_tip);
+
+    for (const CBlockIndex* pindex = current_tip; pindex != new_tip; pindex = pindex->pprev) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex)) {
+            return error("%s: cannot read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+        }
+        if (!UpdateBlock(block, pindex, true)) {
+            return false;
+        }
+    }
+    return BaseIndex::Rewind(current_tip, new_tip);
+}
+
+BaseIndex::DB& TokenIndex::GetDB() const { return *m_db; }
+
+bool TokenIndex::LookupToken(const ColorIdentifier& color, TokenInfo& info) const
+{
+    DBTokenInfo value;
+    if (!m_db->Read(DBTokenKey(color), value)) {
+        return false;
+    }
+    info.issuance_txid = value.issuance_txid;
+    info.issuance_height = value.issuance_height;
+    info.supply = value.supply;
+    info.holder_count = value.holder_count;
+    info.event_count = value.event_count;
+    return true;
+}
+
+bool TokenIndex::LookupSupply(const ColorIdentifier& color, int height, CAmount& supply) const
+{
+    // The last event of the block at height sorts first, followed by the earlier events.
+    std::unique_ptr<CDBIterator> db_it(m_db->NewIterator());
+    db_it->Seek(DBEventKey(color, height, std::numeric_limits<uint32_t>::max()));
+
+    DBEventKey key;
+    if (!db_it->Valid() || !db_it->GetKey(key) || key.color != color) {
+        // The token was not issued yet at height.
+        supply = 0;
+        return true;
+    }
+
+    DBEvent event;
+    if (!db_it->GetValue(event)) {
+        return error("%s: cannot read an event of token %s", __func__, color.toHexString());
+    }
+    supply = event.supply;
+    return true;
+}
+
+bool TokenIndex::LookupEvents(const ColorIdentifier& color, size_t skip, size_t count,
+                              std::vector<TokenEvent>& events) const
+{
+    std::unique_ptr<CDBIterator> db_it(m_db->NewIterator());
+    db_it->Seek(std::make_pair(DB_EVENT, color));
+
+    for (; db_it->Valid() && events.size() < count; db_it->Next()) {
+        DBEventKey key;
+        if (!db_it->GetKey(key) || key.color != color) break;
+
+        if (skip > 0) {
+            --skip;
+            continue;
+        }
+
+        DBEvent value;
+        if (!db_it->GetValue(value)) {
+            return error("%s: cannot read an event of token %s", __func__, color.toHexString());
+        }
+        TokenEvent event;
+        event.txid = value.txid;
+        event.height = key.height;
+        event.delta = value.delta;
+        event.supply = value.supply;
+        events.push_back(event);
+    }
+    return true;
+}
+
+bool TokenIndex::LookupHolders(const ColorIdentifier& color, size_t skip, size_t count,
+                               std::vector<TokenHolder>& holders) const
+{
+    std::unique_ptr<CDBIterator> db_it(m_db->NewIterator());
+    db_it->Seek(std::make_pair(DB_HOLDER, color));
+
+    for (; db_it->Valid() && holders.size() < count; db_it->Next()) {
+        std::pair<char, HolderKey> key;
+        if (!db_it->GetKey(key) || key.first != DB_HOLDER || key.second.first != color) break;
+
+        if (skip > 0) {
+            --skip;
+            continue;
+        }
+
+        DBHolder value;
+        if (!db_it->GetValue(value)) {
+            return error("%s: cannot read a holder of token %s", __func__, color.toHexString());
+        }
+        TokenHolder holder;
+        holder.script = std::move(value.script);
+        holder.amount = value.amount;
+        holders.push_back(std::move(holder));
+    }
+    return true;
+}
@@ -0,0 +1,106 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_TOKENINDEX_H
+#define BITCOIN_INDEX_TOKENINDEX_H
+
+#include <amount.h>
+#include <chain.h>
+#include <coloridentifier.h>
+#include <index/base.h>
+#include <script/script.h>
+#include <uint256.h>
+
+#include <vector>
+
+static const bool DEFAULT_TOKENINDEX = false;
+
+/** Issuance and current supply of a token. */
+struct TokenInfo
+{
+    //! The transaction that first issued the token and its height
+    uint256 issuance_txid;
+    int issuance_height{0};
+    CAmount supply{0};
+    //! The number of scripts holding a positive amount of the token
+    uint64_t holder_count{0};
+    //! The number of mint and burn events
+    uint64_t event_count{0};
+};
+
+/** A transaction changing the supply of a token. */
+struct TokenEvent
+{
+    uint256 txid;
+    int height{0};
+    //! Positive for a mint, negative for a burn
+    CAmount delta{0};
+    //! The supply after the transaction
+    CAmount supply{0};
+};
+
+/** A script holding a token. */
+struct TokenHolder
+{
+    CScript script;
+    CAmount amount{0};
+};
+
+/**
+ * TokenIndex records, for every token issued on the active chain, the transaction that
+ * issued it, each transaction that minted or burnt it, and the scripts holding it. The
+ * supply at any height, the number of holders and the owner of an NFT are answered from
+ * the index instead of a scan of the UTXO set.
+ *
+ * CIssuedColorIds remains the consensus record of issued NON_REISSUABLE and NFT tokens;
+ * this index is only used to answer queries.
+ */
+class TokenIndex final : public BaseIndex
+{
+protected:
+    class DB;
+
+private:
+    const std::unique_ptr<DB> m_db;
+
+    /// Write the entries of a block, or remove them if undo is set.
+    bool UpdateBlock(const CBlock& block, const CBlockIndex* pindex, bool undo);
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    bool Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip) override;
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "tokenindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit TokenIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    // Destructor is declared because this class contains a unique_ptr to an incomplete type.
+    virtual ~TokenIndex() override;
+
+    /// Look up the issuance and the current supply of a token. Returns false if it was never issued.
+    bool LookupToken(const ColorIdentifier& color, TokenInfo& info) const;
+
+    /// Look up the supply of a token after the block at the given height was connected.
+    bool LookupSupply(const ColorIdentifier& color, int height, CAmount& supply) const;
+
+    /// Look up the mint and burn events of a token, most recent first, skipping the first
+    /// skip events and returning at most count.
+    bool LookupEvents(const ColorIdentifier& color, size_t skip, size_t count,
+                      std::vector<TokenEvent>& events) const;
+
+    /// Look up the scripts holding a token, skipping the first skip holders and returning at
+    /// most count. The only holder of an NFT is its owner.
+    bool LookupHolders(const ColorIdentifier& color, size_t skip, size_t count,
+                       std::vector<TokenHolder>& holders) const;
+};
+
+/// The global token index, used by the token RPCs. May be null.
+extern std::unique_ptr<TokenIndex> g_token_index;
+
+#endif // BITCOIN_INDEX_TOKENINDEX_H
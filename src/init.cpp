@@ -10,6 +10,8 @@
 
 #include <addrman.h>
 #include <amount.h>
+#include <backgroundchainstate.h>
+#include <blockindexsnapshot.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
@@ -17,6 +19,10 @@
 #include <fs.h>
 #include <httpserver.h>
 #include <httprpc.h>
+#include <index/addressindex.h>
+#include <index/blockfilterindex.h>
+#include <index/coinstatsindex.h>
+#include <index/tokenindex.h>
 #include <index/txindex.h>
 #include <key.h>
 #include <validation.h>
@@ -41,6 +47,7 @@
 #include <ui_interface.h>
 #include <util.h>
 #include <utilmoneystr.h>
+#include <utxo_snapshot.h>
 #include <validationinterface.h>
 #include <warnings.h>
 #include <walletinitinterface.h>
@@ -76,6 +83,7 @@ static const bool DEFAULT_STOPAFTERBLOCKIMPORT = false;
 
 std::unique_ptr<CConnman> g_connman;
 std::unique_ptr<PeerLogicValidation> peerLogic;
+static std::set<BlockFilterType> g_enabled_filter_types;
 
 #if !defined(ENABLE_WALLET) || !(ENABLE_WALLET)
 class DummyWalletInit : public WalletInitInterface {
@@ -140,32 +148,6 @@ static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
 // shutdown thing.
 //
 
-/**
- * This is a minimally invasive approach to shutdown on LevelDB read errors from the
- * chainstate, while keeping user interface out of the common library, which is shared
- * between tapyrusd, and tapyrus-qt and non-server tools.
-*/
-class CCoinsViewErrorCatcher final : public CCoinsViewBacked
-{
-public:
-    explicit CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override {
-        try {
-            return CCoinsViewBacked::GetCoin(outpoint, coin);
-        } catch(const std::runtime_error& e) {
-            uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
-            LogPrintf("Error reading from database: %s\n", e.what());
-            // Starting the shutdown sequence and returning false to the caller would be
-            // interpreted as 'entry not found' (as opposed to unable to read data), and
-            // could lead to invalid interpretation. Just exit immediately, as we can't
-            // continue anyway, and all writes should be atomic.
-            abort();
-        }
-    }
-    // Writes do not need similar protection, as failure to write is handled by the caller.
-};
-
-static std::unique_ptr<CCoinsViewErrorCatcher> pcoinscatcher;
 static std::unique_ptr<ECCVerifyHandle> globalVerifyHandle;
 
 static CScheduler scheduler;
@@ -183,6 +165,19 @@ void Interrupt()
     if (g_txindex) {
         g_txindex->Interrupt();
     }
+    if (g_coin_stats_index) {
+        g_coin_stats_index->Interrupt();
+    }
+    if (g_address_index) {
+        g_address_index->Interrupt();
+    }
+    if (g_token_index) {
+        g_token_index->Interrupt();
+    }
+    ForEachBlockFilterIndex([](BlockFilterIndex& index) { index.Interrupt(); });
+    if (g_background_chainstate) {
+        g_background_chainstate->Interrupt();
+    }
 }
 
 void Shutdown()
@@ -210,8 +205,14 @@ void Shutdown()
     // Because these depend on each-other, we make sure that neither can be
     // using the other before destroying them.
     if (peerLogic) UnregisterValidationInterface(peerLogic.get());
+    if (g_block_template_builder) UnregisterValidationInterface(g_block_template_builder.get());
     if (g_connman) g_connman->Stop();
     if (g_txindex) g_txindex->Stop();
+    if (g_coin_stats_index) g_coin_stats_index->Stop();
+    if (g_address_index) g_address_index->Stop();
+    if (g_token_index) g_token_index->Stop();
+    ForEachBlockFilterIndex([](BlockFilterIndex& index) { index.Stop(); });
+    if (g_background_chainstate) g_background_chainstate->Stop();
 
     StopTorControl();
 
@@ -222,8 +223,14 @@ void Shutdown()
     // After the threads that potentially access these pointers have been stopped,
     // destruct and reset all to nullptr.
     peerLogic.reset();
+    g_block_template_builder.reset();
     g_connman.reset();
     g_txindex.reset();
+    g_coin_stats_index.reset();
+    g_address_index.reset();
+    g_token_index.reset();
+    DestroyAllBlockFilterIndexes();
+    g_background_chainstate.reset();
 
     if (g_is_mempool_loaded && gArgs.GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         DumpMempool();
@@ -260,7 +267,11 @@ void Shutdown()
         LOCK(cs_main);
         if (pcoinsTip != nullptr) {
             FlushStateToDisk();
+            if (fBlockIndexSnapshot && pblocktree) {
+                WriteBlockIndexSnapshot(*pblocktree, GetBlockIndexSnapshotPath());
+            }
         }
+        g_chainstate.ResetCoinsPrefetch();
         pcoinsTip.reset();
         pcoinscatcher.reset();
         pcoinsdbview.reset();
@@ -356,12 +367,19 @@ void SetupServerArgs()
     gArgs.AddArg("-?", "Print this help message and exit", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-version", "Print version and exit", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-networkid=<id>", "Network Identifier, an unsigned number representing this tapyrus network. The range is from 1 to 4294967295.", false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-addressindex", strprintf("Maintain an index of the outputs, unspent outputs and balances of each address and token, used by the getaddress* rpc calls (default: %u)", DEFAULT_ADDRESSINDEX), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-alertnotify=<cmd>", "Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-assumevalid=<hex>", "If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: 0)", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blocksdir=<dir>", "Specify blocks directory (default: <datadir>/blocks)", false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-blockfilterindex=<type>",
+                 strprintf("Maintain an index of compact filters by block (default: %s, values: %s).", DEFAULT_BLOCKFILTERINDEX, ListBlockFilterTypes()) +
+                 " If <type> is not supplied or if <type> = 1, indexes for all known types are enabled.",
+                 false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-blockindexsnapshot", strprintf("Write a snapshot of the block index at shutdown and read it at startup if it matches the block index database (default: %u)", DEFAULT_BLOCK_INDEX_SNAPSHOT), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blocknotify=<cmd>", "Execute command when the best block changes (%s in cmd is replaced by block hash)", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blockreconstructionextratxn=<n>", strprintf("Extra transactions to keep in memory for compact block reconstructions (default: %u)", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blocksonly", strprintf("Whether to operate in a blocks only mode (default: %u)", DEFAULT_BLOCKSONLY), true, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-coinstatsindex", strprintf("Maintain coinstats index used by the gettxoutsetinfo RPC (default: %u)", DEFAULT_COINSTATSINDEX), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-conf=<file>", strprintf("Specify configuration file. Relative paths will be prefixed by datadir location. (default: %s)", BITCOIN_CONF_FILENAME), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-datadir=<dir>", "Specify data directory", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize), true, OptionsCategory::OPTIONS);
@@ -370,7 +388,9 @@ void SetupServerArgs()
     gArgs.AddArg("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER), true, OptionsCategory::OPTIONS);
     gArgs.AddArg("-includeconf=<file>", "Specify additional configuration file, relative to the -datadir path (only useable from configuration file, not command line)", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-loadblock=<file>", "Imports blocks from external blk000??.dat file on startup", false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-loadsnapshot=<file>", "Load a UTXO set written by dumptxoutset on startup, once the header of its base block is known. Requires -snapshothash. Incompatible with -txindex, -coinstatsindex, -blockfilterindex, -addressindex and -tokenindex until the blocks below the snapshot are validated", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-maxmempool=<n>", strprintf("Keep the transaction memory pool below <n> megabytes (default: %u)", DEFAULT_MAX_MEMPOOL_SIZE), false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-maxmempooltokenshare=<n>", strprintf("When the transaction memory pool is full, evict the transactions of a token first while they use more than <n> percent of -maxmempool (0 to disable, default: %u)", DEFAULT_MEMPOOL_TOKEN_SHARE), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-maxorphantx=<n>", strprintf("Keep at most <n> unconnectable transactions in memory (default: %u)", DEFAULT_MAX_ORPHAN_TRANSACTIONS), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-mempoolexpiry=<n>", strprintf("Do not keep transactions in the mempool longer than <n> hours (default: %u)", DEFAULT_MEMPOOL_EXPIRY), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-par=<n>", strprintf("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)",
@@ -381,17 +401,23 @@ void SetupServerArgs()
 #else
     hidden_args.emplace_back("-pid");
 #endif
-    gArgs.AddArg("-prune=<n>", strprintf("Reduce storage requirements by enabling pruning (deleting) of old blocks. This allows the pruneblockchain RPC to be called to delete specific blocks, and enables automatic pruning of old blocks if a target size in MiB is provided. This mode is incompatible with -txindex and -rescan. "
+    gArgs.AddArg("-prefetchcoins=<n>", strprintf("Set the number of threads reading the coins spent by the next block while a block is connected (0 to %d, 0 = disabled, default: %d)",
+        MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS), false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-prune=<n>", strprintf("Reduce storage requirements by enabling pruning (deleting) of old blocks. This allows the pruneblockchain RPC to be called to delete specific blocks, and enables automatic pruning of old blocks if a target size in MiB is provided. This mode is incompatible with -txindex, -coinstatsindex, -blockfilterindex, -addressindex, -tokenindex and -rescan. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >=%u = automatically prune block files to stay under the specified target size in MiB)", MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-reindex", "Rebuild chain state and block index from the blk*.dat files on disk", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-reindex-chainstate", "Rebuild chain state from the currently indexed blocks", false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-reindexthreads=<n>", strprintf("With -reindex, find the blocks of the block files on <n> threads and accept them in chain order afterwards (0 to %d, 0 = read the block files one by one, default: %d)",
+        MAX_REINDEX_THREADS, DEFAULT_REINDEX_THREADS), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-reloadxfield", "Rebuild xfield change list in blocktree db from xfield in block headers from the blk*.dat files on disk", false, OptionsCategory::OPTIONS);
 #ifndef WIN32
     gArgs.AddArg("-sysperms", "Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)", false, OptionsCategory::OPTIONS);
 #else
     hidden_args.emplace_back("-sysperms");
 #endif
+    gArgs.AddArg("-snapshothash=<hash>", "Expected hash_serialized_3 of the UTXO set given with -loadsnapshot", false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-tokenindex", strprintf("Maintain an index of the issuance, supply history and holders of each token, used by the gettoken* rpc calls (default: %u)", DEFAULT_TOKENINDEX), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-txindex", strprintf("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)", DEFAULT_TXINDEX), false, OptionsCategory::OPTIONS);
 
     gArgs.AddArg("-addnode=<ip[:port]>", "Add a node to connect to and attempt to keep the connection open (see the `addnode` RPC command help for more info). Use [host]:port notation for IPv6 (e.g. [2001:db8::1]:8383). This option can be specified multiple times to add multiple nodes.", false, OptionsCategory::CONNECTION);
@@ -413,6 +439,8 @@ void SetupServerArgs()
     gArgs.AddArg("-maxuploadtarget=<n>", strprintf("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d)", DEFAULT_MAX_UPLOAD_TARGET), false, OptionsCategory::CONNECTION);
     gArgs.AddArg("-onion=<ip:port>", "Use separate SOCKS5 proxy to reach peers via Tor hidden services, set -noonion to disable (default: -proxy)", false, OptionsCategory::CONNECTION);
     gArgs.AddArg("-onlynet=<net>", "Make outgoing connections only through network <net> (ipv4, ipv6 or onion). Incoming connections are not affected by this option. This option can be specified multiple times to allow multiple networks.", false, OptionsCategory::CONNECTION);
+    gArgs.AddArg("-packagerelay", strprintf("Exchange the unconfirmed ancestors of transactions with peers as packages, so that children can pay for their parents (default: %u)", DEFAULT_PACKAGE_RELAY), false, OptionsCategory::CONNECTION);
+    gArgs.AddArg("-peerblockfilters", strprintf("Serve compact block filters to peers per BIP 157 (default: %u)", DEFAULT_PEERBLOCKFILTERS), false, OptionsCategory::CONNECTION);
     gArgs.AddArg("-peerbloomfilters", strprintf("Support filtering of blocks and transaction with bloom filters (default: %u)", DEFAULT_PEERBLOOMFILTERS), false, OptionsCategory::CONNECTION);
     gArgs.AddArg("-port=<port>", strprintf("Listen for connections on <port> (default: %u)", defaultChainParams->GetDefaultPort()), false, OptionsCategory::CONNECTION);
     gArgs.AddArg("-proxy=<ip:port>", "Connect through SOCKS5 proxy, set -noproxy to disable (default: disabled)", false, OptionsCategory::CONNECTION);
@@ -460,6 +488,7 @@ void SetupServerArgs()
     gArgs.AddArg("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT), true, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT), true, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT), true, OptionsCategory::DEBUG_TEST);
+    gArgs.AddArg("-limitclustercount=<n>", strprintf("Do not accept transactions if the cluster of connected in-mempool transactions would have more than <n> transactions (default: %u)", DEFAULT_CLUSTER_LIMIT), true, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT), true, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-addrmantest", "Allows to test address relay on localhost", true, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-debug=<category>", "Output debugging information (default: -nodebug, supplying <category> is optional). "
@@ -662,17 +691,25 @@ static void ThreadImport(std::vector<fs::path> vImportFiles, bool fReloadxfield)
         // To avoid ending up in a situation without genesis block, initialize it:
         LoadGenesisBlock();
 
-        int nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!fs::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(file, &pos, &tempXFieldHistory);
-            nFile++;
+        const int nReindexThreads = std::max(0, std::min<int>(gArgs.GetArg("-reindexthreads", DEFAULT_REINDEX_THREADS), MAX_REINDEX_THREADS));
+        if (nReindexThreads > 0) {
+            LogPrintf("Reindexing block files on %d threads...\n", nReindexThreads);
+            // Stopped by a shutdown or an error, the reindex continues at the next start.
+            if (!LoadBlockFiles(nReindexThreads, &tempXFieldHistory))
+                return;
+        } else {
+            int nFile = 0;
+            while (true) {
+                CDiskBlockPos pos(nFile, 0);
+                if (!fs::exists(GetBlockPosFilename(pos, "blk")))
+                    break; // No block files left to reindex
+                FILE *file = OpenBlockFile(pos, true);
+                if (!file)
+                    break; // This error is logged in OpenBlockFile
+                LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+                LoadExternalBlockFile(file, &pos, &tempXFieldHistory);
+                nFile++;
+            }
         }
         pblocktree->WriteReindexing(false);
         fReindex = false;
@@ -730,6 +767,19 @@ static void ThreadImport(std::vector<fs::path> vImportFiles, bool fReloadxfield)
         return;
     }
     } // End scope of CImportingNow
+
+    // -loadsnapshot=
+    if (gArgs.IsArgSet("-loadsnapshot")) {
+        const fs::path path = fs::absolute(GetDataDir() / gArgs.GetArg("-loadsnapshot", ""));
+        if (!LoadSnapshotOnStartup(path, uint256S(gArgs.GetArg("-snapshothash", "")))) {
+            if (!ShutdownRequested()) {
+                uiInterface.ThreadSafeMessageBox(strprintf(_("Failed to load UTXO snapshot %s. See debug.log for details."), path.string()), "", CClientUIInterface::MSG_ERROR);
+                StartShutdown();
+            }
+            return;
+        }
+    }
+
     if (gArgs.GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         LoadMempool();
     }
@@ -958,10 +1008,50 @@ bool AppInitParameterInteraction()
         return InitError(strprintf(_("Specified blocks directory \"%s\" does not exist."), gArgs.GetArg("-blocksdir", "").c_str()));
     }
 
+    // parse and validate enabled filter types
+    std::string blockfilterindex_value = gArgs.GetArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX);
+    if (blockfilterindex_value == "" || blockfilterindex_value == "1") {
+        g_enabled_filter_types = AllBlockFilterTypes();
+    } else if (blockfilterindex_value != "0") {
+        const std::vector<std::string> names = gArgs.GetArgs("-blockfilterindex");
+        for (const auto& name : names) {
+            BlockFilterType filter_type;
+            if (!BlockFilterTypeByName(name, filter_type)) {
+                return InitError(strprintf(_("Unknown -blockfilterindex value %s."), name));
+            }
+            g_enabled_filter_types.insert(filter_type);
+        }
+    }
+
     // if using block pruning, then disallow txindex
     if (gArgs.GetArg("-prune", 0)) {
         if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX))
+            return InitError(_("Prune mode is incompatible with -coinstatsindex."));
+        if (!g_enabled_filter_types.empty())
+            return InitError(_("Prune mode is incompatible with -blockfilterindex."));
+        if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+            return InitError(_("Prune mode is incompatible with -addressindex."));
+        if (gArgs.GetBoolArg("-tokenindex", DEFAULT_TOKENINDEX))
+            return InitError(_("Prune mode is incompatible with -tokenindex."));
+    }
+
+    if (gArgs.IsArgSet("-loadsnapshot")) {
+        if (!IsHex(gArgs.GetArg("-snapshothash", "")) || gArgs.GetArg("-snapshothash", "").size() != 64)
+            return InitError(_("-loadsnapshot requires a valid -snapshothash."));
+        if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX))
+            return InitError(_("-loadsnapshot is incompatible with -txindex."));
+        if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX))
+            return InitError(_("-loadsnapshot is incompatible with -coinstatsindex."));
+        if (!g_enabled_filter_types.empty())
+            return InitError(_("-loadsnapshot is incompatible with -blockfilterindex."));
+        if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+            return InitError(_("-loadsnapshot is incompatible with -addressindex."));
+        if (gArgs.GetBoolArg("-tokenindex", DEFAULT_TOKENINDEX))
+            return InitError(_("-loadsnapshot is incompatible with -tokenindex."));
+        if (gArgs.GetBoolArg("-reindex", false) || gArgs.GetBoolArg("-reindex-chainstate", false))
+            return InitError(_("-loadsnapshot is incompatible with -reindex and -reindex-chainstate."));
     }
 
     // -bind and -whitebind can't be set when not listening
@@ -1033,6 +1123,7 @@ bool AppInitParameterInteraction()
         mempool.setSanityCheck(1.0 / ratio);
     }
     fCheckBlockIndex = gArgs.GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    fBlockIndexSnapshot = gArgs.GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCK_INDEX_SNAPSHOT);
     fCheckpointsEnabled = gArgs.GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
     hashAssumeValid = uint256S(gArgs.GetArg("-assumevalid", ""));
@@ -1046,6 +1137,10 @@ bool AppInitParameterInteraction()
     int64_t nMempoolSizeMin = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000 * 40;
     if (nMempoolSizeMax < 0 || nMempoolSizeMax < nMempoolSizeMin)
         return InitError(strprintf(_("-maxmempool must be at least %d MB"), std::ceil(nMempoolSizeMin / 1000000.0)));
+    int64_t nTokenShare = gArgs.GetArg("-maxmempooltokenshare", DEFAULT_MEMPOOL_TOKEN_SHARE);
+    if (nTokenShare < 0 || nTokenShare > 100)
+        return InitError(_("-maxmempooltokenshare must be between 0 and 100"));
+    mempool.SetTokenShare(nTokenShare);
     // incremental relay fee sets the minimum feerate increase necessary for BIP 125 replacement in the mempool
     // and the amount the mempool min fee increases above the feerate of txs evicted due to mempool limiting.
     if (gArgs.IsArgSet("-incrementalrelayfee"))
@@ -1065,6 +1160,8 @@ bool AppInitParameterInteraction()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    nPrefetchThreads = std::max(0, std::min<int>(gArgs.GetArg("-prefetchcoins", DEFAULT_PREFETCH_THREADS), MAX_PREFETCH_THREADS));
+
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
     int64_t nPruneArg = gArgs.GetArg("-prune", 0);
     if (nPruneArg < 0) {
@@ -1151,6 +1248,18 @@ bool AppInitParameterInteraction()
     if (gArgs.GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices = ServiceFlags(nLocalServices | NODE_BLOOM);
 
+    // Signal NODE_COMPACT_FILTERS if peerblockfilters and basic filters index are both enabled.
+    if (gArgs.GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS)) {
+        if (g_enabled_filter_types.count(BlockFilterType::BASIC) != 1) {
+            return InitError(_("Cannot set -peerblockfilters without -blockfilterindex."));
+        }
+
+        nLocalServices = ServiceFlags(nLocalServices | NODE_COMPACT_FILTERS);
+    }
+
+    if (gArgs.GetBoolArg("-packagerelay", DEFAULT_PACKAGE_RELAY))
+        nLocalServices = ServiceFlags(nLocalServices | NODE_PACKAGE_RELAY);
+
     nMaxTipAge = gArgs.GetArg("-maxtipage", DEFAULT_MAX_TIP_AGE);
 
     fEnableReplacement = gArgs.GetBoolArg("-mempoolreplacement", DEFAULT_ENABLE_REPLACEMENT);
@@ -1331,6 +1440,9 @@ bool AppInitMain()
     peerLogic.reset(new PeerLogicValidation(&connman, scheduler));
     RegisterValidationInterface(peerLogic.get());
 
+    g_block_template_builder.reset(new BlockTemplateBuilder(scheduler));
+    RegisterValidationInterface(g_block_template_builder.get());
+
     // sanitize comments per BIP-0014, format user agent and check total size
     std::vector<std::string> uacomments;
     for (const std::string& cmt : gArgs.GetArgs("-uacomment")) {
@@ -1445,7 +1557,20 @@ bool AppInitMain()
     nTotalCache -= nBlockTreeDBCache;
     int64_t nTxIndexCache = std::min(nTotalCache / 8, gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxTxIndexCache << 20 : 0);
     nTotalCache -= nTxIndexCache;
-    int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
+    int64_t nCoinStatsIndexCache = std::min(nTotalCache / 8, gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX) ? nMaxCoinStatsIndexCache << 20 : 0);
+    nTotalCache -= nCoinStatsIndexCache;
+    int64_t nAddressIndexCache = std::min(nTotalCache / 8, gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX) ? nMaxAddressIndexCache << 20 : 0);
+    nTotalCache -= nAddressIndexCache;
+    int64_t nTokenIndexCache = std::min(nTotalCache / 8, gArgs.GetBoolArg("-tokenindex", DEFAULT_TOKENINDEX) ? nMaxTokenIndexCache << 20 : 0);
+    nTotalCache -= nTokenIndexCache;
+    int64_t filter_index_cache = 0;
+    if (!g_enabled_filter_types.empty()) {
+        size_t n_indexes = g_enabled_filter_types.size();
+        int64_t max_cache = std::min(nTotalCache / 8, max_filter_index_cache << 20);
+        filter_index_cache = max_cache / n_indexes;
+        nTotalCache -= filter_index_cache * n_indexes;
+    }
+    nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
@@ -1455,10 +1580,24 @@ bool AppInitMain()
     if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
         LogPrintf("* Using %.1fMiB for transaction index database\n", nTxIndexCache * (1.0 / 1024 / 1024));
     }
+    if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX)) {
+        LogPrintf("* Using %.1fMiB for coinstats index database\n", nCoinStatsIndexCache * (1.0 / 1024 / 1024));
+    }
+    if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+        LogPrintf("* Using %.1fMiB for address index database\n", nAddressIndexCache * (1.0 / 1024 / 1024));
+    }
+    if (gArgs.GetBoolArg("-tokenindex", DEFAULT_TOKENINDEX)) {
+        LogPrintf("* Using %.1fMiB for token index database\n", nTokenIndexCache * (1.0 / 1024 / 1024));
+    }
+    for (BlockFilterType filter_type : g_enabled_filter_types) {
+        LogPrintf("* Using %.1f MiB for %s block filter index database\n",
+                  filter_index_cache * (1.0 / 1024 / 1024), BlockFilterTypeName(filter_type));
+    }
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
+    bool use_snapshot = false;
     while (!fLoaded && !ShutdownRequested()) {
         bool fReset = fReindex || fReloadxfield;
         std::string strLoadError;
@@ -1526,7 +1665,17 @@ bool AppInitMain()
                 // At this point we're either in reindex or we've loaded a useful
                 // block tree into mapBlockIndex!
 
-                pcoinsdbview.reset(new CCoinsViewDB(nCoinDBCache, false, fReset || fReindexChainState));
+                // A chainstate loaded from a UTXO snapshot replaces the one built from blocks,
+                // which is kept to validate the blocks below the snapshot base in the background.
+                // Reindexing rebuilds from blocks, so the snapshot chainstate is dropped.
+                use_snapshot = false;
+                if (fReset || fReindexChainState) {
+                    RemoveSnapshotChainstate();
+                } else {
+                    use_snapshot = HaveSnapshotChainstate();
+                }
+                pcoinsdbview.reset(new CCoinsViewDB(use_snapshot ? nCoinDBCache / 2 : nCoinDBCache, false, fReset || fReindexChainState,
+                                                    use_snapshot ? SNAPSHOT_CHAINSTATE_DIR : DEFAULT_CHAINSTATE_DIR));
                 pcoinscatcher.reset(new CCoinsViewErrorCatcher(pcoinsdbview.get()));
 
                 // Create the colorId state before ReplayBlocks so that DisconnectBlock
@@ -1656,6 +1805,21 @@ bool AppInitMain()
         return false;
     }
 
+    // The blocks below the base of a snapshot chainstate are only on disk once background
+    // validation has connected them, and the indexes would read them from the start.
+    if (use_snapshot) {
+        if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX))
+            return InitError(_("-txindex cannot be used until the loaded UTXO snapshot is validated."));
+        if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX))
+            return InitError(_("-coinstatsindex cannot be used until the loaded UTXO snapshot is validated."));
+        if (!g_enabled_filter_types.empty())
+            return InitError(_("-blockfilterindex cannot be used until the loaded UTXO snapshot is validated."));
+        if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+            return InitError(_("-addressindex cannot be used until the loaded UTXO snapshot is validated."));
+        if (gArgs.GetBoolArg("-tokenindex", DEFAULT_TOKENINDEX))
+            return InitError(_("-tokenindex cannot be used until the loaded UTXO snapshot is validated."));
+    }
+
     fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fsbridge::fopen(est_path, "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1669,6 +1833,42 @@ bool AppInitMain()
         g_txindex->Start();
     }
 
+    if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX)) {
+        g_coin_stats_index = MakeUnique<CoinStatsIndex>(nCoinStatsIndexCache, false, fReindex);
+        g_coin_stats_index->Start();
+    }
+
+    if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+        g_address_index = MakeUnique<AddressIndex>(nAddressIndexCache, false, fReindex);
+        g_address_index->Start();
+    }
+
+    if (gArgs.GetBoolArg("-tokenindex", DEFAULT_TOKENINDEX)) {
+        g_token_index = MakeUnique<TokenIndex>(nTokenIndexCache, false, fReindex);
+        g_token_index->Start();
+    }
+
+    for (const auto& filter_type : g_enabled_filter_types) {
+        InitBlockFilterIndex(filter_type, filter_index_cache, false, fReindex);
+        GetBlockFilterIndex(filter_type)->Start();
+    }
+
+    if (use_snapshot) {
+        CBlockIndex* pindexSnapshotBase;
+        {
+            LOCK(cs_main);
+            pindexSnapshotBase = LookupBlockIndex(pcoinsdbview->GetSnapshotBase());
+        }
+        if (!pindexSnapshotBase) {
+            return InitError(_("The block index does not contain the base of the loaded UTXO snapshot. You will need to rebuild the database using -reindex-chainstate."));
+        }
+        g_background_chainstate = MakeUnique<CBackgroundChainstate>(
+            MakeUnique<CCoinsViewDB>(nCoinDBCache / 2, false, false, DEFAULT_CHAINSTATE_DIR), pindexSnapshotBase);
+        if (!g_background_chainstate->Start()) {
+            return InitError(_("Unable to start background validation of the UTXO snapshot. You will need to rebuild the database using -reindex-chainstate."));
+        }
+    }
+
     // ********************************************************* Step 9: load wallet
     if (!g_wallet_init_interface.Open()) return false;
 
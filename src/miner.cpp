@@ -19,6 +19,7 @@
 #include <policy/feerate.h>
 #include <policy/policy.h>
 #include <primitives/transaction.h>
+#include <scheduler.h>
 #include <script/standard.h>
 #include <util.h>
 #include <utilmoneystr.h>
@@ -30,8 +31,8 @@
 
 // Unconfirmed transactions in the memory pool often depend on other
 // transactions in the memory pool. When we select transactions from the
-// pool, we select by highest fee rate of a transaction combined with all
-// its ancestors.
+// pool, we select by highest fee rate of the chunks the mempool splits
+// the linearization of each cluster into.
 
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
@@ -50,11 +51,13 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
 BlockAssembler::Options::Options() {
     blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
     nBlockMaxSize = DEFAULT_BLOCK_MAX_SIZE;
+    fBackground = false;
 }
 
 BlockAssembler::BlockAssembler(const CChainParams& params, const Options& options) : chainparams(params)
 {
     blockMinFeeRate = options.blockMinFeeRate;
+    fBackground = options.fBackground;
     nBlockMaxSize = DEFAULT_BLOCK_MAX_SIZE;
     if (gArgs.IsArgSet("-blockmaxsize")) {
         nBlockMaxSize = gArgs.GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
@@ -132,13 +135,14 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     nLockTimeCutoff = nMedianTimePast;
 
     int nPackagesSelected = 0;
-    int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated, required_age_in_secs);
+    addPackageTxs(nPackagesSelected, required_age_in_secs);
 
     int64_t nTime1 = GetTimeMicros();
 
-    nLastBlockTx = nBlockTx;
-    nLastBlockSize = nBlockSize;
+    if (!fBackground) {
+        nLastBlockTx = nBlockTx;
+        nLastBlockSize = nBlockSize;
+    }
 
     // Create coinbase transaction.
     CMutableTransaction coinbaseTx;
@@ -152,7 +156,11 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
     pblocktemplate->vTxFees[0] = -nFees;
 
-    LogPrintf("CreateNewBlock(): block size: %u txs: %u fees: %ld sigops %d\n",  ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION), nBlockTx, nFees, nBlockSigOpsCost);
+    if (fBackground) {
+        LogPrint(BCLog::BENCH, "CreateNewBlock(): block size: %u txs: %u fees: %ld sigops %d\n",  ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION), nBlockTx, nFees, nBlockSigOpsCost);
+    } else {
+        LogPrintf("CreateNewBlock(): block size: %u txs: %u fees: %ld sigops %d\n",  ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION), nBlockTx, nFees, nBlockSigOpsCost);
+    }
 
     // Fill in header
     pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
@@ -166,22 +174,20 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     }
     int64_t nTime2 = GetTimeMicros();
 
-    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d chunks), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
 
     return std::move(pblocktemplate);
 }
 
-void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
+bool BlockAssembler::HaveParentsInBlock(const std::vector<CTxMemPool::txiter>& package) const
 {
-    for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
-        // Only test txs not already in the block
-        if (inBlock.count(*iit)) {
-            testSet.erase(iit++);
-        }
-        else {
-            iit++;
+    for (size_t i = 0; i < package.size(); ++i) {
+        for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(package[i])) {
+            if (!inBlock.count(parent) && std::find(package.begin(), package.begin() + i, parent) == package.begin() + i)
+                return false;
         }
     }
+    return true;
 }
 
 bool BlockAssembler::TestPackage(uint64_t packageSize, int32_t packageSigOpsCost) const
@@ -195,7 +201,7 @@ bool BlockAssembler::TestPackage(uint64_t packageSize, int32_t packageSigOpsCost
 
 // Perform transaction-level checks before adding to block:
 // - transaction finality (locktime)
-bool BlockAssembler::TestPackageTransactions(const CTxMemPool::setEntries& package)
+bool BlockAssembler::TestPackageTransactions(const std::vector<CTxMemPool::txiter>& package)
 {
     for (CTxMemPool::txiter it : package) {
         if (!IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff))
@@ -223,84 +229,21 @@ void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
     }
 }
 
-int BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
-        indexed_modified_transaction_set &mapModifiedTx)
-{
-    int nDescendantsUpdated = 0;
-    for (CTxMemPool::txiter it : alreadyAdded) {
-        CTxMemPool::setEntries descendants;
-        mempool.CalculateDescendants(it, descendants);
-        // Insert all descendants (not yet in block) into the modified set
-        for (CTxMemPool::txiter desc : descendants) {
-            if (alreadyAdded.count(desc))
-                continue;
-            ++nDescendantsUpdated;
-            modtxiter mit = mapModifiedTx.find(desc);
-            if (mit == mapModifiedTx.end()) {
-                CTxMemPoolModifiedEntry modEntry(desc);
-                modEntry.nSizeWithAncestors -= it->GetTxSize();
-                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
-                modEntry.nSigOpCostWithAncestors -= it->GetSigOpCost();
-                mapModifiedTx.insert(modEntry);
-            } else {
-                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
-            }
-        }
-    }
-    return nDescendantsUpdated;
-}
-
-// Skip entries in mapTx that are already in a block or are present
-// in mapModifiedTx (which implies that the mapTx ancestor state is
-// stale due to ancestor inclusion in the block)
-// Also skip transactions that we've already failed to add. This can happen if
-// we consider a transaction in mapModifiedTx and it fails: we can then
-// potentially consider it again while walking mapTx.  It's currently
-// guaranteed to fail again, but as a belt-and-suspenders check we put it in
-// failedTx and avoid re-evaluation, since the re-evaluation would be using
-// cached size/sigops/fee values that are not actually correct.
-bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx)
-{
-    assert (it != mempool.mapTx.end());
-    return mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it);
-}
-
-void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, std::vector<CTxMemPool::txiter>& sortedEntries)
-{
-    // Sort package by ancestor count
-    // If a transaction A depends on transaction B, then A's ancestor count
-    // must be greater than B's.  So this is sufficient to validly order the
-    // transactions for block inclusion.
-    sortedEntries.clear();
-    sortedEntries.insert(sortedEntries.begin(), package.begin(), package.end());
-    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
-}
-
-// This transaction selection algorithm orders the mempool based
-// on feerate of a transaction including all unconfirmed ancestors.
-// Since we don't remove transactions from the mempool as we select them
-// for block inclusion, we need an alternate method of updating the feerate
-// of a transaction with its not-yet-selected ancestors as we go.
-// This is accomplished by walking the in-mempool descendants of selected
-// transactions and storing a temporary modified state in mapModifiedTxs.
-// Each time through the loop, we compare the best transaction in
-// mapModifiedTxs with the next transaction in the mempool to decide what
-// transaction package to work on next.
-void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated, int required_age_in_secs)
+// This transaction selection algorithm takes the chunks of the mempool
+// clusters from the chunk_score index, highest feerate first. Within a
+// cluster the chunks have non-increasing feerates and come in the order of
+// the linearization, so every transaction follows its in-mempool parents.
+// Once a chunk of a cluster fails, the rest of that cluster is skipped too,
+// as its transactions may depend on the failed ones. A chunk skipped only for
+// being too recent does not fail its cluster: later chunks of the cluster are
+// still taken if they do not spend it.
+void BlockAssembler::addPackageTxs(int &nPackagesSelected, int required_age_in_secs)
 {
     int64_t current_time = GetTime();
-    // mapModifiedTx will store sorted packages after they are modified
-    // because some of their txs are already in the block
-    indexed_modified_transaction_set mapModifiedTx;
-    // Keep track of entries that failed inclusion, to avoid duplicate work
-    CTxMemPool::setEntries failedTx;
-
-    // Start by adding all descendants of previously added txs to mapModifiedTx
-    // and modifying them for their already included ancestors
-    UpdatePackagesForAdded(inBlock, mapModifiedTx);
-
-    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
-    CTxMemPool::txiter iter;
+    // Clusters with a chunk that failed inclusion
+    std::set<uint64_t> failedClusters;
+    // Clusters with a chunk that was skipped for being too recent
+    std::set<uint64_t> recentClusters;
 
     // Limit the number of attempts to add transactions to the block when it is
     // close to full; this is just a simple heuristic to finish quickly if the
@@ -308,72 +251,46 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
     int64_t nConsecutiveFailed = 0;
 
-    while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty())
+    const auto& chunkIndex = mempool.mapTx.get<chunk_score>();
+    auto mi = chunkIndex.begin();
+    while (mi != chunkIndex.end())
     {
-        // First try to find a new transaction in mapTx to evaluate.
-        if (mi != mempool.mapTx.get<ancestor_score>().end() &&
-                SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
-            ++mi;
-            continue;
+        // The transactions of a chunk are next to each other in the index.
+        const ClusterChunk chunk = mi->GetChunk();
+        const uint64_t nClusterId = mi->GetClusterId();
+        std::vector<CTxMemPool::txiter> package;
+        int32_t packageSigOpsCost = 0;
+        bool fTooRecent = false;
+        for (uint32_t i = 0; i < chunk.count && mi != chunkIndex.end(); ++i, ++mi) {
+            assert(mi->GetClusterId() == nClusterId);
+            package.push_back(mempool.mapTx.project<0>(mi));
+            packageSigOpsCost += mi->GetSigOpCost();
+            // Skip transactions that are under X seconds in mempool
+            if (required_age_in_secs && mi->GetTime() > current_time - required_age_in_secs) {
+                fTooRecent = true;
+            }
         }
 
-        // Now that mi is not stale, determine which transaction to evaluate:
-        // the next entry from mapTx, or the best from mapModifiedTx?
-        bool fUsingModified = false;
-
-        modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
-        if (mi == mempool.mapTx.get<ancestor_score>().end()) {
-            // We're out of entries in mapTx; use the entry from mapModifiedTx
-            iter = modit->iter;
-            fUsingModified = true;
-        } else {
-            // Try to compare the mapTx entry to the mapModifiedTx entry
-            iter = mempool.mapTx.project<0>(mi);
-            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
-                    CompareTxMemPoolEntryByAncestorFee()(*modit, CTxMemPoolModifiedEntry(iter))) {
-                // The best entry in mapModifiedTx has higher score
-                // than the one from mapTx.
-                // Switch which transaction (package) to consider
-                iter = modit->iter;
-                fUsingModified = true;
-            } else {
-                // Either no entry in mapModifiedTx, or it's worse than mapTx.
-                // Increment mi for the next loop iteration.
-                ++mi;
-            }
+        if (chunk.fee < blockMinFeeRate.GetFee(chunk.size)) {
+            // Everything else we might consider has a lower fee rate
+            return;
         }
 
-        // Skip transactions that are under X seconds in mempool
-        if (required_age_in_secs && iter->GetTime() > current_time - required_age_in_secs) {
+        if (failedClusters.count(nClusterId)) {
             continue;
         }
 
-        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
-        // contain anything that is inBlock.
-        assert(!inBlock.count(iter));
-
-        uint64_t packageSize = iter->GetSizeWithAncestors();
-        CAmount packageFees = iter->GetModFeesWithAncestors();
-        int32_t packageSigOpsCost = iter->GetSigOpCostWithAncestors();
-        if (fUsingModified) {
-            packageSize = modit->nSizeWithAncestors;
-            packageFees = modit->nModFeesWithAncestors;
-            packageSigOpsCost = modit->nSigOpCostWithAncestors;
+        if (fTooRecent) {
+            recentClusters.insert(nClusterId);
+            continue;
         }
 
-        if (packageFees < blockMinFeeRate.GetFee(packageSize)) {
-            // Everything else we might consider has a lower fee rate
-            return;
+        if (recentClusters.count(nClusterId) && !HaveParentsInBlock(package)) {
+            continue;
         }
 
-        if (!TestPackage(packageSize, packageSigOpsCost)) {
-            if (fUsingModified) {
-                // Since we always look at the best entry in mapModifiedTx,
-                // we must erase failed entries so that we can consider the
-                // next best entry on the next loop iteration
-                mapModifiedTx.get<ancestor_score>().erase(modit);
-                failedTx.insert(iter);
-            }
+        if (!TestPackage(chunk.size, packageSigOpsCost)) {
+            failedClusters.insert(nClusterId);
 
             ++nConsecutiveFailed;
 
@@ -385,41 +302,20 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
             continue;
         }
 
-        CTxMemPool::setEntries ancestors;
-        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
-        std::string dummy;
-        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
-
-        onlyUnconfirmed(ancestors);
-        ancestors.insert(iter);
-
         // Test if all tx's are Final
-        if (!TestPackageTransactions(ancestors)) {
-            if (fUsingModified) {
-                mapModifiedTx.get<ancestor_score>().erase(modit);
-                failedTx.insert(iter);
-            }
+        if (!TestPackageTransactions(package)) {
+            failedClusters.insert(nClusterId);
             continue;
         }
 
-        // This transaction will make it in; reset the failed counter.
+        // This chunk will make it in; reset the failed counter.
         nConsecutiveFailed = 0;
 
-        // Package can be added. Sort the entries in a valid order.
-        std::vector<CTxMemPool::txiter> sortedEntries;
-        SortForBlock(ancestors, sortedEntries);
-
-        for (size_t i=0; i<sortedEntries.
-        size(); ++i) {
-            AddToBlock(sortedEntries[i]);
-            // Erase from the modified set, if present
-            mapModifiedTx.erase(sortedEntries[i]);
+        for (CTxMemPool::txiter iter : package) {
+            AddToBlock(iter);
         }
 
         ++nPackagesSelected;
-
-        // Update transactions that depend on each of these
-        nDescendantsUpdated += UpdatePackagesForAdded(ancestors, mapModifiedTx);
     }
 }
 
@@ -442,3 +338,132 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
     pblock->hashImMerkleRoot = BlockMerkleRoot(*pblock, nullptr, true);
 }
+
+std::unique_ptr<BlockTemplateBuilder> g_block_template_builder;
+
+BlockTemplateBuilder::BlockTemplateBuilder(CScheduler& schedulerIn) : scheduler(schedulerIn),
+    m_transactions_updated(0), m_last_fees(0), m_active(false), m_rebuild_scheduled(false),
+    m_last_request(0), m_last_rebuild(0) {}
+
+std::shared_ptr<const CBlockTemplate> BlockTemplateBuilder::Build()
+{
+    // Read the counter first: a change during assembly only makes the template look older.
+    const unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    // The mining info is updated when the template is handed out.
+    BlockAssembler::Options options = DefaultOptions();
+    options.fBackground = true;
+    std::shared_ptr<const CBlockTemplate> tmpl = BlockAssembler(Params(), options).CreateNewBlock(CScript() << OP_TRUE);
+    if (!tmpl)
+        return nullptr;
+
+    LOCK(cs);
+    m_template = tmpl;
+    m_transactions_updated = nTransactionsUpdated;
+    return tmpl;
+}
+
+void BlockTemplateBuilder::ScheduleRebuild()
+{
+    LOCK(cs);
+    if (!m_active || m_rebuild_scheduled)
+        return;
+    if (GetTime() - m_last_request > BLOCK_TEMPLATE_IDLE_TIMEOUT) {
+        LogPrint(BCLog::BENCH, "BlockTemplateBuilder: no template requested for %ds, stopping background rebuilds\n", BLOCK_TEMPLATE_IDLE_TIMEOUT);
+        m_active = false;
+        m_template.reset();
+        return;
+    }
+    // Changes arriving in a burst are covered by a single rebuild.
+    m_rebuild_scheduled = true;
+    const int64_t nDelay = std::max(BLOCK_TEMPLATE_REBUILD_DELAY_MS, m_last_rebuild + BLOCK_TEMPLATE_MIN_REBUILD_INTERVAL_MS - GetTimeMillis());
+    scheduler.scheduleFromNow(std::bind(&BlockTemplateBuilder::Rebuild, this), nDelay);
+}
+
+void BlockTemplateBuilder::Rebuild()
+{
+    {
+        LOCK(cs);
+        m_rebuild_scheduled = false;
+        m_last_rebuild = GetTimeMillis();
+    }
+    int64_t nTimeStart = GetTimeMicros();
+    try {
+        std::shared_ptr<const CBlockTemplate> tmpl = Build();
+        if (tmpl) {
+            LogPrint(BCLog::BENCH, "BlockTemplateBuilder: rebuilt template on %s with %u txs, fees %d: %.2fms\n",
+                tmpl->block.hashPrevBlock.ToString(), tmpl->block.vtx.size() - 1, -tmpl->vTxFees[0], 0.001 * (GetTimeMicros() - nTimeStart));
+        }
+    } catch (const std::exception& e) {
+        // The template is built on the spot when it is requested next.
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+}
+
+void BlockTemplateBuilder::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    if (fInitialDownload)
+        return;
+    ScheduleRebuild();
+}
+
+void BlockTemplateBuilder::TransactionAddedToMempool(const CTransactionRef &ptxn)
+{
+    ScheduleRebuild();
+}
+
+void BlockTemplateBuilder::TransactionRemovedFromMempool(const CTransactionRef &ptx)
+{
+    ScheduleRebuild();
+}
+
+std::unique_ptr<CBlockTemplate> BlockTemplateBuilder::GetBlockTemplate(const CScript& scriptPubKeyIn, CAmount* pFeeDelta)
+{
+    LOCK(cs_main);
+    const CBlockIndex* pindexPrev = chainActive.Tip();
+    assert(pindexPrev != nullptr);
+    const unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+
+    std::shared_ptr<const CBlockTemplate> tmpl;
+    bool fCached = false;
+    {
+        LOCK(cs);
+        m_active = true;
+        m_last_request = GetTime();
+        if (m_template && m_template->block.hashPrevBlock == pindexPrev->GetBlockHash() &&
+            m_transactions_updated == nTransactionsUpdated) {
+            tmpl = m_template;
+            fCached = true;
+        }
+    }
+    // The background rebuild has not caught up yet.
+    if (!tmpl) {
+        tmpl = Build();
+        if (!tmpl)
+            return nullptr;
+    }
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate(*tmpl));
+    CBlock* pblock = &pblocktemplate->block;
+
+    CMutableTransaction coinbaseTx(*pblock->vtx[0]);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    pblocktemplate->vTxSigOpsCost[0] = GetLegacySigOpCount(*pblock->vtx[0]);
+    UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
+
+    // Same counters as CreateNewBlock reports for a block assembled on request.
+    nLastBlockTx = pblock->vtx.size() - 1;
+    nLastBlockSize = 1000;
+    for (size_t i = 1; i < pblock->vtx.size(); ++i) {
+        nLastBlockSize += ::GetSerializeSize(*pblock->vtx[i], SER_NETWORK, PROTOCOL_VERSION);
+    }
+
+    const CAmount nFees = -pblocktemplate->vTxFees[0];
+    LOCK(cs);
+    LogPrint(BCLog::BENCH, "BlockTemplateBuilder: %s template at height %d, fees %d (%+d)\n",
+        fCached ? "cached" : "new", pindexPrev->nHeight + 1, nFees, nFees - m_last_fees);
+    if (pFeeDelta)
+        *pFeeDelta = nFees - m_last_fees;
+    m_last_fees = nFees;
+    return pblocktemplate;
+}
@@ -8,21 +8,28 @@
 #define BITCOIN_MINER_H
 
 #include <primitives/block.h>
+#include <sync.h>
 #include <txmempool.h>
 #include <validation.h>
+#include <validationinterface.h>
 
 #include <stdint.h>
 #include <memory>
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/ordered_index.hpp>
 
 class CBlockIndex;
 class CChainParams;
+class CScheduler;
 class CScript;
 
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Time to wait after a change of the tip or the mempool before the cached block template is rebuilt */
+static const int64_t BLOCK_TEMPLATE_REBUILD_DELAY_MS = 100;
+/** Minimum time between two background rebuilds of the cached block template */
+static const int64_t BLOCK_TEMPLATE_MIN_REBUILD_INTERVAL_MS = 1000;
+/** Seconds without a template request after which the template is no longer rebuilt in the background */
+static const int64_t BLOCK_TEMPLATE_IDLE_TIMEOUT = 10 * 60;
 
 struct CBlockTemplate
 {
@@ -32,96 +39,6 @@ struct CBlockTemplate
     std::vector<unsigned char> vchCoinbaseCommitment;
 };
 
-// Container for tracking updates to ancestor feerate as we include (parent)
-// transactions in a block
-struct CTxMemPoolModifiedEntry {
-    explicit CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
-    {
-        iter = entry;
-        nSizeWithAncestors = entry->GetSizeWithAncestors();
-        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
-        nSigOpCostWithAncestors = entry->GetSigOpCostWithAncestors();
-    }
-
-    int64_t GetModifiedFee() const { return iter->GetModifiedFee(); }
-    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
-    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
-    size_t GetTxSize() const { return iter->GetTxSize(); }
-    const CTransaction& GetTx() const { return iter->GetTx(); }
-
-    CTxMemPool::txiter iter;
-    uint64_t nSizeWithAncestors;
-    CAmount nModFeesWithAncestors;
-    int32_t nSigOpCostWithAncestors;
-};
-
-/** Comparator for CTxMemPool::txiter objects.
- *  It simply compares the internal memory address of the CTxMemPoolEntry object
- *  pointed to. This means it has no meaning, and is only useful for using them
- *  as key in other indexes.
- */
-struct CompareCTxMemPoolIter {
-    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
-    {
-        return &(*a) < &(*b);
-    }
-};
-
-struct modifiedentry_iter {
-    typedef CTxMemPool::txiter result_type;
-    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
-    {
-        return entry.iter;
-    }
-};
-
-// A comparator that sorts transactions based on number of ancestors.
-// This is sufficient to sort an ancestor package in an order that is valid
-// to appear in a block.
-struct CompareTxIterByAncestorCount {
-    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
-    {
-        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
-            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
-        return CTxMemPool::CompareIteratorByHash()(a, b);
-    }
-};
-
-typedef boost::multi_index_container<
-    CTxMemPoolModifiedEntry,
-    boost::multi_index::indexed_by<
-        boost::multi_index::ordered_unique<
-            modifiedentry_iter,
-            CompareCTxMemPoolIter
-        >,
-        // sorted by modified ancestor fee rate
-        boost::multi_index::ordered_non_unique<
-            // Reuse same tag from CTxMemPool's similar index
-            boost::multi_index::tag<ancestor_score>,
-            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
-            CompareTxMemPoolEntryByAncestorFee
-        >
-    >
-> indexed_modified_transaction_set;
-
-typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
-typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
-
-struct update_for_parent_inclusion
-{
-    explicit update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
-
-    void operator() (CTxMemPoolModifiedEntry &e)
-    {
-        e.nModFeesWithAncestors -= iter->GetFee();
-        e.nSizeWithAncestors -= iter->GetTxSize();
-        e.nSigOpCostWithAncestors -= iter->GetSigOpCost();
-    }
-
-    CTxMemPool::txiter iter;
-};
-
-
 /** Generate a new block, without valid proof-of-work */
 class BlockAssembler
 {
@@ -134,6 +51,8 @@ private:
     // Configuration parameters for the block size
     unsigned int nBlockMaxSize;
     CFeeRate blockMinFeeRate;
+    // Whether the block is assembled in the background, not for a caller
+    bool fBackground;
 
     // Information on the current status of the block
     uint64_t nBlockSize;
@@ -152,6 +71,8 @@ public:
         Options();
         size_t nBlockMaxSize;
         CFeeRate blockMinFeeRate;
+        //! Log to the bench category only and leave the mining info alone
+        bool fBackground;
     };
 
     explicit BlockAssembler(const CChainParams& params);
@@ -168,32 +89,78 @@ private:
     void AddToBlock(CTxMemPool::txiter iter);
 
     // Methods for how to add transactions to a block.
-    /** Add transactions based on feerate including unconfirmed ancestors
-      * Increments nPackagesSelected / nDescendantsUpdated with corresponding
-      * statistics from the package selection (for logging statistics). */
-    void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated, int required_age_in_secs=0) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+    /** Add the chunks of the mempool clusters in the order of their feerate
+      * Increments nPackagesSelected with the number of chunks selected
+      * (for logging statistics). */
+    void addPackageTxs(int &nPackagesSelected, int required_age_in_secs=0) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
 
     // helper functions for addPackageTxs()
-    /** Remove confirmed (inBlock) entries from given set */
-    void onlyUnconfirmed(CTxMemPool::setEntries& testSet);
     /** Test if a new package would "fit" in the block */
     bool TestPackage(uint64_t packageSize, int32_t packageSigOpsCost) const;
     /** Perform checks on each transaction in a package:
       * locktime, serialized size (if necessary)
       * These checks should always succeed, and they're here
       * only as an extra check in case of suboptimal node configuration */
-    bool TestPackageTransactions(const CTxMemPool::setEntries& package);
-    /** Return true if given transaction from mapTx has already been evaluated,
-      * or if the transaction's cached data in mapTx is incorrect. */
-    bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
-    /** Sort the package in an order that is valid to appear in a block */
-    void SortForBlock(const CTxMemPool::setEntries& package, std::vector<CTxMemPool::txiter>& sortedEntries);
-    /** Add descendants of given transactions to mapModifiedTx with ancestor
-      * state updated assuming given transactions are inBlock. Returns number
-      * of updated descendants. */
-    int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+    bool TestPackageTransactions(const std::vector<CTxMemPool::txiter>& package);
+    /** Test if the in-mempool parents of each transaction are in the block or earlier in the package */
+    bool HaveParentsInBlock(const std::vector<CTxMemPool::txiter>& package) const EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
 };
 
+/**
+ * Keeps a block template on the current tip up to date in the background, so
+ * that getnewblock and getblocktemplate can hand out a copy instead of
+ * assembling a block from the whole mempool on every call.
+ *
+ * The builder stays idle until a template is requested. From then on every
+ * change of the tip or of the mempool schedules a rebuild on the scheduler
+ * thread, at most once per BLOCK_TEMPLATE_MIN_REBUILD_INTERVAL_MS, until no
+ * template was requested for BLOCK_TEMPLATE_IDLE_TIMEOUT. A cached template is
+ * only returned while it was built on the current tip from the current state
+ * of the mempool; otherwise the template is built on the spot, as before.
+ */
+class BlockTemplateBuilder final : public CValidationInterface
+{
+private:
+    CScheduler& scheduler;
+
+    mutable Mutex cs;
+    //! The latest template, with a placeholder coinbase output script
+    std::shared_ptr<const CBlockTemplate> m_template GUARDED_BY(cs);
+    //! mempool.GetTransactionsUpdated() before m_template was assembled
+    unsigned int m_transactions_updated GUARDED_BY(cs);
+    //! Transaction fees of the last template handed out
+    CAmount m_last_fees GUARDED_BY(cs);
+    //! Whether a template was requested within BLOCK_TEMPLATE_IDLE_TIMEOUT
+    bool m_active GUARDED_BY(cs);
+    bool m_rebuild_scheduled GUARDED_BY(cs);
+    //! Time of the last template request, in seconds
+    int64_t m_last_request GUARDED_BY(cs);
+    //! Time of the last background rebuild, in milliseconds
+    int64_t m_last_rebuild GUARDED_BY(cs);
+
+    /** Assemble a template on the current tip and cache it */
+    std::shared_ptr<const CBlockTemplate> Build();
+    void ScheduleRebuild();
+    void Rebuild();
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+    void TransactionAddedToMempool(const CTransactionRef &ptxn) override;
+    void TransactionRemovedFromMempool(const CTransactionRef &ptx) override;
+
+public:
+    explicit BlockTemplateBuilder(CScheduler& schedulerIn);
+
+    /**
+     * Return a template on the current tip with coinbase to scriptPubKeyIn.
+     * pFeeDelta is set to the change of the transaction fees against the
+     * template returned before.
+     */
+    std::unique_ptr<CBlockTemplate> GetBlockTemplate(const CScript& scriptPubKeyIn, CAmount* pFeeDelta = nullptr);
+};
+
+extern std::unique_ptr<BlockTemplateBuilder> g_block_template_builder;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
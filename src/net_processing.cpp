@@ -8,15 +8,18 @@
 
 #include <addrman.h>
 #include <arith_uint256.h>
+#include <backgroundchainstate.h>
 #include <blockencodings.h>
 #include <chainparams.h>
 #include <consensus/validation.h>
 #include <hash.h>
+#include <index/blockfilterindex.h>
 #include <validation.h>
 #include <merkleblock.h>
 #include <netmessagemaker.h>
 #include <netbase.h>
 #include <policy/fees.h>
+#include <policy/packages.h>
 #include <policy/policy.h>
 #include <primitives/block.h>
 #include <primitives/transaction.h>
@@ -77,6 +80,14 @@ static constexpr int STALE_RELAY_AGE_LIMIT = 30 * 24 * 60 * 60;
 /// Age after which a block is considered historical for purposes of rate
 /// limiting block relay. Set to one week, denominated in seconds.
 static constexpr int HISTORICAL_BLOCK_AGE = 7 * 24 * 60 * 60;
+/** Maximum number of compact filters that may be requested with one getcfilters. See BIP 157. */
+static constexpr uint32_t MAX_GETCFILTERS_SIZE = 1000;
+/** Maximum number of cf hashes that may be requested with one getcfheaders. See BIP 157. */
+static constexpr uint32_t MAX_GETCFHEADERS_SIZE = 2000;
+/** Maximum number of ancestor packages we ask a peer about at the same time. */
+static constexpr size_t MAX_ANCPKGINFO_IN_FLIGHT = 10;
+/** Time in seconds after which a package we requested with getpkgtxns is no longer waited for. */
+static constexpr int64_t PACKAGE_DOWNLOAD_TIMEOUT = 60;
 
 struct COrphanTx {
     // When modifying, adapt the copy of this definition in tests/DoS_tests.
@@ -303,6 +314,13 @@ struct CNodeState {
     /** Total number of addresses processed (excludes rate-limited ones). Guarded by cs_main. */
     uint64_t m_addr_processed{0};
 
+    //! Transactions whose ancestor package we asked this peer about with getancpkginfo
+    std::set<uint256> m_ancpkginfo_requested;
+    //! Transactions of the ancestor package we are downloading from this peer with getpkgtxns
+    std::vector<uint256> m_pkgtxns_requested;
+    //! When we sent the getpkgtxns request
+    int64_t m_pkgtxns_time{0};
+
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
         nMisbehavior = 0;
@@ -644,6 +662,42 @@ static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vec
     }
 }
 
+/** Add not-in-flight blocks below the snapshot base that background validation still needs to vBlocks,
+ *  until it has at most count entries. */
+static void FindNextHistoricalBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (vBlocks.size() >= count || !g_background_chainstate)
+        return;
+
+    const CBlockIndex* pindexBase = g_background_chainstate->GetSnapshotBase();
+    if (pindexBase == nullptr)
+        return;
+
+    CNodeState *state = State(nodeid);
+    assert(state != nullptr);
+    if (state->pindexBestKnownBlock == nullptr || state->pindexBestKnownBlock->GetAncestor(pindexBase->nHeight) != pindexBase) {
+        // This peer is not on the chain of the snapshot.
+        return;
+    }
+
+    const CBlockIndex* pindexTip = g_background_chainstate->GetTip();
+    const int nStartHeight = pindexTip ? pindexTip->nHeight + 1 : 0;
+    const int nWindowEnd = std::min<int>(pindexBase->nHeight, nStartHeight + BLOCK_DOWNLOAD_WINDOW);
+
+    std::vector<const CBlockIndex*> vToFetch;
+    for (const CBlockIndex* pindex = pindexBase->GetAncestor(nWindowEnd); pindex && pindex->nHeight >= nStartHeight; pindex = pindex->pprev) {
+        vToFetch.push_back(pindex);
+    }
+    for (auto it = vToFetch.rbegin(); it != vToFetch.rend(); ++it) {
+        const CBlockIndex* pindex = *it;
+        if (pindex->nStatus & BLOCK_HAVE_DATA || mapBlocksInFlight.count(pindex->GetBlockHash()))
+            continue;
+        vBlocks.push_back(pindex);
+        if (vBlocks.size() == count)
+            return;
+    }
+}
+
 } // namespace
 
 // This function is used for testing the stale tip eviction logic, see
@@ -1634,6 +1688,30 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
     return true;
 }
 
+/** Whether we and the peer both exchange ancestor packages */
+static bool PeerRelaysPackages(const CNode* pnode)
+{
+    return (pnode->GetLocalServices() & NODE_PACKAGE_RELAY) && (pnode->nServices & NODE_PACKAGE_RELAY);
+}
+
+/**
+ * Ask a peer for the unconfirmed ancestors of a transaction, when its parents
+ * were rejected alone, so that it can pay for them as a package.
+ */
+static void RequestAncestorPackage(CNode* pfrom, const uint256& txid, CConnman* connman) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    AssertLockHeld(cs_main);
+    if (!PeerRelaysPackages(pfrom))
+        return;
+
+    CNodeState* state = State(pfrom->GetId());
+    if (state->m_ancpkginfo_requested.size() >= MAX_ANCPKGINFO_IN_FLIGHT || !state->m_ancpkginfo_requested.insert(txid).second)
+        return;
+
+    LogPrint(BCLog::NET, "requesting ancestor package of %s from peer=%d\n", txid.ToString(), pfrom->GetId());
+    connman->PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::GETANCPKGINFO, txid));
+}
+
 void static ProcessOrphanTx(CConnman *connman, std::set<uint256>& orphan_work_set) EXCLUSIVE_LOCKS_REQUIRED(cs_main, g_cs_orphans)
 {
     AssertLockHeld(cs_main);
@@ -1693,6 +1771,217 @@ void static ProcessOrphanTx(CConnman *connman, std::set<uint256>& orphan_work_se
     }
 }
 
+/**
+ * Validation logic for compact filters request handling.
+ *
+ * May disconnect from the peer in the case of a bad request.
+ *
+ * @param[in]   pfrom           The peer that we received the request from
+ * @param[in]   chain_params    Chain parameters
+ * @param[in]   filter_type     The filter type the request is for. Must be basic filters.
+ * @param[in]   start_height    The start height for the request
+ * @param[in]   stop_hash       The stop_hash for the request
+ * @param[in]   max_height_diff The maximum number of items permitted to request, as specified in BIP 157
+ * @param[out]  stop_index      The CBlockIndex for the stop_hash block, if the request can be serviced.
+ * @param[out]  filter_index    The filter index, if the request can be serviced.
+ * @return                      True if the request can be serviced.
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, const CChainParams& chain_params,
+                                      BlockFilterType filter_type, uint32_t start_height,
+                                      const uint256& stop_hash, uint32_t max_height_diff,
+                                      const CBlockIndex*& stop_index,
+                                      BlockFilterIndex*& filter_index)
+{
+    const bool supported_filter_type =
+        (filter_type == BlockFilterType::BASIC &&
+         (pfrom->GetLocalServices() & NODE_COMPACT_FILTERS));
+    if (!supported_filter_type) {
+        LogPrint(BCLog::NET, "peer %d requested unsupported block filter type: %d\n",
+                 pfrom->GetId(), static_cast<uint8_t>(filter_type));
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        stop_index = LookupBlockIndex(stop_hash);
+
+        // Check that the stop block exists and the peer would be allowed to fetch it.
+        if (!stop_index || !BlockRequestAllowed(stop_index, chain_params.GetConsensus())) {
+            LogPrint(BCLog::NET, "peer %d requested invalid block hash: %s\n",
+                     pfrom->GetId(), stop_hash.ToString());
+            pfrom->fDisconnect = true;
+            return false;
+        }
+    }
+
+    uint32_t stop_height = stop_index->nHeight;
+    if (start_height > stop_height) {
+        LogPrint(BCLog::NET, "peer %d sent invalid getcfilters/getcfheaders with " /* Continued */
+                 "start height %d and stop height %d\n",
+                 pfrom->GetId(), start_height, stop_height);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    if (stop_height - start_height >= max_height_diff) {
+        LogPrint(BCLog::NET, "peer %d requested too many cfilters/cfheaders: %d / %d\n",
+                 pfrom->GetId(), stop_height - start_height + 1, max_height_diff);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    filter_index = GetBlockFilterIndex(filter_type);
+    if (!filter_index) {
+        LogPrint(BCLog::NET, "Filter index for supported type %s not found\n", BlockFilterTypeName(filter_type));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Handle a cfilters request.
+ *
+ * May disconnect from the peer in the case of a bad request.
+ *
+ * @param[in]   pfrom           The peer that we received the request from
+ * @param[in]   vRecv           The raw message received
+ * @param[in]   chain_params    Chain parameters
+ * @param[in]   connman         Pointer to the connection manager
+ */
+static void ProcessGetCFilters(CNode* pfrom, CDataStream& vRecv, const CChainParams& chain_params,
+                               CConnman* connman)
+{
+    uint8_t filter_type_ser;
+    uint32_t start_height;
+    uint256 stop_hash;
+
+    vRecv >> filter_type_ser >> start_height >> stop_hash;
+
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* stop_index;
+    BlockFilterIndex* filter_index;
+    if (!PrepareBlockFilterRequest(pfrom, chain_params, filter_type, start_height, stop_hash,
+                                   MAX_GETCFILTERS_SIZE, stop_index, filter_index)) {
+        return;
+    }
+
+    std::vector<BlockFilter> filters;
+    if (!filter_index->LookupFilterRange(start_height, stop_index, filters)) {
+        LogPrint(BCLog::NET, "Failed to find block filter in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(filter_type), start_height, stop_hash.ToString());
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    for (const auto& filter : filters) {
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::CFILTER, filter));
+    }
+}
+
+/**
+ * Handle a cfheaders request.
+ *
+ * May disconnect from the peer in the case of a bad request.
+ *
+ * @param[in]   pfrom           The peer that we received the request from
+ * @param[in]   vRecv           The raw message received
+ * @param[in]   chain_params    Chain parameters
+ * @param[in]   connman         Pointer to the connection manager
+ */
+static void ProcessGetCFHeaders(CNode* pfrom, CDataStream& vRecv, const CChainParams& chain_params,
+                                CConnman* connman)
+{
+    uint8_t filter_type_ser;
+    uint32_t start_height;
+    uint256 stop_hash;
+
+    vRecv >> filter_type_ser >> start_height >> stop_hash;
+
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* stop_index;
+    BlockFilterIndex* filter_index;
+    if (!PrepareBlockFilterRequest(pfrom, chain_params, filter_type, start_height, stop_hash,
+                                   MAX_GETCFHEADERS_SIZE, stop_index, filter_index)) {
+        return;
+    }
+
+    uint256 prev_header;
+    if (start_height > 0) {
+        const CBlockIndex* const prev_block =
+            stop_index->GetAncestor(static_cast<int>(start_height - 1));
+        if (!filter_index->LookupFilterHeader(prev_block, prev_header)) {
+            LogPrint(BCLog::NET, "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(filter_type), prev_block->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    std::vector<uint256> filter_hashes;
+    if (!filter_index->LookupFilterHashRange(start_height, stop_index, filter_hashes)) {
+        LogPrint(BCLog::NET, "Failed to find block filter hashes in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(filter_type), start_height, stop_hash.ToString());
+        return;
+    }
+
+    connman->PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::CFHEADERS,
+                                                                          filter_type_ser,
+                                                                          stop_index->GetBlockHash(),
+                                                                          prev_header,
+                                                                          filter_hashes));
+}
+
+/**
+ * Handle a getcfcheckpt request.
+ *
+ * May disconnect from the peer in the case of a bad request.
+ *
+ * @param[in]   pfrom           The peer that we received the request from
+ * @param[in]   vRecv           The raw message received
+ * @param[in]   chain_params    Chain parameters
+ * @param[in]   connman         Pointer to the connection manager
+ */
+static void ProcessGetCFCheckPt(CNode* pfrom, CDataStream& vRecv, const CChainParams& chain_params,
+                                CConnman* connman)
+{
+    uint8_t filter_type_ser;
+    uint256 stop_hash;
+
+    vRecv >> filter_type_ser >> stop_hash;
+
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* stop_index;
+    BlockFilterIndex* filter_index;
+    if (!PrepareBlockFilterRequest(pfrom, chain_params, filter_type, /*start_height=*/0, stop_hash,
+                                   /*max_height_diff=*/std::numeric_limits<uint32_t>::max(),
+                                   stop_index, filter_index)) {
+        return;
+    }
+
+    std::vector<uint256> headers(stop_index->nHeight / CFCHECKPT_INTERVAL);
+
+    // Populate headers.
+    const CBlockIndex* block_index = stop_index;
+    for (int i = headers.size() - 1; i >= 0; i--) {
+        int height = (i + 1) * CFCHECKPT_INTERVAL;
+        block_index = block_index->GetAncestor(height);
+
+        if (!filter_index->LookupFilterHeader(block_index, headers[i])) {
+            LogPrint(BCLog::NET, "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(filter_type), block_index->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    connman->PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::CFCHECKPT,
+                                                                          filter_type_ser,
+                                                                          stop_index->GetBlockHash(),
+                                                                          headers));
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->GetId());
@@ -2322,9 +2611,17 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         std::vector<CBlock> vHeaders;
         int nLimit = MAX_HEADERS_RESULTS;
         LogPrint(BCLog::NET, "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.IsNull() ? "end" : hashStop.ToString(), pfrom->GetId());
+        bool fMissingProof = false;
         for (; pindex; pindex = chainActive.Next(pindex))
         {
-            vHeaders.push_back(pindex->GetBlockHeader());
+            CBlockHeader header;
+            if (!GetBlockHeaderWithProof(pindex, header)) {
+                // A header without its proof is invalid to the peer, so only the
+                // headers before it are sent.
+                fMissingProof = true;
+                break;
+            }
+            vHeaders.push_back(header);
             if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
                 break;
         }
@@ -2340,7 +2637,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         // without the new block. By resetting the BestHeaderSent, we ensure we
         // will re-announce the new block via headers (or compact blocks again)
         // in the SendMessages logic.
-        nodestate->pindexBestHeaderSent = pindex ? pindex : chainActive.Tip();
+        if (fMissingProof)
+            nodestate->pindexBestHeaderSent = pindex->pprev;
+        else
+            nodestate->pindexBestHeaderSent = pindex ? pindex : chainActive.Tip();
         connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::HEADERS, vHeaders));
     }
 
@@ -2362,13 +2662,29 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         CInv inv(MSG_TX, tx.GetHashMalFix());
         pfrom->AddInventoryKnown(inv);
 
+        // Check the scripts before cs_main is taken, so that other threads can use it meanwhile
+        bool fAlreadyHave;
+        {
+            LOCK(cs_main);
+            fAlreadyHave = AlreadyHave(inv);
+        }
+        std::vector<CTxMempoolPreCheck> prechecks;
+        if (!fAlreadyHave)
+            PreCheckForMemPool({ptx}, prechecks);
+
         LOCK2(cs_main, g_cs_orphans);
 
         pfrom->setAskFor.erase(inv.hash);
         mapAlreadyAskedFor.erase(inv.hash);
 
+        // Another peer may have sent the transaction during the pre-check.
+        const bool fHaveNow = AlreadyHave(inv);
+        if (fHaveNow)
+            UncachePreCheckedCoins(prechecks);
+
         CTxMempoolAcceptanceOptions opt;
-        if (!AlreadyHave(inv) &&
+        opt.precheck = prechecks.empty() ? nullptr : &prechecks[0];
+        if (!fHaveNow &&
             AcceptToMemoryPool(ptx, opt)) {
             mempool.check(pcoinsTip.get());
             RelayTransaction(tx, connman);
@@ -2419,6 +2735,9 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 // We will continue to reject this tx since it has rejected
                 // parents so avoid re-requesting it from other peers.
                 recentRejects->insert(tx.GetHashMalFix());
+                // The parents may only have been rejected for their fee, which
+                // this tx can pay for when they are accepted as a package.
+                RequestAncestorPackage(pfrom, tx.GetHashMalFix(), connman);
             }
         } else {
             if (!opt.state.CorruptionPossible()) {
@@ -2429,6 +2748,18 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 }
             }
 
+            // Orphans waiting for this tx may pay for it as a package
+            if (opt.state.GetRejectCode() == REJECT_INSUFFICIENTFEE) {
+                for (unsigned int i = 0; i < tx.vout.size(); i++) {
+                    auto it_by_prev = mapOrphanTransactionsByPrev.find(COutPoint(inv.hash, i));
+                    if (it_by_prev != mapOrphanTransactionsByPrev.end()) {
+                        for (const auto& elem : it_by_prev->second) {
+                            RequestAncestorPackage(pfrom, elem->first, connman);
+                        }
+                    }
+                }
+            }
+
             if (pfrom->fWhitelisted && gArgs.GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
                 // Always relay transactions received from whitelisted peers, even
                 // if they were already in the mempool or rejected from it due
@@ -2465,6 +2796,202 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     }
 
 
+    else if (strCommand == NetMsgType::GETANCPKGINFO)
+    {
+        uint256 txid;
+        vRecv >> txid;
+
+        if (!(pfrom->GetLocalServices() & NODE_PACKAGE_RELAY)) {
+            LogPrint(BCLog::NET, "getancpkginfo sent in violation of protocol peer=%d\n", pfrom->GetId());
+            pfrom->fDisconnect = true;
+            return true;
+        }
+
+        const std::chrono::seconds now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch());
+        const std::chrono::seconds mempool_req = pfrom->fRelayTxes ? static_cast<std::chrono::seconds>(pfrom->timeLastMempoolReq.load())
+                                                                   : std::chrono::seconds::min();
+        std::vector<uint256> vPackage;
+        if (pfrom->fRelayTxes && FindTxForGetData(pfrom, txid, mempool_req, now)) {
+            LOCK(mempool.cs);
+            auto it = mempool.mapTx.find(txid);
+            if (it != mempool.mapTx.end()) {
+                CTxMemPool::setEntries setAncestors;
+                uint64_t noLimit = std::numeric_limits<uint64_t>::max();
+                std::string dummy;
+                mempool.CalculateMemPoolAncestors(*it, setAncestors, noLimit, noLimit, noLimit, noLimit, dummy, false);
+                if (setAncestors.size() < MAX_PACKAGE_COUNT) {
+                    // Parents have fewer ancestors than their children
+                    std::vector<CTxMemPool::txiter> vAncestors(setAncestors.begin(), setAncestors.end());
+                    std::sort(vAncestors.begin(), vAncestors.end(), [](const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) {
+                        return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+                    });
+                    for (const CTxMemPool::txiter& ancestor : vAncestors) {
+                        vPackage.push_back(ancestor->GetTx().GetHashMalFix());
+                    }
+                    vPackage.push_back(txid);
+                }
+            }
+        }
+
+        if (vPackage.empty()) {
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::NOTFOUND, std::vector<CInv>{CInv(MSG_TX, txid)}));
+            return true;
+        }
+
+        {
+            // Let the peer download the ancestors, which we may not have announced to it
+            LOCK(cs_main);
+            for (const uint256& hash : vPackage) {
+                State(pfrom->GetId())->m_recently_announced_invs.insert(hash);
+            }
+        }
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::ANCPKGINFO, vPackage));
+    }
+
+
+    else if (strCommand == NetMsgType::ANCPKGINFO)
+    {
+        std::vector<uint256> vPackage;
+        vRecv >> vPackage;
+
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        if (vPackage.empty() || !state->m_ancpkginfo_requested.erase(vPackage.back())) {
+            LogPrint(BCLog::NET, "unrequested ancpkginfo from peer=%d\n", pfrom->GetId());
+            return true;
+        }
+        if (vPackage.size() > MAX_PACKAGE_COUNT) {
+            Misbehaving(pfrom->GetId(), 10, strprintf("peer=%d sent an ancpkginfo of %u transactions", pfrom->GetId(), vPackage.size()));
+            return true;
+        }
+
+        // Download one package at a time from each peer
+        if (!state->m_pkgtxns_requested.empty() && state->m_pkgtxns_time + PACKAGE_DOWNLOAD_TIMEOUT > GetTime()) {
+            LogPrint(BCLog::NET, "not downloading ancestor package of %s from peer=%d, another one is in flight\n", vPackage.back().ToString(), pfrom->GetId());
+            return true;
+        }
+
+        // Ancestors of a transaction in the mempool are in the mempool as well,
+        // so the transactions which are left still form an ancestor package.
+        std::vector<uint256> vRequest;
+        for (const uint256& hash : vPackage) {
+            if (!mempool.exists(hash))
+                vRequest.push_back(hash);
+        }
+        if (vRequest.empty())
+            return true;
+
+        state->m_pkgtxns_requested = vRequest;
+        state->m_pkgtxns_time = GetTime();
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETPKGTXNS, vRequest));
+    }
+
+
+    else if (strCommand == NetMsgType::GETPKGTXNS)
+    {
+        std::vector<uint256> vRequest;
+        vRecv >> vRequest;
+
+        if (!(pfrom->GetLocalServices() & NODE_PACKAGE_RELAY)) {
+            LogPrint(BCLog::NET, "getpkgtxns sent in violation of protocol peer=%d\n", pfrom->GetId());
+            pfrom->fDisconnect = true;
+            return true;
+        }
+        if (vRequest.size() > MAX_PACKAGE_COUNT) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 10, strprintf("peer=%d requested a package of %u transactions", pfrom->GetId(), vRequest.size()));
+            return true;
+        }
+        if (!pfrom->fRelayTxes) {
+            // Ignore requests for transactions from blocks-only peers.
+            return true;
+        }
+
+        const std::chrono::seconds now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch());
+        const std::chrono::seconds mempool_req = static_cast<std::chrono::seconds>(pfrom->timeLastMempoolReq.load());
+        std::vector<CTransactionRef> vPackage;
+        std::vector<CInv> vNotFound;
+        for (const uint256& hash : vRequest) {
+            CTransactionRef tx = FindTxForGetData(pfrom, hash, mempool_req, now);
+            if (tx) {
+                vPackage.push_back(std::move(tx));
+            } else {
+                vNotFound.push_back(CInv(MSG_TX, hash));
+            }
+        }
+
+        if (!vNotFound.empty()) {
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::NOTFOUND, vNotFound));
+        } else {
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::PKGTXNS, vPackage));
+        }
+    }
+
+
+    else if (strCommand == NetMsgType::PKGTXNS)
+    {
+        std::vector<CTransactionRef> vPackage;
+        vRecv >> vPackage;
+
+        std::vector<uint256> vHashes;
+        for (const CTransactionRef& tx : vPackage) {
+            vHashes.push_back(tx->GetHashMalFix());
+        }
+
+        {
+            LOCK(cs_main);
+            CNodeState* state = State(pfrom->GetId());
+            if (vHashes.empty() || state->m_pkgtxns_requested != vHashes) {
+                LogPrint(BCLog::NET, "unrequested pkgtxns from peer=%d\n", pfrom->GetId());
+                return true;
+            }
+            state->m_pkgtxns_requested.clear();
+        }
+
+        for (const uint256& hash : vHashes) {
+            pfrom->AddInventoryKnown(CInv(MSG_TX, hash));
+        }
+
+        // Validate the package without holding cs_main, which it takes once itself
+        CValidationState state;
+        PackageValidationState results;
+        const bool fAccepted = AcceptAncestorPackage(vPackage, state, results);
+
+        LOCK2(cs_main, g_cs_orphans);
+        if (!fAccepted) {
+            LogPrint(BCLog::MEMPOOLREJ, "package with child %s from peer=%d was not accepted: %s\n", vHashes.back().ToString(),
+                pfrom->GetId(),
+                FormatStateMessage(state));
+            return true;
+        }
+
+        for (const CTransactionRef& ptx : vPackage) {
+            const CTransaction& tx = *ptx;
+            const uint256& hash = tx.GetHashMalFix();
+            RelayTransaction(tx, connman);
+            for (unsigned int i = 0; i < tx.vout.size(); i++) {
+                auto it_by_prev = mapOrphanTransactionsByPrev.find(COutPoint(hash, i));
+                if (it_by_prev != mapOrphanTransactionsByPrev.end()) {
+                    for (const auto& elem : it_by_prev->second) {
+                        pfrom->orphan_work_set.insert(elem->first);
+                    }
+                }
+            }
+            EraseOrphanTx(hash);
+        }
+        pfrom->nLastTXTime = GetTime();
+        mempool.check(pcoinsTip.get());
+
+        LogPrint(BCLog::MEMPOOL, "AcceptAncestorPackage: peer=%d: accepted %u txn with child %s (poolsz %u txn, %u kB)\n",
+            pfrom->GetId(), vPackage.size(),
+            vHashes.back().ToString(),
+            mempool.size(), mempool.DynamicMemoryUsage() / 1000);
+
+        // Recursively process any orphan transactions that depended on the package
+        ProcessOrphanTx(connman, pfrom->orphan_work_set);
+    }
+
+
     else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CBlockHeaderAndShortTxIDs cmpctblock;
@@ -3059,6 +3586,18 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         pfrom->fRelayTxes = true;
     }
 
+    else if (strCommand == NetMsgType::GETCFILTERS) {
+        ProcessGetCFilters(pfrom, vRecv, chainparams, connman);
+    }
+
+    else if (strCommand == NetMsgType::GETCFHEADERS) {
+        ProcessGetCFHeaders(pfrom, vRecv, chainparams, connman);
+    }
+
+    else if (strCommand == NetMsgType::GETCFCHECKPT) {
+        ProcessGetCFCheckPt(pfrom, vRecv, chainparams, connman);
+    }
+
     else if (strCommand == NetMsgType::FEEFILTER) {
         CAmount newFeeFilter = 0;
         vRecv >> newFeeFilter;
@@ -3072,8 +3611,21 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     }
 
     else if (strCommand == NetMsgType::NOTFOUND) {
-        // We do not care about the NOTFOUND message, but logging an Unknown Command
-        // message would be undesirable as we transmit it ourselves.
+        // We only care about the NOTFOUND message for package requests, but logging
+        // an Unknown Command message would be undesirable as we transmit it ourselves.
+        std::vector<CInv> vInv;
+        vRecv >> vInv;
+        if (vInv.size() <= MAX_INV_SZ) {
+            LOCK(cs_main);
+            CNodeState* state = State(pfrom->GetId());
+            for (const CInv& inv : vInv) {
+                if (inv.type != MSG_TX)
+                    continue;
+                state->m_ancpkginfo_requested.erase(inv.hash);
+                if (std::find(state->m_pkgtxns_requested.begin(), state->m_pkgtxns_requested.end(), inv.hash) != state->m_pkgtxns_requested.end())
+                    state->m_pkgtxns_requested.clear();
+            }
+        }
     }
 
     else {
@@ -3564,16 +4116,26 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
                         break;
                     }
                     pBestIndex = pindex;
+                    CBlockHeader header;
                     if (fFoundStartingHeader) {
                         // add this to the headers message
-                        vHeaders.push_back(pindex->GetBlockHeader());
+                        if (!GetBlockHeaderWithProof(pindex, header)) {
+                            fRevertToInv = true;
+                            break;
+                        }
+                        vHeaders.push_back(header);
                     } else if (PeerHasHeader(&state, pindex)) {
                         continue; // keep looking for the first new block
                     } else if (pindex->pprev == nullptr || PeerHasHeader(&state, pindex->pprev)) {
                         // Peer doesn't have this header but they do have the prior one.
                         // Start sending headers.
                         fFoundStartingHeader = true;
-                        vHeaders.push_back(pindex->GetBlockHeader());
+                        if (!GetBlockHeaderWithProof(pindex, header)) {
+                            // Announce by inv rather than with a header the peer would reject.
+                            fRevertToInv = true;
+                            break;
+                        }
+                        vHeaders.push_back(header);
                     } else {
                         // Peer doesn't have this header or the prior one -- nothing will
                         // connect, so bail out.
@@ -3866,6 +4428,10 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
             FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.vBlocksInFlight.size(), vToDownload, staller, consensusParams);
+            if (!pto->m_limited_node) {
+                // Blocks on the tip take priority; fill the rest with blocks for background validation of a UTXO snapshot.
+                FindNextHistoricalBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.vBlocksInFlight.size(), vToDownload);
+            }
             for (const CBlockIndex *pindex : vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
@@ -0,0 +1,127 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <policy/cluster.h>
+
+#include <assert.h>
+#include <queue>
+
+/** Order the transactions topologically, taking the ready transaction with the highest feerate first. */
+static std::vector<uint32_t> SortByFeeRate(const std::vector<ClusterTx>& txs)
+{
+    const uint32_t n = txs.size();
+    std::vector<std::vector<uint32_t>> children(n);
+    std::vector<uint32_t> missing(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        missing[i] = txs[i].parents.size();
+        for (uint32_t parent : txs[i].parents) {
+            assert(parent < n);
+            children[parent].push_back(i);
+        }
+    }
+
+    auto worse = [&txs](uint32_t a, uint32_t b) {
+        if (HigherFeeRate(txs[a].fee, txs[a].size, txs[b].fee, txs[b].size))
+            return false;
+        if (HigherFeeRate(txs[b].fee, txs[b].size, txs[a].fee, txs[a].size))
+            return true;
+        return a > b;
+    };
+    std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(worse)> ready(worse);
+    for (uint32_t i = 0; i < n; ++i) {
+        if (missing[i] == 0)
+            ready.push(i);
+    }
+
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    while (!ready.empty()) {
+        const uint32_t i = ready.top();
+        ready.pop();
+        order.push_back(i);
+        for (uint32_t child : children[i]) {
+            if (--missing[child] == 0)
+                ready.push(child);
+        }
+    }
+    // Transactions cannot depend on each other in a cycle.
+    assert(order.size() == n);
+    return order;
+}
+
+std::vector<uint32_t> LinearizeCluster(const std::vector<ClusterTx>& txs)
+{
+    const std::vector<uint32_t> sorted = SortByFeeRate(txs);
+    const uint32_t n = txs.size();
+    if (n > MAX_CLUSTER_LINEARIZE_SIZE)
+        return sorted;
+
+    // ancestors[i][j] is set if j is i or one of its ancestors.
+    std::vector<std::vector<bool>> ancestors(n, std::vector<bool>(n, false));
+    for (uint32_t i : sorted) {
+        ancestors[i][i] = true;
+        for (uint32_t parent : txs[i].parents) {
+            for (uint32_t j = 0; j < n; ++j) {
+                if (ancestors[parent][j])
+                    ancestors[i][j] = true;
+            }
+        }
+    }
+
+    // Fee and size of each transaction with its ancestors which are not ordered yet
+    std::vector<CAmount> fees(n, 0);
+    std::vector<int64_t> sizes(n, 0);
+    for (uint32_t i = 0; i < n; ++i) {
+        for (uint32_t j = 0; j < n; ++j) {
+            if (ancestors[i][j]) {
+                fees[i] += txs[j].fee;
+                sizes[i] += txs[j].size;
+            }
+        }
+    }
+
+    std::vector<bool> done(n, false);
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    while (order.size() < n) {
+        uint32_t best = n;
+        for (uint32_t i : sorted) {
+            if (!done[i] && (best == n || HigherFeeRate(fees[i], sizes[i], fees[best], sizes[best])))
+                best = i;
+        }
+        // Take the best transaction with its remaining ancestors, parents first.
+        for (uint32_t j : sorted) {
+            if (done[j] || !ancestors[best][j])
+                continue;
+            done[j] = true;
+            order.push_back(j);
+            for (uint32_t k = 0; k < n; ++k) {
+                if (!done[k] && ancestors[k][j]) {
+                    fees[k] -= txs[j].fee;
+                    sizes[k] -= txs[j].size;
+                }
+            }
+        }
+    }
+    return order;
+}
+
+std::vector<ClusterChunk> ChunkLinearization(const std::vector<ClusterTx>& txs, const std::vector<uint32_t>& order)
+{
+    std::vector<ClusterChunk> chunks;
+    for (uint32_t i : order) {
+        chunks.push_back(ClusterChunk{txs[i].fee, txs[i].size, 1});
+        while (chunks.size() > 1) {
+            ClusterChunk& last = chunks.back();
+            ClusterChunk& prev = chunks[chunks.size() - 2];
+            if (!HigherFeeRate(last.fee, last.size, prev.fee, prev.size))
+                break;
+            prev.fee += last.fee;
+            prev.size += last.size;
+            prev.count += last.count;
+            chunks.pop_back();
+        }
+    }
+    return chunks;
+}
@@ -0,0 +1,54 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TAPYRUS_POLICY_CLUSTER_H
+#define TAPYRUS_POLICY_CLUSTER_H
+
+#include <amount.h>
+
+#include <cstdint>
+#include <vector>
+
+/** Clusters up to this size are linearized by ancestor set feerate, larger ones by the feerate of single transactions. */
+static const unsigned int MAX_CLUSTER_LINEARIZE_SIZE = 100;
+
+/** A transaction of a cluster: the fee, the size and the positions of its parents in the cluster */
+struct ClusterTx
+{
+    CAmount fee;
+    int64_t size;
+    std::vector<uint32_t> parents;
+};
+
+/** Consecutive transactions of a linearization which are mined together */
+struct ClusterChunk
+{
+    CAmount fee;
+    int64_t size;
+    uint32_t count;
+};
+
+/** Return whether fee1/size1 is higher than fee2/size2. */
+inline bool HigherFeeRate(CAmount fee1, int64_t size1, CAmount fee2, int64_t size2)
+{
+    // Avoid division by rewriting (a/b > c/d) as (a*d > c*b), in 128 bits so that it is exact.
+    return static_cast<__int128>(fee1) * size2 > static_cast<__int128>(fee2) * size1;
+}
+
+/**
+ * Order the transactions of a cluster for mining: parents always come before
+ * their children. Clusters of up to MAX_CLUSTER_LINEARIZE_SIZE transactions
+ * repeatedly take the remaining transaction with the highest feerate including
+ * its remaining ancestors; larger clusters take the ready transaction with the
+ * highest feerate. Returns the positions of the transactions in that order.
+ */
+std::vector<uint32_t> LinearizeCluster(const std::vector<ClusterTx>& txs);
+
+/**
+ * Split a linearization into chunks of non-increasing feerate: a chunk is
+ * merged into the one before it while its feerate is higher.
+ */
+std::vector<ClusterChunk> ChunkLinearization(const std::vector<ClusterTx>& txs, const std::vector<uint32_t>& order);
+
+#endif // TAPYRUS_POLICY_CLUSTER_H
@@ -5,6 +5,7 @@
 
 #include <policy/packages.h>
 #include <policy/policy.h>
+#include <consensus/tx_verify.h>
 #include <primitives/transaction.h>
 #include <txmempool.h>
 #include <validation.h>
@@ -73,6 +74,32 @@ bool CheckPackage(const Package& txns, CValidationState& state)
     return true;
 }
 
+bool IsAncestorPackage(const Package& package)
+{
+    if (package.empty())
+        return false;
+
+    std::map<uint256, size_t> positions;
+    for (size_t i = 0; i < package.size(); i++) {
+        positions.emplace(package[i]->GetHashMalFix(), i);
+    }
+
+    // Walk from the child towards the parents: the package is sorted, so all
+    // descendants of a transaction are visited before the transaction itself.
+    std::vector<bool> ancestors(package.size(), false);
+    ancestors.back() = true;
+    for (size_t i = package.size(); i-- > 0;) {
+        if (!ancestors[i])
+            return false;
+        for (const auto& input : package[i]->vin) {
+            auto it = positions.find(input.prevout.hashMalFix);
+            if (it != positions.end())
+                ancestors[it->second] = true;
+        }
+    }
+    return true;
+}
+
 bool ArePackageTransactionsAccepted(const PackageValidationState& results)
 {
     for (const auto& r : results) {
@@ -97,34 +124,24 @@ void FilterMempoolDuplicates(const std::vector<CTransaction>& txns, Package& pac
 }
 
 
-bool SubmitPackageToMempool(const Package& package,
-                                  CValidationState& state,
-                                  PackageValidationState& results,
-                                  CTxMempoolAcceptanceOptions& opt)
+/** Accept the transactions of a package in order and record the result of each one. */
+static void AcceptPackageTransactions(const Package& package,
+                                      const std::vector<CTxMempoolPreCheck>& prechecks,
+                                      PackageValidationState& results,
+                                      CTxMempoolAcceptanceOptions& opt) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
-    if(!CheckPackage(package, state))
-        return false;
+    AssertLockHeld(cs_main);
 
-    // For TEST_ONLY (testmempoolaccept dry-run), install a virtual-mempool view
-    // so each tx in a chained package can resolve its inputs against outputs of
-    // earlier package txs that passed validation but were not admitted.
-    // Replacing mempool_view with the subclass is safe: CTxMempoolAcceptanceOptions
-    // owns the pointer and its destructor deletes it; CCoinsView has a virtual dtor.
-    if (opt.flags == MempoolAcceptanceFlags::TEST_ONLY) {
-        delete opt.mempool_view;
-        opt.mempool_view = new CCoinsViewVirtualMemPool(pcoinsTip.get(), mempool);
-    }
     CCoinsViewVirtualMemPool* virtualView =
         dynamic_cast<CCoinsViewVirtualMemPool*>(opt.mempool_view);
 
-    for(auto &tx : package)
+    for(size_t i = 0; i < package.size(); i++)
     {
-        {
-            opt.state = CValidationState();
-            opt.coins_to_uncache.clear();
-            LOCK(::cs_main);
-            AcceptToMemoryPool(tx, opt);
-        }
+        const CTransactionRef& tx = package[i];
+        opt.state = CValidationState();
+        opt.coins_to_uncache.clear();
+        opt.precheck = &prechecks[i];
+        AcceptToMemoryPool(tx, opt);
 
         opt.state.missingInputs = opt.missingInputs.size() > 0;
         results.emplace(tx->GetHashMalFix(), opt.state);
@@ -140,6 +157,39 @@ bool SubmitPackageToMempool(const Package& package,
         }
     }
 
+    opt.precheck = nullptr;
+}
+
+bool SubmitPackageToMempool(const Package& package,
+                                  CValidationState& state,
+                                  PackageValidationState& results,
+                                  CTxMempoolAcceptanceOptions& opt)
+{
+    if(!CheckPackage(package, state))
+        return false;
+
+    // For TEST_ONLY (testmempoolaccept dry-run), install a virtual-mempool view
+    // so each tx in a chained package can resolve its inputs against outputs of
+    // earlier package txs that passed validation but were not admitted.
+    // Replacing mempool_view with the subclass is safe: CTxMempoolAcceptanceOptions
+    // owns the pointer and its destructor deletes it; CCoinsView has a virtual dtor.
+    if (opt.flags == MempoolAcceptanceFlags::TEST_ONLY) {
+        delete opt.mempool_view;
+        opt.mempool_view = new CCoinsViewVirtualMemPool(pcoinsTip.get(), mempool);
+    }
+
+    // Transactions spending other transactions of the package are not known
+    // to the pre-check and are checked under cs_main only.
+    std::vector<CTxMempoolPreCheck> prechecks;
+    PreCheckForMemPool(package, prechecks);
+
+    {
+        LOCK(::cs_main);
+        AcceptPackageTransactions(package, prechecks, results, opt);
+        // A test-only acceptance leaves the coins cached.
+        UncachePreCheckedCoins(prechecks);
+    }
+
     bool success = ArePackageTransactionsAccepted(results);
 
     // Relay only after the entire package has been successfully admitted.
@@ -154,3 +204,96 @@ bool SubmitPackageToMempool(const Package& package,
 
     return success;
 }
+
+bool AcceptAncestorPackage(const Package& package, CValidationState& state, PackageValidationState& results)
+{
+    if (!CheckPackage(package, state))
+        return false;
+
+    if (!IsAncestorPackage(package))
+        return state.Invalid(false, REJECT_PACKAGE_INVALID, "package-not-child-with-parents");
+
+    std::vector<CTxMempoolPreCheck> prechecks;
+    PreCheckForMemPool(package, prechecks);
+
+    LOCK2(::cs_main, mempool.cs);
+
+    // Add up the fees of the transactions which are not in the mempool yet. Their
+    // inputs are looked up in the chain, the mempool and the package itself.
+    Package txns;
+    std::vector<CTxMempoolPreCheck> txnsPrechecks;
+    CAmount nPackageFees = 0, nChildFees = 0;
+    int64_t nPackageSize = 0, nChildSize = 0;
+    {
+        CCoinsViewMemPool viewMemPool(pcoinsTip.get(), mempool);
+        CCoinsViewCache view(&viewMemPool);
+        for (size_t i = 0; i < package.size(); i++) {
+            const CTransactionRef& tx = package[i];
+            const uint256& hash = tx->GetHashMalFix();
+            if (mempool.exists(hash))
+                continue;
+
+            CValidationState txState;
+            CAmount nFees = 0;
+            if (!Consensus::CheckTxInputs(*tx, txState, view, GetSpendHeight(view), nFees)) {
+                results.emplace(hash, txState);
+                UncachePreCheckedCoins(prechecks);
+                return state.Invalid(false, REJECT_PACKAGE_INVALID, "package-inputs-missing");
+            }
+            mempool.ApplyDelta(hash, nFees);
+            nChildFees = nFees;
+            nChildSize = GetTransactionSize(*tx);
+            nPackageFees += nChildFees;
+            nPackageSize += nChildSize;
+            AddCoins(view, *tx, MEMPOOL_HEIGHT);
+
+            txns.push_back(tx);
+            txnsPrechecks.push_back(prechecks[i]);
+        }
+    }
+    if (txns.empty())
+        return true;
+
+    // The child pays for its ancestors, not the other way round
+    CFeeRate packageFeeRate(nPackageFees, nPackageSize);
+    if (txns.back() != package.back() || CFeeRate(nChildFees, nChildSize) < packageFeeRate)
+        packageFeeRate = CFeeRate();
+
+    {
+        PackageValidationState testResults;
+        CTxMempoolAcceptanceOptions opt;
+        opt.context = ValidationContext::PACKAGE;
+        opt.flags = MempoolAcceptanceFlags::TEST_ONLY;
+        opt.packageFeeRate = packageFeeRate;
+        delete opt.mempool_view;
+        opt.mempool_view = new CCoinsViewVirtualMemPool(pcoinsTip.get(), mempool);
+        AcceptPackageTransactions(txns, txnsPrechecks, testResults, opt);
+        if (!ArePackageTransactionsAccepted(testResults)) {
+            results.swap(testResults);
+            UncachePreCheckedCoins(prechecks);
+            return state.Invalid(false, REJECT_PACKAGE_INVALID, "package-not-accepted");
+        }
+    }
+
+    CTxMempoolAcceptanceOptions opt;
+    opt.context = ValidationContext::PACKAGE;
+    opt.packageFeeRate = packageFeeRate;
+    opt.fDeferTrim = true;
+    AcceptPackageTransactions(txns, txnsPrechecks, results, opt);
+
+    // Trim only now, so that the parents are not evicted before the child joins them
+    LimitMempoolSize(mempool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+    for (const CTransactionRef& tx : txns) {
+        const uint256& hash = tx->GetHashMalFix();
+        auto it = results.find(hash);
+        if (it != results.end() && it->second.IsValid() && !mempool.exists(hash)) {
+            CValidationState txState;
+            txState.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+            results.erase(it);
+            results.emplace(hash, txState);
+        }
+    }
+    UncachePreCheckedCoins(prechecks);
+
+    return ArePackageTransactionsAccepted(results);
+}
@@ -23,6 +23,7 @@ static constexpr uint32_t MAX_PACKAGE_COUNT{25};
 // defaults reflect this constraint.
 static_assert(DEFAULT_DESCENDANT_LIMIT >= MAX_PACKAGE_COUNT);
 static_assert(DEFAULT_ANCESTOR_LIMIT >= MAX_PACKAGE_COUNT);
+static_assert(DEFAULT_CLUSTER_LIMIT >= MAX_PACKAGE_COUNT);
 
 /** A package is an set of transactions. The transactions cannot conflict with (spend the
  * same inputs as) one another. */
@@ -69,6 +70,30 @@ bool SubmitPackageToMempool(const Package& package,
                                   PackageValidationState& results,
                                   CTxMempoolAcceptanceOptions& opt);
 
+/**
+ * IsAncestorPackage tells whether every transaction of a sorted package is an
+ * ancestor of its last transaction, the child.
+ */
+bool IsAncestorPackage(const Package& package);
+
+/**
+ * AcceptAncestorPackage is used to accept a package relayed by a peer: a child with
+ * those of its unconfirmed ancestors which are not in the mempool, sorted parents first.
+ *
+ * The fees of the transactions are added up, so that a child can pay for parents
+ * which do not meet the mempool minimum fee alone. The package feerate is only used
+ * if the child pays at least that feerate itself. The whole package is validated
+ * under one lock of cs_main, first as a dry run, and only admitted if every
+ * transaction passed. The mempool is trimmed once after the child was added.
+ * Relaying the transactions is left to the caller.
+ *
+ * @param package The package of transactions to be accepted.
+ * @param state A reference to the validation state of the package as a whole.
+ * @param results A reference to the package validation state that records the validation outcome of each transaction.
+ * @return True if all transactions in the package were accepted, false otherwise.
+ */
+bool AcceptAncestorPackage(const Package& package, CValidationState& state, PackageValidationState& results);
+
 /**
  * ArePackageTransactionsAccepted checks the result of a package submit attempt and
  * tells whether all the transactions in the package were accepted.
@@ -30,6 +30,8 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 
 /** Default for -maxmempool, maximum megabytes of mempool memory usage */
 static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -maxmempooltokenshare, the percentage of -maxmempool one token may use when the mempool is full */
+static const unsigned int DEFAULT_MEMPOOL_TOKEN_SHARE = 50;
 /** Default for -incrementalrelayfee, which sets the minimum feerate increase for mempool limiting or BIP 125 replacement **/
 static const unsigned int DEFAULT_INCREMENTAL_RELAY_FEE = 1000;
 /** Default for -bytespersigop */
@@ -114,6 +114,7 @@ public:
 
     // memory only
     mutable bool fChecked;
+    mutable bool fCheckedTransactions;
 
     CBlock()
     {
@@ -139,6 +140,7 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         fChecked = false;
+        fCheckedTransactions = false;
     }
 
     CBlockHeader GetBlockHeader() const
@@ -239,6 +239,63 @@ extern const char *GETBLOCKTXN;
  * @since protocol version 70014 as described by BIP 152
  */
 extern const char *BLOCKTXN;
+/**
+ * getcfilters requests compact filters for a range of blocks.
+ * Only available with service bit NODE_COMPACT_FILTERS as described by
+ * BIP 157 & 158.
+ */
+extern const char *GETCFILTERS;
+/**
+ * cfilter is a response to a getcfilters request containing a single compact
+ * filter.
+ */
+extern const char *CFILTER;
+/**
+ * getcfheaders requests a compact filter header and the filter hashes for a
+ * range of blocks, which can then be used to reconstruct the filter headers
+ * for those blocks.
+ * Only available with service bit NODE_COMPACT_FILTERS as described by
+ * BIP 157 & 158.
+ */
+extern const char *GETCFHEADERS;
+/**
+ * cfheaders is a response to a getcfheaders request containing a filter header
+ * and a vector of filter hashes for each subsequent block in the requested range.
+ */
+extern const char *CFHEADERS;
+/**
+ * getcfcheckpt requests evenly spaced compact filter headers, enabling
+ * parallelized download and validation of the headers between them.
+ * Only available with service bit NODE_COMPACT_FILTERS as described by
+ * BIP 157 & 158.
+ */
+extern const char *GETCFCHECKPT;
+/**
+ * cfcheckpt is a response to a getcfcheckpt request containing a vector of
+ * evenly spaced filter headers for blocks on the requested chain.
+ */
+extern const char *CFCHECKPT;
+/**
+ * getancpkginfo asks for the unconfirmed ancestors of a mempool transaction.
+ * Only available with service bit NODE_PACKAGE_RELAY.
+ */
+extern const char *GETANCPKGINFO;
+/**
+ * ancpkginfo is a response to a getancpkginfo request containing the txids of
+ * the unconfirmed ancestors of the transaction, sorted parents first, followed
+ * by the txid of the transaction itself.
+ */
+extern const char *ANCPKGINFO;
+/**
+ * getpkgtxns requests the transactions of an ancestor package.
+ * Only available with service bit NODE_PACKAGE_RELAY.
+ */
+extern const char *GETPKGTXNS;
+/**
+ * pkgtxns is a response to a getpkgtxns request containing the requested
+ * transactions in the order of the request.
+ */
+extern const char *PKGTXNS;
 };
 
 /* Get a vector of all valid message types (see above) */
@@ -267,6 +324,13 @@ enum ServiceFlags : uint64_t {
     // NODE_XTHIN means the node supports Xtreme Thinblocks
     // If this is turned off then the node will not service nor make xthin requests
     NODE_XTHIN = (1 << 4),
+    // NODE_COMPACT_FILTERS means the node will service basic block filter requests.
+    // See BIP157 and BIP158 for details on how this is implemented.
+    NODE_COMPACT_FILTERS = (1 << 6),
+    // NODE_PACKAGE_RELAY means the node will serve and accept the unconfirmed
+    // ancestors of a transaction as a package, so that a child can pay for
+    // parents which do not meet the mempool minimum fee alone.
+    NODE_PACKAGE_RELAY = (1 << 7),
     // NODE_NETWORK_LIMITED means the same as NODE_NETWORK with the limitation of only
     // serving the last 288 (2 day) blocks
     // See BIP159 for details on how this is implemented.
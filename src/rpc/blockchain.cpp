@@ -8,15 +8,22 @@
 #include <cs_main.h>
 
 #include <amount.h>
+#include <backgroundchainstate.h>
+#include <chainstate.h>
 #include <base58.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <coins.h>
+#include <coinstats.h>
 #include <consensus/validation.h>
 #include <validation.h>
 #include <blockprune.h>
 #include <core_io.h>
+#include <index/addressindex.h>
+#include <index/blockfilterindex.h>
+#include <index/coinstatsindex.h>
+#include <index/tokenindex.h>
 #include <index/txindex.h>
 #include <key_io.h>
 #include <policy/feerate.h>
@@ -81,8 +88,11 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.pushKV("time", (int64_t)blockindex->nTime);
     result.pushKV("mediantime", (int64_t)blockindex->GetMedianTimePast());
     result.pushKV("nTx", (uint64_t)blockindex->nTx);
-    result.pushKV("xfield", blockindex->xfield.ToString());
-    result.pushKV("proof", HexStr(blockindex->proof));
+    result.pushKV("xfield", blockindex->GetXField().ToString());
+    CBlockHeader header;
+    if (!GetBlockHeaderWithProof(blockindex, header))
+        throw JSONRPCError(RPC_MISC_ERROR, "Can't read block proof from disk");
+    result.pushKV("proof", HexStr(header.proof));
 
     if (blockindex->pprev)
         result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
@@ -92,7 +102,7 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, const CBlockUndo* blockUndo)
 {
     AssertLockHeld(cs_main);
     UniValue result(UniValue::VOBJ);
@@ -109,12 +119,15 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.pushKV("merkleroot", block.hashMerkleRoot.GetHex());
     result.pushKV("immutablemerkleroot", block.hashImMerkleRoot.GetHex());
     UniValue txs(UniValue::VARR);
-    for(const auto& tx : block.vtx)
+    for(size_t i = 0; i < block.vtx.size(); ++i)
     {
+        const CTransactionRef& tx = block.vtx[i];
         if(txDetails)
         {
+            // The undo data has no entry for the coinbase transaction.
+            const CTxUndo* txundo = (blockUndo && i > 0) ? &blockUndo->vtxundo.at(i - 1) : nullptr;
             UniValue objTx(UniValue::VOBJ);
-            TxToUniv(*tx, uint256(), objTx, true, RPCSerializationFlags());
+            TxToUniv(*tx, uint256(), objTx, true, RPCSerializationFlags(), txundo);
             txs.push_back(objTx);
         }
         else
@@ -123,7 +136,7 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.pushKV("tx", txs);
     result.pushKV("time", block.GetBlockTime());
     result.pushKV("mediantime", (int64_t)blockindex->GetMedianTimePast());
-    result.pushKV("xfield", blockindex->xfield.ToString());
+    result.pushKV("xfield", blockindex->GetXField().ToString());
     result.pushKV("proof", HexStr(block.GetBlockHeader().proof));
     result.pushKV("nTx", (uint64_t)blockindex->nTx);
 
@@ -406,9 +419,39 @@ static void entryToJSON(UniValue &info, const CTxMemPoolEntry &e) EXCLUSIVE_LOCK
     info.pushKV("spentby", spent);
 }
 
-UniValue mempoolToJSON(bool fVerbose)
+static ColorIdentifier ParseTokenColor(const UniValue& param)
 {
-    if (fVerbose)
+    const std::vector<unsigned char> vColorId(ParseHex(param.get_str()));
+    if (vColorId.size() != COLOR_IDENTIFIER_SIZE) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid token");
+    }
+    ColorIdentifier colorId(vColorId);
+    if (colorId.type == TokenTypes::NONE) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid token");
+    }
+    return colorId;
+}
+
+UniValue mempoolToJSON(bool fVerbose, const std::optional<ColorIdentifier>& color)
+{
+    if (color)
+    {
+        LOCK(mempool.cs);
+        UniValue o(fVerbose ? UniValue::VOBJ : UniValue::VARR);
+        for (CTxMemPool::txiter it : mempool.GetColorEntries(*color))
+        {
+            const uint256& hash = it->GetTx().GetHashMalFix();
+            if (fVerbose) {
+                UniValue info(UniValue::VOBJ);
+                entryToJSON(info, *it);
+                o.pushKV(hash.ToString(), info);
+            } else {
+                o.push_back(hash.ToString());
+            }
+        }
+        return o;
+    }
+    else if (fVerbose)
     {
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
@@ -436,13 +479,14 @@ UniValue mempoolToJSON(bool fVerbose)
 
 static UniValue getrawmempool(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() > 1)
+    if (request.fHelp || request.params.size() > 2)
         throw std::runtime_error(
-            "getrawmempool ( verbose )\n"
+            "getrawmempool ( verbose \"token\" )\n"
             "\nReturns all transaction ids in memory pool as a json array of string transaction ids.\n"
             "\nHint: use getmempoolentry to fetch a specific transaction from the mempool.\n"
             "\nArguments:\n"
             "1. verbose (boolean, optional, default=false) True for a json object, false for array of transaction ids\n"
+            "2. \"token\" (string, optional) Only the transactions with outputs of this token or spending coins of it\n"
             "\nResult: (for verbose = false):\n"
             "[                     (json array of string)\n"
             "  \"transactionid\"     (string) The transaction id\n"
@@ -456,6 +500,7 @@ static UniValue getrawmempool(const JSONRPCRequest& request)
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getrawmempool", "true")
+            + HelpExampleCli("getrawmempool", "false \"c1ec2fd806701a3f55808cbec3922c38dafaa3070c48c803e9043ee3642c660b46\"")
             + HelpExampleRpc("getrawmempool", "true")
         );
 
@@ -463,7 +508,11 @@ static UniValue getrawmempool(const JSONRPCRequest& request)
     if (!request.params[0].isNull())
         fVerbose = request.params[0].get_bool();
 
-    return mempoolToJSON(fVerbose);
+    std::optional<ColorIdentifier> color;
+    if (!request.params[1].isNull())
+        color = ParseTokenColor(request.params[1]);
+
+    return mempoolToJSON(fVerbose, color);
 }
 
 static UniValue getmempoolancestors(const JSONRPCRequest& request)
@@ -702,8 +751,11 @@ static UniValue getblockheader(const JSONRPCRequest& request)
 
     if (!fVerbose)
     {
+        CBlockHeader header;
+        if (!GetBlockHeaderWithProof(pblockindex, header))
+            throw JSONRPCError(RPC_MISC_ERROR, "Can't read block proof from disk");
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << pblockindex->GetBlockHeader();
+        ssBlock << header;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
         return strHex;
     }
@@ -730,6 +782,25 @@ static CBlock GetBlockChecked(const CBlockIndex* pblockindex)
     return block;
 }
 
+static CBlockUndo GetUndoChecked(const CBlockIndex* pblockindex)
+{
+    CBlockUndo blockUndo;
+    // The genesis block has no undo data.
+    if (pblockindex->nHeight == 0) {
+        return blockUndo;
+    }
+
+    if (IsBlockPruned(pblockindex)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Undo data not available (pruned data)");
+    }
+
+    if (!UndoReadFromDisk(blockUndo, pblockindex)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Can't read undo data from disk");
+    }
+
+    return blockUndo;
+}
+
 // TODO: add proof in result
 static UniValue getblock(const JSONRPCRequest& request)
 {
@@ -739,9 +810,10 @@ static UniValue getblock(const JSONRPCRequest& request)
             "\nIf verbosity is 0, returns a string that is serialized, hex-encoded data for block 'hash'.\n"
             "If verbosity is 1, returns an Object with information about block <hash>.\n"
             "If verbosity is 2, returns an Object with information about block <hash> and information about each transaction. \n"
+            "If verbosity is 3, returns an Object with information about block <hash> and information about each transaction, including the output spent by each input and the fee.\n"
             "\nArguments:\n"
             "1. \"blockhash\"          (string, required) The block hash\n"
-            "2. verbosity              (numeric, optional, default=1) 0 for hex encoded data, 1 for a json object, and 2 for json object with transaction data\n"
+            "2. verbosity              (numeric, optional, default=1) 0 for hex encoded data, 1 for a json object, 2 for json object with transaction data, and 3 for json object with transaction data and spent outputs\n"
             "\nResult (for verbosity = 0):\n"
             "\"data\"             (string) A string that is serialized, hex-encoded data for block 'hash'.\n"
             "\nResult (for verbosity = 1):\n"
@@ -775,6 +847,29 @@ static UniValue getblock(const JSONRPCRequest& request)
             "  ],\n"
             "  ,...                     Same output as verbosity = 1.\n"
             "}\n"
+            "\nResult (for verbosity = 3):\n"
+            "{\n"
+            "  ...,                     Same output as verbosity = 2.\n"
+            "  \"tx\" : [               (array of Objects) The transactions in the format of the getrawtransaction RPC with verbosity = 2.\n"
+            "    {\n"
+            "      ...,                 Same output as verbosity = 2.\n"
+            "      \"vin\" : [\n"
+            "        {\n"
+            "          ...,             Same output as verbosity = 2.\n"
+            "          \"prevout\" : {   (json object) The output spent by this input. Not present for the coinbase transaction.\n"
+            "            \"generated\" : true|false, (boolean) Whether the output was created by a coinbase transaction\n"
+            "            \"height\" : n,             (numeric) The height of the block containing the output\n"
+            "            \"token\" : \"xxx\",         (string) TPC or the token color identifier\n"
+            "            \"value\" : x.xxx,          (numeric) The value in " + CURRENCY_UNIT + ", or the amount of the token\n"
+            "            \"scriptPubKey\" : {...}    (json object) The script of the output\n"
+            "          }\n"
+            "        },...\n"
+            "      ],\n"
+            "      \"fee\" : x.xxx,     (numeric) The transaction fee in " + CURRENCY_UNIT + ". Not present for the coinbase transaction.\n"
+            "    },...\n"
+            "  ],\n"
+            "  ,...                     Same output as verbosity = 2.\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
             + HelpExampleRpc("getblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
@@ -808,77 +903,11 @@ static UniValue getblock(const JSONRPCRequest& request)
         return strHex;
     }
 
-    return blockToJSON(block, pblockindex, verbosity >= 2);
-}
-
-struct CCoinsStats
-{
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nBogoSize;
-    uint256 hashSerialized;
-    uint64_t nDiskSize;
-    TxColoredCoinBalancesMap mTotalAmount;
-
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0){ mTotalAmount[ColorIdentifier()] = 0; }
-};
-
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
-{
-    assert(!outputs.empty());
-    ss << hash;
-    ss << VARINT(outputs.begin()->second.nHeight * 2 + (outputs.begin()->second.fCoinBase ? 1u : 0u));
-    stats.nTransactions++;
-    for (const auto& output : outputs) {
-        ss << VARINT(output.first + 1);
-        ss << output.second.out.scriptPubKey;
-        ss << VARINT_MODE(output.second.out.nValue, VarIntMode::NONNEGATIVE_SIGNED);
-        stats.nTransactionOutputs++;
-        stats.mTotalAmount[GetColorIdFromScript(output.second.out.scriptPubKey)] += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
-    }
-    ss << VARINT(0u);
-}
-
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
-{
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-    assert(pcursor);
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
-    }
-    ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
-    while (pcursor->Valid()) {
-        COutPoint key;
-        Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hashMalFix != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hashMalFix;
-            outputs.emplace(key.n, coin);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
+    if (verbosity >= 3) {
+        const CBlockUndo blockUndo = GetUndoChecked(pblockindex);
+        return blockToJSON(block, pblockindex, true, &blockUndo);
     }
-    stats.hashSerialized = ss.GetHash();
-    stats.nDiskSize = view->EstimateSize();
-    return true;
+    return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
 static UniValue pruneblockchain(const JSONRPCRequest& request)
@@ -930,40 +959,132 @@ static UniValue pruneblockchain(const JSONRPCRequest& request)
     return UniValue(height);
 }
 
+/** Look up a block of the active chain given by its hash or height. */
+static CBlockIndex* ParseHashOrHeight(const UniValue& param) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    CBlockIndex* pindex;
+    if (param.isNum()) {
+        const int height = param.get_int();
+        const int current_tip = chainActive.Height();
+        if (height < 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d is negative", height));
+        }
+        if (height > current_tip) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d after current tip %d", height, current_tip));
+        }
+
+        pindex = chainActive[height];
+    } else {
+        const std::string strHash = param.get_str();
+        const uint256 hash(uint256S(strHash));
+        pindex = LookupBlockIndex(hash);
+        if (!pindex) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        }
+        if (!chainActive.Contains(pindex)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block is not in chain %s", FederationParams().NetworkIDString()));
+        }
+    }
+
+    assert(pindex != nullptr);
+    return pindex;
+}
+
 static UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 3)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" hash_or_height use_index )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
             "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"    (string, optional, default=\"hash_serialized_3\") Which UTXO set hash should be calculated.\n"
+            "                     Options: 'hash_serialized_3' (the legacy algorithm, also used by UTXO snapshots), 'muhash', 'none'.\n"
+            "2. hash_or_height   (string or numeric, optional, default=the current best block) The block hash or height of the target height (only available with coinstatsindex).\n"
+            "3. use_index        (boolean, optional, default=true) Use coinstatsindex, if available. It is not used with hash_type 'hash_serialized_3'.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) The hash of the block at the tip of the chain\n"
-            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs\n"
+            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs (not available when coinstatsindex is used)\n"
             "  \"txouts\": n,            (numeric) The number of unspent transaction outputs\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_3\": \"hash\", (string) The serialized hash\n"
+            "  \"hash_serialized_3\": \"hash\", (string) The serialized hash (only present if 'hash_serialized_3' hash_type is chosen)\n"
+            "  \"muhash\": \"hash\",            (string) The MuHash of the UTXO set (only present if 'muhash' hash_type is chosen)\n"
             "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
+            + HelpExampleCli("gettxoutsetinfo", "\"none\" 1000")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    CoinStatsHashType hash_type = CoinStatsHashType::HASH_SERIALIZED;
+    if (!request.params[0].isNull()) {
+        const std::string hash_type_input = request.params[0].get_str();
+        if (hash_type_input == "hash_serialized_3") {
+            hash_type = CoinStatsHashType::HASH_SERIALIZED;
+        } else if (hash_type_input == "muhash") {
+            hash_type = CoinStatsHashType::MUHASH;
+        } else if (hash_type_input == "none") {
+            hash_type = CoinStatsHashType::NONE;
+        } else {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("%s is not a valid hash_type", hash_type_input));
+        }
+    }
+
+    const bool index_requested = request.params[2].isNull() || request.params[2].get_bool();
+    const CBlockIndex* pindex = nullptr;
+    if (!request.params[1].isNull()) {
+        if (!g_coin_stats_index) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Querying specific block heights requires coinstatsindex");
+        }
+        if (hash_type == CoinStatsHashType::HASH_SERIALIZED) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "hash_serialized_3 hash type cannot be queried for a specific block");
+        }
+        if (!index_requested) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot set use_index to false when querying for a specific block");
+        }
+        LOCK(cs_main);
+        pindex = ParseHashOrHeight(request.params[1]);
+    }
+    const bool use_index = g_coin_stats_index && index_requested && hash_type != CoinStatsHashType::HASH_SERIALIZED;
+
     UniValue ret(UniValue::VOBJ);
 
     CCoinsStats stats;
-    FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview.get(), stats)) {
+    bool success;
+    if (use_index) {
+        if (!pindex) {
+            LOCK(cs_main);
+            pindex = chainActive.Tip();
+        }
+        // The index may still be catching up; only the blocks it has processed can be looked up.
+        g_coin_stats_index->BlockUntilSyncedToCurrentChain();
+        success = g_coin_stats_index->LookUpStats(pindex, stats);
+        if (!success) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set statistics from coinstatsindex; it may still be syncing");
+        }
+        stats.nDiskSize = pcoinsdbview->EstimateSize();
+    } else {
+        FlushStateToDisk();
+        success = GetUTXOStats(pcoinsdbview.get(), stats, hash_type);
+    }
+    if (success) {
         ret.pushKV("height", (int64_t)stats.nHeight);
         ret.pushKV("bestblock", stats.hashBlock.GetHex());
-        ret.pushKV("transactions", (int64_t)stats.nTransactions);
+        if (!use_index) {
+            ret.pushKV("transactions", (int64_t)stats.nTransactions);
+        }
         ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
         ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
-        ret.pushKV("hash_serialized_3", stats.hashSerialized.GetHex());
+        if (hash_type == CoinStatsHashType::HASH_SERIALIZED) {
+            ret.pushKV("hash_serialized_3", stats.hashSerialized.GetHex());
+        } else if (hash_type == CoinStatsHashType::MUHASH) {
+            ret.pushKV("muhash", stats.hashMuHash.GetHex());
+        }
         ret.pushKV("disk_size", stats.nDiskSize);
 
         UniValue amount(UniValue::VOBJ);
@@ -1121,6 +1242,11 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             "  \"pruneheight\": xxxxxx,        (numeric) lowest-height complete block stored (only present if pruning is enabled)\n"
             "  \"automatic_pruning\": xx,      (boolean) whether automatic pruning is enabled (only present if pruning is enabled)\n"
             "  \"prune_target_size\": xxxxxx,  (numeric) the target size used by pruning (only present if automatic pruning is enabled)\n"
+            "  \"snapshot_validation\": {     (object) background validation of the blocks below a loaded UTXO snapshot (only present while it is running)\n"
+            "     \"base_hash\": \"...\",       (string) the hash of the snapshot base block\n"
+            "     \"base_height\": xxxxxx,     (numeric) the height of the snapshot base block\n"
+            "     \"blocks\": xxxxxx,          (numeric) the number of blocks validated in the background\n"
+            "  },\n"
             "  \"aggregatePubkeys\": {        (object) pairs of aggregate pubkey of the federation and block height where it is used to verify block proof\n"
             "  },\n"
             "  \"warnings\" : \"...\",           (string) any network and blockchain warnings.\n"
@@ -1159,6 +1285,15 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             obj.pushKV("prune_target_size",  nPruneTarget);
         }
     }
+    if (g_background_chainstate && g_background_chainstate->GetSnapshotBase()) {
+        const CBlockIndex* pindexBase = g_background_chainstate->GetSnapshotBase();
+        const CBlockIndex* pindexTip = g_background_chainstate->GetTip();
+        UniValue snapshot(UniValue::VOBJ);
+        snapshot.pushKV("base_hash",    pindexBase->GetBlockHash().GetHex());
+        snapshot.pushKV("base_height",  pindexBase->nHeight);
+        snapshot.pushKV("blocks",       pindexTip ? pindexTip->nHeight : -1);
+        obj.pushKV("snapshot_validation", snapshot);
+    }
     //aggregate pubkey list with block height and block hash
     UniValue xfieldChanges(UniValue::VARR);
     CXFieldHistory xFieldHistory;
@@ -1587,7 +1722,6 @@ static UniValue getblockstats(const JSONRPCRequest& request)
             "getblockstats hash_or_height ( stats )\n"
             "\nCompute per block statistics for a given window. All amounts are in tapyrus.\n"
             "It won't work for some heights with pruning.\n"
-            "It won't work without -txindex for utxo_size_inc, *fee or *feerate stats.\n"
             "\nArguments:\n"
             "1. \"hash_or_height\"     (string or numeric, required) The block hash or height of the target block\n"
             "2. \"stats\"              (array,  optional) Values to plot, by default all values (see result below)\n"
@@ -1638,31 +1772,7 @@ static UniValue getblockstats(const JSONRPCRequest& request)
 
     LOCK(cs_main);
 
-    CBlockIndex* pindex;
-    if (request.params[0].isNum()) {
-        const int height = request.params[0].get_int();
-        const int current_tip = chainActive.Height();
-        if (height < 0) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d is negative", height));
-        }
-        if (height > current_tip) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d after current tip %d", height, current_tip));
-        }
-
-        pindex = chainActive[height];
-    } else {
-        const std::string strHash = request.params[0].get_str();
-        const uint256 hash(uint256S(strHash));
-        pindex = LookupBlockIndex(hash);
-        if (!pindex) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-        }
-        if (!chainActive.Contains(pindex)) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block is not in chain %s", FederationParams().NetworkIDString()));
-        }
-    }
-
-    assert(pindex != nullptr);
+    CBlockIndex* pindex = ParseHashOrHeight(request.params[0]);
 
     std::set<std::string> stats;
     if (!request.params[1].isNull()) {
@@ -1685,6 +1795,9 @@ static UniValue getblockstats(const JSONRPCRequest& request)
     const bool do_calculate_size = do_all || do_mediantxsize ||
         SetHasKeys(stats, "total_size", "avgtxsize", "mintxsize", "maxtxsize", "avgfeerate", "feerate_percentiles", "minfeerate", "maxfeerate");
 
+    // The outputs spent by the block are read from its undo data rather than looked up in the txindex.
+    const CBlockUndo blockUndo = loop_inputs ? GetUndoChecked(pindex) : CBlockUndo();
+
     CAmount maxfee = 0;
     CAmount maxfeerate = 0;
     CAmount minfee = MAX_MONEY;
@@ -1701,13 +1814,19 @@ static UniValue getblockstats(const JSONRPCRequest& request)
     std::vector<std::pair<CAmount, int64_t>> feerate_array;
     std::vector<int64_t> txsize_array;
 
-    for (const auto& tx : block.vtx) {
+    for (size_t i = 0; i < block.vtx.size(); ++i) {
+        const CTransactionRef& tx = block.vtx[i];
         outputs += tx->vout.size();
 
         CAmount tx_total_out = 0;
+        // Fees are paid in TPC only, so tokens are left out of the fee computation.
+        CAmount tx_total_out_tpc = 0;
         if (loop_outputs) {
             for (const CTxOut& out : tx->vout) {
                 tx_total_out += out.nValue;
+                if (GetColorIdFromScript(out.scriptPubKey).type == TokenTypes::NONE) {
+                    tx_total_out_tpc += out.nValue;
+                }
                 utxo_size_inc += GetSerializeSize(out, SER_NETWORK, PROTOCOL_VERSION) + PER_UTXO_OVERHEAD;
             }
         }
@@ -1733,24 +1852,18 @@ static UniValue getblockstats(const JSONRPCRequest& request)
 
         if (loop_inputs) {
 
-            if (!g_txindex) {
-                throw JSONRPCError(RPC_INVALID_PARAMETER, "One or more of the selected stats requires -txindex enabled");
-            }
+            const CTxUndo& txundo = blockUndo.vtxundo.at(i - 1);
             CAmount tx_total_in = 0;
-            for (const CTxIn& in : tx->vin) {
-                CTransactionRef tx_in;
-                uint256 hashBlock;
-                if (!GetTransaction(in.prevout.hashMalFix, tx_in, Params().GetConsensus(), hashBlock, false)) {
-                    throw JSONRPCError(RPC_INTERNAL_ERROR, std::string("Unexpected internal error (tx index seems corrupt)"));
-                }
+            for (const Coin& coin : txundo.vprevout) {
+                const CTxOut& prevoutput = coin.out;
 
-                CTxOut prevoutput = tx_in->vout[in.prevout.n];
-
-                tx_total_in += prevoutput.nValue;
+                if (GetColorIdFromScript(prevoutput.scriptPubKey).type == TokenTypes::NONE) {
+                    tx_total_in += prevoutput.nValue;
+                }
                 utxo_size_inc -= GetSerializeSize(prevoutput, SER_NETWORK, PROTOCOL_VERSION) + PER_UTXO_OVERHEAD;
             }
 
-            CAmount txfee = tx_total_in - tx_total_out;
+            CAmount txfee = tx_total_in - tx_total_out_tpc;
             assert(MoneyRange(txfee));
             if (do_medianfee) {
                 fee_array.push_back(txfee);
@@ -1819,6 +1932,81 @@ static UniValue getblockstats(const JSONRPCRequest& request)
     return ret;
 }
 
+static UniValue getblockfilter(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "getblockfilter \"blockhash\" ( \"filtertype\" )\n"
+            "\nRetrieve a BIP 157 content filter for a particular block.\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"   (string, required) The hash of the block\n"
+            "2. \"filtertype\"  (string, optional, default=basic) The type name of the filter\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : (string) the hex-encoded filter data\n"
+            "  \"header\" : (string) the hex-encoded filter header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" \"basic\"")
+            + HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", \"basic\"")
+        );
+
+    uint256 block_hash = ParseHashV(request.params[0], "blockhash");
+    std::string filtertype_name = "basic";
+    if (!request.params[1].isNull()) {
+        filtertype_name = request.params[1].get_str();
+    }
+
+    BlockFilterType filtertype;
+    if (!BlockFilterTypeByName(filtertype_name, filtertype)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown filtertype");
+    }
+
+    BlockFilterIndex* index = GetBlockFilterIndex(filtertype);
+    if (!index) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Index is not enabled for filtertype " + filtertype_name);
+    }
+
+    const CBlockIndex* block_index;
+    bool block_was_connected;
+    {
+        LOCK(cs_main);
+        block_index = LookupBlockIndex(block_hash);
+        if (!block_index) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        }
+        block_was_connected = block_index->IsValid(BLOCK_VALID_SCRIPTS);
+    }
+
+    bool index_ready = index->BlockUntilSyncedToCurrentChain();
+
+    BlockFilter filter;
+    uint256 filter_header;
+    if (!index->LookupFilter(block_index, filter) ||
+        !index->LookupFilterHeader(block_index, filter_header)) {
+        int err_code;
+        std::string errmsg = "Filter not found.";
+
+        if (!block_was_connected) {
+            err_code = RPC_INVALID_ADDRESS_OR_KEY;
+            errmsg += " Block was not connected to active chain.";
+        } else if (!index_ready) {
+            err_code = RPC_MISC_ERROR;
+            errmsg += " Block filters are still in the process of being indexed.";
+        } else {
+            err_code = RPC_INTERNAL_ERROR;
+            errmsg += " This error is unexpected and indicates index corruption.";
+        }
+
+        throw JSONRPCError(err_code, errmsg);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("filter", HexStr(filter.GetEncodedFilter()));
+    ret.pushKV("header", filter_header.GetHex());
+    return ret;
+}
+
 static UniValue savemempool(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0) {
@@ -2057,6 +2245,386 @@ UniValue scantxoutset(const JSONRPCRequest& request)
     return result;
 }
 
+/** Check that the address index is enabled and has caught up with the active chain. */
+static void EnsureAddressIndexReady()
+{
+    if (!g_address_index) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is not enabled. Start tapyrusd with -addressindex");
+    }
+    if (!g_address_index->BlockUntilSyncedToCurrentChain()) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is still in the process of being built");
+    }
+}
+
+/** The script of an address, and its color if the address is colored. */
+static CScript ParseIndexedAddress(const UniValue& param, std::optional<ColorIdentifier>& color)
+{
+    CTxDestination destination = DecodeDestination(param.get_str());
+    if (!IsValidDestination(destination)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
+    CScript script = GetScriptForDestination(destination);
+    ColorIdentifier colorId = GetColorIdFromScript(script);
+    if (colorId.type != TokenTypes::NONE) {
+        color = colorId;
+    }
+    return script;
+}
+
+static void ParsePagination(const JSONRPCRequest& request, size_t& count, size_t& skip)
+{
+    int nCount = 100;
+    if (!request.params[1].isNull())
+        nCount = request.params[1].get_int();
+    int nSkip = 0;
+    if (!request.params[2].isNull())
+        nSkip = request.params[2].get_int();
+
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    if (nSkip < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative skip");
+    count = nCount;
+    skip = nSkip;
+}
+
+static UniValue AddressAmount(const ColorIdentifier& colorId, CAmount amount)
+{
+    return colorId.type == TokenTypes::NONE ? ValueFromAmount(amount) : amount;
+}
+
+static UniValue getaddressbalance(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "getaddressbalance \"address\"\n"
+            "\nReturns the confirmed balance of each token held by an address. Requires -addressindex.\n"
+            "For an uncolored address, the balances of all tokens sent to the same key or script are returned.\n"
+            "\nArguments:\n"
+            "1. \"address\"     (string, required) The address, which may be colored\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"token\" : \"token\",   (string) The token, " + CURRENCY_UNIT + " or the color identifier\n"
+            "    \"balance\" : x.xxx,   (numeric) The amount of unspent outputs\n"
+            "    \"received\" : x.xxx,  (numeric) The total amount ever received\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "\"1D1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\"")
+            + HelpExampleRpc("getaddressbalance", "\"1D1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\"")
+        );
+
+    std::optional<ColorIdentifier> color;
+    CScript script = ParseIndexedAddress(request.params[0], color);
+    EnsureAddressIndexReady();
+
+    std::vector<AddressBalance> balances;
+    if (!g_address_index->LookupBalances(script, color, balances)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read the address index");
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (const AddressBalance& balance : balances) {
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("token", balance.color.toHexString());
+        entry.pushKV("balance", AddressAmount(balance.color, balance.balance));
+        entry.pushKV("received", AddressAmount(balance.color, balance.received));
+        ret.push_back(entry);
+    }
+    return ret;
+}
+
+static UniValue getaddressutxos(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw std::runtime_error(
+            "getaddressutxos \"address\" ( count skip )\n"
+            "\nReturns the confirmed unspent outputs of an address, ordered by token and height. Requires -addressindex.\n"
+            "For an uncolored address, the outputs of all tokens sent to the same key or script are returned.\n"
+            "\nArguments:\n"
+            "1. \"address\"     (string, required) The address, which may be colored\n"
+            "2. count         (numeric, optional, default=100) The number of outputs to return\n"
+            "3. skip          (numeric, optional, default=0) The number of outputs to skip\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\" : \"transactionid\",  (string) The transaction id\n"
+            "    \"vout\" : n,                (numeric) The output index\n"
+            "    \"token\" : \"token\",         (string) The token, " + CURRENCY_UNIT + " or the color identifier\n"
+            "    \"amount\" : x.xxx,          (numeric) The amount of the output\n"
+            "    \"height\" : n,              (numeric) The height of the block containing the output\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "\"1D1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\"")
+            + HelpExampleCli("getaddressutxos", "\"1D1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\" 100 200")
+            + HelpExampleRpc("getaddressutxos", "\"1D1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\", 100, 200")
+        );
+
+    std::optional<ColorIdentifier> color;
+    CScript script = ParseIndexedAddress(request.params[0], color);
+    size_t count, skip;
+    ParsePagination(request, count, skip);
+    EnsureAddressIndexReady();
+
+    std::vector<AddressOutput> outputs;
+    if (!g_address_index->LookupOutputs(script, color, true, skip, count, outputs)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read the address index");
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (const AddressOutput& output : outputs) {
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("txid", output.outpoint.hashMalFix.GetHex());
+        entry.pushKV("vout", (int32_t)output.outpoint.n);
+        entry.pushKV("token", output.color.toHexString());
+        entry.pushKV("amount", AddressAmount(output.color, output.amount));
+        entry.pushKV("height", output.height);
+        ret.push_back(entry);
+    }
+    return ret;
+}
+
+static UniValue getaddresshistory(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw std::runtime_error(
+            "getaddresshistory \"address\" ( count skip )\n"
+            "\nReturns the confirmed outputs ever paid to an address and the inputs spending them, ordered by token and height.\n"
+            "Requires -addressindex. For an uncolored address, the outputs of all tokens sent to the same key or script are returned.\n"
+            "\nArguments:\n"
+            "1. \"address\"     (string, required) The address, which may be colored\n"
+            "2. count         (numeric, optional, default=100) The number of outputs to return\n"
+            "3. skip          (numeric, optional, default=0) The number of outputs to skip\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\" : \"transactionid\",  (string) The transaction id\n"
+            "    \"vout\" : n,                (numeric) The output index\n"
+            "    \"token\" : \"token\",         (string) The token, " + CURRENCY_UNIT + " or the color identifier\n"
+            "    \"amount\" : x.xxx,          (numeric) The amount of the output\n"
+            "    \"height\" : n,              (numeric) The height of the block containing the output\n"
+            "    \"spent\" : {                (json object, optional) The input spending the output, if spent\n"
+            "      \"txid\" : \"transactionid\",  (string) The id of the spending transaction\n"
+            "      \"vin\" : n,                 (numeric) The input index\n"
+            "      \"height\" : n,              (numeric) The height of the block containing the spending transaction\n"
+            "    }\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresshistory", "\"1D1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\"")
+            + HelpExampleCli("getaddresshistory", "\"1D1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\" 100 200")
+            + HelpExampleRpc("getaddresshistory", "\"1D1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\", 100, 200")
+        );
+
+    std::optional<ColorIdentifier> color;
+    CScript script = ParseIndexedAddress(request.params[0], color);
+    size_t count, skip;
+    ParsePagination(request, count, skip);
+    EnsureAddressIndexReady();
+
+    std::vector<AddressOutput> outputs;
+    if (!g_address_index->LookupOutputs(script, color, false, skip, count, outputs)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read the address index");
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (const AddressOutput& output : outputs) {
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("txid", output.outpoint.hashMalFix.GetHex());
+        entry.pushKV("vout", (int32_t)output.outpoint.n);
+        entry.pushKV("token", output.color.toHexString());
+        entry.pushKV("amount", AddressAmount(output.color, output.amount));
+        entry.pushKV("height", output.height);
+        if (output.IsSpent()) {
+            UniValue spent(UniValue::VOBJ);
+            spent.pushKV("txid", output.spent_txid.GetHex());
+            spent.pushKV("vin", (int32_t)output.spent_index);
+            spent.pushKV("height", output.spent_height);
+            entry.pushKV("spent", spent);
+        }
+        ret.push_back(entry);
+    }
+    return ret;
+}
+
+/** Check that the token index is enabled and has caught up with the active chain. */
+static void EnsureTokenIndexReady()
+{
+    if (!g_token_index) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Token index is not enabled. Start tapyrusd with -tokenindex");
+    }
+    if (!g_token_index->BlockUntilSyncedToCurrentChain()) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Token index is still in the process of being built");
+    }
+}
+
+static const char* TokenTypeName(TokenTypes type)
+{
+    switch (type) {
+    case TokenTypes::REISSUABLE: return "REISSUABLE";
+    case TokenTypes::NON_REISSUABLE: return "NON_REISSUABLE";
+    case TokenTypes::NFT: return "NFT";
+    default: return "NONE";
+    }
+}
+
+static UniValue gettokeninfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "gettokeninfo \"token\" ( hash_or_height )\n"
+            "\nReturns the issuance and the supply of a token. Requires -tokenindex.\n"
+            "\nArguments:\n"
+            "1. \"token\"          (string, required) The color identifier of the token\n"
+            "2. hash_or_height   (string or numeric, optional) The block hash or height at which the supply is reported,\n"
+            "                    the current tip if not given\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"token\" : \"token\",              (string) The color identifier of the token\n"
+            "  \"type\" : \"type\",                (string) REISSUABLE, NON_REISSUABLE or NFT\n"
+            "  \"issuance_txid\" : \"txid\",       (string) The transaction that first issued the token\n"
+            "  \"issuance_height\" : n,          (numeric) The height of the block containing the issuance\n"
+            "  \"height\" : n,                   (numeric) The height at which the supply is reported\n"
+            "  \"supply\" : n,                   (numeric) The amount of the token in circulation at that height\n"
+            "  \"holders\" : n,                  (numeric) The number of scripts currently holding the token\n"
+            "  \"events\" : n,                   (numeric) The number of transactions that minted or burnt the token\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gettokeninfo", "\"c1ec2fd806701a3f55808cbec3922c38dafaa3070c48c803e9043ee3642c660b46\"")
+            + HelpExampleCli("gettokeninfo", "\"c1ec2fd806701a3f55808cbec3922c38dafaa3070c48c803e9043ee3642c660b46\" 1000")
+            + HelpExampleRpc("gettokeninfo", "\"c1ec2fd806701a3f55808cbec3922c38dafaa3070c48c803e9043ee3642c660b46\", 1000")
+        );
+
+    const ColorIdentifier colorId = ParseTokenColor(request.params[0]);
+    EnsureTokenIndexReady();
+
+    int height;
+    {
+        LOCK(cs_main);
+        height = request.params[1].isNull() ? chainActive.Height() : ParseHashOrHeight(request.params[1])->nHeight;
+    }
+
+    TokenInfo info;
+    if (!g_token_index->LookupToken(colorId, info)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Token not found");
+    }
+    CAmount supply = info.supply;
+    if (!request.params[1].isNull() && !g_token_index->LookupSupply(colorId, height, supply)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read the token index");
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("token", colorId.toHexString());
+    ret.pushKV("type", TokenTypeName(colorId.type));
+    ret.pushKV("issuance_txid", info.issuance_txid.GetHex());
+    ret.pushKV("issuance_height", info.issuance_height);
+    ret.pushKV("height", height);
+    ret.pushKV("supply", supply);
+    ret.pushKV("holders", info.holder_count);
+    ret.pushKV("events", info.event_count);
+    return ret;
+}
+
+static UniValue gettokenhistory(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw std::runtime_error(
+            "gettokenhistory \"token\" ( count skip )\n"
+            "\nReturns the transactions that minted or burnt a token, most recent first. Requires -tokenindex.\n"
+            "\nArguments:\n"
+            "1. \"token\"     (string, required) The color identifier of the token\n"
+            "2. count       (numeric, optional, default=100) The number of transactions to return\n"
+            "3. skip        (numeric, optional, default=0) The number of transactions to skip\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\" : \"transactionid\",  (string) The transaction id\n"
+            "    \"height\" : n,              (numeric) The height of the block containing the transaction\n"
+            "    \"delta\" : n,               (numeric) The amount minted, negative if burnt\n"
+            "    \"supply\" : n,              (numeric) The supply after the transaction\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gettokenhistory", "\"c1ec2fd806701a3f55808cbec3922c38dafaa3070c48c803e9043ee3642c660b46\"")
+            + HelpExampleRpc("gettokenhistory", "\"c1ec2fd806701a3f55808cbec3922c38dafaa3070c48c803e9043ee3642c660b46\", 100, 200")
+        );
+
+    const ColorIdentifier colorId = ParseTokenColor(request.params[0]);
+    size_t count, skip;
+    ParsePagination(request, count, skip);
+    EnsureTokenIndexReady();
+
+    std::vector<TokenEvent> events;
+    if (!g_token_index->LookupEvents(colorId, skip, count, events)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read the token index");
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (const TokenEvent& event : events) {
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("txid", event.txid.GetHex());
+        entry.pushKV("height", event.height);
+        entry.pushKV("delta", event.delta);
+        entry.pushKV("supply", event.supply);
+        ret.push_back(entry);
+    }
+    return ret;
+}
+
+static UniValue gettokenholders(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw std::runtime_error(
+            "gettokenholders \"token\" ( count skip )\n"
+            "\nReturns the scripts holding a token. The only holder of an NFT is its owner. Requires -tokenindex.\n"
+            "\nArguments:\n"
+            "1. \"token\"     (string, required) The color identifier of the token\n"
+            "2. count       (numeric, optional, default=100) The number of holders to return\n"
+            "3. skip        (numeric, optional, default=0) The number of holders to skip\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"scriptPubKey\" : \"script\",  (string) The colored script holding the token\n"
+            "    \"address\" : \"address\",      (string, optional) The address of the script\n"
+            "    \"amount\" : n,               (numeric) The amount held\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gettokenholders", "\"c3ec2fd806701a3f55808cbec3922c38dafaa3070c48c803e9043ee3642c660b46\"")
+            + HelpExampleRpc("gettokenholders", "\"c3ec2fd806701a3f55808cbec3922c38dafaa3070c48c803e9043ee3642c660b46\", 100, 200")
+        );
+
+    const ColorIdentifier colorId = ParseTokenColor(request.params[0]);
+    size_t count, skip;
+    ParsePagination(request, count, skip);
+    EnsureTokenIndexReady();
+
+    std::vector<TokenHolder> holders;
+    if (!g_token_index->LookupHolders(colorId, skip, count, holders)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read the token index");
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (const TokenHolder& holder : holders) {
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("scriptPubKey", HexStr(holder.script.begin(), holder.script.end()));
+        CTxDestination destination;
+        if (ExtractDestination(holder.script, destination)) {
+            entry.pushKV("address", EncodeDestination(destination));
+        }
+        entry.pushKV("amount", holder.amount);
+        ret.push_back(entry);
+    }
+    return ret;
+}
+
 static UniValue getcolor(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -2325,6 +2893,71 @@ static UniValue dumptxoutset(const JSONRPCRequest& request)
     return result;
 }
 
+/**
+ * Load a UTXO set written by dumptxoutset and make its base block the active tip.
+ *
+ * @see ActivateSnapshot
+ */
+static UniValue loadtxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 2)
+        throw std::runtime_error(
+            "loadtxoutset \"path\" \"txoutset_hash\"\n"
+            "\nLoad a serialized UTXO set written by dumptxoutset and use it as the chainstate.\n"
+            "The header of the snapshot base block must already be known, and the active chain must not be past it.\n"
+            "Blocks after the base are then downloaded and validated as usual. Blocks up to the base are not validated.\n"
+            "Wallet transactions in the skipped blocks are not detected. -txindex must be disabled.\n"
+            "\nArguments:\n"
+            "1. \"path\"           (string, required) Path to the snapshot file. If relative, will be prefixed by datadir.\n"
+            "2. \"txoutset_hash\"  (string, required) The expected hash_serialized_3 of the snapshot UTXO set, taken from\n"
+            "                      gettxoutsetinfo or dumptxoutset on a trusted node.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_loaded\": n,        (numeric) The number of coins loaded from the snapshot\n"
+            "  \"base_hash\": \"hex\",      (string) The hash of the base of the snapshot\n"
+            "  \"base_height\": n,         (numeric) The height of the base of the snapshot\n"
+            "  \"path\": \"path\",          (string) The absolute path of the snapshot file\n"
+            "  \"txoutset_hash\": \"hex\"   (string) The hash of the UTXO set contents\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\" \"1a3a974c72d75c933dfb6e6d11983813c593ae8387260a2f7fbaa0cb41894ac1\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"1a3a974c72d75c933dfb6e6d11983813c593ae8387260a2f7fbaa0cb41894ac1\"")
+        );
+
+    const fs::path path = fs::absolute(GetDataDir() / request.params[0].get_str());
+    const uint256 expected_hash = ParseHashV(request.params[1], "txoutset_hash");
+
+    FILE* file{fsbridge::fopen(path, "rb")};
+    CAutoFile afile{file, SER_DISK, CLIENT_VERSION};
+    if (afile.IsNull()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Couldn't open file " + path.string() + " for reading.");
+    }
+
+    SnapshotMetadata metadata;
+    try {
+        afile >> metadata;
+    } catch (const std::ios_base::failure& e) {
+        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("Unable to parse metadata: %s", e.what()));
+    }
+
+    std::string strError;
+    if (!ActivateSnapshot(afile, metadata, expected_hash, strError)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to load UTXO snapshot: " + strError);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindexBase = LookupBlockIndex(metadata.base_blockhash);
+        result.pushKV("coins_loaded", metadata.coins_count);
+        result.pushKV("base_hash", pindexBase->GetBlockHash().ToString());
+        result.pushKV("base_height", pindexBase->nHeight);
+    }
+    result.pushKV("path", path.string());
+    result.pushKV("txoutset_hash", expected_hash.ToString());
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
@@ -2334,6 +2967,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       {} },
     { "blockchain",         "getblockcount",          &getblockcount,          {} },
     { "blockchain",         "getblock",               &getblock,               {"blockhash","verbosity|verbose"} },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         {"blockhash", "filtertype"} },
     { "blockchain",         "getblockhash",           &getblockhash,           {"height"} },
     { "blockchain",         "getblockheader",         &getblockheader,         {"blockhash","verbose"} },
     { "blockchain",         "getchaintips",           &getchaintips,           {} },
@@ -2341,17 +2975,24 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  {"txid","verbose"} },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        {"txid"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose","token"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_type", "hash_or_height", "use_index"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
 
     { "blockchain",         "preciousblock",          &preciousblock,          {"blockhash"} },
     { "blockchain",         "scantxoutset",           &scantxoutset,           {"action", "scanobjects"} },
+    { "blockchain",         "getaddressbalance",      &getaddressbalance,      {"address"} },
+    { "blockchain",         "getaddresshistory",      &getaddresshistory,      {"address", "count", "skip"} },
+    { "blockchain",         "getaddressutxos",        &getaddressutxos,        {"address", "count", "skip"} },
+    { "blockchain",         "gettokenhistory",        &gettokenhistory,        {"token", "count", "skip"} },
+    { "blockchain",         "gettokenholders",        &gettokenholders,        {"token", "count", "skip"} },
+    { "blockchain",         "gettokeninfo",           &gettokeninfo,           {"token", "hash_or_height"} },
     { "blockchain",         "getcolor",                   &getcolor,               {"type","txid","index"} },
     { "blockchain",         "dumptxoutset",           &dumptxoutset,               {"path"} },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           {"path", "txoutset_hash"} },
 
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        {"blockhash"} },
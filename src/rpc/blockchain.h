@@ -6,12 +6,15 @@
 #ifndef BITCOIN_RPC_BLOCKCHAIN_H
 #define BITCOIN_RPC_BLOCKCHAIN_H
 
+#include <optional>
 #include <vector>
 #include <stdint.h>
 #include <amount.h>
+#include <coloridentifier.h>
 #include <primitives/xfield.h>
 
 class CBlock;
+class CBlockUndo;
 class CBlockIndex;
 class UniValue;
 
@@ -20,14 +23,14 @@ static constexpr int NUM_GETBLOCKSTATS_PERCENTILES = 5;
 /** Callback for when block tip changed. */
 void RPCNotifyBlockChange(bool ibd, const CBlockIndex *);
 
-/** Block description to JSON */
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+/** Block description to JSON. If blockUndo is given, the inputs of each transaction include the output they spend. */
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false, const CBlockUndo* blockUndo = nullptr);
 
 /** Mempool information to JSON */
 UniValue mempoolInfoToJSON();
 
-/** Mempool to JSON */
-UniValue mempoolToJSON(bool fVerbose = false);
+/** Mempool to JSON, optionally only the transactions of a token */
+UniValue mempoolToJSON(bool fVerbose = false, const std::optional<ColorIdentifier>& color = std::nullopt);
 
 /** Block header to JSON */
 UniValue blockheaderToJSON(const CBlockIndex* blockindex);
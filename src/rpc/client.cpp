@@ -117,6 +117,17 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "importmulti", 1, "options" },
     { "verifychain", 0, "checklevel" },
     { "verifychain", 1, "nblocks" },
+    { "gettxoutsetinfo", 1, "hash_or_height" },
+    { "gettxoutsetinfo", 2, "use_index" },
+    { "getaddresshistory", 1, "count" },
+    { "getaddresshistory", 2, "skip" },
+    { "getaddressutxos", 1, "count" },
+    { "getaddressutxos", 2, "skip" },
+    { "gettokeninfo", 1, "hash_or_height" },
+    { "gettokenhistory", 1, "count" },
+    { "gettokenhistory", 2, "skip" },
+    { "gettokenholders", 1, "count" },
+    { "gettokenholders", 2, "skip" },
     { "getblockstats", 0, "hash_or_height" },
     { "getblockstats", 1, "stats" },
     { "pruneblockchain", 0, "height" },
@@ -131,6 +142,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getmempoolancestors", 1, "verbose" },
     { "getmempooldescendants", 1, "verbose" },
     { "bumpfee", 1, "options" },
+    { "setsigcachesize", 0, "size" },
     { "logging", 0, "include" },
     { "logging", 1, "exclude" },
     { "disconnectnode", 1, "nodeid" },
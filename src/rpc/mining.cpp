@@ -234,7 +234,12 @@ UniValue getnewblock(const JSONRPCRequest& request)
     }
     CScript coinbaseScript {GetScriptForDestination(destination)};
 
-    std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(coinbaseScript, true, &xfield));
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    // The template kept by the builder neither changes an xfield nor leaves out young transactions
+    if (g_block_template_builder && required_wait == 0 && xfield.xfieldType == TAPYRUS_XFIELDTYPES::NONE)
+        pblocktemplate = g_block_template_builder->GetBlockTemplate(coinbaseScript);
+    else
+        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(coinbaseScript, required_wait, &xfield);
     if (!pblocktemplate.get())
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Wallet keypool empty");
     {
@@ -359,6 +364,7 @@ static UniValue getblocktemplate(const JSONRPCRequest& request)
             "      \"flags\" : \"xx\"                  (string) key name is to be ignored, and value included in scriptSig\n"
             "  },\n"
             "  \"coinbasevalue\" : n,              (numeric) maximum allowable input to coinbase transaction, including the generation award and transaction fees (in tapyrus)\n"
+            "  \"feedelta\" : n,                   (numeric) change of the transaction fees against the template handed out before (in tapyrus)\n"
             "  \"coinbasetxn\" : { ... },          (json object) information for coinbase transaction\n"
             "  \"target\" : \"xxxx\",                (string) The hash target\n"
             "  \"mintime\" : xxx,                  (numeric) The minimum timestamp appropriate for next block time in seconds since epoch (Jan 1 1970 GMT)\n"
@@ -500,6 +506,7 @@ static UniValue getblocktemplate(const JSONRPCRequest& request)
     static CBlockIndex* pindexPrev;
     static int64_t nStart;
     static std::unique_ptr<CBlockTemplate> pblocktemplate;
+    static CAmount nFeeDelta;
     if (pindexPrev != chainActive.Tip() ||
         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
     {
@@ -513,7 +520,12 @@ static UniValue getblocktemplate(const JSONRPCRequest& request)
 
         // Create new block
         CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy);
+        if (g_block_template_builder) {
+            pblocktemplate = g_block_template_builder->GetBlockTemplate(scriptDummy, &nFeeDelta);
+        } else {
+            pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy);
+            nFeeDelta = 0;
+        }
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
@@ -582,6 +594,7 @@ static UniValue getblocktemplate(const JSONRPCRequest& request)
     result.pushKV("transactions", transactions);
     result.pushKV("coinbaseaux", aux);
     result.pushKV("coinbasevalue", (int64_t)pblock->vtx[0]->vout[0].nValue);
+    result.pushKV("feedelta", nFeeDelta);
     result.pushKV("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast));
     result.pushKV("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1);
     result.pushKV("mutable", aMutable);
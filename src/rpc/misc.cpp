@@ -14,6 +14,7 @@
 #include <rpc/protocol.h>
 #include <rpc/server.h>
 #include <rpc/util.h>
+#include <script/sigcache.h>
 #include <util.h>
 #include <utilstrencodings.h>
 #if ENABLE_WALLET
@@ -343,6 +344,70 @@ static UniValue getmemoryinfo(const JSONRPCRequest& request)
     }
 }
 
+static UniValue SigCacheInfoToJSON(const SignatureCacheStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("bytes", (uint64_t)stats.bytes);
+    obj.pushKV("capacity", (uint64_t)stats.capacity);
+    obj.pushKV("entries", (uint64_t)stats.entries);
+    obj.pushKV("hits", stats.hits);
+    obj.pushKV("misses", stats.misses);
+    obj.pushKV("inserts", stats.inserts);
+    obj.pushKV("evictions", stats.evictions);
+    return obj;
+}
+
+static const std::string SIGCACHEINFO_RESULT_HELP =
+    "{\n"
+    "  \"bytes\": xxxxx,         (numeric) Memory used by the cache\n"
+    "  \"capacity\": xxxxx,      (numeric) Number of signatures the cache can hold\n"
+    "  \"entries\": xxxxx,       (numeric) Number of signatures the cache holds\n"
+    "  \"hits\": xxxxx,          (numeric) Lookups that found the signature, since startup\n"
+    "  \"misses\": xxxxx,        (numeric) Lookups that did not find the signature, since startup\n"
+    "  \"inserts\": xxxxx,       (numeric) Signatures added, since startup\n"
+    "  \"evictions\": xxxxx,     (numeric) Signatures dropped to make room for others, since startup\n"
+    "}\n";
+
+static UniValue getsigcacheinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getsigcacheinfo\n"
+            "Returns the occupancy of the signature cache and its hit, miss and eviction counters.\n"
+            "\nResult:\n"
+            + SIGCACHEINFO_RESULT_HELP +
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
+
+    return SigCacheInfoToJSON(GetSignatureCacheStats());
+}
+
+static UniValue setsigcachesize(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "setsigcachesize size\n"
+            "Resizes the signature cache while the node runs, keeping the signatures that still fit.\n"
+            "The script execution cache keeps the size set by -maxsigcachesize.\n"
+            "\nArguments:\n"
+            "1. size    (numeric, required) The memory to use for the signature cache, in MiB\n"
+            "\nResult:\n"
+            + SIGCACHEINFO_RESULT_HELP +
+            "\nExamples:\n"
+            + HelpExampleCli("setsigcachesize", "64")
+            + HelpExampleRpc("setsigcachesize", "64")
+        );
+
+    const int64_t size = request.params[0].get_int64();
+    if (size < 0 || size > MAX_MAX_SIG_CACHE_SIZE) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("size must be between 0 and %d", MAX_MAX_SIG_CACHE_SIZE));
+    }
+    ResizeSignatureCache((size_t)size << 20);
+    return SigCacheInfoToJSON(GetSignatureCacheStats());
+}
+
 static void EnableOrDisableLogCategories(UniValue cats, bool enable) {
     cats = cats.get_array();
     for (unsigned int i = 0; i < cats.size(); ++i) {
@@ -459,6 +524,8 @@ static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getmemoryinfo",          &getmemoryinfo,          {"mode"} },
+    { "control",            "getsigcacheinfo",        &getsigcacheinfo,        {} },
+    { "control",            "setsigcachesize",        &setsigcachesize,        {"size"} },
     { "control",            "logging",                &logging,                {"include", "exclude"}},
     { "util",               "validateaddress",        &validateaddress,        {"address"} }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         {"nrequired","keys"} },
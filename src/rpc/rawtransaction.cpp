@@ -5,6 +5,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <chain.h>
+#include <chainstate.h>
 #include <coins.h>
 #include <compat/byteswap.h>
 #include <consensus/validation.h>
@@ -42,14 +43,14 @@
 #include <univalue.h>
 
 
-static void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
+static void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry, const CTxUndo* txundo = nullptr)
 {
     // Call into TxToUniv() in tapyrus-common to decode the transaction hex.
     //
     // Blockchain contextual information (confirmations and blocktime) is not
     // available to code in tapyrus-common, so we query them here and push the
     // data into the returned UniValue.
-    TxToUniv(tx, uint256(), entry, true, RPCSerializationFlags());
+    TxToUniv(tx, uint256(), entry, true, RPCSerializationFlags(), txundo);
 
     if (!hashBlock.IsNull()) {
         LOCK(cs_main);
@@ -82,12 +83,14 @@ static UniValue getrawtransaction(const JSONRPCRequest& request)
             "DEPRECATED: for now, it also works for transactions with unspent outputs.\n"
 
             "\nReturn the raw transaction data.\n"
-            "\nIf verbose is 'true', returns an Object with information about 'txid'.\n"
+            "\nIf verbose is 'true' or 1, returns an Object with information about 'txid'.\n"
+            "If verbose is 2, the Object also contains the output spent by each input and the fee, when the transaction\n"
+            "is confirmed and the undo data of its block is available.\n"
             "If verbose is 'false' or omitted, returns a string that is serialized, hex-encoded data for 'txid'.\n"
 
             "\nArguments:\n"
             "1. \"txid\"      (string, required) The transaction id\n"
-            "2. verbose     (bool, optional, default=false) If false, return a string, otherwise return a json object\n"
+            "2. verbose     (bool or numeric, optional, default=false) If false or 0, return a string, 1 or true for a json object, 2 for a json object with the spent outputs\n"
             "3. \"blockhash\" (string, optional) The block in which to look for the transaction\n"
 
             "\nResult (if verbose is not set or set to false):\n"
@@ -110,7 +113,14 @@ static UniValue getrawtransaction(const JSONRPCRequest& request)
             "         \"asm\": \"asm\",  (string) asm\n"
             "         \"hex\": \"hex\"   (string) hex\n"
             "       },\n"
-            "       \"sequence\": n      (numeric) The script sequence number\n"
+            "       \"sequence\": n,     (numeric) The script sequence number\n"
+            "       \"prevout\": {       (json object) The output spent by this input (only present if verbose is 2)\n"
+            "         \"generated\": b,  (bool) Whether the output was created by a coinbase transaction\n"
+            "         \"height\": n,     (numeric) The height of the block containing the output\n"
+            "         \"token\": \"color\", (string) Color Identifier for tokens or " + CURRENCY_UNIT + "\n"
+            "         \"value\": x.xxx,  (numeric) The value in the token stated above\n"
+            "         \"scriptPubKey\": {...} (json object) The script of the output\n"
+            "       }\n"
             "     }\n"
             "     ,...\n"
             "  ],\n"
@@ -132,6 +142,7 @@ static UniValue getrawtransaction(const JSONRPCRequest& request)
             "     }\n"
             "     ,...\n"
             "  ],\n"
+            "  \"fee\" : x.xxx,            (numeric) The transaction fee in " + CURRENCY_UNIT + " (only present if verbose is 2)\n"
             "  \"blockhash\" : \"hash\",   (string) the block hash\n"
             "  \"confirmations\" : n,      (numeric) The confirmations\n"
             "  \"time\" : ttt,             (numeric) The transaction time in seconds since epoch (Jan 1 1970 GMT)\n"
@@ -144,6 +155,7 @@ static UniValue getrawtransaction(const JSONRPCRequest& request)
             + HelpExampleRpc("getrawtransaction", "\"mytxid\", true")
             + HelpExampleCli("getrawtransaction", "\"mytxid\" false \"myblockhash\"")
             + HelpExampleCli("getrawtransaction", "\"mytxid\" true \"myblockhash\"")
+            + HelpExampleCli("getrawtransaction", "\"mytxid\" 2")
         );
 
     bool in_active_chain = true;
@@ -156,9 +168,9 @@ static UniValue getrawtransaction(const JSONRPCRequest& request)
     }
 
     // Accept either a bool (true) or a num (>=1) to indicate verbose output.
-    bool fVerbose = false;
+    int verbosity = 0;
     if (!request.params[1].isNull()) {
-        fVerbose = request.params[1].isNum() ? (request.params[1].get_int() != 0) : request.params[1].get_bool();
+        verbosity = request.params[1].isNum() ? request.params[1].get_int() : (request.params[1].get_bool() ? 1 : 0);
     }
 
     if (!request.params[2].isNull()) {
@@ -196,13 +208,34 @@ static UniValue getrawtransaction(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, errmsg + ". Use gettransaction for wallet transactions.");
     }
 
-    if (!fVerbose) {
+    if (verbosity <= 0) {
         return EncodeHexTx(*tx, RPCSerializationFlags());
     }
 
     UniValue result(UniValue::VOBJ);
     if (blockindex) result.pushKV("in_active_chain", in_active_chain);
-    TxToJSON(*tx, hash_block, result);
+
+    // The spent outputs of a confirmed transaction are read from the undo data of its block.
+    // They are left out for mempool transactions and when the block or its undo data is not available.
+    CBlockUndo blockUndo;
+    const CTxUndo* txundo = nullptr;
+    if (verbosity >= 2 && !hash_block.IsNull() && !tx->IsCoinBase()) {
+        LOCK(cs_main);
+        if (!blockindex) {
+            blockindex = LookupBlockIndex(hash_block);
+        }
+        CBlock block;
+        if (blockindex && !IsBlockPruned(blockindex) && ReadBlockFromDisk(block, blockindex) &&
+            UndoReadFromDisk(blockUndo, blockindex)) {
+            for (size_t i = 1; i < block.vtx.size(); ++i) {
+                if (block.vtx[i]->GetHashMalFix() == tx->GetHashMalFix()) {
+                    txundo = &blockUndo.vtxundo.at(i - 1);
+                    break;
+                }
+            }
+        }
+    }
+    TxToJSON(*tx, hash_block, result, txundo);
     return result;
 }
 
@@ -1115,6 +1148,10 @@ static UniValue sendrawtransaction(const JSONRPCRequest& request)
     if (!request.params[1].isNull() && request.params[1].get_bool())
         nMaxRawTxFee = 0;
 
+    // Check the scripts before cs_main is taken, so that concurrent calls do not wait for each other
+    std::vector<CTxMempoolPreCheck> prechecks;
+    PreCheckForMemPool({tx}, prechecks);
+
     { // cs_main scope
     LOCK(cs_main);
     CCoinsViewCache &view = *pcoinsTip;
@@ -1124,10 +1161,13 @@ static UniValue sendrawtransaction(const JSONRPCRequest& request)
         fHaveChain = !existingCoin.IsSpent();
     }
     bool fHaveMempool = mempool.exists(hashTx);
+    if (fHaveMempool || fHaveChain)
+        UncachePreCheckedCoins(prechecks);
     if (!fHaveMempool && !fHaveChain) {
         // push to local node and sync with wallets
         CTxMempoolAcceptanceOptions opt;
         opt.nAbsurdFee = nMaxRawTxFee;
+        opt.precheck = &prechecks[0];
         if (!AcceptToMemoryPool(std::move(tx), opt)) {
             if (opt.state.IsInvalid()) {
                 throw JSONRPCError(RPC_TRANSACTION_REJECTED, FormatStateMessage(opt.state));
@@ -12,6 +12,7 @@
 #include <crypto/sha256.h>
 #include <pubkey.h>
 #include <script/script.h>
+#include <streams.h>
 #include <uint256.h>
 
 typedef std::vector<unsigned char> valtype;
@@ -950,7 +951,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                         //serror is set
                         return false;
                     }
-                    bool fSuccess = checker.CheckSig(vchSig, vchPubKey, scriptCode);
+                    bool fSuccess = checker.CheckSigDeferrable(vchSig, vchPubKey, scriptCode);
 
                     if (!fSuccess && (flags & SCRIPT_VERIFY_NULLFAIL) && vchSig.size())
                         return set_error(serror, SCRIPT_ERR_SIG_NULLFAIL);
@@ -995,7 +996,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                         CSHA256().Write(vchMessage.data(), vchMessage.size())
                             .Finalize(vchHash.data());
                         //no hashtype in signature. call VerifySignature not CheckSig
-                        fSuccess = checker.VerifySignature(vchSig, CPubKey(vchPubKey), uint256(vchHash));
+                        fSuccess = checker.VerifySignatureDeferrable(vchSig, CPubKey(vchPubKey), uint256(vchHash));
                     }
 
                     if (!fSuccess && (flags & SCRIPT_VERIFY_NULLFAIL) && vchSig.size()) {
@@ -1059,6 +1060,9 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     }
 
                     bool fSuccess = true;
+                    // With as many signatures as keys, every signature has to match its key,
+                    // so none of them is tried against a key it does not match.
+                    const bool fDeferrable = nSigsCount == nKeysCount;
                     const SignatureScheme currentScheme(stacktop(-isig).size() == CPubKey::COMPACT_SIGNATURE_SIZE ?SignatureScheme::SCHNORR : SignatureScheme::ECDSA);
                     while (fSuccess && nSigsCount > 0)
                     {
@@ -1083,7 +1087,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                         }
 
                         // Check signature
-                        bool fOk = checker.CheckSig(vchSig, vchPubKey, scriptCode);
+                        bool fOk = fDeferrable ? checker.CheckSigDeferrable(vchSig, vchPubKey, scriptCode) : checker.CheckSig(vchSig, vchPubKey, scriptCode);
 
                         if (fOk) {
                             isig++;
@@ -1302,7 +1306,38 @@ public:
 } // namespace
 
 template <class T>
-uint256 SignatureHash(const CScript& scriptCode, const T& txTo, unsigned int nIn, int nHashType, const CAmount& amount)
+PrecomputedTransactionData::PrecomputedTransactionData(const T& txTo)
+{
+    CVectorWriter inputs_writer(SER_GETHASH, 0, inputs, 0);
+    CVectorWriter inputs_zero_sequence_writer(SER_GETHASH, 0, inputs_zero_sequence, 0);
+    for (const CTxIn& txin : txTo.vin) {
+        inputs_writer << txin.prevout << CScript() << txin.nSequence;
+        inputs_zero_sequence_writer << txin.prevout << CScript() << (int)0;
+    }
+    assert(inputs.size() == txTo.vin.size() * INPUT_SIZE);
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nFeatures;
+    ::WriteCompactSize(ss, txTo.vin.size());
+    CHashWriter ss_zero_sequence(ss);
+    prefix.reserve(txTo.vin.size());
+    prefix_zero_sequence.reserve(txTo.vin.size());
+    for (size_t i = 0; i < txTo.vin.size(); i++) {
+        prefix.push_back(ss);
+        prefix_zero_sequence.push_back(ss_zero_sequence);
+        ss.write((const char*)&inputs[i * INPUT_SIZE], INPUT_SIZE);
+        ss_zero_sequence.write((const char*)&inputs_zero_sequence[i * INPUT_SIZE], INPUT_SIZE);
+    }
+
+    CVectorWriter outputs_writer(SER_GETHASH, 0, outputs, 0);
+    ::WriteCompactSize(outputs_writer, txTo.vout.size());
+    for (const CTxOut& txout : txTo.vout) {
+        outputs_writer << txout;
+    }
+}
+
+template <class T>
+uint256 SignatureHash(const CScript& scriptCode, const T& txTo, unsigned int nIn, int nHashType, const CAmount& amount, const PrecomputedTransactionData* cache)
 {
     assert(nIn < txTo.vin.size());
 
@@ -1319,9 +1354,41 @@ uint256 SignatureHash(const CScript& scriptCode, const T& txTo, unsigned int nIn
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer<T> txTmp(txTo, scriptCode, nIn, nHashType);
 
-    // Serialize and hash
-    CHashWriter ss(SER_GETHASH, 0);
-    ss << txTmp << nHashType;
+    if (!cache) {
+        // Serialize and hash
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << txTmp << nHashType;
+        return ss.GetHash();
+    }
+
+    // The same serialization, with the parts not depending on nIn taken from the cache.
+    assert(cache->inputs.size() == txTo.vin.size() * PrecomputedTransactionData::INPUT_SIZE);
+    const bool fAnyoneCanPay = !!(nHashType & SIGHASH_ANYONECANPAY);
+    const bool fHashSingle = (nHashType & 0x1f) == SIGHASH_SINGLE;
+    const bool fHashNone = (nHashType & 0x1f) == SIGHASH_NONE;
+    const bool fZeroSequence = fHashSingle || fHashNone;
+
+    CHashWriter ss = fAnyoneCanPay ? CHashWriter(SER_GETHASH, 0) : (fZeroSequence ? cache->prefix_zero_sequence[nIn] : cache->prefix[nIn]);
+    if (fAnyoneCanPay) {
+        ss << txTo.nFeatures;
+        ::WriteCompactSize(ss, 1);
+    }
+    txTmp.SerializeInput(ss, nIn);
+    if (!fAnyoneCanPay) {
+        const std::vector<unsigned char>& inputs = fZeroSequence ? cache->inputs_zero_sequence : cache->inputs;
+        const size_t pos = (nIn + 1) * PrecomputedTransactionData::INPUT_SIZE;
+        ss.write((const char*)inputs.data() + pos, inputs.size() - pos);
+    }
+    if (fHashNone) {
+        ::WriteCompactSize(ss, 0);
+    } else if (fHashSingle) {
+        ::WriteCompactSize(ss, nIn + 1);
+        for (unsigned int nOutput = 0; nOutput <= nIn; nOutput++)
+            txTmp.SerializeOutput(ss, nOutput);
+    } else {
+        ss.write((const char*)cache->outputs.data(), cache->outputs.size());
+    }
+    ss << txTo.nLockTime << nHashType;
     return ss.GetHash();
 }
 
@@ -1336,6 +1403,18 @@ bool GenericTransactionSignatureChecker<T>::VerifySignature(const std::vector<un
 
 template <class T>
 bool GenericTransactionSignatureChecker<T>::CheckSig(const std::vector<unsigned char>& vchSigIn, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const
+{
+    return CheckSig(vchSigIn, vchPubKey, scriptCode, false);
+}
+
+template <class T>
+bool GenericTransactionSignatureChecker<T>::CheckSigDeferrable(const std::vector<unsigned char>& vchSigIn, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const
+{
+    return CheckSig(vchSigIn, vchPubKey, scriptCode, true);
+}
+
+template <class T>
+bool GenericTransactionSignatureChecker<T>::CheckSig(const std::vector<unsigned char>& vchSigIn, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, bool fDeferrable) const
 {
     CPubKey pubkey(vchPubKey);
     if (!pubkey.IsValid())
@@ -1348,9 +1427,9 @@ bool GenericTransactionSignatureChecker<T>::CheckSig(const std::vector<unsigned
     int nHashType = vchSig.back();
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount);
+    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, txdata);
 
-    if (!VerifySignature(vchSig, pubkey, sighash))
+    if (!(fDeferrable ? VerifySignatureDeferrable(vchSig, pubkey, sighash) : VerifySignature(vchSig, pubkey, sighash)))
         return false;
 
     return true;
@@ -1437,8 +1516,10 @@ bool GenericTransactionSignatureChecker<T>::CheckSequence(const CScriptNum& nSeq
 }
 
 // explicit instantiation
-template uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount);
-template uint256 SignatureHash(const CScript& scriptCode, const CMutableTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount);
+template uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount, const PrecomputedTransactionData* cache);
+template uint256 SignatureHash(const CScript& scriptCode, const CMutableTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount, const PrecomputedTransactionData* cache);
+template PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& tx);
+template PrecomputedTransactionData::PrecomputedTransactionData(const CMutableTransaction& tx);
 template class GenericTransactionSignatureChecker<CTransaction>;
 template class GenericTransactionSignatureChecker<CMutableTransaction>;
 
@@ -11,6 +11,7 @@
 #include <primitives/transaction.h>
 #include <consensus/consensus.h>
 #include <coloridentifier.h>
+#include <hash.h>
 
 #include <vector>
 #include <stdint.h>
@@ -126,8 +127,30 @@ bool CheckECDSASignatureEncoding(const std::vector<unsigned char> &vchSig, Scrip
 
 bool CheckSchnorrSignatureEncoding(const std::vector<unsigned char> &vchSig, ScriptError* serror, bool dataSignature = false);
 
+/**
+ * The parts of the signature hash serialization of a transaction that do not depend on
+ * the input being signed, computed once and shared by the checks of all its inputs, so
+ * that a transaction with many inputs is not serialized again for each signature.
+ */
+struct PrecomputedTransactionData
+{
+    //! Size of an input serialized with an empty script
+    static constexpr size_t INPUT_SIZE = 41;
+
+    //! The inputs serialized with an empty script, with their nSequence kept as for
+    //! SIGHASH_ALL or zeroed as for SIGHASH_NONE and SIGHASH_SINGLE
+    std::vector<unsigned char> inputs, inputs_zero_sequence;
+    //! The hash state after the transaction header and the inputs before each input
+    std::vector<CHashWriter> prefix, prefix_zero_sequence;
+    //! The number of outputs and the outputs, serialized as for SIGHASH_ALL
+    std::vector<unsigned char> outputs;
+
+    template <class T>
+    explicit PrecomputedTransactionData(const T& tx);
+};
+
 template <class T>
-uint256 SignatureHash(const CScript& scriptCode, const T& txTo, unsigned int nIn, int nHashType, const CAmount& amount);
+uint256 SignatureHash(const CScript& scriptCode, const T& txTo, unsigned int nIn, int nHashType, const CAmount& amount, const PrecomputedTransactionData* cache = nullptr);
 
 class BaseSignatureChecker
 {
@@ -142,6 +165,22 @@ public:
         return false;
     }
 
+    /**
+     * Variants of VerifySignature and CheckSig for a signature that the script needs to be
+     * valid to succeed. A checker may assume such a signature is valid and collect it to be
+     * verified later; the script must then be run again without deferring if any of them
+     * turns out to be invalid.
+     */
+    virtual bool VerifySignatureDeferrable(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const
+    {
+        return VerifySignature(vchSig, vchPubKey, sighash);
+    }
+
+    virtual bool CheckSigDeferrable(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const
+    {
+        return CheckSig(scriptSig, vchPubKey, scriptCode);
+    }
+
     virtual bool CheckLockTime(const CScriptNum& nLockTime) const
     {
          return false;
@@ -162,11 +201,15 @@ private:
     const T* txTo;
     unsigned int nIn;
     const CAmount amount;
+    const PrecomputedTransactionData* txdata;
+
+    bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, bool fDeferrable) const;
 
 public:
-    GenericTransactionSignatureChecker(const T* txToIn, unsigned int nInIn, const CAmount& amountIn) : txTo(txToIn), nIn(nInIn), amount(amountIn) {}
+    GenericTransactionSignatureChecker(const T* txToIn, unsigned int nInIn, const CAmount& amountIn, const PrecomputedTransactionData* txdataIn = nullptr) : txTo(txToIn), nIn(nInIn), amount(amountIn), txdata(txdataIn) {}
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const override;
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const override;
+    bool CheckSigDeferrable(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const override;
     bool CheckLockTime(const CScriptNum& nLockTime) const override;
     bool CheckSequence(const CScriptNum& nSequence) const override;
 };
@@ -11,10 +11,185 @@
 #include <uint256.h>
 #include <util.h>
 
-#include <cuckoocache.h>
-
+#include <algorithm>
+#include <cstring>
+#include <functional>
 #include <thread>
-#include <shared_mutex>
+
+SignatureCacheSet::Table::Table(size_t n_buckets_in) :
+    slots(std::make_unique<Slot[]>(n_buckets_in * BUCKET_SIZE)), n_buckets(n_buckets_in) {}
+
+SignatureCacheSet::SignatureCacheSet() : m_table(new Table(1)) {}
+
+SignatureCacheSet::~SignatureCacheSet()
+{
+    delete m_table.load();
+}
+
+bool SignatureCacheSet::ReadSlot(const Slot& slot, uint64_t words[4])
+{
+    while (true) {
+        const uint32_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq & 1) continue; // a writer is changing the slot
+        for (int i = 0; i < 4; ++i) {
+            words[i] = slot.words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == seq) {
+            return words[0] || words[1] || words[2] || words[3];
+        }
+    }
+}
+
+SignatureCacheSet::Slot* SignatureCacheSet::FindBucket(const Table& table, const uint64_t words[4], int choice)
+{
+    // Entries are nonced hashes, so any of their bits can pick the bucket.
+    return &table.slots[(words[choice * 2] % table.n_buckets) * BUCKET_SIZE];
+}
+
+SignatureCacheSet::Shard& SignatureCacheSet::ThreadShard()
+{
+    static thread_local const size_t index = std::hash<std::thread::id>()(std::this_thread::get_id()) % SHARDS;
+    return m_shards[index];
+}
+
+bool SignatureCacheSet::contains(const uint256& entry, bool erase)
+{
+    uint64_t key[4];
+    std::memcpy(key, entry.begin(), sizeof(key));
+
+    // Pin the table so that a concurrent resize does not free it under us.
+    Shard& shard = ThreadShard();
+    shard.readers.fetch_add(1);
+    const Table& table = *m_table.load();
+    bool found = false;
+    for (int choice = 0; choice < 2 && !found; ++choice) {
+        Slot* bucket = FindBucket(table, key, choice);
+        for (size_t i = 0; i < BUCKET_SIZE && !found; ++i) {
+            uint64_t words[4];
+            if (ReadSlot(bucket[i], words) && std::equal(words, words + 4, key)) {
+                if (erase) bucket[i].erased.store(true, std::memory_order_relaxed);
+                found = true;
+            }
+        }
+    }
+    shard.readers.fetch_sub(1, std::memory_order_release);
+
+    (found ? shard.hits : shard.misses).fetch_add(1, std::memory_order_relaxed);
+    return found;
+}
+
+bool SignatureCacheSet::InsertInto(Table& table, const uint64_t words[4], bool& inserted)
+{
+    Slot* buckets[2] = {FindBucket(table, words, 0), FindBucket(table, words, 1)};
+
+    // Only this thread writes to the table, so its slots can be read directly.
+    Slot* empty_slots[2] = {nullptr, nullptr};
+    size_t n_empty[2] = {0, 0};
+    Slot* erased_slot = nullptr;
+    for (size_t i = 0; i < 2 * BUCKET_SIZE; ++i) {
+        const size_t b = i / BUCKET_SIZE;
+        Slot& slot = buckets[b][i % BUCKET_SIZE];
+        bool same = true, empty = true;
+        for (int j = 0; j < 4; ++j) {
+            const uint64_t word = slot.words[j].load(std::memory_order_relaxed);
+            same &= word == words[j];
+            empty &= word == 0;
+        }
+        if (same) {
+            slot.erased.store(false, std::memory_order_relaxed);
+            inserted = false;
+            return false;
+        }
+        if (empty) {
+            if (!empty_slots[b]) empty_slots[b] = &slot;
+            ++n_empty[b];
+        } else if (!erased_slot && slot.erased.load(std::memory_order_relaxed)) {
+            erased_slot = &slot;
+        }
+    }
+
+    // Prefer an empty slot in the emptier bucket, then an erased entry, and only then
+    // evict a live entry.
+    bool evicted = false;
+    Slot* empty_slot = empty_slots[n_empty[1] > n_empty[0] ? 1 : 0];
+    Slot* target = empty_slot ? empty_slot : erased_slot;
+    if (empty_slot) {
+        ++m_entries;
+    } else if (!target) {
+        target = &buckets[words[1] & 1][(words[1] >> 1) % BUCKET_SIZE];
+        evicted = true;
+    }
+
+    const uint32_t seq = target->seq.load(std::memory_order_relaxed);
+    target->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int j = 0; j < 4; ++j) {
+        target->words[j].store(words[j], std::memory_order_relaxed);
+    }
+    target->seq.store(seq + 2, std::memory_order_release);
+    target->erased.store(false, std::memory_order_relaxed);
+    inserted = true;
+    return evicted;
+}
+
+void SignatureCacheSet::insert(const uint256& entry)
+{
+    uint64_t words[4];
+    std::memcpy(words, entry.begin(), sizeof(words));
+
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    bool inserted;
+    if (InsertInto(*m_table.load(std::memory_order_relaxed), words, inserted)) ++m_evictions;
+    if (inserted) ++m_inserts;
+}
+
+size_t SignatureCacheSet::setup_bytes(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    const size_t n_buckets = std::max<size_t>(1, bytes / (sizeof(Slot) * BUCKET_SIZE));
+    std::unique_ptr<Table> table = std::make_unique<Table>(n_buckets);
+
+    // Move the live entries over; those that no longer fit count as evicted.
+    Table* old_table = m_table.load(std::memory_order_relaxed);
+    m_entries = 0;
+    for (size_t i = 0; i < old_table->n_buckets * BUCKET_SIZE; ++i) {
+        const Slot& slot = old_table->slots[i];
+        uint64_t words[4];
+        for (int j = 0; j < 4; ++j) {
+            words[j] = slot.words[j].load(std::memory_order_relaxed);
+        }
+        if ((!words[0] && !words[1] && !words[2] && !words[3]) || slot.erased.load(std::memory_order_relaxed)) continue;
+        bool inserted;
+        if (InsertInto(*table, words, inserted)) ++m_evictions;
+    }
+
+    m_table.store(table.release());
+    // A reader either pinned the old table before it was replaced, or loads the new one.
+    for (Shard& shard : m_shards) {
+        while (shard.readers.load() != 0) {
+            std::this_thread::yield();
+        }
+    }
+    delete old_table;
+    return n_buckets * BUCKET_SIZE;
+}
+
+SignatureCacheStats SignatureCacheSet::GetStats()
+{
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    SignatureCacheStats stats;
+    stats.capacity = m_table.load(std::memory_order_relaxed)->n_buckets * BUCKET_SIZE;
+    stats.bytes = stats.capacity * sizeof(Slot);
+    stats.entries = m_entries;
+    for (const Shard& shard : m_shards) {
+        stats.hits += shard.hits.load(std::memory_order_relaxed);
+        stats.misses += shard.misses.load(std::memory_order_relaxed);
+    }
+    stats.inserts = m_inserts;
+    stats.evictions = m_evictions;
+    return stats;
+}
 
 namespace {
 /**
@@ -27,9 +202,7 @@ class CSignatureCache
 private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
-    map_type setValid;
-    std::shared_mutex cs_sigcache;
+    SignatureCacheSet setValid;
 
 public:
     CSignatureCache()
@@ -46,19 +219,21 @@ public:
     bool
     Get(const uint256& entry, const bool erase)
     {
-        std::shared_lock<std::shared_mutex> lock(cs_sigcache);
         return setValid.contains(entry, erase);
     }
 
     void Set(uint256& entry)
     {
-        std::unique_lock<std::shared_mutex> lock(cs_sigcache);
         setValid.insert(entry);
     }
-    uint32_t setup_bytes(size_t n)
+    size_t setup_bytes(size_t n)
     {
         return setValid.setup_bytes(n);
     }
+    SignatureCacheStats GetStats()
+    {
+        return setValid.GetStats();
+    }
 };
 
 /* In previous versions of this code, signatureCache was a local static variable
@@ -79,7 +254,19 @@ void InitSignatureCache()
     size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
     size_t nElems = signatureCache.setup_bytes(nMaxCacheSize);
     LogPrintf("Using %zu MiB out of %zu/2 requested for signature cache, able to store %zu elements\n",
-            (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
+            signatureCache.GetStats().bytes >> 20, (nMaxCacheSize*2)>>20, nElems);
+}
+
+size_t ResizeSignatureCache(size_t bytes)
+{
+    size_t nElems = signatureCache.setup_bytes(bytes);
+    LogPrintf("Resized signature cache to %zu MiB, able to store %zu elements\n", signatureCache.GetStats().bytes >> 20, nElems);
+    return nElems;
+}
+
+SignatureCacheStats GetSignatureCacheStats()
+{
+    return signatureCache.GetStats();
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
@@ -94,3 +281,65 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
         signatureCache.Set(entry);
     return true;
 }
+
+bool CachingTransactionSignatureChecker::VerifySignatureDeferrable(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
+    if (!sigbatch || !pubkey.IsValid())
+        return VerifySignature(vchSig, pubkey, sighash);
+
+    CDeferredSignature deferred;
+    signatureCache.ComputeEntry(deferred.cache_entry, sighash, vchSig, pubkey);
+    if (signatureCache.Get(deferred.cache_entry, !store))
+        return true;
+    deferred.pubkey = pubkey;
+    deferred.sighash = sighash;
+    deferred.sig = vchSig;
+    deferred.origin = origin;
+    deferred.store = store;
+    sigbatch->Add(std::move(deferred));
+    return true;
+}
+
+std::optional<ScriptError> CSignatureCheck::operator()()
+{
+    if (m_sig->sig.size() == 64)
+        m_sig->valid = m_sig->pubkey.Verify_Schnorr(m_sig->sighash, m_sig->sig);
+    else
+        m_sig->valid = m_sig->pubkey.Verify_ECDSA(m_sig->sighash, m_sig->sig);
+    if (m_sig->valid && m_sig->store)
+        signatureCache.Set(m_sig->cache_entry);
+    return std::nullopt;
+}
+
+void CSignatureBatch::Add(CDeferredSignature&& sig)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_sigs.push_back(std::move(sig));
+}
+
+size_t CSignatureBatch::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_sigs.size();
+}
+
+std::vector<CSignatureCheck> CSignatureBatch::GetChecks()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<CSignatureCheck> checks;
+    checks.reserve(m_sigs.size());
+    for (CDeferredSignature& sig : m_sigs) {
+        checks.emplace_back(&sig);
+    }
+    return checks;
+}
+
+std::set<size_t> CSignatureBatch::GetInvalidOrigins() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::set<size_t> origins;
+    for (const CDeferredSignature& sig : m_sigs) {
+        if (!sig.valid) origins.insert(sig.origin);
+    }
+    return origins;
+}
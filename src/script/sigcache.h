@@ -6,8 +6,14 @@
 #ifndef BITCOIN_SCRIPT_SIGCACHE_H
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
+#include <pubkey.h>
 #include <script/interpreter.h>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <vector>
 
 // DoS prevention: limit cache size to 32MB (over 1000000 entries on 64-bit
@@ -17,8 +23,6 @@ static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32;
 // Maximum sig cache size allowed
 static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
-class CPubKey;
-
 /**
  * We're hashing a nonce into the entries themselves, so we don't need extra
  * blinding in the set hash computation.
@@ -40,17 +44,151 @@ public:
     }
 };
 
+/** Occupancy of the signature cache, and its traffic since startup */
+struct SignatureCacheStats
+{
+    size_t bytes{0};
+    //! Number of entries the cache can hold, and that it holds
+    size_t capacity{0};
+    size_t entries{0};
+    uint64_t hits{0};
+    uint64_t misses{0};
+    uint64_t inserts{0};
+    //! Inserts that replaced a live entry
+    uint64_t evictions{0};
+};
+
+/**
+ * Set of 256-bit entries for the signature cache, which can be resized while in use.
+ *
+ * Lookups take no lock: each slot carries a sequence number that writers make odd while
+ * they change the slot, and a reader retries if it changed while reading. Writers and
+ * resizing are serialized by a mutex. A resize publishes a new table and frees the old one
+ * once no reader is pinning it; readers pin tables and count hits on one of several
+ * counter shards, so concurrent lookups do not write to a shared cache line.
+ *
+ * An entry can be in either of two buckets of a few slots. Erasing only marks an entry as
+ * the first to be overwritten, as CuckooCache does; when both buckets are full of live
+ * entries, one of them is evicted.
+ */
+class SignatureCacheSet
+{
+private:
+    struct Slot {
+        std::atomic<uint32_t> seq{0};
+        std::atomic<bool> erased{false};
+        //! All zero if the slot is empty
+        std::atomic<uint64_t> words[4]{};
+    };
+    struct Table {
+        std::unique_ptr<Slot[]> slots;
+        size_t n_buckets{0};
+        explicit Table(size_t n_buckets_in);
+    };
+    struct alignas(64) Shard {
+        std::atomic<uint32_t> readers{0};
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+    };
+    static constexpr size_t BUCKET_SIZE = 4;
+    static constexpr size_t SHARDS = 16;
+
+    std::atomic<Table*> m_table;
+    Shard m_shards[SHARDS];
+    std::mutex m_write_mutex;
+    size_t m_entries{0};
+    uint64_t m_inserts{0};
+    uint64_t m_evictions{0};
+
+    static bool ReadSlot(const Slot& slot, uint64_t words[4]);
+    //! One of the two buckets an entry can be in
+    static Slot* FindBucket(const Table& table, const uint64_t words[4], int choice);
+    //! Insert into table, which m_write_mutex protects. Returns whether a live entry was evicted.
+    bool InsertInto(Table& table, const uint64_t words[4], bool& inserted);
+    Shard& ThreadShard();
+
+public:
+    SignatureCacheSet();
+    ~SignatureCacheSet();
+
+    bool contains(const uint256& entry, bool erase);
+    void insert(const uint256& entry);
+
+    /** Resize to use at most bytes, keeping as many entries as fit. Returns the capacity in entries. */
+    size_t setup_bytes(size_t bytes);
+
+    SignatureCacheStats GetStats();
+};
+
+/** A signature whose verification was deferred, and the script check it came from */
+struct CDeferredSignature
+{
+    uint256 cache_entry;
+    CPubKey pubkey;
+    uint256 sighash;
+    std::vector<unsigned char> sig;
+    //! Caller-chosen index of the script check that assumed the signature valid
+    size_t origin{0};
+    //! Whether to add the signature to the signature cache once it is verified
+    bool store{false};
+    bool valid{false};
+};
+
+/** Closure verifying one deferred signature, for a CCheckQueue */
+class CSignatureCheck
+{
+private:
+    CDeferredSignature* m_sig{nullptr};
+
+public:
+    CSignatureCheck() = default;
+    explicit CSignatureCheck(CDeferredSignature* sig) : m_sig(sig) {}
+
+    /** Never fails, so that the queue verifies every signature; see CDeferredSignature::valid. */
+    std::optional<ScriptError> operator()();
+};
+
+/**
+ * Signatures that script checks assumed valid, collected so that they can be verified
+ * separately from the scripts, spread over all script check threads even when a few
+ * inputs carry most of them. Add is safe to call from several threads.
+ */
+class CSignatureBatch
+{
+private:
+    mutable std::mutex m_mutex;
+    std::vector<CDeferredSignature> m_sigs;
+
+public:
+    void Add(CDeferredSignature&& sig);
+    size_t size() const;
+
+    /** Checks for every signature; they point into the batch, which must not be added to until they ran. */
+    std::vector<CSignatureCheck> GetChecks();
+    /** Origins of the signatures found invalid by the checks */
+    std::set<size_t> GetInvalidOrigins() const;
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
+    CSignatureBatch* sigbatch;
+    size_t origin;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, bool storeIn) : TransactionSignatureChecker(txToIn, nInIn, amountIn), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, bool storeIn, const PrecomputedTransactionData* txdataIn = nullptr, CSignatureBatch* sigbatchIn = nullptr, size_t originIn = 0) : TransactionSignatureChecker(txToIn, nInIn, amountIn, txdataIn), store(storeIn), sigbatch(sigbatchIn), origin(originIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const override;
+    /** Assumes a signature not in the cache is valid and adds it to sigbatch, if there is one. */
+    bool VerifySignatureDeferrable(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const override;
 };
 
 void InitSignatureCache();
 
+/** Resize the signature cache to use at most bytes. Returns the number of entries it can hold. */
+size_t ResizeSignatureCache(size_t bytes);
+
+SignatureCacheStats GetSignatureCacheStats();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
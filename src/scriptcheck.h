@@ -8,6 +8,9 @@
 #include <optional>
 #include <script/script_error.h>
 
+class CSignatureBatch;
+struct PrecomputedTransactionData;
+
 /**
  * Closure representing one script verification
  * Note that this stores references to the spending transaction
@@ -20,17 +23,27 @@ private:
     unsigned int nIn;
     unsigned int nFlags;
     bool cacheStore;
+    const PrecomputedTransactionData* txdata;
     ColorIdentifier colorid;
+    CSignatureBatch* m_sigbatch{nullptr};
+    size_t m_origin{0};
 
 public:
-    CScriptCheck(): ptxTo(nullptr), nIn(0), nFlags(0), cacheStore(false), colorid(ColorIdentifier()) {}
-    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, ColorIdentifier coloridIn = ColorIdentifier()) :
-        m_tx_out(outIn), ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), colorid(coloridIn) { }
+    CScriptCheck(): ptxTo(nullptr), nIn(0), nFlags(0), cacheStore(false), txdata(nullptr), colorid(ColorIdentifier()) {}
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, const PrecomputedTransactionData* txdataIn = nullptr, ColorIdentifier coloridIn = ColorIdentifier()) :
+        m_tx_out(outIn), ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), txdata(txdataIn), colorid(coloridIn) { }
 
     // Returns nullopt on success, or the ScriptError on failure.
     std::optional<ScriptError> operator()();
 
     const ColorIdentifier& GetColorIdentifier() const { return colorid; }
+
+    /**
+     * Assume the signatures the script needs valid and add them to sigbatch, tagged with
+     * origin. Success then only holds if they all verify; otherwise the check has to be
+     * run again without deferring to get its result.
+     */
+    void DeferSignatures(CSignatureBatch* sigbatch, size_t origin) { m_sigbatch = sigbatch; m_origin = origin; }
 };
 
 /** Initializes the script-execution cache */
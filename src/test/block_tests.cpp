@@ -2,7 +2,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <consensus/merkle.h>
 #include <primitives/block.h>
+#include <validation.h>
 #include <xfieldhistory.h>
 #include <test/test_tapyrus.h>
 #include <test/test_keys_helper.h>
@@ -276,4 +278,44 @@ BOOST_AUTO_TEST_CASE(blockHeaderWithxfieldType3_maxxfieldtype)
     BOOST_CHECK_EQUAL(blockHeader.proof.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(check_block_transactions)
+{
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.n = 1;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].scriptPubKey.assign(1, OP_TRUE);
+    CMutableTransaction tx;
+    tx.vin.emplace_back(InsecureRand256(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey.assign(1, OP_TRUE);
+
+    CBlock block;
+    block.nFeatures = CBlock::TAPYRUS_BLOCK_FEATURES;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    block.vtx.push_back(MakeTransactionRef(tx));
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    block.hashImMerkleRoot = BlockMerkleRoot(block, nullptr, true);
+
+    // A failed check is not remembered.
+    CBlock bad(block);
+    bad.vtx.push_back(bad.vtx[1]);
+    bad.vtx.push_back(bad.vtx[1]);
+    bad.hashMerkleRoot = BlockMerkleRoot(bad);
+    bad.hashImMerkleRoot = BlockMerkleRoot(bad, nullptr, true);
+    CValidationState state;
+    BOOST_CHECK(!CheckBlockTransactions(bad, state));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-duplicate");
+    BOOST_CHECK(!bad.fCheckedTransactions);
+
+    BOOST_CHECK(CheckBlockTransactions(block, state));
+    BOOST_CHECK(block.fCheckedTransactions);
+    // CheckBlock remembers nothing without the header checks.
+    BOOST_CHECK(CheckBlock(block, state, false, true));
+    BOOST_CHECK(!block.fChecked);
+
+    block.SetNull();
+    BOOST_CHECK(!block.fCheckedTransactions);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,201 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilter.h>
+#include <coloridentifier.h>
+#include <script/standard.h>
+#include <streams.h>
+#include <test/test_tapyrus.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included_elements, excluded_elements;
+    for (int i = 0; i < 100; ++i) {
+        GCSFilter::Element element1(32);
+        element1[0] = i;
+        included_elements.insert(std::move(element1));
+
+        GCSFilter::Element element2(32);
+        element2[1] = i;
+        excluded_elements.insert(std::move(element2));
+    }
+
+    GCSFilter filter({0, 0, 10, 1 << 10}, included_elements);
+    for (const auto& element : included_elements) {
+        BOOST_CHECK(filter.Match(element));
+
+        auto insertion = excluded_elements.insert(element);
+        BOOST_CHECK(filter.MatchAny(excluded_elements));
+        excluded_elements.erase(insertion.first);
+    }
+
+    // Reconstructing the filter from its encoding gives the same filter.
+    GCSFilter decoded(filter.GetParams(), filter.GetEncoded());
+    BOOST_CHECK_EQUAL(decoded.GetN(), 100U);
+    for (const auto& element : included_elements) {
+        BOOST_CHECK(decoded.Match(element));
+    }
+
+    // An encoding with trailing data or with missing data is rejected.
+    std::vector<unsigned char> encoded = filter.GetEncoded();
+    encoded.push_back(0);
+    BOOST_CHECK_THROW(GCSFilter(filter.GetParams(), encoded), std::ios_base::failure);
+    encoded.resize(encoded.size() - 2);
+    BOOST_CHECK_THROW(GCSFilter(filter.GetParams(), encoded), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_default_constructor)
+{
+    GCSFilter filter;
+    BOOST_CHECK_EQUAL(filter.GetN(), 0U);
+    BOOST_CHECK_EQUAL(filter.GetEncoded().size(), 1U);
+
+    const GCSFilter::Params& params = filter.GetParams();
+    BOOST_CHECK_EQUAL(params.m_siphash_k0, 0U);
+    BOOST_CHECK_EQUAL(params.m_siphash_k1, 0U);
+    BOOST_CHECK_EQUAL(params.m_P, 0);
+    BOOST_CHECK_EQUAL(params.m_M, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript included_scripts[5], excluded_scripts[4];
+
+    // First two are outputs on a single transaction.
+    included_scripts[0] << std::vector<unsigned char>(65, 0) << OP_CHECKSIG;
+    included_scripts[1] << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // Third is an output on in a second transaction.
+    included_scripts[2] << OP_1 << std::vector<unsigned char>(33, 2) << OP_1 << OP_CHECKMULTISIG;
+
+    // Last two are spent by a single transaction.
+    included_scripts[3] << OP_HASH160 << std::vector<unsigned char>(20, 3) << OP_EQUAL;
+    included_scripts[4] << OP_4 << OP_ADD << OP_8 << OP_EQUAL;
+
+    // OP_RETURN output is an output on the second transaction.
+    excluded_scripts[0] << OP_RETURN << std::vector<unsigned char>(40, 4);
+
+    // This script is not related to the block at all.
+    excluded_scripts[1] << std::vector<unsigned char>(33, 5) << OP_CHECKSIG;
+
+    // OP_RETURN is non-standard since it's not followed by a data push, but is still excluded from
+    // filter.
+    excluded_scripts[2] << OP_RETURN << OP_4 << OP_ADD << OP_8 << OP_EQUAL;
+
+    CMutableTransaction tx_1;
+    tx_1.vout.emplace_back(100, included_scripts[0]);
+    tx_1.vout.emplace_back(200, included_scripts[1]);
+    tx_1.vout.emplace_back(0, excluded_scripts[0]);
+
+    CMutableTransaction tx_2;
+    tx_2.vout.emplace_back(300, included_scripts[2]);
+    tx_2.vout.emplace_back(0, excluded_scripts[2]);
+    tx_2.vout.emplace_back(400, excluded_scripts[3]); // Script is empty
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx_1));
+    block.vtx.push_back(MakeTransactionRef(tx_2));
+
+    CBlockUndo block_undo;
+    block_undo.vtxundo.emplace_back();
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(500, included_scripts[3]), 1000, true);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(600, included_scripts[4]), 10000, false);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(700, excluded_scripts[3]), 100000, false);
+
+    BlockFilter block_filter(BlockFilterType::BASIC, block, block_undo);
+    const GCSFilter& filter = block_filter.GetFilter();
+
+    for (const CScript& script : included_scripts) {
+        BOOST_CHECK(filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    }
+    for (const CScript& script : excluded_scripts) {
+        BOOST_CHECK(!filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    }
+
+    // Test serialization/unserialization.
+    BlockFilter block_filter2;
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block_filter;
+    stream >> block_filter2;
+
+    BOOST_CHECK(block_filter.GetFilterType() == block_filter2.GetFilterType());
+    BOOST_CHECK_EQUAL(block_filter.GetBlockHash(), block_filter2.GetBlockHash());
+    BOOST_CHECK(block_filter.GetEncodedFilter() == block_filter2.GetEncodedFilter());
+    BOOST_CHECK_EQUAL(block_filter.GetHash(), block_filter2.GetHash());
+
+    // The header commits to the filter and to the previous header.
+    const uint256 header = block_filter.ComputeHeader(uint256());
+    BOOST_CHECK(header != block_filter.ComputeHeader(header));
+
+    BlockFilter default_ctor_block_filter_1;
+    BlockFilter default_ctor_block_filter_2;
+    BOOST_CHECK(default_ctor_block_filter_1.GetFilterType() == default_ctor_block_filter_2.GetFilterType());
+    BOOST_CHECK(default_ctor_block_filter_1.GetFilterType() == BlockFilterType::INVALID);
+    BOOST_CHECK_EQUAL(default_ctor_block_filter_1.GetBlockHash(), default_ctor_block_filter_2.GetBlockHash());
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_colored_test)
+{
+    const CKeyID key_id(uint160(std::vector<unsigned char>(20, 7)));
+    const ColorIdentifier color(CScript() << OP_TRUE);
+    const ColorIdentifier other_color(CScript() << OP_FALSE);
+
+    const CScript uncolored_script = GetScriptForDestination(key_id);
+    const CScript colored_script = GetScriptForDestination(CColorKeyID(key_id, color));
+    const CScript spent_script = GetScriptForDestination(CColorScriptID(uint160(std::vector<unsigned char>(20, 8)), other_color));
+    BOOST_CHECK(GetColorIdFromScript(colored_script) == color);
+    BOOST_CHECK(GetColorIdFromScript(spent_script) == other_color);
+
+    CMutableTransaction tx;
+    tx.vout.emplace_back(100, colored_script);
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx));
+
+    CBlockUndo block_undo;
+    block_undo.vtxundo.emplace_back();
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(100, spent_script), 1000, false);
+
+    BlockFilter block_filter(BlockFilterType::BASIC, block, block_undo);
+    const GCSFilter& filter = block_filter.GetFilter();
+
+    // The colored script, its uncolored part and the color identifier all match.
+    BOOST_CHECK(filter.Match(GCSFilter::Element(colored_script.begin(), colored_script.end())));
+    BOOST_CHECK(filter.Match(GCSFilter::Element(uncolored_script.begin(), uncolored_script.end())));
+    BOOST_CHECK(filter.Match(color.toVector()));
+
+    // So does the color of the spent output.
+    BOOST_CHECK(filter.Match(GCSFilter::Element(spent_script.begin(), spent_script.end())));
+    BOOST_CHECK(filter.Match(other_color.toVector()));
+
+    // A payment of the same color to another address does not.
+    const CScript unrelated_script = GetScriptForDestination(CColorKeyID(CKeyID(uint160(std::vector<unsigned char>(20, 9))), color));
+    BOOST_CHECK(!filter.Match(GCSFilter::Element(unrelated_script.begin(), unrelated_script.end())));
+
+    // Each colored script adds three elements: the script, the color identifier and the uncolored script.
+    BOOST_CHECK_EQUAL(filter.GetN(), 6U);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_type_names)
+{
+    BOOST_CHECK_EQUAL(BlockFilterTypeName(BlockFilterType::BASIC), "basic");
+    BOOST_CHECK_EQUAL(BlockFilterTypeName(static_cast<BlockFilterType>(255)), "");
+
+    BlockFilterType filter_type;
+    BOOST_CHECK(BlockFilterTypeByName("basic", filter_type));
+    BOOST_CHECK(filter_type == BlockFilterType::BASIC);
+
+    BOOST_CHECK(!BlockFilterTypeByName("unknown", filter_type));
+
+    BOOST_CHECK_EQUAL(AllBlockFilterTypes().size(), 1U);
+    BOOST_CHECK_EQUAL(ListBlockFilterTypes(), "basic");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
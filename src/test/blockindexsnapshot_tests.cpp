@@ -0,0 +1,125 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockindexsnapshot.h>
+#include <chain.h>
+#include <txdb.h>
+#include <util.h>
+#include <validation.h>
+#include <test/test_tapyrus.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockindexsnapshot_tests, TestChainSetup)
+
+static fs::path WriteSnapshot()
+{
+    FlushStateToDisk();
+    const fs::path path = GetDataDir() / "blockindex.dat";
+    LOCK(cs_main);
+    BOOST_CHECK(WriteBlockIndexSnapshot(*pblocktree, path));
+    return path;
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_roundtrip)
+{
+    const fs::path path = WriteSnapshot();
+
+    std::vector<std::pair<uint256, std::unique_ptr<CBlockIndex>>> entries;
+    BOOST_CHECK(ReadBlockIndexSnapshot(*pblocktree, path, entries));
+
+    LOCK(cs_main);
+    BOOST_CHECK_EQUAL(entries.size(), mapBlockIndex.size());
+    int nHeight = 0;
+    for (const auto& entry : entries) {
+        const CBlockIndex* pindex = entry.second.get();
+        BOOST_CHECK(pindex->nHeight >= nHeight);
+        nHeight = pindex->nHeight;
+
+        BlockMap::const_iterator it = mapBlockIndex.find(entry.first);
+        BOOST_REQUIRE(it != mapBlockIndex.end());
+        const CBlockIndex* pexpected = it->second;
+        BOOST_CHECK_EQUAL(pindex->nHeight, pexpected->nHeight);
+        BOOST_CHECK_EQUAL(pindex->nFile, pexpected->nFile);
+        BOOST_CHECK_EQUAL(pindex->nDataPos, pexpected->nDataPos);
+        BOOST_CHECK_EQUAL(pindex->nUndoPos, pexpected->nUndoPos);
+        BOOST_CHECK_EQUAL(pindex->nTx, pexpected->nTx);
+        BOOST_CHECK_EQUAL(pindex->nStatus, pexpected->nStatus);
+        BOOST_CHECK_EQUAL(pindex->nFeatures, pexpected->nFeatures);
+        BOOST_CHECK(pindex->hashMerkleRoot == pexpected->hashMerkleRoot);
+        BOOST_CHECK(pindex->hashImMerkleRoot == pexpected->hashImMerkleRoot);
+        BOOST_CHECK_EQUAL(pindex->nTime, pexpected->nTime);
+        BOOST_CHECK_EQUAL(pindex->nXFieldId, pexpected->nXFieldId);
+        if (pexpected->pprev) {
+            BOOST_REQUIRE(pindex->pprev);
+            BOOST_CHECK_EQUAL(pindex->pprev->nHeight, pexpected->pprev->nHeight);
+            BOOST_CHECK(pindex->pprev->hashMerkleRoot == pexpected->pprev->hashMerkleRoot);
+        } else {
+            BOOST_CHECK(pindex->pprev == nullptr);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_outdated)
+{
+    const fs::path path = WriteSnapshot();
+
+    // Connecting a block writes the block index, which invalidates the snapshot.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CreateAndProcessBlock({}, scriptPubKey);
+    FlushStateToDisk();
+
+    std::vector<std::pair<uint256, std::unique_ptr<CBlockIndex>>> entries;
+    BOOST_CHECK(!ReadBlockIndexSnapshot(*pblocktree, path, entries));
+    BOOST_CHECK(entries.empty());
+
+    // A new snapshot is used again.
+    WriteSnapshot();
+    BOOST_CHECK(ReadBlockIndexSnapshot(*pblocktree, path, entries));
+    BOOST_CHECK(!entries.empty());
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_left_by_older_binary)
+{
+    const fs::path path = WriteSnapshot();
+    uint256 id;
+    BOOST_REQUIRE(pblocktree->ReadBlockIndexSnapshotId(id));
+
+    // A binary that does not know the snapshot leaves its id in place when it connects a
+    // block, but the block file records it writes no longer match the snapshot.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CreateAndProcessBlock({}, scriptPubKey);
+    FlushStateToDisk();
+    BOOST_REQUIRE(pblocktree->WriteBlockIndexSnapshotId(id));
+
+    std::vector<std::pair<uint256, std::unique_ptr<CBlockIndex>>> entries;
+    BOOST_CHECK(!ReadBlockIndexSnapshot(*pblocktree, path, entries));
+    BOOST_CHECK(entries.empty());
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_damaged)
+{
+    const fs::path path = WriteSnapshot();
+
+    // Flip a byte in the middle of the file.
+    FILE* file = fsbridge::fopen(path, "r+b");
+    BOOST_REQUIRE(file);
+    const long nPos = fs::file_size(path) / 2;
+    BOOST_REQUIRE(fseek(file, nPos, SEEK_SET) == 0);
+    const int c = fgetc(file);
+    BOOST_REQUIRE(c != EOF);
+    BOOST_REQUIRE(fseek(file, nPos, SEEK_SET) == 0);
+    fputc(c ^ 0xff, file);
+    fclose(file);
+
+    std::vector<std::pair<uint256, std::unique_ptr<CBlockIndex>>> entries;
+    BOOST_CHECK(!ReadBlockIndexSnapshot(*pblocktree, path, entries));
+    BOOST_CHECK(entries.empty());
+
+    // A missing snapshot is not used either.
+    fs::remove(path);
+    BOOST_CHECK(!ReadBlockIndexSnapshot(*pblocktree, path, entries));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
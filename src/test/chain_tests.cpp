@@ -45,6 +45,7 @@
 #include <uint256.h>
 #include <validation.h>
 #include <streams.h>
+#include <txdb.h>
 
 #include <boost/test/unit_test.hpp>
 
@@ -405,8 +406,8 @@ BOOST_AUTO_TEST_CASE(blockindex_get_block_header)
     index.hashMerkleRoot = InsecureRand256();
     index.hashImMerkleRoot = InsecureRand256();
     index.nTime = 1609459200;
-    index.proof = {0x01, 0x02, 0x03, 0x04};
-    index.xfield = CXField(XFieldAggPubKey({0x05, 0x06, 0x07, 0x08}));
+    const CXField xfield(XFieldAggPubKey({0x05, 0x06, 0x07, 0x08}));
+    index.SetXField(xfield);
 
     // Reconstruct header
     CBlockHeader header = index.GetBlockHeader();
@@ -417,8 +418,9 @@ BOOST_AUTO_TEST_CASE(blockindex_get_block_header)
     BOOST_CHECK(header.hashMerkleRoot == index.hashMerkleRoot);
     BOOST_CHECK(header.hashImMerkleRoot == index.hashImMerkleRoot);
     BOOST_CHECK_EQUAL(header.nTime, index.nTime);
-    BOOST_CHECK(header.proof == index.proof);
-    BOOST_CHECK(header.xfield == index.xfield);
+    // The proof is not kept in the block index.
+    BOOST_CHECK(header.proof.empty());
+    BOOST_CHECK(header.xfield == xfield);
 
     // Case 2: Block without parent (genesis)
     CBlockIndex genesisIndex;
@@ -453,10 +455,11 @@ BOOST_AUTO_TEST_CASE(diskblockindex_edge_cases)
     index.hashMerkleRoot = InsecureRand256();
     index.hashImMerkleRoot = InsecureRand256();
     index.nTime = 1609459200;
-    index.proof = {0x01, 0x02, 0x03};
+    const std::vector<unsigned char> proof{0x01, 0x02, 0x03};
 
-    CDiskBlockIndex diskIndex(&index);
+    CDiskBlockIndex diskIndex(&index, proof);
     BOOST_CHECK(diskIndex.hashPrev == parentHash);
+    BOOST_CHECK(diskIndex.proof == proof);
     BOOST_CHECK_EQUAL(diskIndex.nHeight, index.nHeight);
     BOOST_CHECK_EQUAL(diskIndex.nFeatures, index.nFeatures);
 
@@ -466,7 +469,7 @@ BOOST_AUTO_TEST_CASE(diskblockindex_edge_cases)
     genesisIndex.nHeight = 0;
     genesisIndex.nFeatures = 1;
 
-    CDiskBlockIndex diskGenesisIndex(&genesisIndex);
+    CDiskBlockIndex diskGenesisIndex(&genesisIndex, {});
     BOOST_CHECK(diskGenesisIndex.hashPrev.IsNull());
     BOOST_CHECK_EQUAL(diskGenesisIndex.nHeight, 0);
 
@@ -476,6 +479,58 @@ BOOST_AUTO_TEST_CASE(diskblockindex_edge_cases)
     BOOST_CHECK_EQUAL(defaultDiskIndex.nHeight, 0);
 }
 
+/**
+ * Test the compact xfield and proof of block index entries
+ *
+ * Entries with the same xfield share one table entry, and the proof of an
+ * entry is kept by the block tree database until the entry is written, then
+ * read back from the database.
+ */
+BOOST_AUTO_TEST_CASE(blockindex_xfield_and_proof)
+{
+    const CXField xfield1(XFieldAggPubKey({0x01, 0x02, 0x03}));
+    const CXField xfield2(XFieldMaxBlockSize(2000000));
+    CBlockIndex index1, index2, index3, index4;
+    index1.SetXField(xfield1);
+    index2.SetXField(xfield2);
+    index3.SetXField(xfield1);
+    index4.SetXField(CXField());
+    BOOST_CHECK_NE(index1.nXFieldId, 0U);
+    BOOST_CHECK_NE(index1.nXFieldId, index2.nXFieldId);
+    BOOST_CHECK_EQUAL(index1.nXFieldId, index3.nXFieldId);
+    BOOST_CHECK_EQUAL(index4.nXFieldId, 0U);
+    BOOST_CHECK(index2.GetXField() == xfield2);
+
+    CBlockTreeDB db(1 << 20, true);
+    const uint256 hash = InsecureRand256();
+    index1.phashBlock = &hash;
+    const std::vector<unsigned char> proof(CPubKey::SCHNORR_SIGNATURE_SIZE, 0x42);
+    std::vector<unsigned char> read;
+    BOOST_CHECK(!db.ReadBlockProof(hash, read));
+    db.AddBlockProof(hash, proof);
+    BOOST_CHECK(db.ReadBlockProof(hash, read));
+    BOOST_CHECK(read == proof);
+
+    BOOST_CHECK(db.WriteBatchSync({}, 0, {&index1}));
+    read.clear();
+    BOOST_CHECK(db.ReadBlockProof(hash, read));
+    BOOST_CHECK(read == proof);
+
+    // A batch with an entry without a proof is not written, and the proofs of the
+    // other entries are kept for the next one.
+    const uint256 hash2 = InsecureRand256();
+    index2.phashBlock = &hash2;
+    const uint256 hash3 = InsecureRand256();
+    index3.phashBlock = &hash3;
+    db.AddBlockProof(hash3, proof);
+    BOOST_CHECK(!db.WriteBatchSync({}, 0, {&index2, &index3}));
+    BOOST_CHECK(!db.Exists(std::make_pair('b', hash2)));
+    BOOST_CHECK(!db.Exists(std::make_pair('b', hash3)));
+    read.clear();
+    BOOST_CHECK(db.ReadBlockProof(hash3, read));
+    BOOST_CHECK(read == proof);
+}
+
 /**
  * Test LastCommonAncestor function edge cases
  *
@@ -919,8 +974,8 @@ BOOST_AUTO_TEST_CASE(blockindex_initialization)
     BOOST_CHECK_EQUAL(index1.nFeatures, 0);
     BOOST_CHECK(index1.hashMerkleRoot.IsNull());
     BOOST_CHECK_EQUAL(index1.nTime, 0);
-    BOOST_CHECK(index1.xfield.xfieldType == TAPYRUS_XFIELDTYPES::NONE);
-    BOOST_CHECK(index1.proof.empty());
+    BOOST_CHECK_EQUAL(index1.nXFieldId, 0U);
+    BOOST_CHECK(index1.GetXField().xfieldType == TAPYRUS_XFIELDTYPES::NONE);
 
     // Case 2: Constructor from CBlockHeader
     CBlockHeader header;
@@ -936,8 +991,7 @@ BOOST_AUTO_TEST_CASE(blockindex_initialization)
     BOOST_CHECK(index2.hashMerkleRoot == header.hashMerkleRoot);
     BOOST_CHECK(index2.hashImMerkleRoot == header.hashImMerkleRoot);
     BOOST_CHECK_EQUAL(index2.nTime, header.nTime);
-    BOOST_CHECK(index2.proof == header.proof);
-    BOOST_CHECK(index2.xfield.xfieldType == header.xfield.xfieldType);
+    BOOST_CHECK(index2.GetXField() == header.xfield);
 
     // Other fields should still be initialized to null/zero
     BOOST_CHECK(index2.phashBlock == nullptr);
@@ -17,6 +17,8 @@
  * - Block hash collisions and hasher edge cases
  */
 
+#include <arith_uint256.h>
+#include <blockproofbatch.h>
 #include <chainstate.h>
 #include <test/test_tapyrus.h>
 #include <validation.h>
@@ -720,6 +722,98 @@ BOOST_AUTO_TEST_CASE(check_block_header_orphan_uses_latest_aggpubkey)
     }
 }
 
+/**
+ * CBlockProofBatch verifies the proofs of a run of headers against the aggregate
+ * key at each height. CheckBlockHeader skips only the proofs verified against the
+ * key it derives itself, and checks the others one by one.
+ */
+BOOST_AUTO_TEST_CASE(block_proof_batch)
+{
+    CKey rotatedKey;
+    rotatedKey.MakeNewKey(true);
+    const CPubKey rotatedPubKey = rotatedKey.GetPubKey();
+
+    CTempXFieldHistory tempHistory;
+    tempHistory.Add(TAPYRUS_XFIELDTYPES::AGGPUBKEY,
+                    XFieldChange(XFieldAggPubKey(rotatedPubKey), 5, uint256()));
+
+    auto make_header = [](int n, const CKey& key) {
+        CBlockHeader header;
+        header.nFeatures     = CBlock::TAPYRUS_BLOCK_FEATURES;
+        header.hashPrevBlock = ArithToUint256(arith_uint256(n + 1));
+        header.nTime = n;
+        header.xfield.clear();
+        std::vector<unsigned char> sig;
+        BOOST_REQUIRE(key.Sign_Schnorr(header.GetHashForSign(), sig));
+        header.proof = sig;
+        return header;
+    };
+
+    std::vector<CBlockHeader> headers;
+    for (size_t i = 0; i < 2 * MIN_BLOCK_PROOF_BATCH_SIZE; ++i) {
+        headers.push_back(make_header(i, rotatedKey));
+    }
+    headers[3].proof[10] ^= 1;
+
+    CBlockProofBatch proofs;
+    for (size_t i = 0; i < headers.size(); ++i) {
+        proofs.Add(headers[i], 10 + i, &tempHistory);
+    }
+    BOOST_CHECK_EQUAL(proofs.size(), headers.size());
+    BOOST_CHECK(!proofs.Verify());
+    // The first proof is checked alone. Proofs after the invalid one may be left unchecked.
+    BOOST_CHECK(proofs.IsVerified(headers[0].GetHashForSign(), rotatedPubKey, headers[0].proof));
+    BOOST_CHECK(!proofs.IsVerified(headers[3].GetHashForSign(), rotatedPubKey, headers[3].proof));
+
+    // An invalid first proof stops the batch before any other proof is checked.
+    std::vector<CBlockHeader> badFirst(headers.begin() + 4, headers.end());
+    badFirst[0].proof[10] ^= 1;
+    CBlockProofBatch badFirstProofs;
+    for (size_t i = 0; i < badFirst.size(); ++i) {
+        badFirstProofs.Add(badFirst[i], 14 + i, &tempHistory);
+    }
+    BOOST_CHECK(!badFirstProofs.Verify());
+    for (const CBlockHeader& header : badFirst) {
+        BOOST_CHECK(!badFirstProofs.IsVerified(header.GetHashForSign(), rotatedPubKey, header.proof));
+    }
+
+    {
+        CValidationState state;
+        BOOST_CHECK(CheckBlockHeader(headers[0], state, &tempHistory, 10, true, &proofs));
+    }
+    {
+        // The invalid proof is checked again and rejected.
+        CValidationState state;
+        BOOST_CHECK(!CheckBlockHeader(headers[3], state, &tempHistory, 13, true, &proofs));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-proof");
+    }
+    {
+        // A proof verified against the rotated key does not pass at a height using the genesis key.
+        CValidationState state;
+        BOOST_CHECK(!CheckBlockHeader(headers[0], state, &tempHistory, 1, true, &proofs));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-proof");
+    }
+
+    // A key change in the run applies to the headers after it.
+    CKey nextKey;
+    nextKey.MakeNewKey(true);
+    const CPubKey nextPubKey = nextKey.GetPubKey();
+    CBlockHeader change = make_header(100, rotatedKey);
+    change.xfield = CXField(XFieldData(XFieldAggPubKey(nextPubKey)));
+    std::vector<unsigned char> sig;
+    BOOST_REQUIRE(rotatedKey.Sign_Schnorr(change.GetHashForSign(), sig));
+    change.proof = sig;
+    const CBlockHeader next = make_header(101, nextKey);
+
+    CBlockProofBatch changeProofs;
+    changeProofs.Add(change, 20, &tempHistory);
+    changeProofs.Add(next, 21, &tempHistory);
+    BOOST_CHECK(changeProofs.Verify());
+    BOOST_CHECK(changeProofs.IsVerified(change.GetHashForSign(), rotatedPubKey, change.proof));
+    BOOST_CHECK(changeProofs.IsVerified(next.GetHashForSign(), nextPubKey, next.proof));
+    BOOST_CHECK(!changeProofs.IsVerified(next.GetHashForSign(), rotatedPubKey, next.proof));
+}
+
 /**
  * Regression test: DisconnectBlock(fDryRun=true) must not erase from g_colorid_state.
  *
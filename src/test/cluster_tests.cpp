@@ -0,0 +1,130 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <policy/cluster.h>
+#include <test/test_tapyrus.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(cluster_tests, BasicTestingSetup)
+
+static void CheckLinearization(const std::vector<ClusterTx>& txs, const std::vector<uint32_t>& order, const std::vector<ClusterChunk>& chunks)
+{
+    BOOST_REQUIRE_EQUAL(order.size(), txs.size());
+    std::vector<bool> done(txs.size(), false);
+    for (uint32_t i : order) {
+        BOOST_REQUIRE(i < txs.size());
+        BOOST_CHECK(!done[i]);
+        for (uint32_t parent : txs[i].parents) {
+            BOOST_CHECK(done[parent]);
+        }
+        done[i] = true;
+    }
+
+    size_t nPos = 0;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        CAmount nFee = 0;
+        int64_t nSize = 0;
+        for (uint32_t j = 0; j < chunks[i].count; j++) {
+            BOOST_REQUIRE(nPos < order.size());
+            nFee += txs[order[nPos]].fee;
+            nSize += txs[order[nPos]].size;
+            nPos++;
+        }
+        BOOST_CHECK_EQUAL(chunks[i].fee, nFee);
+        BOOST_CHECK_EQUAL(chunks[i].size, nSize);
+        if (i > 0) {
+            BOOST_CHECK(!HigherFeeRate(chunks[i].fee, chunks[i].size, chunks[i - 1].fee, chunks[i - 1].size));
+        }
+    }
+    BOOST_CHECK_EQUAL(nPos, order.size());
+}
+
+BOOST_AUTO_TEST_CASE(higher_feerate_exact)
+{
+    // k/(k-1) and (k+1)/k differ by less than a double can tell at this size.
+    const int64_t k = 100000000000LL;
+    BOOST_CHECK(HigherFeeRate(k, k - 1, k + 1, k));
+    BOOST_CHECK(!HigherFeeRate(k + 1, k, k, k - 1));
+    BOOST_CHECK(!HigherFeeRate(k, k, k, k));
+    BOOST_CHECK(HigherFeeRate(0, 1, -1, 1));
+}
+
+BOOST_AUTO_TEST_CASE(linearize_child_pays_for_parent)
+{
+    // A low fee parent with a high fee child goes before an unrelated transaction.
+    std::vector<ClusterTx> txs{
+        {1000, 100, {}},
+        {5000, 100, {}},
+        {20000, 100, {0}},
+    };
+    std::vector<uint32_t> order = LinearizeCluster(txs);
+    BOOST_CHECK(order == std::vector<uint32_t>({0, 2, 1}));
+
+    std::vector<ClusterChunk> chunks = ChunkLinearization(txs, order);
+    BOOST_REQUIRE_EQUAL(chunks.size(), 2U);
+    BOOST_CHECK_EQUAL(chunks[0].fee, 21000);
+    BOOST_CHECK_EQUAL(chunks[0].size, 200);
+    BOOST_CHECK_EQUAL(chunks[0].count, 2U);
+    BOOST_CHECK_EQUAL(chunks[1].fee, 5000);
+    BOOST_CHECK_EQUAL(chunks[1].count, 1U);
+    CheckLinearization(txs, order, chunks);
+}
+
+BOOST_AUTO_TEST_CASE(linearize_diamond)
+{
+    // 0 is spent by 1 and 2, which are both spent by 3.
+    std::vector<ClusterTx> txs{
+        {7000, 100, {}},
+        {1000, 100, {0}},
+        {1100, 100, {0}},
+        {9000, 100, {1, 2}},
+    };
+    std::vector<uint32_t> order = LinearizeCluster(txs);
+    BOOST_CHECK(order == std::vector<uint32_t>({0, 2, 1, 3}));
+
+    // 3 pays for both of its parents.
+    std::vector<ClusterChunk> chunks = ChunkLinearization(txs, order);
+    BOOST_REQUIRE_EQUAL(chunks.size(), 2U);
+    BOOST_CHECK_EQUAL(chunks[0].count, 1U);
+    BOOST_CHECK_EQUAL(chunks[1].fee, 11100);
+    BOOST_CHECK_EQUAL(chunks[1].size, 300);
+    BOOST_CHECK_EQUAL(chunks[1].count, 3U);
+    CheckLinearization(txs, order, chunks);
+}
+
+BOOST_AUTO_TEST_CASE(linearize_equal_feerates)
+{
+    // Chunks of the same feerate are not merged.
+    std::vector<ClusterTx> txs{
+        {1000, 100, {}},
+        {1000, 100, {0}},
+        {1000, 100, {1}},
+    };
+    std::vector<uint32_t> order = LinearizeCluster(txs);
+    BOOST_CHECK(order == std::vector<uint32_t>({0, 1, 2}));
+    std::vector<ClusterChunk> chunks = ChunkLinearization(txs, order);
+    BOOST_CHECK_EQUAL(chunks.size(), 3U);
+    CheckLinearization(txs, order, chunks);
+}
+
+BOOST_AUTO_TEST_CASE(linearize_random)
+{
+    for (uint32_t nSize : {1U, 2U, 10U, 50U, MAX_CLUSTER_LINEARIZE_SIZE, MAX_CLUSTER_LINEARIZE_SIZE + 50}) {
+        std::vector<ClusterTx> txs(nSize);
+        for (uint32_t i = 0; i < nSize; i++) {
+            txs[i].fee = InsecureRandRange(100000);
+            txs[i].size = 100 + InsecureRandRange(1000);
+            // Parents are added before their children.
+            for (uint32_t j = 0; j < i; j++) {
+                if (InsecureRandRange(i) < 2)
+                    txs[i].parents.push_back(j);
+            }
+        }
+        std::vector<uint32_t> order = LinearizeCluster(txs);
+        CheckLinearization(txs, order, ChunkLinearization(txs, order));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -14,6 +14,7 @@
 
 #include <vector>
 #include <map>
+#include <optional>
 
 #include <boost/test/unit_test.hpp>
 
@@ -77,7 +78,7 @@ public:
     void SelfTest() const
     {
         // Manually recompute the dynamic usage of the whole data, and compare it.
-        size_t ret = memusage::DynamicUsage(cacheCoins);
+        size_t ret = cacheCoins.DynamicMemoryUsage();
         size_t count = 0;
         for (const auto& entry : cacheCoins) {
             ret += entry.second.coin.DynamicMemoryUsage();
@@ -604,10 +605,9 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
 
 void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
-    CCoinsMapMemoryResource resource;
     CoinsCachePair sentinel{};
     sentinel.second.SelfRef(sentinel);
-    CCoinsMap map(0, SaltedOutpointHasher{}, CCoinsMap::key_equal{}, &resource);
+    CCoinsMap map;
     size_t usage{InsertCoinsMapEntry(map, sentinel, value, flags)};
     auto cursor{CoinsViewCacheCursor(usage, sentinel, map, /*will_erase=*/true)};
     BOOST_CHECK(view.BatchWrite(cursor, {}));
@@ -877,4 +877,135 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_map_rehash)
+{
+    // Insert and erase enough entries for the table to be rebuilt several times, and
+    // check that the flagged entries are still linked at their new address.
+    CoinsCachePair sentinel{};
+    sentinel.second.SelfRef(sentinel);
+    CCoinsMap map;
+    std::map<COutPoint, std::pair<CAmount, char>> expected;
+    for (int i = 0; i < 20000; ++i) {
+        const COutPoint outpoint(InsecureRand256(), InsecureRandRange(4));
+        if (!expected.empty() && InsecureRandRange(4) == 0) {
+            const COutPoint erased = expected.begin()->first;
+            BOOST_CHECK_EQUAL(map.erase(erased), 1U);
+            BOOST_CHECK_EQUAL(map.erase(erased), 0U);
+            expected.erase(erased);
+        }
+        auto [it, inserted] = map.try_emplace(outpoint);
+        BOOST_CHECK(inserted);
+        const CAmount value = InsecureRandRange(1000);
+        const char flags = InsecureRandRange(4);
+        it->second.coin.out.nValue = value;
+        it->second.AddFlags(flags, *it, sentinel);
+        expected.emplace(outpoint, std::make_pair(value, flags));
+    }
+
+    BOOST_CHECK_EQUAL(map.size(), expected.size());
+    BOOST_CHECK_EQUAL(map.DynamicMemoryUsage(), memusage::MallocUsage(map.capacity() * (sizeof(CoinsCachePair) + 1)));
+    size_t count = 0;
+    size_t flagged = 0;
+    for (const auto& entry : map) {
+        const auto expected_it = expected.find(entry.first);
+        BOOST_REQUIRE(expected_it != expected.end());
+        BOOST_CHECK_EQUAL(entry.second.coin.out.nValue, expected_it->second.first);
+        BOOST_CHECK_EQUAL(entry.second.GetFlags(), expected_it->second.second);
+        ++count;
+        if (entry.second.GetFlags()) ++flagged;
+    }
+    BOOST_CHECK_EQUAL(count, expected.size());
+
+    size_t linked = 0;
+    for (CoinsCachePair* entry = sentinel.second.Next(); entry != &sentinel; entry = entry->second.Next()) {
+        BOOST_CHECK(entry->second.Next()->second.Prev() == entry);
+        BOOST_CHECK(&*map.find(entry->first) == entry);
+        ++linked;
+    }
+    BOOST_CHECK_EQUAL(linked, flagged);
+
+    map.clear();
+    BOOST_CHECK(sentinel.second.Next() == &sentinel);
+    BOOST_CHECK_EQUAL(map.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_map_erase_circular_shrink)
+{
+    // A pass that shrinks the table goes on from where the previous pass stopped.
+    CCoinsMap map;
+    for (int i = 0; i < 1000; ++i) {
+        BOOST_CHECK(map.try_emplace(COutPoint(InsecureRand256(), 0)).second);
+    }
+    const size_t capacity = map.capacity();
+    size_t erased = 0;
+    COutPoint last;
+    map.EraseCircular([&](const CoinsCachePair& entry) {
+        last = entry.first;
+        return ++erased <= 900;
+    }, [&] { return erased > 900; });
+    BOOST_CHECK_EQUAL(map.size(), 100U);
+
+    // The entry after the one the pass stopped at, in slot order.
+    auto it = std::next(map.find(last));
+    if (it == map.end()) it = map.begin();
+    const COutPoint next = it->first;
+
+    map.Shrink();
+    BOOST_CHECK(map.capacity() < capacity);
+    std::optional<COutPoint> first;
+    map.EraseCircular([&](const CoinsCachePair& entry) {
+        first = entry.first;
+        return false;
+    }, [&] { return first.has_value(); });
+    BOOST_REQUIRE(first);
+    BOOST_CHECK(*first == next);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_evict)
+{
+    CCoinsView root;
+    CCoinsViewCacheTest base{&root};
+    CCoinsViewCacheTest cache{&base};
+
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 1000; ++i) {
+        outpoints.emplace_back(InsecureRand256(), 0);
+        Coin coin;
+        coin.out.nValue = InsecureRandRange(1000) + 1;
+        coin.out.scriptPubKey.assign(1, OP_TRUE);
+        cache.AddCoin(outpoints.back(), std::move(coin), false);
+    }
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1000U);
+
+    // Flagged coins are never evicted.
+    Coin coin;
+    coin.out.nValue = 1;
+    coin.out.scriptPubKey.assign(1, OP_TRUE);
+    const COutPoint dirty(InsecureRand256(), 0);
+    cache.AddCoin(dirty, std::move(coin), false);
+
+    // The coins looked up since the last pass are kept.
+    for (size_t i = 0; i < 100; ++i) {
+        BOOST_CHECK(cache.HaveCoin(outpoints[i]));
+    }
+    const size_t max_usage = CCoinsMap::UsageForSize(200);
+    const size_t evicted = cache.Evict(max_usage);
+    BOOST_CHECK(evicted > 0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1001U - evicted);
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= max_usage);
+    cache.SelfTest();
+    BOOST_CHECK(cache.HaveCoinInCache(dirty));
+    for (size_t i = 0; i < 100; ++i) {
+        BOOST_CHECK(cache.HaveCoinInCache(outpoints[i]));
+    }
+
+    // The evicted coins are still read from the base view.
+    for (const COutPoint& outpoint : outpoints) {
+        BOOST_CHECK(cache.HaveCoin(outpoint));
+    }
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1001U);
+    cache.SelfTest();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
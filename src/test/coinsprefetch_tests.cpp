@@ -0,0 +1,124 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinsprefetch.h>
+#include <random.h>
+#include <test/test_tapyrus.h>
+#include <txdb.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinsprefetch_tests, BasicTestingSetup)
+
+namespace {
+
+//! A block spending n coins written to db, and one output of its own first transaction.
+std::shared_ptr<CBlock> SpendingBlock(CCoinsViewDB& db, size_t n, std::vector<COutPoint>& spent)
+{
+    CCoinsViewCache cache(&db);
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+    coinbase.vout[0].scriptPubKey.assign(1, OP_TRUE);
+    CMutableTransaction tx;
+    for (size_t i = 0; i < n; ++i) {
+        const COutPoint outpoint(InsecureRand256(), 0);
+        Coin coin;
+        coin.out.nValue = i + 1;
+        coin.out.scriptPubKey.assign(1, OP_TRUE);
+        cache.AddCoin(outpoint, std::move(coin), false);
+        tx.vin.emplace_back(outpoint);
+        spent.push_back(outpoint);
+    }
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey.assign(1, OP_TRUE);
+    cache.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(cache.Flush());
+
+    CMutableTransaction child;
+    child.vin.emplace_back(CTransaction(tx).GetHashMalFix(), 0);
+    child.vout.resize(1);
+
+    auto block = std::make_shared<CBlock>();
+    block->vtx.push_back(MakeTransactionRef(std::move(coinbase)));
+    block->vtx.push_back(MakeTransactionRef(std::move(tx)));
+    block->vtx.push_back(MakeTransactionRef(std::move(child)));
+    return block;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(prefetch_block_inputs)
+{
+    LOCK(cs_main);
+    CCoinsViewDB db(1 << 20, true);
+    std::vector<COutPoint> spent;
+    const std::shared_ptr<CBlock> block = SpendingBlock(db, 200, spent);
+    const uint256 hash = block->GetHash();
+    CBlockIndex index;
+    index.phashBlock = &hash;
+
+    CCoinsPrefetchThreads threads(4);
+    CCoinsPrefetch prefetch(&index, block, db, threads);
+    BOOST_CHECK(prefetch.GetBlockHash() == hash);
+    CCoinsViewCache cache(&db);
+    // One coin is already in the cache and is left alone.
+    BOOST_CHECK(cache.SpendCoin(spent[0]));
+    // The output spent within the block is not in the database.
+    BOOST_CHECK_EQUAL(prefetch.Apply(cache), spent.size() - 1);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), spent.size());
+    BOOST_CHECK(!cache.HaveCoinInCache(spent[0]));
+    for (size_t i = 1; i < spent.size(); ++i) {
+        BOOST_CHECK(cache.HaveCoinInCache(spent[i]));
+        BOOST_CHECK_EQUAL(cache.AccessCoin(spent[i]).out.nValue, CAmount(i + 1));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_discarded_after_write)
+{
+    LOCK(cs_main);
+    CCoinsViewDB db(1 << 20, true);
+    std::vector<COutPoint> spent;
+    const std::shared_ptr<CBlock> block = SpendingBlock(db, 10, spent);
+    const uint256 hash = block->GetHash();
+    CBlockIndex index;
+    index.phashBlock = &hash;
+
+    CCoinsPrefetchThreads threads(1);
+    CCoinsPrefetch prefetch(&index, block, db, threads);
+    // Writing the database may change the coins the prefetch read.
+    CCoinsViewCache writer(&db);
+    BOOST_CHECK(writer.SpendCoin(spent[0]));
+    writer.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(writer.Flush());
+
+    CCoinsViewCache cache(&db);
+    BOOST_CHECK_EQUAL(prefetch.Apply(cache), 0U);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_shared_threads)
+{
+    LOCK(cs_main);
+    CCoinsViewDB db(1 << 20, true);
+    std::vector<COutPoint> spent1, spent2;
+    const std::shared_ptr<CBlock> block1 = SpendingBlock(db, 300, spent1);
+    const std::shared_ptr<CBlock> block2 = SpendingBlock(db, 300, spent2);
+    const uint256 hash1 = block1->GetHash();
+    const uint256 hash2 = block2->GetHash();
+    CBlockIndex index1, index2;
+    index1.phashBlock = &hash1;
+    index2.phashBlock = &hash2;
+
+    // Prefetches running at the same time do not wait for each other's threads.
+    CCoinsPrefetchThreads threads(2);
+    CCoinsPrefetch prefetch1(&index1, block1, db, threads);
+    CCoinsPrefetch prefetch2(&index2, block2, db, threads);
+    CCoinsViewCache cache(&db);
+    BOOST_CHECK_EQUAL(prefetch2.Apply(cache), spent2.size());
+    BOOST_CHECK_EQUAL(prefetch1.Apply(cache), spent1.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,7 @@
 #include <crypto/sha512.h>
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
+#include <crypto/muhash.h>
 #include <random.h>
 #include <utilstrencodings.h>
 #include <test/test_tapyrus.h>
@@ -561,4 +562,78 @@ BOOST_AUTO_TEST_CASE(sha256d64)
     }
 }
 
+static MuHash3072 FromInt(unsigned char i) {
+    unsigned char tmp[32] = {i, 0};
+    return MuHash3072(Span<const unsigned char>(tmp, sizeof(tmp)));
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    uint256 out;
+
+    for (int iter = 0; iter < 10; ++iter) {
+        uint256 res;
+        int table[4];
+        for (int i = 0; i < 4; ++i) {
+            table[i] = InsecureRandBits(3);
+        }
+        for (int order = 0; order < 4; ++order) {
+            MuHash3072 acc;
+            for (int i = 0; i < 4; ++i) {
+                int t = table[i ^ order];
+                if (t & 4) {
+                    acc /= FromInt(t & 3);
+                } else {
+                    acc *= FromInt(t & 3);
+                }
+            }
+            acc.Finalize(out);
+            if (order == 0) {
+                res = out;
+            } else {
+                BOOST_CHECK(res == out);
+            }
+        }
+
+        MuHash3072 x = FromInt(InsecureRandBits(4)); // x=X
+        MuHash3072 y = FromInt(InsecureRandBits(4)); // x=X, y=Y
+        MuHash3072 z;                                // x=X, y=Y, z=1
+        z *= x;                                      // x=X, y=Y, z=X
+        z *= y;                                      // x=X, y=Y, z=X*Y
+        y *= x;                                      // x=X, y=Y*X, z=X*Y
+        z /= y;                                      // x=X, y=Y*X, z=1
+        z.Finalize(out);
+
+        uint256 out2;
+        MuHash3072 a;
+        a.Finalize(out2);
+
+        BOOST_CHECK_EQUAL(out, out2);
+    }
+
+    MuHash3072 acc = FromInt(0);
+    acc *= FromInt(1);
+    acc /= FromInt(2);
+    acc.Finalize(out);
+    BOOST_CHECK_EQUAL(out, uint256S("10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863"));
+
+    // Partial hashes of disjoint subsets combine to the hash of their union.
+    MuHash3072 acc2 = FromInt(0);
+    acc2 /= FromInt(2);
+    MuHash3072 acc3 = FromInt(1);
+    acc2 *= acc3;
+    acc2.Finalize(out);
+    BOOST_CHECK_EQUAL(out, uint256S("10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863"));
+
+    MuHash3072 acc4;
+    unsigned char tmp[32] = {1, 0};
+    acc4.Insert(Span<const unsigned char>(tmp, sizeof(tmp)));
+    acc4.Remove(Span<const unsigned char>(tmp, sizeof(tmp)));
+    acc4.Finalize(out);
+    MuHash3072 empty;
+    uint256 out2;
+    empty.Finalize(out2);
+    BOOST_CHECK_EQUAL(out, out2);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -800,4 +800,198 @@ BOOST_AUTO_TEST_CASE(comparator_tests)
     BOOST_CHECK(pool.CompareDepthAndScore(tf->GetHashMalFix(), tc->GetHashMalFix()));
     BOOST_CHECK(pool.CompareDepthAndScore(tf->GetHashMalFix(), td->GetHashMalFix()));
 }
+
+static CScript ColoredScript(const ColorIdentifier& colorId)
+{
+    return CScript() << colorId.toVector() << OP_COLOR << OP_DUP << OP_HASH160
+                     << ToByteVector(uint160()) << OP_EQUALVERIFY << OP_CHECKSIG;
+}
+
+static CMutableTransaction ColoredTx(int n, const std::vector<ColorIdentifier>& colors)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << n;
+    tx.vout.resize(colors.size() + 1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx.vout[0].nValue = COIN;
+    for (size_t i = 0; i < colors.size(); i++) {
+        tx.vout[i + 1].scriptPubKey = ColoredScript(colors[i]);
+        tx.vout[i + 1].nValue = 100;
+    }
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(MempoolColorIndexTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+    const ColorIdentifier colorA(CScript() << OP_1);
+    const ColorIdentifier colorB(COutPoint(uint256S("01"), 0), TokenTypes::NON_REISSUABLE);
+
+    CMutableTransaction tx1 = ColoredTx(1, {colorA});
+    CMutableTransaction tx2 = ColoredTx(2, {});
+    CMutableTransaction tx3 = ColoredTx(3, {colorA, colorB, colorA});
+
+    LOCK(pool.cs);
+    pool.addUnchecked(tx1.GetHashMalFix(), entry.FromTx(tx1));
+    // tx2 burns colorA: only its input has the color
+    CTxMemPoolEntry entry2 = entry.FromTx(tx2);
+    entry2.AddInputColors({ColorIdentifier(), colorA});
+    BOOST_CHECK(entry2.GetColors() == std::vector<ColorIdentifier>{colorA});
+    pool.addUnchecked(tx2.GetHashMalFix(), entry2);
+    pool.addUnchecked(tx3.GetHashMalFix(), entry.FromTx(tx3));
+
+    BOOST_CHECK_EQUAL(pool.GetColorEntries(colorA).size(), 3U);
+    BOOST_CHECK_EQUAL(pool.GetColorEntries(colorB).size(), 1U);
+    BOOST_CHECK(pool.GetColorEntries(ColorIdentifier()).empty());
+    BOOST_CHECK((*pool.GetColorEntries(colorB).begin())->GetTx().GetHashMalFix() == tx3.GetHashMalFix());
+
+    pool.removeRecursive(CTransaction(tx3));
+    BOOST_CHECK_EQUAL(pool.GetColorEntries(colorA).size(), 2U);
+    BOOST_CHECK(pool.GetColorEntries(colorB).empty());
+
+    pool.removeRecursive(CTransaction(tx1));
+    pool.removeRecursive(CTransaction(tx2));
+    BOOST_CHECK(pool.GetColorEntries(colorA).empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolTokenShareTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+    const ColorIdentifier color(CScript() << OP_1);
+
+    std::vector<CMutableTransaction> tokenTxs;
+    for (int i = 0; i < 4; i++) {
+        tokenTxs.push_back(ColoredTx(i + 1, {color}));
+    }
+    CMutableTransaction tx = ColoredTx(10, {});
+
+    LOCK(pool.cs);
+    for (const CMutableTransaction& tokenTx : tokenTxs) {
+        pool.addUnchecked(tokenTx.GetHashMalFix(), entry.Fee(50000LL).FromTx(tokenTx));
+    }
+    pool.addUnchecked(tx.GetHashMalFix(), entry.Fee(1000LL).FromTx(tx));
+    const size_t nUsage = pool.DynamicMemoryUsage();
+
+    // The token uses more than a quarter of the mempool, so its transactions go
+    // first even though they pay more, and the rolling minimum fee is not bumped.
+    pool.SetTokenShare(25);
+    pool.TrimToSize(nUsage * 9 / 10);
+    BOOST_CHECK(pool.exists(tx.GetHashMalFix()));
+    BOOST_CHECK_EQUAL(pool.GetColorEntries(color).size(), 3U);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    // Without a share the transaction with the lowest fee rate goes first.
+    for (const CMutableTransaction& tokenTx : tokenTxs) {
+        if (!pool.exists(tokenTx.GetHashMalFix()))
+            pool.addUnchecked(tokenTx.GetHashMalFix(), entry.Fee(50000LL).FromTx(tokenTx));
+    }
+    pool.SetTokenShare(0);
+    pool.TrimToSize(nUsage * 9 / 10);
+    BOOST_CHECK(!pool.exists(tx.GetHashMalFix()));
+    BOOST_CHECK_EQUAL(pool.GetColorEntries(color).size(), 4U);
+    BOOST_CHECK(pool.GetMinFee(1).GetFeePerK() > 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    // tx1 is spent by tx2 and tx3, which are both spent by tx4. tx5 is not connected to them.
+    CMutableTransaction tx1 = ColoredTx(1, {});
+    tx1.vout.push_back(tx1.vout[0]);
+    CMutableTransaction tx2 = ColoredTx(2, {});
+    tx2.vin[0].prevout = COutPoint(tx1.GetHashMalFix(), 0);
+    CMutableTransaction tx3 = ColoredTx(3, {});
+    tx3.vin[0].prevout = COutPoint(tx1.GetHashMalFix(), 1);
+    CMutableTransaction tx4 = ColoredTx(4, {});
+    tx4.vin[0].prevout = COutPoint(tx2.GetHashMalFix(), 0);
+    tx4.vin.push_back(CTxIn(COutPoint(tx3.GetHashMalFix(), 0), CScript() << OP_4));
+    CMutableTransaction tx5 = ColoredTx(5, {});
+
+    LOCK(pool.cs);
+    pool.addUnchecked(tx1.GetHashMalFix(), entry.Fee(7000LL).FromTx(tx1));
+    pool.addUnchecked(tx2.GetHashMalFix(), entry.Fee(1000LL).FromTx(tx2));
+    pool.addUnchecked(tx3.GetHashMalFix(), entry.Fee(1100LL).FromTx(tx3));
+    pool.addUnchecked(tx4.GetHashMalFix(), entry.Fee(9000LL).FromTx(tx4));
+    pool.addUnchecked(tx5.GetHashMalFix(), entry.Fee(4000LL).FromTx(tx5));
+
+    CTxMemPool::txiter it1 = pool.mapTx.find(tx1.GetHashMalFix());
+    CTxMemPool::txiter it4 = pool.mapTx.find(tx4.GetHashMalFix());
+    CTxMemPool::txiter it5 = pool.mapTx.find(tx5.GetHashMalFix());
+    BOOST_CHECK_EQUAL(it1->GetClusterId(), it4->GetClusterId());
+    BOOST_CHECK(it1->GetClusterId() != it5->GetClusterId());
+    BOOST_CHECK_EQUAL(it4->GetClusterSize(), 4U);
+    BOOST_CHECK_EQUAL(it5->GetClusterSize(), 1U);
+    BOOST_CHECK_EQUAL(it1->GetClusterPos(), 0U);
+    BOOST_CHECK_EQUAL(it4->GetClusterPos(), 3U);
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize({it4, it5}), 6U);
+
+    // tx4 pays for tx2 and tx3, but not enough to be mined before tx5.
+    const ClusterChunk chunk = it4->GetChunk();
+    BOOST_CHECK_EQUAL(chunk.fee, 11100);
+    BOOST_CHECK_EQUAL(chunk.count, 3U);
+    BOOST_CHECK_EQUAL(it4->GetChunkPos(), 1U);
+    std::vector<uint256> order;
+    for (const CTxMemPoolEntry& e : pool.mapTx.get<chunk_score>()) {
+        order.push_back(e.GetTx().GetHashMalFix());
+    }
+    BOOST_REQUIRE_EQUAL(order.size(), 5U);
+    BOOST_CHECK(order[0] == tx1.GetHashMalFix());
+    BOOST_CHECK(order[1] == tx5.GetHashMalFix());
+    BOOST_CHECK(order[4] == tx4.GetHashMalFix());
+
+    // Trimming evicts the last transaction of the worst chunk only.
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx4.GetHashMalFix()));
+    BOOST_CHECK_EQUAL(pool.size(), 4U);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), CFeeRate(chunk.fee, chunk.size).GetFeePerK() + 1000);
+    BOOST_CHECK_EQUAL(it1->GetClusterSize(), 3U);
+
+    // Prioritising a transaction updates its chunk.
+    pool.PrioritiseTransaction(tx3.GetHashMalFix(), 10000);
+    CTxMemPool::txiter it3 = pool.mapTx.find(tx3.GetHashMalFix());
+    BOOST_CHECK_EQUAL(it3->GetChunk().fee, 7000 + 11100);
+    BOOST_CHECK_EQUAL(it3->GetClusterPos(), 1U);
+
+    // Once tx1 is confirmed, tx2 and tx3 are not connected anymore.
+    pool.removeForBlock({MakeTransactionRef(tx1)}, 1);
+    CTxMemPool::txiter it2 = pool.mapTx.find(tx2.GetHashMalFix());
+    BOOST_CHECK(it2->GetClusterId() != it3->GetClusterId());
+    BOOST_CHECK_EQUAL(it2->GetClusterSize(), 1U);
+    BOOST_CHECK_EQUAL(it3->GetClusterSize(), 1U);
+    BOOST_CHECK_EQUAL(it3->GetChunk().fee, 11100);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterReorgTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    // tx1 is spent by tx2, which is spent by tx3.
+    CMutableTransaction tx1 = ColoredTx(1, {});
+    CMutableTransaction tx2 = ColoredTx(2, {});
+    tx2.vin[0].prevout = COutPoint(tx1.GetHashMalFix(), 0);
+    CMutableTransaction tx3 = ColoredTx(3, {});
+    tx3.vin[0].prevout = COutPoint(tx2.GetHashMalFix(), 0);
+
+    // tx1 comes back from a disconnected block after its descendants.
+    LOCK(pool.cs);
+    pool.addUnchecked(tx2.GetHashMalFix(), entry.Fee(1000LL).FromTx(tx2));
+    pool.addUnchecked(tx3.GetHashMalFix(), entry.Fee(1000LL).FromTx(tx3));
+    pool.addUnchecked(tx1.GetHashMalFix(), entry.Fee(1000LL).FromTx(tx1));
+
+    // The cluster joined by tx1 is trimmed to the limit from its end.
+    pool.UpdateTransactionsFromBlock({tx1.GetHashMalFix()}, 2);
+    BOOST_CHECK_EQUAL(pool.size(), 2U);
+    BOOST_CHECK(pool.exists(tx1.GetHashMalFix()));
+    BOOST_CHECK(pool.exists(tx2.GetHashMalFix()));
+    BOOST_CHECK(!pool.exists(tx3.GetHashMalFix()));
+    CTxMemPool::txiter it1 = pool.mapTx.find(tx1.GetHashMalFix());
+    BOOST_CHECK_EQUAL(it1->GetClusterSize(), 2U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
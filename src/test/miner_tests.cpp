@@ -631,6 +631,109 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_required_age_in_secs)
     BOOST_CHECK(pblocktemplate != nullptr);
     BOOST_CHECK(pblocktemplate->block.vtx.size() == 2); // index 0 is coinbase tx.
     BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHashMalFix() == hashPastTimeTx);
+
+    // A chunk skipped for being too recent does not hold back the chunks of
+    // its cluster which do not spend it.
+    mempool.clear();
+    CMutableTransaction parent;
+    parent.vin.resize(1);
+    parent.vin[0].scriptSig = CScript() << OP_1;
+    parent.vin[0].prevout.hashMalFix = txFirst[2]->GetHashMalFix();
+    parent.vin[0].prevout.n = 0;
+    parent.vout.resize(2);
+    parent.vout[0].nValue = 2000000000LL;
+    parent.vout[0].scriptPubKey = CScript() << OP_1;
+    parent.vout[1] = parent.vout[0];
+    CMutableTransaction recentChild;
+    recentChild.vin.resize(1);
+    recentChild.vin[0].scriptSig = CScript() << OP_1;
+    recentChild.vin[0].prevout = COutPoint(parent.GetHashMalFix(), 0);
+    recentChild.vout.resize(1);
+    recentChild.vout[0].nValue = 2000000000LL - 20000;
+    CMutableTransaction oldChild = recentChild;
+    oldChild.vin[0].prevout.n = 1;
+    oldChild.vout[0].nValue = 2000000000LL - 10000;
+    {
+        LOCK(::mempool.cs);
+        mempool.addUnchecked(parent.GetHashMalFix(),
+                             entry.Fee(30000).Time(GetTime() - 60).SpendsCoinbase(true).FromTx(parent));
+        mempool.addUnchecked(recentChild.GetHashMalFix(),
+                             entry.Fee(20000).Time(GetTime()).SpendsCoinbase(false).FromTx(recentChild));
+        mempool.addUnchecked(oldChild.GetHashMalFix(),
+                             entry.Fee(10000).Time(GetTime() - 60).SpendsCoinbase(false).FromTx(oldChild));
+    }
+    pblocktemplate = AssemblerForTest(Params()).CreateNewBlock(scriptPubKey, 60);
+    BOOST_REQUIRE(pblocktemplate != nullptr);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHashMalFix() == parent.GetHashMalFix());
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHashMalFix() == oldChild.GetHashMalFix());
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(BlockTemplateBuilder_cache)
+{
+    CKey aggregateKey;
+    aggregateKey.Set(validAggPrivateKey, validAggPrivateKey + 32, true);
+    CPubKey aggPubkey;
+    aggPubkey.Set(validAggPubKey, validAggPubKey + 33);
+
+    auto chainParams = FederationParams();
+    chainParams.ReadGenesisBlock(getTestGenesisBlockHex(aggPubkey, aggregateKey));
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    int baseheight = 0;
+    std::vector<CTransactionRef> txFirst;
+    CreateBlocks(Params(), pblocktemplate, baseheight, txFirst);
+
+    // Without a scheduler thread nothing is rebuilt in the background.
+    CScheduler builderScheduler;
+    BlockTemplateBuilder builder(builderScheduler);
+    CScript scriptOther = CScript() << OP_TRUE;
+    CAmount nFeeDelta = -1;
+
+    pblocktemplate = builder.GetBlockTemplate(scriptPubKey, &nFeeDelta);
+    BOOST_REQUIRE(pblocktemplate != nullptr);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK(pblocktemplate->block.vtx[0]->vout[0].scriptPubKey == scriptPubKey);
+    BOOST_CHECK(pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(nFeeDelta, 0);
+
+    // The cached template is handed out with the requested coinbase.
+    std::unique_ptr<CBlockTemplate> pcached = builder.GetBlockTemplate(scriptOther, &nFeeDelta);
+    BOOST_REQUIRE(pcached != nullptr);
+    BOOST_CHECK(pcached->block.vtx[0]->vout[0].scriptPubKey == scriptOther);
+    BOOST_CHECK_EQUAL(pcached->block.vtx[0]->vout[0].nValue, pblocktemplate->block.vtx[0]->vout[0].nValue);
+    BOOST_CHECK_EQUAL(nFeeDelta, 0);
+
+    // A change of the mempool is picked up by the next request.
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].prevout.hashMalFix = txFirst[0]->GetHashMalFix();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 5000000000LL - 1000;
+    {
+        LOCK(::mempool.cs);
+        mempool.addUnchecked(tx.GetHashMalFix(), entry.Fee(1000).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+    }
+    pblocktemplate = builder.GetBlockTemplate(scriptPubKey, &nFeeDelta);
+    BOOST_REQUIRE(pblocktemplate != nullptr);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHashMalFix() == tx.GetHashMalFix());
+    BOOST_CHECK_EQUAL(nFeeDelta, 1000);
+
+    pblocktemplate = builder.GetBlockTemplate(scriptPubKey, &nFeeDelta);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+    BOOST_CHECK_EQUAL(nFeeDelta, 0);
+
+    {
+        LOCK(::mempool.cs);
+        mempool.removeRecursive(CTransaction(tx));
+    }
+    pblocktemplate = builder.GetBlockTemplate(scriptPubKey, &nFeeDelta);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK_EQUAL(nFeeDelta, -1000);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
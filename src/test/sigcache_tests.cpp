@@ -0,0 +1,155 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <key.h>
+#include <primitives/transaction.h>
+#include <script/script.h>
+#include <script/sigcache.h>
+#include <test/test_tapyrus.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sigcache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(sigcache_set_contains)
+{
+    SignatureCacheSet set;
+    const size_t capacity = set.setup_bytes(1 << 20);
+
+    // Fill the set to half of its capacity: every entry is found, nothing else is.
+    std::vector<uint256> entries;
+    for (size_t i = 0; i < capacity / 2; ++i) {
+        entries.push_back(InsecureRand256());
+        set.insert(entries.back());
+    }
+    SignatureCacheStats stats = set.GetStats();
+    BOOST_CHECK_EQUAL(stats.capacity, capacity);
+    BOOST_CHECK_EQUAL(stats.inserts, entries.size());
+    BOOST_CHECK_EQUAL(stats.entries + stats.evictions, entries.size());
+    BOOST_CHECK(stats.evictions < entries.size() / 1000);
+
+    size_t found = 0;
+    for (const uint256& entry : entries) {
+        found += set.contains(entry, false);
+    }
+    BOOST_CHECK_EQUAL(found, entries.size() - stats.evictions);
+    for (int i = 0; i < 1000; ++i) {
+        BOOST_CHECK(!set.contains(InsecureRand256(), false));
+    }
+
+    stats = set.GetStats();
+    BOOST_CHECK_EQUAL(stats.hits, found);
+    BOOST_CHECK_EQUAL(stats.misses, entries.size() - found + 1000);
+
+    // Inserting again is not counted, and erased entries are still found until overwritten.
+    set.insert(entries[0]);
+    BOOST_CHECK_EQUAL(set.GetStats().inserts, entries.size());
+    BOOST_CHECK(set.contains(entries[0], true));
+    BOOST_CHECK(set.contains(entries[0], false));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_set_resize)
+{
+    SignatureCacheSet set;
+    const size_t capacity = set.setup_bytes(1 << 20);
+    std::vector<uint256> entries;
+    for (size_t i = 0; i < capacity / 4; ++i) {
+        entries.push_back(InsecureRand256());
+        set.insert(entries.back());
+    }
+
+    // Growing keeps every entry; shrinking keeps as many as fit.
+    BOOST_CHECK(set.setup_bytes(4 << 20) > capacity);
+    size_t found = 0;
+    for (const uint256& entry : entries) {
+        found += set.contains(entry, false);
+    }
+    BOOST_CHECK_EQUAL(found, set.GetStats().entries);
+
+    const size_t small_capacity = set.setup_bytes(1 << 10);
+    const SignatureCacheStats stats = set.GetStats();
+    BOOST_CHECK_EQUAL(stats.capacity, small_capacity);
+    BOOST_CHECK(stats.entries <= small_capacity);
+    BOOST_CHECK_EQUAL(stats.entries + stats.evictions, entries.size());
+
+    // Lookups running while the set is resized never see an entry that was not inserted.
+    set.setup_bytes(1 << 20);
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> fakes{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; ++t) {
+        readers.emplace_back([&] {
+            FastRandomContext rng;
+            while (!stop) {
+                fakes += set.contains(rng.rand256(), false);
+            }
+        });
+    }
+    for (int i = 0; i < 20; ++i) {
+        set.setup_bytes((i % 2 ? 1 : 2) << 20);
+        for (int j = 0; j < 100; ++j) {
+            set.insert(InsecureRand256());
+        }
+    }
+    stop = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    BOOST_CHECK_EQUAL(fakes, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_deferred_signatures)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript checksig = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    const CScript checksig_not = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG << OP_NOT;
+    const CAmount amount = 1000;
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = amount;
+    const CTransaction tx(mtx);
+
+    std::vector<unsigned char> sig;
+    BOOST_REQUIRE(key.Sign_Schnorr(SignatureHash(checksig, tx, 0, SIGHASH_ALL, amount), sig));
+    sig.push_back(SIGHASH_ALL);
+    std::vector<unsigned char> bad_sig;
+    BOOST_REQUIRE(key.Sign_Schnorr(SignatureHash(checksig_not, tx, 0, SIGHASH_ALL, amount), bad_sig));
+    bad_sig.push_back(SIGHASH_ALL);
+    bad_sig[10] ^= 1;
+
+    // Both signatures are assumed valid and collected, tagged with the check they came from.
+    CSignatureBatch batch;
+    ColorIdentifier colorId;
+    ScriptError err;
+    BOOST_CHECK(VerifyScript(CScript() << sig, checksig, SCRIPT_VERIFY_NONE,
+        CachingTransactionSignatureChecker(&tx, 0, amount, false, nullptr, &batch, 3), colorId, &err));
+    BOOST_CHECK(!VerifyScript(CScript() << bad_sig, checksig_not, SCRIPT_VERIFY_NONE,
+        CachingTransactionSignatureChecker(&tx, 0, amount, false, nullptr, &batch, 5), colorId, &err));
+    BOOST_CHECK_EQUAL(err, SCRIPT_ERR_EVAL_FALSE);
+    BOOST_CHECK_EQUAL(batch.size(), 2U);
+
+    // Only the check that relied on the invalid signature has to be run again, and then
+    // it gets the result it has without deferring.
+    for (CSignatureCheck& check : batch.GetChecks()) {
+        BOOST_CHECK(!check().has_value());
+    }
+    BOOST_CHECK(batch.GetInvalidOrigins() == std::set<size_t>{5});
+    BOOST_CHECK(VerifyScript(CScript() << bad_sig, checksig_not, SCRIPT_VERIFY_NONE,
+        CachingTransactionSignatureChecker(&tx, 0, amount, false), colorId, &err));
+
+    // Without a batch nothing is deferred.
+    BOOST_CHECK(!VerifyScript(CScript() << bad_sig, checksig, SCRIPT_VERIFY_NONE,
+        CachingTransactionSignatureChecker(&tx, 0, amount, false), colorId, &err));
+    BOOST_CHECK_EQUAL(err, SCRIPT_ERR_EVAL_FALSE);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
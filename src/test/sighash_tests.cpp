@@ -162,6 +162,26 @@ BOOST_AUTO_TEST_CASE(sighash_test)
     #endif
 }
 
+// Goal: check that the precomputed transaction data gives the same hash for every input
+BOOST_AUTO_TEST_CASE(sighash_precomputed)
+{
+    SeedInsecureRand(false);
+
+    for (int i=0; i<2000; i++) {
+        int nHashType = InsecureRand32();
+        CMutableTransaction txTo;
+        RandomTransaction(txTo, (nHashType & 0x1f) == SIGHASH_SINGLE);
+        CScript scriptCode;
+        RandomScript(scriptCode);
+        const CTransaction tx(txTo);
+        const PrecomputedTransactionData txdata(tx);
+
+        for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++) {
+            BOOST_CHECK(SignatureHash(scriptCode, tx, nIn, nHashType, 0, &txdata) == SignatureHash(scriptCode, tx, nIn, nHashType, 0));
+        }
+    }
+}
+
 // Goal: check that SignatureHash generates correct hash
 BOOST_AUTO_TEST_CASE(sighash_from_data)
 {
@@ -207,6 +227,9 @@ BOOST_AUTO_TEST_CASE(sighash_from_data)
 
         sh = SignatureHash(scriptCode, *tx, nIn, nHashType, 0);
         BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
+        const PrecomputedTransactionData txdata(*tx);
+        sh = SignatureHash(scriptCode, *tx, nIn, nHashType, 0, &txdata);
+        BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
     }
 }
 BOOST_AUTO_TEST_SUITE_END()
@@ -783,4 +783,96 @@ BOOST_FIXTURE_TEST_CASE(testmempoolaccept_missing_inputs_no_overlay_leak, Packag
     BOOST_CHECK(validationState[mtx_child.GetHashMalFix()].missingInputs);
 }
 
+BOOST_FIXTURE_TEST_CASE(ancestor_package_tests, PackageTestSetup)
+{
+    unsigned long index_cb = m_coinbase_txns.size(); //init this index before refilling coinbase
+    refillCoinbase(10);
+    std::vector<unsigned char> vchSig;
+
+    // A parent paying no fee and a child paying for both
+    COutPoint spend_cbase(m_coinbase_txns[index_cb]->GetHashMalFix(), 0);
+    CAmount nValue = m_coinbase_txns[index_cb]->vout[0].nValue;
+    CMutableTransaction mtx_parent = CreateValidTransaction(spend_cbase, nValue, {CScript() << OP_TRUE << OP_EQUAL});
+    Sign(vchSig, coinbaseKey, m_coinbase_txns[index_cb]->vout[0].scriptPubKey, 0, mtx_parent, 0);
+    mtx_parent.vin[0].scriptSig = CScript() << vchSig;
+    CTransactionRef tx_parent{MakeTransactionRef(mtx_parent)};
+
+    COutPoint spend_parent(tx_parent->GetHashMalFix(), 0);
+    CMutableTransaction mtx_child = CreateValidTransaction(spend_parent, nValue - 4 * COIN - CENT, {CScript() << OP_TRUE << OP_EQUAL});
+    mtx_child.vin[0].scriptSig = CScript() << OP_TRUE;
+    for(int x = 0; x < 4; ++x)
+        mtx_child.vout.push_back(CTxOut(CAmount(1 * COIN), {CScript() << OP_TRUE << OP_EQUAL}));
+    CTransactionRef tx_child{MakeTransactionRef(mtx_child)};
+
+    // A parent paying a fee and a child paying none
+    ++index_cb;
+    COutPoint spend_cbase2(m_coinbase_txns[index_cb]->GetHashMalFix(), 0);
+    CMutableTransaction mtx_parent2 = CreateValidTransaction(spend_cbase2, m_coinbase_txns[index_cb]->vout[0].nValue - CENT, {CScript() << OP_TRUE << OP_EQUAL});
+    Sign(vchSig, coinbaseKey, m_coinbase_txns[index_cb]->vout[0].scriptPubKey, 0, mtx_parent2, 0);
+    mtx_parent2.vin[0].scriptSig = CScript() << vchSig;
+    CTransactionRef tx_parent2{MakeTransactionRef(mtx_parent2)};
+
+    COutPoint spend_parent2(tx_parent2->GetHashMalFix(), 0);
+    CMutableTransaction mtx_child2 = CreateValidTransaction(spend_parent2, mtx_parent2.vout[0].nValue - 4 * COIN, {CScript() << OP_TRUE << OP_EQUAL});
+    mtx_child2.vin[0].scriptSig = CScript() << OP_TRUE;
+    for(int x = 0; x < 4; ++x)
+        mtx_child2.vout.push_back(CTxOut(CAmount(1 * COIN), {CScript() << OP_TRUE << OP_EQUAL}));
+    CTransactionRef tx_child2{MakeTransactionRef(mtx_child2)};
+
+    BOOST_CHECK(IsAncestorPackage({tx_parent, tx_child}));
+    BOOST_CHECK(IsAncestorPackage({tx_child}));
+    BOOST_CHECK(!IsAncestorPackage({tx_parent2, tx_child}));
+    BOOST_CHECK(!IsAncestorPackage({tx_parent, tx_child, tx_parent2}));
+
+    // The parent is rejected alone
+    {
+        LOCK(cs_main);
+        CTxMempoolAcceptanceOptions opt;
+        BOOST_CHECK(!AcceptToMemoryPool(tx_parent, opt));
+        BOOST_CHECK_EQUAL(opt.state.GetRejectCode(), REJECT_INSUFFICIENTFEE);
+        BOOST_CHECK_EQUAL(opt.state.GetRejectReason(), "min relay fee not met");
+    }
+
+    // Unrelated transactions are not an ancestor package
+    {
+        CValidationState state;
+        PackageValidationState packageState;
+        BOOST_CHECK(!AcceptAncestorPackage({tx_parent2, tx_child}, state, packageState));
+        BOOST_CHECK_EQUAL(state.GetRejectCode(), REJECT_PACKAGE_INVALID);
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "package-not-child-with-parents");
+    }
+
+    // A parent cannot pay for its child: nothing of the package is accepted
+    {
+        CValidationState state;
+        PackageValidationState packageState;
+        BOOST_CHECK(!AcceptAncestorPackage({tx_parent2, tx_child2}, state, packageState));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "package-not-accepted");
+        BOOST_CHECK_EQUAL(packageState[tx_parent2->GetHashMalFix()].GetRejectCode(), 0);
+        BOOST_CHECK_EQUAL(packageState[tx_child2->GetHashMalFix()].GetRejectReason(), "min relay fee not met");
+        BOOST_CHECK(!mempool.exists(tx_parent2->GetHashMalFix()));
+        BOOST_CHECK(!mempool.exists(tx_child2->GetHashMalFix()));
+    }
+
+    // The child pays for its parent
+    {
+        CValidationState state;
+        PackageValidationState packageState;
+        BOOST_CHECK(AcceptAncestorPackage({tx_parent, tx_child}, state, packageState));
+        BOOST_CHECK(state.IsValid());
+        BOOST_CHECK_EQUAL(packageState[tx_parent->GetHashMalFix()].GetRejectReason(), "");
+        BOOST_CHECK_EQUAL(packageState[tx_child->GetHashMalFix()].GetRejectReason(), "");
+        BOOST_CHECK(mempool.exists(tx_parent->GetHashMalFix()));
+        BOOST_CHECK(mempool.exists(tx_child->GetHashMalFix()));
+    }
+
+    // Transactions which are in the mempool already are skipped
+    {
+        CValidationState state;
+        PackageValidationState packageState;
+        BOOST_CHECK(AcceptAncestorPackage({tx_parent, tx_child}, state, packageState));
+        BOOST_CHECK(packageState.empty());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
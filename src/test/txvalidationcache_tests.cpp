@@ -374,4 +374,137 @@ BOOST_FIXTURE_TEST_CASE(checkinputs_test, TestChainSetup)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(mempool_precheck, TestChainSetup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    std::vector<CTransactionRef> txs;
+    for (int i = 0; i < 2; i++) {
+        CMutableTransaction spend;
+        spend.nFeatures = 1;
+        spend.vin.resize(1);
+        spend.vin[0].prevout.hashMalFix = m_coinbase_txns[i]->GetHashMalFix();
+        spend.vin[0].prevout.n = 0;
+        spend.vout.resize(1);
+        spend.vout[0].nValue = 11*CENT;
+        spend.vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0);
+        BOOST_CHECK(coinbaseKey.Sign_Schnorr(hash, vchSig));
+        // The second transaction has an invalid signature.
+        if (i == 1)
+            vchSig[0] ^= 1;
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spend.vin[0].scriptSig << vchSig;
+        txs.push_back(MakeTransactionRef(spend));
+    }
+    // A coinbase transaction is not checked.
+    txs.push_back(m_coinbase_txns[2]);
+
+    std::vector<CTxMempoolPreCheck> prechecks;
+    PreCheckForMemPool(txs, prechecks);
+    BOOST_REQUIRE_EQUAL(prechecks.size(), 3U);
+    uint256 hashTip;
+    {
+        LOCK(cs_main);
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+    BOOST_CHECK(prechecks[0].hash == txs[0]->GetHashMalFix());
+    BOOST_CHECK(prechecks[0].hashTip == hashTip);
+    BOOST_CHECK(!prechecks[0].fFailed);
+    BOOST_CHECK(prechecks[1].hashTip == hashTip);
+    BOOST_CHECK(prechecks[1].fFailed);
+    BOOST_CHECK_EQUAL(prechecks[1].state.GetRejectReason().rfind("mandatory-script-verify-flag-failed", 0), 0U);
+    BOOST_CHECK(prechecks[2].hashTip.IsNull());
+    BOOST_CHECK(!prechecks[2].fFailed);
+
+    // A failed pre-check is reused while the tip does not move...
+    CTxMempoolPreCheck failed = prechecks[0];
+    failed.fFailed = true;
+    failed.state.DoS(0, false, REJECT_INVALID, "precheck-failed");
+    {
+        LOCK(cs_main);
+        CTxMempoolAcceptanceOptions opt;
+        opt.precheck = &failed;
+        BOOST_CHECK(!AcceptToMemoryPool(txs[0], opt));
+        BOOST_CHECK_EQUAL(opt.state.GetRejectReason(), "precheck-failed");
+
+        CTxMempoolAcceptanceOptions opt2;
+        opt2.precheck = &prechecks[1];
+        BOOST_CHECK(!AcceptToMemoryPool(txs[1], opt2));
+        BOOST_CHECK_EQUAL(opt2.state.GetRejectReason(), prechecks[1].state.GetRejectReason());
+    }
+
+    // ... and the transaction is checked again once it moved.
+    CreateAndProcessBlock({}, scriptPubKey);
+    {
+        LOCK(cs_main);
+        CTxMempoolAcceptanceOptions opt;
+        opt.precheck = &failed;
+        BOOST_CHECK(AcceptToMemoryPool(txs[0], opt));
+        BOOST_CHECK(mempool.exists(txs[0]->GetHashMalFix()));
+    }
+
+    // The coins pulled in for a transaction that is not passed to AcceptToMemoryPool
+    // are uncached, unless the transaction is in the mempool.
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        std::vector<CTxMempoolPreCheck> skipped(2);
+        for (size_t i = 0; i < skipped.size(); i++) {
+            skipped[i].hash = txs[i]->GetHashMalFix();
+            skipped[i].coins_to_uncache.push_back(txs[i]->vin[0].prevout);
+            pcoinsTip->AccessCoin(txs[i]->vin[0].prevout);
+            BOOST_CHECK(pcoinsTip->HaveCoinInCache(txs[i]->vin[0].prevout));
+        }
+        UncachePreCheckedCoins(skipped);
+        BOOST_CHECK(pcoinsTip->HaveCoinInCache(txs[0]->vin[0].prevout));
+        BOOST_CHECK(!pcoinsTip->HaveCoinInCache(txs[1]->vin[0].prevout));
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(checkinputs_color_cache, TestChainSetup)
+{
+    LOCK(cs_main);
+    InitScriptExecutionCache();
+
+    // A coin colored with a CP2SH script that anyone can spend
+    const CScript redeemScript = CScript() << OP_TRUE;
+    const ColorIdentifier colorId(redeemScript);
+    const CScript coloredScript = CScript() << colorId.toVector() << OP_COLOR << OP_HASH160 << ToByteVector(CScriptID(redeemScript)) << OP_EQUAL;
+    BOOST_REQUIRE(GetColorIdFromScript(coloredScript) == colorId);
+
+    CCoinsView dummy;
+    CCoinsViewCache coins(&dummy);
+    const COutPoint prevout(InsecureRand256(), 0);
+    coins.AddCoin(prevout, Coin(CTxOut(100, coloredScript), 1, false), false);
+
+    CMutableTransaction mtx;
+    mtx.vin.emplace_back(prevout, CScript() << ToByteVector(redeemScript));
+    mtx.vout.emplace_back(100, coloredScript);
+    const CTransaction tx(mtx);
+
+    // Caching the script execution keeps the colors of the inputs with it.
+    CValidationState state;
+    std::vector<ColorIdentifier> colors;
+    BOOST_CHECK(CheckInputs(tx, state, coins, true, SCRIPT_VERIFY_NONE, true, true, nullptr, 0, nullptr, &colors));
+    BOOST_CHECK(colors == std::vector<ColorIdentifier>{colorId});
+
+    // A block connect that finds the scripts cached gets the colors from the cache, not
+    // from the spent coins: this view has none.
+    CCoinsViewCache no_coins(&dummy);
+    std::vector<CScriptCheck> scriptchecks;
+    std::vector<ColorIdentifier> cached_colors;
+    BOOST_CHECK(CheckInputs(tx, state, no_coins, true, SCRIPT_VERIFY_NONE, false, false, &scriptchecks, 0, nullptr, &cached_colors));
+    BOOST_CHECK(scriptchecks.empty());
+    BOOST_CHECK(cached_colors == colors);
+
+    // Other flags make another entry, which has to be checked and derives the colors.
+    cached_colors.clear();
+    BOOST_CHECK(CheckInputs(tx, state, coins, true, SCRIPT_VERIFY_NULLFAIL, false, false, &scriptchecks, 0, nullptr, &cached_colors));
+    BOOST_CHECK_EQUAL(scriptchecks.size(), 1U);
+    BOOST_CHECK(cached_colors == colors);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
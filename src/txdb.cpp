@@ -29,7 +29,11 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_BLOCK_INDEX_SNAPSHOT = 'n';
 static const char DB_ISSUED_COLORID = 'I';
+static const char DB_SNAPSHOT_BASE = 'S';
+static const char DB_SNAPSHOT_UTXO_HASH = 'U';
+static const char DB_SNAPSHOT_VALIDATED = 'V';
 
 namespace {
 
@@ -55,7 +59,7 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const std::string& dirName) : db(GetDataDir() / dirName, nCacheSize, fMemory, fWipe, true)
 {
 }
 
@@ -83,6 +87,8 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CoinsViewCacheCursor& cursor, const uint256 &hashBlock) {
+    // Counted before the first write, see CCoinsPrefetch.
+    ++m_write_count;
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -169,6 +175,49 @@ bool CCoinsViewDB::LoadIssuedColorIds(std::set<ColorIdentifier>& colorIds)
     return !pcursor->HasError();
 }
 
+bool CCoinsViewDB::WriteSnapshotBase(const uint256& hashBase, const uint256& hashUTXOSet)
+{
+    CDBBatch batch(db);
+    batch.Write(DB_SNAPSHOT_UTXO_HASH, hashUTXOSet);
+    batch.Write(DB_SNAPSHOT_BASE, hashBase);
+    return db.WriteBatch(batch, true);
+}
+
+uint256 CCoinsViewDB::GetSnapshotBase() const
+{
+    uint256 hashBase;
+    if (!db.Read(DB_SNAPSHOT_BASE, hashBase))
+        return uint256();
+    return hashBase;
+}
+
+uint256 CCoinsViewDB::GetSnapshotUTXOHash() const
+{
+    uint256 hashUTXOSet;
+    if (!db.Read(DB_SNAPSHOT_UTXO_HASH, hashUTXOSet))
+        return uint256();
+    return hashUTXOSet;
+}
+
+bool CCoinsViewDB::WriteSnapshotValidated()
+{
+    return db.Write(DB_SNAPSHOT_VALIDATED, '1', true);
+}
+
+bool CCoinsViewDB::IsSnapshotValidated() const
+{
+    return db.Exists(DB_SNAPSHOT_VALIDATED);
+}
+
+bool CCoinsViewDB::EraseSnapshotBase()
+{
+    CDBBatch batch(db);
+    batch.Erase(DB_SNAPSHOT_BASE);
+    batch.Erase(DB_SNAPSHOT_UTXO_HASH);
+    batch.Erase(DB_SNAPSHOT_VALIDATED);
+    return db.WriteBatch(batch, true);
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(gArgs.IsArgSet("-blocksdir") ? GetDataDir() / "blocks" / "index" : GetBlocksDir() / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -233,16 +282,34 @@ CCoinsViewCursor *CCoinsViewDB::Cursor() const
        that restriction.  */
     i->pcursor->Seek(DB_COIN);
     // Cache key of first record
-    if (i->pcursor->Valid()) {
-        CoinEntry entry(&i->keyTmp.second);
-        i->pcursor->GetKey(entry);
-        i->keyTmp.first = entry.key;
-    } else {
-        i->keyTmp.first = 0; // Make sure Valid() and GetKey() return false
-    }
+    i->CacheKey();
     return i;
 }
 
+std::vector<std::unique_ptr<CCoinsViewCursor>> CCoinsViewDB::RangeCursors(int nRanges) const
+{
+    assert(nRanges > 0 && nRanges <= 256);
+
+    const CDBWrapper::Snapshot snapshot = db.GetSnapshot();
+    uint256 hashBestChain;
+    if (!db.Read(DB_BEST_BLOCK, hashBestChain, snapshot))
+        hashBestChain.SetNull();
+
+    std::vector<std::unique_ptr<CCoinsViewCursor>> cursors;
+    for (int n = 0; n < nRanges; n++) {
+        const unsigned int nBegin = 256 * n / nRanges;
+        const unsigned int nEnd = 256 * (n + 1) / nRanges;
+        CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(snapshot), hashBestChain, snapshot, nEnd);
+        // Keys are ordered by the serialized txid, whose first byte is begin()[0].
+        uint256 hashBegin;
+        *hashBegin.begin() = nBegin;
+        i->pcursor->Seek(std::make_pair(DB_COIN, hashBegin));
+        i->CacheKey();
+        cursors.emplace_back(i);
+    }
+    return cursors;
+}
+
 bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
 {
     // Return cached key
@@ -271,8 +338,13 @@ bool CCoinsViewDBCursor::Valid() const
 void CCoinsViewDBCursor::Next()
 {
     pcursor->Next();
+    CacheKey();
+}
+
+void CCoinsViewDBCursor::CacheKey()
+{
     CoinEntry entry(&keyTmp.second);
-    if (!pcursor->Valid() || !pcursor->GetKey(entry)) {
+    if (!pcursor->Valid() || !pcursor->GetKey(entry) || *keyTmp.second.hashMalFix.begin() >= m_end) {
         keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
     } else {
         keyTmp.first = entry.key;
@@ -285,10 +357,85 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
         batch.Write(std::make_pair(DB_BLOCK_FILES, it->first), *it->second);
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
+    if (!blockinfo.empty()) {
+        // A snapshot of the block index does not match the database any more.
+        batch.Erase(DB_BLOCK_INDEX_SNAPSHOT);
+    }
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
-        batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
+        std::vector<unsigned char> proof;
+        if (!ReadBlockProof((*it)->GetBlockHash(), proof))
+            return error("%s: no proof for block %s", __func__, (*it)->GetBlockHash().ToString());
+        batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it, proof));
+    }
+    if (!WriteBatch(batch, true))
+        return false;
+
+    LOCK(m_proofs_mutex);
+    for (const CBlockIndex* pindex : blockinfo) {
+        auto it = m_unwritten_proofs.find(pindex->GetBlockHash());
+        if (it == m_unwritten_proofs.end()) continue;
+        // The headers of new blocks are the ones announced to peers next.
+        AddRecentProof(it->first, it->second);
+        m_unwritten_proofs.erase(it);
+    }
+    return true;
+}
+
+bool CBlockTreeDB::WriteBlockIndexSnapshotId(const uint256& id)
+{
+    return Write(DB_BLOCK_INDEX_SNAPSHOT, id, true);
+}
+
+bool CBlockTreeDB::ReadBlockIndexSnapshotId(uint256& id)
+{
+    return Read(DB_BLOCK_INDEX_SNAPSHOT, id);
+}
+
+void CBlockTreeDB::AddBlockProof(const uint256& hash, const std::vector<unsigned char>& proof)
+{
+    LOCK(m_proofs_mutex);
+    m_unwritten_proofs.emplace(hash, proof);
+}
+
+void CBlockTreeDB::AddRecentProof(const uint256& hash, const std::vector<unsigned char>& proof)
+{
+    auto it = m_recent_proofs_index.find(hash);
+    if (it != m_recent_proofs_index.end()) {
+        m_recent_proofs.splice(m_recent_proofs.begin(), m_recent_proofs, it->second);
+        return;
+    }
+    m_recent_proofs.emplace_front(hash, proof);
+    m_recent_proofs_index.emplace(hash, m_recent_proofs.begin());
+    if (m_recent_proofs.size() > MAX_RECENT_BLOCK_PROOFS) {
+        m_recent_proofs_index.erase(m_recent_proofs.back().first);
+        m_recent_proofs.pop_back();
     }
-    return WriteBatch(batch, true);
+}
+
+bool CBlockTreeDB::ReadBlockProof(const uint256& hash, std::vector<unsigned char>& proof)
+{
+    {
+        LOCK(m_proofs_mutex);
+        auto it = m_unwritten_proofs.find(hash);
+        if (it != m_unwritten_proofs.end()) {
+            proof = it->second;
+            return true;
+        }
+        auto recent = m_recent_proofs_index.find(hash);
+        if (recent != m_recent_proofs_index.end()) {
+            m_recent_proofs.splice(m_recent_proofs.begin(), m_recent_proofs, recent->second);
+            proof = recent->second->second;
+            return true;
+        }
+    }
+    CDiskBlockIndex diskindex;
+    if (!Read(std::make_pair(DB_BLOCK_INDEX, hash), diskindex))
+        return false;
+    proof = std::move(diskindex.proof);
+
+    LOCK(m_proofs_mutex);
+    AddRecentProof(hash, proof);
+    return true;
 }
 
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
@@ -326,8 +473,7 @@ bool CBlockTreeDB::LoadBlockIndexGuts(std::function<CBlockIndex*(const uint256&)
                 pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
                 pindexNew->hashImMerkleRoot = diskindex.hashImMerkleRoot;
                 pindexNew->nTime          = diskindex.nTime;
-                pindexNew->xfield         = diskindex.xfield;
-                pindexNew->proof          = diskindex.proof;
+                pindexNew->SetXField(diskindex.xfield);
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
 
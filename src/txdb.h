@@ -16,6 +16,8 @@
 #include <sync.h>
 #include <xfieldhistory.h>
 
+#include <atomic>
+#include <list>
 #include <map>
 #include <memory>
 #include <set>
@@ -68,6 +70,8 @@ struct XFieldAggpubkey {
 
 //! No need to periodic flush if at least this much space still available.
 static constexpr int MAX_BLOCK_COINSDB_USAGE = 10;
+//! -dbcache share, in percent, kept in the coins cache when a flush evicts coins from it
+static constexpr int COINS_CACHE_EVICT_TARGET_PERCENT = 70;
 //! -dbcache default (MiB)
 static const int64_t nDefaultDbCache = 450;
 //! -dbbatchsize default (bytes)
@@ -82,20 +86,37 @@ static const int64_t nMaxBlockDBCache = 2;
 // Unlike for the UTXO database, for the txindex scenario the leveldb cache make
 // a meaningful difference: https://github.com/bitcoin/bitcoin/pull/8273#issuecomment-229601991
 static const int64_t nMaxTxIndexCache = 1024;
+//! Max memory allocated to coinstats index DB specific cache in MiB
+static const int64_t nMaxCoinStatsIndexCache = 8;
+//! Max memory allocated to address index DB specific cache in MiB
+static const int64_t nMaxAddressIndexCache = 256;
+//! Max memory allocated to token index DB specific cache in MiB
+static const int64_t nMaxTokenIndexCache = 32;
+//! Max memory allocated to all block filter index caches combined in MiB.
+static const int64_t max_filter_index_cache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! Number of block proofs read back from the block tree DB that are kept in memory
+static const size_t MAX_RECENT_BLOCK_PROOFS = 4000;
+
+//! Directory (relative to the data directory) of the coin database
+static const char* const DEFAULT_CHAINSTATE_DIR = "chainstate";
+//! Directory (relative to the data directory) of a coin database built from a UTXO snapshot
+static const char* const SNAPSHOT_CHAINSTATE_DIR = "chainstate_snapshot";
 
 /** Tracks NON_REISSUABLE and NFT colorIds issued on-chain; see issuedcolorids.h. */
 class CIssuedColorIds;
 
-/** CCoinsView backed by the coin database (chainstate/) */
+/** CCoinsView backed by the coin database (chainstate/ or chainstate_snapshot/) */
 class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
     CIssuedColorIds* m_colorid_state = nullptr;
+    //! Number of calls to BatchWrite, so that readers without cs_main can tell that a coin they read may be stale
+    std::atomic<uint64_t> m_write_count{0};
 public:
-    explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const std::string& dirName = DEFAULT_CHAINSTATE_DIR);
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
@@ -103,6 +124,14 @@ public:
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CoinsViewCacheCursor& cursor, const uint256 &hashBlock) override EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     CCoinsViewCursor *Cursor() const override;
+    uint64_t GetWriteCount() const { return m_write_count.load(); }
+
+    /**
+     * Split the coins into nRanges (at most 256) disjoint ranges of txids, in key order,
+     * and return a cursor over each. All cursors read the same consistent view of the
+     * database, so the ranges can be scanned in parallel while the database is written to.
+     */
+    std::vector<std::unique_ptr<CCoinsViewCursor>> RangeCursors(int nRanges) const;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
@@ -113,6 +142,18 @@ public:
 
 
     bool LoadIssuedColorIds(std::set<ColorIdentifier>& colorIds);
+
+    //! Record the base block hash and the UTXO set hash of the snapshot this database was built from.
+    bool WriteSnapshotBase(const uint256& hashBase, const uint256& hashUTXOSet);
+    //! Return the snapshot base block hash, or null if this database was not built from a snapshot.
+    uint256 GetSnapshotBase() const;
+    //! Return the UTXO set hash of the snapshot, or null if this database was not built from a snapshot.
+    uint256 GetSnapshotUTXOHash() const;
+    //! Record that the blocks below the snapshot base were validated and produced the snapshot UTXO set.
+    bool WriteSnapshotValidated();
+    bool IsSnapshotValidated() const;
+    //! Forget the snapshot this database was built from.
+    bool EraseSnapshotBase();
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -131,8 +172,16 @@ public:
 private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
         CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+    CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn, const CDBWrapper::Snapshot& snapshot, unsigned int nEnd):
+        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn), m_snapshot(snapshot), m_end(nEnd) {}
+    //! Cache the key of the current record, or invalidate it past the last coin in range.
+    void CacheKey();
     std::unique_ptr<CDBIterator> pcursor;
     std::pair<char, COutPoint> keyTmp;
+    //! Database snapshot the iterator reads, if any; must outlive pcursor.
+    CDBWrapper::Snapshot m_snapshot;
+    //! Stop before txids whose first byte is m_end or above.
+    unsigned int m_end = 256;
 
     friend class CCoinsViewDB;
 };
@@ -140,9 +189,32 @@ private:
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper
 {
+private:
+    Mutex m_proofs_mutex;
+    //! Proofs of block index entries that were not written yet, see AddBlockProof().
+    std::map<uint256, std::vector<unsigned char>> m_unwritten_proofs GUARDED_BY(m_proofs_mutex);
+    //! Proofs read or written most recently, most recent first, so that serving the
+    //! same headers to several peers does not read them from the database each time.
+    std::list<std::pair<uint256, std::vector<unsigned char>>> m_recent_proofs GUARDED_BY(m_proofs_mutex);
+    std::map<uint256, std::list<std::pair<uint256, std::vector<unsigned char>>>::iterator> m_recent_proofs_index GUARDED_BY(m_proofs_mutex);
+
+    void AddRecentProof(const uint256& hash, const std::vector<unsigned char>& proof) EXCLUSIVE_LOCKS_REQUIRED(m_proofs_mutex);
+
 public:
     explicit CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
+    /**
+     * The block index does not keep the proofs of its headers in memory. The proof of
+     * a new entry is kept here until WriteBatchSync() writes the entry, and is read
+     * back from the database afterwards. The last MAX_RECENT_BLOCK_PROOFS proofs read
+     * or written are kept in memory.
+     *
+     * WriteBatchSync() fails if the proof of an entry is found neither here nor in
+     * the database, and writes nothing.
+     */
+    void AddBlockProof(const uint256& hash, const std::vector<unsigned char>& proof);
+    bool ReadBlockProof(const uint256& hash, std::vector<unsigned char>& proof);
+
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &info);
     bool ReadLastBlockFile(int &nFile);
@@ -152,6 +224,13 @@ public:
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 
+    /**
+     * The id of the block index snapshot that matches the database, see
+     * WriteBlockIndexSnapshot(). It is erased when a block index entry is written.
+     */
+    bool WriteBlockIndexSnapshotId(const uint256& id);
+    bool ReadBlockIndexSnapshotId(uint256& id);
+
     bool ReadXField(const char key, XFieldChangeListWrapper& xFieldList);
     bool WriteXField(const XFieldChange & xFieldChange);
     bool RewriteXField(std::vector<XFieldChange> & xFieldChanges);
@@ -26,7 +26,14 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
     spendsCoinbase(_spendsCoinbase), sigOpCost(_sigOpsCost), lockPoints(lp)
 {
     nTxSize = GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-    nUsageSize = RecursiveDynamicUsage(tx);
+    for (const CTxOut& txout : tx->vout) {
+        const ColorIdentifier color(GetColorIdFromScript(txout.scriptPubKey));
+        if (color.type != TokenTypes::NONE)
+            colors.push_back(color);
+    }
+    std::sort(colors.begin(), colors.end());
+    colors.erase(std::unique(colors.begin(), colors.end()), colors.end());
+    nUsageSize = RecursiveDynamicUsage(tx) + memusage::DynamicUsage(colors);
 
     nCountWithDescendants = 1;
     nSizeWithDescendants = GetTxSize();
@@ -38,6 +45,23 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
     nSizeWithAncestors = GetTxSize();
     nModFeesWithAncestors = nFee;
     nSigOpCostWithAncestors = sigOpCost;
+
+    nClusterId = 0;
+    nClusterSize = 1;
+    nClusterPos = 0;
+    nChunkPos = 0;
+    chunk = ClusterChunk{nFee, GetTxSize(), 1};
+}
+
+void CTxMemPoolEntry::AddInputColors(const std::vector<ColorIdentifier>& inputColors)
+{
+    for (const ColorIdentifier& color : inputColors) {
+        if (color.type != TokenTypes::NONE)
+            colors.push_back(color);
+    }
+    std::sort(colors.begin(), colors.end());
+    colors.erase(std::unique(colors.begin(), colors.end()), colors.end());
+    nUsageSize = RecursiveDynamicUsage(tx) + memusage::DynamicUsage(colors);
 }
 
 void CTxMemPoolEntry::UpdateFeeDelta(int64_t newFeeDelta)
@@ -52,6 +76,15 @@ void CTxMemPoolEntry::UpdateLockPoints(const LockPoints& lp)
     lockPoints = lp;
 }
 
+void CTxMemPoolEntry::UpdateClusterState(uint64_t clusterId, uint32_t clusterSize, uint32_t clusterPos, uint32_t chunkPos, const ClusterChunk& _chunk)
+{
+    nClusterId = clusterId;
+    nClusterSize = clusterSize;
+    nClusterPos = clusterPos;
+    nChunkPos = chunkPos;
+    chunk = _chunk;
+}
+
 int32_t CTxMemPoolEntry::GetTxSize() const
 {
     return GetTransactionSize(nTxSize, sigOpCost);
@@ -107,7 +140,7 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
 // for each entry, look for descendants that are outside vHashesToUpdate, and
 // add fee/size information for such descendants to the parent.
 // for each such descendant, also update the ancestor state to include the parent.
-void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashesToUpdate)
+void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashesToUpdate, uint64_t nClusterLimit)
 {
     LOCK(cs);
     // For each entry in vHashesToUpdate, store the set of in-mempool, but not
@@ -149,6 +182,41 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
         }
         UpdateForDescendants(it, mapMemPoolDescendantsToUpdate, setAlreadyIncluded);
     }
+
+    // The transactions from the block may now be connected to other clusters.
+    setEntries setUpdated;
+    for (const uint256& hash : vHashesToUpdate) {
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end()) {
+            setUpdated.insert(it);
+        }
+    }
+    UpdateClusters(setUpdated);
+
+    // The transactions from the block were accepted without the cluster limit.
+    // The descendants of a transaction come after it in the linearization, so
+    // the tail of a cluster can be removed on its own.
+    setEntries stage;
+    std::set<uint64_t> setTrimmed;
+    for (txiter root : setUpdated) {
+        if (root->GetClusterSize() <= nClusterLimit || !setTrimmed.insert(root->GetClusterId()).second)
+            continue;
+        setEntries setVisited{root};
+        std::vector<txiter> cluster{root};
+        for (size_t i = 0; i < cluster.size(); i++) {
+            if (cluster[i]->GetClusterPos() >= nClusterLimit)
+                stage.insert(cluster[i]);
+            for (const setEntries* links : {&GetMemPoolParents(cluster[i]), &GetMemPoolChildren(cluster[i])}) {
+                for (txiter linkedIt : *links) {
+                    if (setVisited.insert(linkedIt).second)
+                        cluster.push_back(linkedIt);
+                }
+            }
+        }
+    }
+    if (!stage.empty()) {
+        RemoveStaged(stage, false, MemPoolRemovalReason::REORG);
+    }
 }
 
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
@@ -329,7 +397,7 @@ void CTxMemPoolEntry::UpdateAncestorState(int32_t modifySize, CAmount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(CBlockPolicyEstimator* estimator) :
-    nTransactionsUpdated(0), minerPolicyEstimator(estimator)
+    nTransactionsUpdated(0), minerPolicyEstimator(estimator), nTokenShare(DEFAULT_MEMPOOL_TOKEN_SHARE), nNextClusterId(1)
 {
     _clear(); //lock free clear
 
@@ -357,6 +425,12 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
     nTransactionsUpdated += n;
 }
 
+//! Memory usage of an entry including its node in mapTx, see CTxMemPool::DynamicMemoryUsage()
+static size_t EntryUsage(const CTxMemPoolEntry& entry)
+{
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) + entry.DynamicMemoryUsage();
+}
+
 void CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, setEntries &setAncestors, bool validFeeEstimate)
 {
     NotifyEntryAdded(entry.GetSharedTx());
@@ -388,6 +462,12 @@ void CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
         mapNextTx.insert(std::make_pair(&tx.vin[i].prevout, &tx));
         setParentTransactions.insert(tx.vin[i].prevout.hashMalFix);
     }
+    for (const ColorIdentifier& color : entry.GetColors()) {
+        ColorTxs& colorTxs = mapColorTxs[color];
+        colorTxs.txs.insert(newit);
+        colorTxs.usage += EntryUsage(entry);
+        cachedInnerUsage += memusage::IncrementalDynamicUsage(colorTxs.txs);
+    }
     // Don't bother worrying about child transactions of this one.
     // Normal case of a new transaction arriving is that there can't be any
     // children, because such children would be orphans.
@@ -404,6 +484,8 @@ void CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     }
     UpdateAncestorsOf(true, newit, setAncestors);
     UpdateEntryForAncestors(newit, setAncestors);
+    // The new transaction joins the clusters of its parents.
+    UpdateClusters({newit});
 
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
@@ -433,6 +515,14 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     const uint256 hash = it->GetTx().GetHashMalFix();
     for (const CTxIn& txin : it->GetTx().vin)
         mapNextTx.erase(txin.prevout);
+    for (const ColorIdentifier& color : it->GetColors()) {
+        auto colorit = mapColorTxs.find(color);
+        colorit->second.txs.erase(it);
+        colorit->second.usage -= EntryUsage(*it);
+        cachedInnerUsage -= memusage::IncrementalDynamicUsage(colorit->second.txs);
+        if (colorit->second.txs.empty())
+            mapColorTxs.erase(colorit);
+    }
 
     if (vTxHashes.size() > 1) {
         vTxHashes[it->vTxHashesIdx] = std::move(vTxHashes.back());
@@ -651,6 +741,7 @@ void CTxMemPool::_clear()
     mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+    mapColorTxs.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     lastRollingFeeUpdate = GetTime();
@@ -692,6 +783,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     const int32_t spendheight = GetSpendHeight(mempoolDuplicate);
 
     std::list<const CTxMemPoolEntry*> waitingOnDependants;
+    std::map<uint64_t, std::vector<const CTxMemPoolEntry*>> clusters;
     for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         checkTotal += it->GetTxSize();
         innerUsage += it->DynamicMemoryUsage();
@@ -700,6 +792,9 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         assert(linksiter != mapLinks.end());
         const TxLinks &links = linksiter->second;
         innerUsage += memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
+        for (const ColorIdentifier& color : it->GetColors()) {
+            assert(mapColorTxs.at(color).txs.count(it));
+        }
         bool fDependsWait = false;
         setEntries setParentCheck;
         for (const CTxIn &txin : tx.vin) {
@@ -725,6 +820,11 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
         std::string dummy;
         CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+        for (txiter parentIt : setParentCheck) {
+            assert(parentIt->GetClusterId() == it->GetClusterId());
+            assert(parentIt->GetClusterPos() < it->GetClusterPos());
+        }
+        clusters[it->GetClusterId()].push_back(&*it);
         uint64_t nCountCheck = setAncestors.size() + 1;
         int32_t nSizeCheck = it->GetTxSize();
         CAmount nFeesCheck = it->GetModifiedFee();
@@ -784,6 +884,38 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         assert(&tx == it->second);
     }
 
+    // Check that each cluster is linearized and chunked completely.
+    for (auto& item : clusters) {
+        std::vector<const CTxMemPoolEntry*>& entries = item.second;
+        std::sort(entries.begin(), entries.end(), [](const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) { return a->GetClusterPos() < b->GetClusterPos(); });
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            const CTxMemPoolEntry* entry = entries[i];
+            assert(entry->GetClusterSize() == entries.size());
+            assert(entry->GetClusterPos() == i);
+            const ClusterChunk& chunk = entry->GetChunk();
+            assert(entry->GetChunkPos() <= i && i < entry->GetChunkPos() + chunk.count);
+            if (entry->GetChunkPos() == i) {
+                CAmount nFees = 0;
+                int64_t nSize = 0;
+                for (uint32_t j = i; j < i + chunk.count; j++) {
+                    assert(entries[j]->GetChunkPos() == i);
+                    nFees += entries[j]->GetModifiedFee();
+                    nSize += entries[j]->GetTxSize();
+                }
+                assert(nFees == chunk.fee && nSize == chunk.size);
+            }
+        }
+    }
+
+    for (const auto& item : mapColorTxs) {
+        size_t colorUsage = 0;
+        for (txiter colorit : item.second.txs) {
+            colorUsage += EntryUsage(*colorit);
+        }
+        assert(colorUsage == item.second.usage);
+        innerUsage += memusage::DynamicUsage(item.second.txs);
+    }
+
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
 }
@@ -851,6 +983,14 @@ void CTxMemPool::queryHashes(std::vector<uint256>& vtxid)
     }
 }
 
+const CTxMemPool::setEntries& CTxMemPool::GetColorEntries(const ColorIdentifier& color) const
+{
+    AssertLockHeld(cs);
+    static const setEntries empty;
+    auto it = mapColorTxs.find(color);
+    return it == mapColorTxs.end() ? empty : it->second.txs;
+}
+
 static TxMempoolInfo GetInfo(CTxMemPool::indexed_transaction_set::const_iterator it) {
     return TxMempoolInfo{it->GetSharedTx(), it->GetTime(), CFeeRate(it->GetFee(), it->GetTxSize()), it->GetModifiedFee() - it->GetFee()};
 }
@@ -911,6 +1051,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeD
             for (txiter descendantIt : setDescendants) {
                 mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
             }
+            UpdateClusters({it});
             ++nTransactionsUpdated;
         }
     }
@@ -978,16 +1119,85 @@ void CCoinsViewVirtualMemPool::AddVirtualTx(const CTransaction& tx) {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + memusage::DynamicUsage(mapColorTxs) + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
     AssertLockHeld(cs);
+    // Transactions linked to removed ones are left in smaller clusters.
+    setEntries setLinked;
+    for (txiter it : stage) {
+        for (txiter parentIt : GetMemPoolParents(it)) {
+            if (!stage.count(parentIt)) setLinked.insert(parentIt);
+        }
+        for (txiter childIt : GetMemPoolChildren(it)) {
+            if (!stage.count(childIt)) setLinked.insert(childIt);
+        }
+    }
     UpdateForRemoveFromMempool(stage, updateDescendants);
     for (const txiter& it : stage) {
         removeUnchecked(it, reason);
     }
+    UpdateClusters(setLinked);
+}
+
+void CTxMemPool::UpdateClusters(const setEntries& entries)
+{
+    AssertLockHeld(cs);
+    setEntries setVisited;
+    for (txiter root : entries) {
+        if (!setVisited.insert(root).second)
+            continue;
+        // Walk the transactions connected to root.
+        std::vector<txiter> cluster{root};
+        for (size_t i = 0; i < cluster.size(); i++) {
+            for (const setEntries* links : {&GetMemPoolParents(cluster[i]), &GetMemPoolChildren(cluster[i])}) {
+                for (txiter linkedIt : *links) {
+                    if (setVisited.insert(linkedIt).second)
+                        cluster.push_back(linkedIt);
+                }
+            }
+        }
+
+        std::map<txiter, uint32_t, CompareIteratorByHash> positions;
+        for (uint32_t i = 0; i < cluster.size(); i++) {
+            positions.emplace(cluster[i], i);
+        }
+        std::vector<ClusterTx> txs(cluster.size());
+        for (uint32_t i = 0; i < cluster.size(); i++) {
+            txs[i].fee = cluster[i]->GetModifiedFee();
+            txs[i].size = cluster[i]->GetTxSize();
+            for (txiter parentIt : GetMemPoolParents(cluster[i])) {
+                txs[i].parents.push_back(positions.at(parentIt));
+            }
+        }
+
+        const std::vector<uint32_t> order = LinearizeCluster(txs);
+        const std::vector<ClusterChunk> chunks = ChunkLinearization(txs, order);
+        const uint64_t nClusterId = nNextClusterId++;
+        uint32_t nPos = 0;
+        for (const ClusterChunk& chunk : chunks) {
+            for (uint32_t i = nPos; i < nPos + chunk.count; i++) {
+                mapTx.modify(cluster[order[i]], update_cluster_state(nClusterId, cluster.size(), i, nPos, chunk));
+            }
+            nPos += chunk.count;
+        }
+    }
+}
+
+uint64_t CTxMemPool::CalculateClusterSize(const setEntries& setAncestors) const
+{
+    AssertLockHeld(cs);
+    std::map<uint64_t, uint32_t> clusterSizes;
+    for (txiter ancestorIt : setAncestors) {
+        clusterSizes.emplace(ancestorIt->GetClusterId(), ancestorIt->GetClusterSize());
+    }
+    uint64_t nSize = 1;
+    for (const auto& item : clusterSizes) {
+        nSize += item.second;
+    }
+    return nSize;
 }
 
 int CTxMemPool::Expire(int64_t time) {
@@ -1087,22 +1297,30 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpends
     LOCK(cs);
 
     unsigned nTxnRemoved = 0;
+    unsigned nTokenTxnRemoved = 0;
     CFeeRate maxFeeRateRemoved(0);
     while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
-        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
-
-        // We set the new mempool min fee to the feerate of the removed set, plus the
-        // "minimum reasonable fee rate" (ie some value under which we consider txn
-        // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
-        // equal to txn which were removed with no block in between.
-        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
-        removed += incrementalRelayFee;
-        trackPackageRemoved(removed);
-        maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
+        // The rolling minimum fee is left alone when a token over its share is trimmed:
+        // other transactions should not pay more because one token uses too much of the mempool.
+        txiter it = GetTokenShareVictim(sizelimit);
+        const bool fTokenShare = it != mapTx.end();
+        if (!fTokenShare) {
+            // The last transaction of the worst chunk, which has no descendants.
+            it = mapTx.project<0>(std::prev(mapTx.get<chunk_score>().end()));
+
+            // We set the new mempool min fee to the feerate of the removed chunk, plus the
+            // "minimum reasonable fee rate" (ie some value under which we consider txn
+            // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
+            // equal to txn which were removed with no block in between.
+            CFeeRate removed(it->GetChunk().fee, it->GetChunk().size);
+            removed += incrementalRelayFee;
+            trackPackageRemoved(removed);
+            maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
+        }
 
         setEntries stage;
-        CalculateDescendants(mapTx.project<0>(it), stage);
-        nTxnRemoved += stage.size();
+        CalculateDescendants(it, stage);
+        (fTokenShare ? nTokenTxnRemoved : nTxnRemoved) += stage.size();
 
         std::vector<CTransaction> txn;
         if (pvNoSpendsRemaining) {
@@ -1121,11 +1339,34 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpends
         }
     }
 
+    if (nTokenTxnRemoved > 0) {
+        LogPrint(BCLog::MEMPOOL, "Removed %u txn of tokens over their share of the mempool\n", nTokenTxnRemoved);
+    }
     if (maxFeeRateRemoved > CFeeRate(0)) {
         LogPrint(BCLog::MEMPOOL, "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, maxFeeRateRemoved.ToString());
     }
 }
 
+CTxMemPool::txiter CTxMemPool::GetTokenShareVictim(size_t sizelimit) const
+{
+    AssertLockHeld(cs);
+    if (nTokenShare == 0 || nTokenShare >= 100)
+        return mapTx.end();
+
+    const size_t nTokenLimit = sizelimit / 100 * nTokenShare;
+    const ColorTxs* pworst = nullptr;
+    for (const auto& item : mapColorTxs) {
+        if (item.second.usage > nTokenLimit && (!pworst || item.second.usage > pworst->usage))
+            pworst = &item.second;
+    }
+    if (!pworst)
+        return mapTx.end();
+
+    // Same order as the chunk_score index, which TrimToSize evicts from the end of.
+    CompareTxMemPoolEntryByChunkScore compare;
+    return *std::max_element(pworst->txs.begin(), pworst->txs.end(), [&compare](txiter a, txiter b) { return compare(*a, *b); });
+}
+
 uint64_t CTxMemPool::CalculateDescendantMaximum(txiter entry) const {
     // find parent with highest descendant count
     std::vector<txiter> candidates;
@@ -1173,4 +1414,4 @@ std::string RemovalReasonToString(const MemPoolRemovalReason& r) noexcept
         default:return "unknown";
     }
 }
-CTxMempoolAcceptanceOptions:: CTxMempoolAcceptanceOptions():context(ValidationContext::TRANSACTION), flags(MempoolAcceptanceFlags::NONE), nAbsurdFee(0), nAcceptTime(0), mempool_view(new CCoinsViewMemPool(pcoinsTip.get(), mempool)){}
+CTxMempoolAcceptanceOptions:: CTxMempoolAcceptanceOptions():context(ValidationContext::TRANSACTION), flags(MempoolAcceptanceFlags::NONE), nAbsurdFee(0), nAcceptTime(0), mempool_view(new CCoinsViewMemPool(pcoinsTip.get(), mempool)), precheck(nullptr), fDeferTrim(false){}
@@ -16,7 +16,9 @@
 
 #include <amount.h>
 #include <coins.h>
+#include <coloridentifier.h>
 #include <indirectmap.h>
+#include <policy/cluster.h>
 #include <policy/feerate.h>
 #include <primitives/transaction.h>
 #include <sync.h>
@@ -61,6 +63,9 @@ class CTxMemPool;
  * (nCountWithDescendants, nSizeWithDescendants, and nModFeesWithDescendants) for
  * all ancestors of the newly added transaction.
  *
+ * It also stores the position of the transaction in the linearization of its
+ * cluster and the chunk it is mined with, see CTxMemPool::UpdateClusters().
+ *
  */
 
 class CTxMemPoolEntry
@@ -76,6 +81,7 @@ private:
     int32_t sigOpCost;         //!< Total sigop cost
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
+    std::vector<ColorIdentifier> colors; //!< Token colors of the outputs and of the spent coins, sorted
 
     // Information about descendants of this transaction that are in the
     // mempool; if we remove this transaction we must remove all of these
@@ -90,6 +96,13 @@ private:
     CAmount nModFeesWithAncestors;
     int32_t nSigOpCostWithAncestors;
 
+    // The cluster of in-mempool transactions this transaction is connected to
+    uint64_t nClusterId;      //!< Changes each time the cluster is linearized
+    uint32_t nClusterSize;    //!< number of transactions in the cluster
+    uint32_t nClusterPos;     //!< position in the linearization of the cluster
+    uint32_t nChunkPos;       //!< position of the first transaction of the chunk
+    ClusterChunk chunk;       //!< fee, size and transaction count of the chunk
+
 public:
     CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                     int64_t _nTime, unsigned int _entryHeight,
@@ -106,7 +119,11 @@ public:
     int64_t GetModifiedFee() const { return nFee + feeDelta; }
     size_t DynamicMemoryUsage() const { return nUsageSize; }
     const LockPoints& GetLockPoints() const { return lockPoints; }
+    const std::vector<ColorIdentifier>& GetColors() const { return colors; }
 
+    // Adds the token colors of the coins spent by the transaction, see GetInputColorIds().
+    // Must be called before the entry is added to the mempool.
+    void AddInputColors(const std::vector<ColorIdentifier>& inputColors);
     // Adjusts the descendant state.
     void UpdateDescendantState(int32_t modifySize, CAmount modifyFee, int64_t modifyCount);
     // Adjusts the ancestor state
@@ -116,6 +133,8 @@ public:
     void UpdateFeeDelta(int64_t feeDelta);
     // Update the LockPoints after a reorg
     void UpdateLockPoints(const LockPoints& lp);
+    // Sets the position in the linearization of the cluster
+    void UpdateClusterState(uint64_t clusterId, uint32_t clusterSize, uint32_t clusterPos, uint32_t chunkPos, const ClusterChunk& chunk);
 
     uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
     int64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
@@ -128,6 +147,12 @@ public:
     CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
     int32_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
+    uint64_t GetClusterId() const { return nClusterId; }
+    uint32_t GetClusterSize() const { return nClusterSize; }
+    uint32_t GetClusterPos() const { return nClusterPos; }
+    uint32_t GetChunkPos() const { return nChunkPos; }
+    const ClusterChunk& GetChunk() const { return chunk; }
+
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
 };
 
@@ -183,6 +208,23 @@ private:
     const LockPoints& lp;
 };
 
+struct update_cluster_state
+{
+    update_cluster_state(uint64_t _clusterId, uint32_t _clusterSize, uint32_t _clusterPos, uint32_t _chunkPos, const ClusterChunk& _chunk) :
+        clusterId(_clusterId), clusterSize(_clusterSize), clusterPos(_clusterPos), chunkPos(_chunkPos), chunk(_chunk)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateClusterState(clusterId, clusterSize, clusterPos, chunkPos, chunk); }
+
+    private:
+        uint64_t clusterId;
+        uint32_t clusterSize;
+        uint32_t clusterPos;
+        uint32_t chunkPos;
+        ClusterChunk chunk;
+};
+
 // extracts a transaction hash from CTxMempoolEntry or CTransactionRef
 struct mempoolentry_Imtxid
 {
@@ -314,10 +356,34 @@ public:
     }
 };
 
+/** \class CompareTxMemPoolEntryByChunkScore
+ *
+ *  Sort by feerate of the chunk of the entry in descending order, and by the
+ *  position in the linearization of the cluster within a chunk. Mining in this
+ *  order always takes parents before their children.
+ */
+class CompareTxMemPoolEntryByChunkScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        const ClusterChunk& a_chunk = a.GetChunk();
+        const ClusterChunk& b_chunk = b.GetChunk();
+        if (HigherFeeRate(a_chunk.fee, a_chunk.size, b_chunk.fee, b_chunk.size))
+            return true;
+        if (HigherFeeRate(b_chunk.fee, b_chunk.size, a_chunk.fee, a_chunk.size))
+            return false;
+        if (a.GetClusterId() != b.GetClusterId())
+            return a.GetClusterId() < b.GetClusterId();
+        return a.GetClusterPos() < b.GetClusterPos();
+    }
+};
+
 // Multi_index tag names
 struct descendant_score {};
 struct entry_time {};
 struct ancestor_score {};
+struct chunk_score {};
 
 class CBlockPolicyEstimator;
 
@@ -383,11 +449,12 @@ public:
  *
  * CTxMemPool::mapTx, and CTxMemPoolEntry bookkeeping:
  *
- * mapTx is a boost::multi_index that sorts the mempool on 4 criteria:
+ * mapTx is a boost::multi_index that sorts the mempool on 5 criteria:
  * - transaction hash
  * - descendant feerate [we use max(feerate of tx, feerate of tx with all descendants)]
  * - time in mempool
  * - ancestor feerate [we use min(feerate of tx, feerate of tx with all unconfirmed ancestors)]
+ * - chunk feerate [the feerate of the chunk of the tx in the linearization of its cluster]
  *
  * Note: the term "descendant" refers to in-mempool transactions that depend on
  * this one, while "ancestor" refers to in-mempool transactions that a given
@@ -432,6 +499,15 @@ public:
  * CalculateMemPoolAncestors() and CalculateDescendants() that rely
  * on them to walk the mempool are not generally safe to use).
  *
+ * Clusters:
+ *
+ * A cluster is a set of in-mempool transactions connected by spending each
+ * other's outputs. Whenever a cluster changes, UpdateClusters() orders its
+ * transactions for mining (see LinearizeCluster()) and splits that order into
+ * chunks of non-increasing feerate. Block assembly takes chunks from the
+ * chunk_score index, best first, and TrimToSize() evicts the last transaction
+ * of the worst chunk, so both agree on which transactions are worth the least.
+ *
  * Computational limits:
  *
  * Updating all in-mempool ancestors of a newly added transaction can be slow,
@@ -449,6 +525,8 @@ private:
 
     uint64_t totalTxSize GUARDED_BY(cs);      //!< sum of all mempool tx's serialized sizes.
     uint64_t cachedInnerUsage; //!< sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+    unsigned int nTokenShare GUARDED_BY(cs); //!< Percentage of the size limit one token may use when trimming, 0 for no limit
+    uint64_t nNextClusterId GUARDED_BY(cs); //!< Identifies the next linearized cluster
 
     mutable int64_t lastRollingFeeUpdate GUARDED_BY(cs);
     mutable bool blockSinceLastRollingFeeBump GUARDED_BY(cs);
@@ -482,6 +560,12 @@ public:
                 boost::multi_index::tag<ancestor_score>,
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByAncestorFee
+            >,
+            // sorted by fee rate of the chunk
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<chunk_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByChunkScore
             >
         >
     > indexed_transaction_set;
@@ -512,6 +596,16 @@ private:
     typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
     txlinksMap mapLinks;
 
+    /** The transactions of a token color and the sum of their memory usage */
+    struct ColorTxs {
+        setEntries txs;
+        size_t usage = 0;
+    };
+    std::map<ColorIdentifier, ColorTxs> mapColorTxs GUARDED_BY(cs);
+
+    /** The transaction to evict first from the token furthest over its share of sizelimit, or mapTx.end() */
+    txiter GetTokenShareVictim(size_t sizelimit) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
@@ -533,6 +627,7 @@ public:
      */
     void check(const CCoinsViewCache *pcoins) const;
     void setSanityCheck(double dFrequency = 1.0) { LOCK(cs); nCheckFrequency = static_cast<uint32_t>(dFrequency * 4294967295.0); }
+    void SetTokenShare(unsigned int nPercent) { LOCK(cs); nTokenShare = nPercent; }
 
     // addUnchecked must updated state for all ancestors of a given transaction,
     // to track size/count of descendant transactions.  First version of
@@ -557,6 +652,8 @@ public:
     void _clear() EXCLUSIVE_LOCKS_REQUIRED(cs); //lock free
     bool CompareDepthAndScore(const uint256& hasha, const uint256& hashb);
     void queryHashes(std::vector<uint256>& vtxid);
+    /** The transactions with outputs of the token color or spending coins of it */
+    const setEntries& GetColorEntries(const ColorIdentifier& color) const EXCLUSIVE_LOCKS_REQUIRED(cs);
     bool isSpent(const COutPoint& outpoint) const;
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
@@ -589,8 +686,10 @@ public:
      *  child transactions present in vHashesToUpdate, which are already accounted
      *  for).  Note: vHashesToUpdate should be the set of transactions from the
      *  disconnected block that have been accepted back into the mempool.
+     *  Clusters which grow past nClusterLimit transactions are trimmed to it,
+     *  removing the transactions that come last in their linearization.
      */
-    void UpdateTransactionsFromBlock(const std::vector<uint256> &vHashesToUpdate);
+    void UpdateTransactionsFromBlock(const std::vector<uint256> &vHashesToUpdate, uint64_t nClusterLimit);
 
     /** Try to calculate all in-mempool ancestors of entry.
      *  (these are all calculated including the tx itself)
@@ -604,6 +703,10 @@ public:
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents = true) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
+    /** The number of transactions in the cluster a new transaction with the
+     *  given in-mempool ancestors would belong to, including itself. */
+    uint64_t CalculateClusterSize(const setEntries& setAncestors) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
     /** Populate setDescendants with all in-mempool descendants of hash.
      *  Assumes that setDescendants includes all in-mempool descendants of anything
      *  already in it.  */
@@ -618,6 +721,9 @@ public:
     CFeeRate GetMinFee(size_t sizelimit) const;
 
     /** Remove transactions from the mempool until its dynamic size is <= sizelimit.
+      *  The last transaction of the chunk with the lowest feerate is removed first.
+      *  While a token uses more than its share of sizelimit (see SetTokenShare),
+      *  its transactions are removed first.
       *  pvNoSpendsRemaining, if set, will be populated with the list of outpoints
       *  which are not in mempool which no longer have any spends in this mempool.
       */
@@ -686,6 +792,9 @@ private:
     void UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants) EXCLUSIVE_LOCKS_REQUIRED(cs);
     /** Sever link between specified transaction and direct children. */
     void UpdateChildrenForRemoval(txiter entry) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Linearize the clusters of the given transactions, which are found by
+     *  walking mapLinks, and update the cluster state of their entries. */
+    void UpdateClusters(const setEntries& entries) EXCLUSIVE_LOCKS_REQUIRED(cs);
 
     /** Before calling removeUnchecked for a given transaction,
      *  UpdateForRemoveFromMempool must be called on the entire (dependent) set
@@ -847,6 +956,21 @@ enum class MempoolAcceptanceFlags
     TEST_ONLY = 2
 };
 
+/* Result of checking the scripts of a transaction for the mempool without holding cs_main, see PreCheckForMemPool()*/
+struct CTxMempoolPreCheck {
+    uint256 hash;
+    //! Tip whose coins and script flags the scripts were checked with, null if they were not checked
+    uint256 hashTip;
+    unsigned int nFlags;
+    unsigned int nMandatoryFlags;
+    bool fFailed;
+    CValidationState state;
+    //! Coins which were not in pcoinsTip's cache before the check
+    std::vector<COutPoint> coins_to_uncache;
+
+    CTxMempoolPreCheck() : nFlags(0), nMandatoryFlags(0), fFailed(false) {}
+};
+
 /* All configurable inputs and outputs of accept to mempool are consolidated here for ease of use*/
 struct CTxMempoolAcceptanceOptions {
     ValidationContext context;
@@ -858,6 +982,11 @@ struct CTxMempoolAcceptanceOptions {
     std::vector<CTransactionRef> txnReplaced;
     std::vector<COutPoint> coins_to_uncache;
     std::vector<COutPoint> missingInputs;
+    const CTxMempoolPreCheck* precheck;
+    //! Feerate of the package the transaction is accepted with, see AcceptAncestorPackage()
+    CFeeRate packageFeeRate;
+    //! Leave trimming the mempool to the caller, which trims after the last transaction of a package
+    bool fDeferTrim;
 
     CTxMempoolAcceptanceOptions();
     ~CTxMempoolAcceptanceOptions() {
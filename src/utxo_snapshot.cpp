@@ -4,13 +4,381 @@
 
 #include <utxo_snapshot.h>
 
+#include <backgroundchainstate.h>
+#include <coins.h>
+#include <coinstats.h>
+#include <cs_main.h>
+#include <index/addressindex.h>
+#include <index/blockfilterindex.h>
+#include <index/coinstatsindex.h>
+#include <index/tokenindex.h>
+#include <index/txindex.h>
+#include <issuedcolorids.h>
+#include <shutdown.h>
 #include <streams.h>
+#include <txdb.h>
+#include <txmempool.h>
+#include <ui_interface.h>
+#include <util.h>
 #include <utilstrencodings.h>
+#include <utilmemory.h>
+#include <utiltime.h>
+#include <validation.h>
+#include <validationinterface.h>
+#include <file_io.h>
+
+#include <limits>
 
 
 SnapshotMetadata::SnapshotMetadata(const uint256& base_blockhash, uint64_t coins_count) :
     base_blockhash(base_blockhash),
-    coins_count(coins_count) { 
+    coins_count(coins_count) {
         ParseUInt64(FederationParams().NetworkIDString(), &networkid);
         network_mode = gArgs.GetChainMode();
 }
+
+/** Serializes concurrent loadtxoutset calls; they would share chainstate_snapshot/. */
+static Mutex g_snapshot_mutex;
+
+/** Check that the snapshot can be activated on top of the current active chain. */
+static bool CheckSnapshotBase(const SnapshotMetadata& metadata, CBlockIndex*& pindexBase, std::string& strError) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    AssertLockHeld(cs_main);
+
+    uint64_t networkid = 0;
+    ParseUInt64(FederationParams().NetworkIDString(), &networkid);
+    if (metadata.networkid != networkid || metadata.network_mode != gArgs.GetChainMode()) {
+        strError = strprintf("snapshot belongs to network %d (%s), not to this network",
+            metadata.networkid, TAPYRUS_MODES::GetChainName(metadata.network_mode));
+        return false;
+    }
+    if (g_txindex) {
+        strError = "a UTXO snapshot cannot be loaded while -txindex is enabled";
+        return false;
+    }
+    if (g_coin_stats_index) {
+        strError = "a UTXO snapshot cannot be loaded while -coinstatsindex is enabled";
+        return false;
+    }
+    if (GetBlockFilterIndex(BlockFilterType::BASIC)) {
+        strError = "a UTXO snapshot cannot be loaded while -blockfilterindex is enabled";
+        return false;
+    }
+    if (g_address_index) {
+        strError = "a UTXO snapshot cannot be loaded while -addressindex is enabled";
+        return false;
+    }
+    if (g_token_index) {
+        strError = "a UTXO snapshot cannot be loaded while -tokenindex is enabled";
+        return false;
+    }
+    if (!pcoinsdbview->GetSnapshotBase().IsNull()) {
+        strError = "a UTXO snapshot has already been loaded";
+        return false;
+    }
+
+    pindexBase = LookupBlockIndex(metadata.base_blockhash);
+    if (!pindexBase) {
+        strError = strprintf("the header of snapshot base block %s is not known yet. Wait for the headers to sync and retry",
+            metadata.base_blockhash.ToString());
+        return false;
+    }
+    if (pindexBase->nStatus & BLOCK_FAILED_MASK) {
+        strError = strprintf("snapshot base block %s is marked invalid", metadata.base_blockhash.ToString());
+        return false;
+    }
+    if (pindexBase->nHeight <= chainActive.Height()) {
+        strError = strprintf("the active chain has already reached height %d, the snapshot base height", pindexBase->nHeight);
+        return false;
+    }
+    if (pindexBase->GetAncestor(chainActive.Height()) != chainActive.Tip()) {
+        strError = strprintf("snapshot base block %s does not descend from the active chain tip", metadata.base_blockhash.ToString());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Stream the coins of the snapshot into view, collecting the NON_REISSUABLE
+ * and NFT colorIds found in their scripts.
+ */
+static bool LoadSnapshotCoins(CAutoFile& coins_file, const SnapshotMetadata& metadata, int nBaseHeight, CCoinsViewCache& view, std::set<ColorIdentifier>& issuedColorIds, std::string& strError)
+{
+    const uint64_t coins_count = metadata.coins_count;
+    uint64_t coins_left = coins_count;
+    uint256 txid;
+
+    LogPrintf("[snapshot] loading %d coins from snapshot %s\n", coins_count, metadata.base_blockhash.ToString());
+    view.SetBestBlock(metadata.base_blockhash);
+
+    try {
+        while (coins_left > 0) {
+            // dumptxoutset groups coins by txid; a group may be empty.
+            coins_file >> txid;
+            const uint64_t coins_per_txid = ReadCompactSize(coins_file);
+            if (coins_per_txid > coins_left) {
+                strError = "mismatch in coins count in snapshot metadata and actual snapshot data";
+                return false;
+            }
+            for (uint64_t i = 0; i < coins_per_txid; ++i) {
+                const uint64_t n = ReadCompactSize(coins_file);
+                Coin coin;
+                coins_file >> coin;
+                if (n >= std::numeric_limits<uint32_t>::max() || coin.nHeight > (uint32_t)nBaseHeight) {
+                    strError = strprintf("bad snapshot data after deserializing %d coins", coins_count - coins_left);
+                    return false;
+                }
+                const ColorIdentifier colorId(GetColorIdFromScript(coin.out.scriptPubKey));
+                if (colorId.type == TokenTypes::NON_REISSUABLE || colorId.type == TokenTypes::NFT) {
+                    issuedColorIds.insert(colorId);
+                }
+                view.AddCoin(COutPoint(txid, (uint32_t)n), std::move(coin), false);
+                --coins_left;
+
+                if (coins_left % 50000 == 0) {
+                    if (ShutdownRequested()) {
+                        strError = "shutdown requested while loading the snapshot";
+                        return false;
+                    }
+                    LogPrintf("[snapshot] %d coins left to load\n", coins_left);
+                }
+                if (view.DynamicMemoryUsage() > (size_t)nCoinCacheUsage) {
+                    LOCK(cs_main);
+                    if (!view.Flush()) {
+                        strError = "failed to write the snapshot chainstate";
+                        return false;
+                    }
+                }
+            }
+        }
+    } catch (const std::ios_base::failure& e) {
+        strError = strprintf("bad snapshot format or truncated snapshot after deserializing %d coins: %s", coins_count - coins_left, e.what());
+        return false;
+    } catch (const std::logic_error& e) {
+        strError = strprintf("bad snapshot data after deserializing %d coins: %s", coins_count - coins_left, e.what());
+        return false;
+    }
+
+    // Anything left in the file means the metadata understates the coins count.
+    bool out_of_coins = false;
+    try {
+        coins_file >> txid;
+    } catch (const std::ios_base::failure&) {
+        out_of_coins = true;
+    }
+    if (!out_of_coins) {
+        strError = strprintf("bad snapshot - coins left over after deserializing %d coins", coins_count);
+        return false;
+    }
+    return true;
+}
+
+/** Add the xfield changes in the headers of (pindexFrom, pindexTo] to the global history and the block tree. */
+static void RebuildXFieldHistory(const CBlockIndex* pindexFrom, const CBlockIndex* pindexTo) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    std::vector<const CBlockIndex*> vChain;
+    for (const CBlockIndex* pindex = pindexTo; pindex != pindexFrom; pindex = pindex->pprev) {
+        vChain.push_back(pindex);
+    }
+
+    CXFieldHistory xfieldHistory;
+    for (auto it = vChain.rbegin(); it != vChain.rend(); ++it) {
+        const CBlockIndex* pindex = *it;
+        const CXField xfield = pindex->GetXField();
+        if (xfield.IsValid()
+            && IsXFieldNew(xfield, &xfieldHistory, static_cast<uint32_t>(pindex->nHeight))) {
+            XFieldChange newChange(xfield.xfieldValue, pindex->nHeight + 1, pindex->GetBlockHash());
+            xfieldHistory.Add(xfield.xfieldType, newChange);
+            pblocktree->WriteXField(newChange);
+        }
+    }
+}
+
+bool ActivateSnapshot(CAutoFile& coins_file, const SnapshotMetadata& metadata, const uint256& expected_hash, std::string& strError)
+{
+    TRY_LOCK(g_snapshot_mutex, lockSnapshot);
+    if (!lockSnapshot) {
+        strError = "a UTXO snapshot is already being loaded";
+        return false;
+    }
+
+    CBlockIndex* pindexBase = nullptr;
+    {
+        LOCK(cs_main);
+        if (!CheckSnapshotBase(metadata, pindexBase, strError))
+            return false;
+    }
+
+    // The current chainstate keeps its database cache for background validation until the next restart.
+    auto snapshot_db = MakeUnique<CCoinsViewDB>(nCoinDBCache / 2, false, true, SNAPSHOT_CHAINSTATE_DIR);
+    auto colorid_state = MakeUnique<CIssuedColorIds>();
+    snapshot_db->SetColorIdState(colorid_state.get());
+
+    auto cleanup = [&]() {
+        snapshot_db.reset();
+        RemoveSnapshotChainstate();
+        return false;
+    };
+
+    std::set<ColorIdentifier> issuedColorIds;
+    {
+        CCoinsViewCache view(snapshot_db.get());
+        if (!LoadSnapshotCoins(coins_file, metadata, pindexBase->nHeight, view, issuedColorIds, strError))
+            return cleanup();
+
+        // A NON_REISSUABLE or NFT colorId whose outputs were all burned before the base
+        // is not recovered here. That is harmless: its issuing outpoint is spent, so the
+        // same colorId can never be issued again.
+        LOCK(cs_main);
+        colorid_state->Insert(issuedColorIds);
+        if (!view.Flush()) {
+            strError = "failed to write the snapshot chainstate";
+            return cleanup();
+        }
+    }
+
+    CCoinsStats stats;
+    if (!GetUTXOStats(snapshot_db.get(), stats)) {
+        strError = "unable to read the snapshot chainstate";
+        return cleanup();
+    }
+    if (stats.hashSerialized != expected_hash) {
+        strError = strprintf("snapshot UTXO set hash %s does not match the expected hash %s",
+            stats.hashSerialized.ToString(), expected_hash.ToString());
+        return cleanup();
+    }
+
+    LOCK(cs_main);
+    // The active chain may have advanced while the coins were loaded.
+    if (!CheckSnapshotBase(metadata, pindexBase, strError))
+        return cleanup();
+
+    // Leave the current chainstate consistent on disk; background validation continues from it.
+    CValidationState state;
+    if (!FlushStateToDisk(state, FlushStateMode::ALWAYS)) {
+        strError = strprintf("failed to flush the current chainstate: %s", FormatStateMessage(state));
+        return cleanup();
+    }
+    if (!snapshot_db->WriteSnapshotBase(metadata.base_blockhash, expected_hash)) {
+        strError = "failed to write the snapshot chainstate";
+        return cleanup();
+    }
+
+    CBlockIndex* pindexOldTip = chainActive.Tip();
+    RebuildXFieldHistory(pindexOldTip, pindexBase);
+
+    // Mempool transactions were validated against the old UTXO set.
+    mempool.clear();
+
+    g_chainstate.ResetCoinsPrefetch();
+    pcoinsTip.reset();
+    pcoinscatcher.reset();
+    std::unique_ptr<CCoinsViewDB> background_db = std::move(pcoinsdbview);
+    background_db->SetColorIdState(nullptr);
+    pcoinsdbview = std::move(snapshot_db);
+    pcoinscatcher.reset(new CCoinsViewErrorCatcher(pcoinsdbview.get()));
+    pcoinsTip.reset(new CCoinsViewCache(pcoinscatcher.get()));
+    g_colorid_state = std::move(colorid_state);
+
+    g_chainstate.ActivateSnapshotTip(pindexBase);
+
+    g_background_chainstate = MakeUnique<CBackgroundChainstate>(std::move(background_db), pindexBase);
+    if (!g_background_chainstate->Start()) {
+        return AbortNode("Failed to start background validation of the UTXO snapshot");
+    }
+
+    if (!FlushStateToDisk(state, FlushStateMode::ALWAYS)) {
+        // The snapshot chainstate is already active; there is nothing left to roll back to.
+        return AbortNode(state, "Failed to write the block index after loading the UTXO snapshot");
+    }
+
+    LogPrintf("[snapshot] activated UTXO snapshot at height %d (%s), %d coins\n",
+        pindexBase->nHeight, pindexBase->GetBlockHash().ToString(), metadata.coins_count);
+
+    const bool fInitialDownload = IsInitialBlockDownload();
+    GetMainSignals().UpdatedBlockTip(pindexBase, pindexOldTip, fInitialDownload);
+    uiInterface.NotifyBlockTip(fInitialDownload, pindexBase);
+    return true;
+}
+
+bool HaveSnapshotChainstate()
+{
+    const fs::path snapshot_dir = GetDataDir() / SNAPSHOT_CHAINSTATE_DIR;
+    if (!fs::exists(snapshot_dir))
+        return false;
+
+    bool fComplete;
+    bool fValidated;
+    {
+        CCoinsViewDB snapshot_db(0, false, false, SNAPSHOT_CHAINSTATE_DIR);
+        fComplete = !snapshot_db.GetSnapshotBase().IsNull();
+        fValidated = fComplete && snapshot_db.IsSnapshotValidated();
+    }
+    if (!fComplete) {
+        LogPrintf("[snapshot] removing snapshot chainstate that is incomplete or failed validation\n");
+        RemoveSnapshotChainstate();
+        return false;
+    }
+    if (fValidated) {
+        // Background validation has finished: the snapshot chainstate replaces the one built from blocks.
+        LogPrintf("[snapshot] replacing the chainstate with the validated snapshot chainstate\n");
+        const fs::path chainstate_dir = GetDataDir() / DEFAULT_CHAINSTATE_DIR;
+        fs::remove_all(chainstate_dir);
+        fs::rename(snapshot_dir, chainstate_dir);
+        CCoinsViewDB coins_db(0, false, false, DEFAULT_CHAINSTATE_DIR);
+        coins_db.EraseSnapshotBase();
+        return false;
+    }
+    return true;
+}
+
+void RemoveSnapshotChainstate()
+{
+    const fs::path snapshot_dir = GetDataDir() / SNAPSHOT_CHAINSTATE_DIR;
+    try {
+        fs::remove_all(snapshot_dir);
+    } catch (const fs::filesystem_error& e) {
+        LogPrintf("[snapshot] failed to remove %s: %s\n", snapshot_dir.string(), e.what());
+    }
+}
+
+bool LoadSnapshotOnStartup(const fs::path& path, const uint256& expected_hash)
+{
+    FILE* file{fsbridge::fopen(path, "rb")};
+    CAutoFile afile{file, SER_DISK, CLIENT_VERSION};
+    if (afile.IsNull()) {
+        return error("%s: unable to open snapshot file %s", __func__, path.string());
+    }
+
+    SnapshotMetadata metadata;
+    try {
+        afile >> metadata;
+    } catch (const std::ios_base::failure& e) {
+        return error("%s: unable to parse snapshot metadata: %s", __func__, e.what());
+    }
+
+    {
+        LOCK(cs_main);
+        if (pcoinsdbview->GetSnapshotBase() == metadata.base_blockhash) {
+            LogPrintf("[snapshot] snapshot %s is already loaded\n", metadata.base_blockhash.ToString());
+            return true;
+        }
+    }
+
+    LogPrintf("[snapshot] waiting for the header of snapshot base block %s\n", metadata.base_blockhash.ToString());
+    while (!ShutdownRequested()) {
+        {
+            LOCK(cs_main);
+            if (LookupBlockIndex(metadata.base_blockhash)) break;
+        }
+        MilliSleep(500);
+    }
+    if (ShutdownRequested())
+        return true;
+
+    std::string strError;
+    if (!ActivateSnapshot(afile, metadata, expected_hash, strError)) {
+        return error("%s: failed to load snapshot %s: %s", __func__, path.string(), strError);
+    }
+    return true;
+}
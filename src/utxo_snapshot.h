@@ -8,10 +8,15 @@
 
 #include <serialize.h>
 #include <sync.h>
+#include <tinyformat.h>
 #include <uint256.h>
 #include <fs.h>
 #include <xfieldhistory.h>
 
+#include <ios>
+#include <string>
+
+class CAutoFile;
 
 // UTXO set snapshot magic bytes
 static constexpr std::array<uint8_t, 5> SNAPSHOT_MAGIC_BYTES = {'u', 't', 'x', 'o', 0xff};
@@ -49,6 +54,68 @@ public:
         s << base_blockhash;
         s << VARINT(coins_count);
     }
+
+    template <typename Stream>
+    inline void Unserialize(Stream& s) {
+        std::array<uint8_t, SNAPSHOT_MAGIC_BYTES.size()> magic;
+        s >> magic;
+        if (magic != SNAPSHOT_MAGIC_BYTES) {
+            throw std::ios_base::failure("Invalid UTXO set snapshot magic bytes. Please check if this is indeed a snapshot file or if you are using an outdated snapshot format.");
+        }
+
+        uint16_t snapshot_version;
+        s >> snapshot_version;
+        if (supported_versions.count(snapshot_version) == 0) {
+            throw std::ios_base::failure(strprintf("Version of snapshot %s does not match any of the supported versions.", snapshot_version));
+        }
+
+        s >> networkid;
+
+        std::string chain_name;
+        s >> chain_name;
+        if (chain_name == TAPYRUS_MODES::PROD) {
+            network_mode = TAPYRUS_OP_MODE::PROD;
+        } else if (chain_name == TAPYRUS_MODES::DEV) {
+            network_mode = TAPYRUS_OP_MODE::DEV;
+        } else {
+            throw std::ios_base::failure(strprintf("Unknown network mode %s in snapshot.", chain_name));
+        }
+
+        s >> base_blockhash;
+        s >> VARINT(coins_count);
+    }
 };
 
+/**
+ * Load a UTXO set written by dumptxoutset into a new chainstate database
+ * (chainstate_snapshot/) and make the snapshot base block the active tip.
+ *
+ * The header of the base block must already be known and the active chain
+ * must not have moved past it. The hash_serialized_3 of the loaded set must
+ * equal expected_hash, which the operator takes from gettxoutsetinfo or
+ * dumptxoutset on a trusted node. Issued NON_REISSUABLE/NFT colorIds are
+ * rebuilt from the colored outputs in the snapshot and xfield history from
+ * the block headers up to the base. The previous chainstate is kept to
+ * validate the blocks below the base in the background, see
+ * CBackgroundChainstate.
+ */
+bool ActivateSnapshot(CAutoFile& coins_file, const SnapshotMetadata& metadata, const uint256& expected_hash, std::string& strError);
+
+/**
+ * Return whether a snapshot chainstate that still needs background validation
+ * exists on disk. One left by an interrupted load or discarded by failed
+ * validation is deleted. A validated one is renamed to the regular chainstate
+ * directory, replacing the chainstate built from blocks.
+ */
+bool HaveSnapshotChainstate();
+
+/** Delete the snapshot chainstate, e.g. when the UTXO set is rebuilt by -reindex-chainstate. */
+void RemoveSnapshotChainstate();
+
+/**
+ * -loadsnapshot: wait until the header of the snapshot base block has been
+ * received, then load the snapshot. Does nothing if it was already loaded.
+ */
+bool LoadSnapshotOnStartup(const fs::path& path, const uint256& expected_hash);
+
 #endif // BITCOIN_UTXO_SNAPSHOT_H
@@ -6,6 +6,8 @@
 
 #include <addrman.h>
 #include <validation.h>
+#include <blockindexsnapshot.h>
+#include <blockproofbatch.h>
 #include <cs_main.h>
 #include <issuedcolorids.h>
 #include <checkpoints.h>
@@ -34,7 +36,9 @@
 #include <warnings.h>
 #include <xfieldhistory.h>
 
+#include <atomic>
 #include <future>
+#include <list>
 #include <thread>
 #include <sstream>
 
@@ -58,13 +62,16 @@ CConditionVariable g_best_block_cv;
 uint256 g_best_block;
 std::unique_ptr<CIssuedColorIds> g_colorid_state;
 int nScriptCheckThreads = 0;
+int nPrefetchThreads = 0;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fCheckBlockIndex = false;
+bool fBlockIndexSnapshot = DEFAULT_BLOCK_INDEX_SNAPSHOT;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
+int64_t nCoinDBCache = nMinDbCache << 20;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
@@ -179,7 +186,23 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
+std::unique_ptr<CCoinsViewErrorCatcher> pcoinscatcher;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
+
+bool CCoinsViewErrorCatcher::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    try {
+        return CCoinsViewBacked::GetCoin(outpoint, coin);
+    } catch(const std::runtime_error& e) {
+        uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
+        LogPrintf("Error reading from database: %s\n", e.what());
+        // Starting the shutdown sequence and returning false to the caller would be
+        // interpreted as 'entry not found' (as opposed to unable to read data), and
+        // could lead to invalid interpretation. Just exit immediately, as we can't
+        // continue anyway, and all writes should be atomic.
+        abort();
+    }
+}
 std::unique_ptr<CBlockTreeDB> pblocktree;
 
 bool CheckFinalTx(const CTransaction &tx, int flags)
@@ -338,7 +361,7 @@ static bool IsCurrentForFeeEstimation()
 // Used to avoid mempool polluting consensus critical paths if CCoinsViewMempool
 // were somehow broken and returning the wrong scriptPubKeys
 static bool CheckInputsFromMempoolAndCache(ValidationContext context, const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, const CTxMemPool& pool,
-                 unsigned int flags, bool cacheSigStore) {
+                 unsigned int flags, bool cacheSigStore, std::vector<ColorIdentifier>& inputColors) {
     AssertLockHeld(cs_main);
 
     // pool.cs should be locked already, but go ahead and re-take the lock here
@@ -368,7 +391,7 @@ static bool CheckInputsFromMempoolAndCache(ValidationContext context, const CTra
         }
     }
 
-    return CheckInputs(tx, state, view, true, flags, cacheSigStore, true);
+    return CheckInputs(tx, state, view, true, flags, cacheSigStore, true, nullptr, 0, nullptr, &inputColors);
 }
 
 static bool CheckConflictsInMempool(const CTransaction& tx, std::set<uint256>& setConflicts, CValidationState& state)
@@ -439,7 +462,17 @@ static bool DoAllInputsExist(const CTransaction& tx, CValidationState& state, CT
     return true;
 }
 
-bool CheckColorIdentifierValidity(const CTransaction& tx, CValidationState& state, CCoinsViewCache &inputs, int32_t blockHeight)
+std::vector<ColorIdentifier> GetInputColorIds(const CTransaction& tx, const CCoinsViewCache& inputs)
+{
+    std::vector<ColorIdentifier> colors;
+    colors.reserve(tx.vin.size());
+    for (const CTxIn& txin : tx.vin) {
+        colors.push_back(GetColorIdFromScript(inputs.AccessCoin(txin.prevout).out.scriptPubKey));
+    }
+    return colors;
+}
+
+bool CheckColorIdentifierValidity(const CTransaction& tx, CValidationState& state, CCoinsViewCache &inputs, int32_t blockHeight, const std::vector<ColorIdentifier>* inputColors)
 {
     // Track NFT colorId output count across the whole tx (must be exactly 1).
     std::map<ColorIdentifier, unsigned int> nftOutputCount;
@@ -469,11 +502,12 @@ bool CheckColorIdentifierValidity(const CTransaction& tx, CValidationState& stat
         bool matchFound = false;
         bool isIssuance = false;
 
-        for(auto txin : tx.vin)
+        for(size_t j = 0; j < tx.vin.size(); j++)
         {
+            const CTxIn& txin = tx.vin[j];
             const Coin& coin = inputs.AccessCoin(txin.prevout);
             ColorIdentifier coinColorId;
-            ColorIdentifier cid = GetColorIdFromScript(coin.out.scriptPubKey);
+            ColorIdentifier cid = inputColors ? (*inputColors)[j] : GetColorIdFromScript(coin.out.scriptPubKey);
 
             if (cid.type == TokenTypes::NONE && coin.out.scriptPubKey.IsColoredScript()) {
                 if (GetSoftForkManager().IsActive(SCRIPT_VERIFY_CP2SH_COLORED, blockHeight))
@@ -538,15 +572,16 @@ bool CheckColorIdentifierValidity(const CTransaction& tx, CValidationState& stat
     return true;
 }
 
-bool VerifyTokenBalances(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, CAmount minrelayFee, std::set<ColorIdentifier>* newIssuances, int32_t blockHeight)
+bool VerifyTokenBalances(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, CAmount minrelayFee, std::set<ColorIdentifier>* newIssuances, int32_t blockHeight, const std::vector<ColorIdentifier>* inputColors)
 {
     // Build input balance map from the UTXO view.
     // Simultaneously collect TPC input outpoints for issuance detection.
     TxColoredCoinBalancesMap inColoredCoinBalances;
     std::vector<COutPoint> tpcInputOutpoints;
-    for (const auto& txin : tx.vin) {
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        const CTxIn& txin = tx.vin[i];
         const Coin& coin = inputs.AccessCoin(txin.prevout);
-        ColorIdentifier cid = GetColorIdFromScript(coin.out.scriptPubKey);
+        ColorIdentifier cid = inputColors ? (*inputColors)[i] : GetColorIdFromScript(coin.out.scriptPubKey);
         // A legacy non-standard OP_COLOR UTXO (colorId resolves to NONE) is rejected
         // post-activation.  Pre-activation its nValue falls through to the TPC bucket.
         if (cid.type == TokenTypes::NONE && coin.out.scriptPubKey.IsColoredScript() &&
@@ -708,7 +743,8 @@ static bool AcceptToMemoryPoolWorker(const CTransactionRef &ptx, CTxMempoolAccep
             return false;
 
         //if there are colored coins in the output verify their colorids
-        if(!CheckColorIdentifierValidity(tx, state, view, chainActive.Tip()->nHeight + 1))
+        std::vector<ColorIdentifier> inputColors = GetInputColorIds(tx, view);
+        if(!CheckColorIdentifierValidity(tx, state, view, chainActive.Tip()->nHeight + 1, &inputColors))
             return false;
 
         // Bring the best block into scope
@@ -755,19 +791,23 @@ static bool AcceptToMemoryPoolWorker(const CTransactionRef &ptx, CTxMempoolAccep
 
         CTxMemPoolEntry entry(ptx, nFees, opt.nAcceptTime, chainActive.Height(),
                               fSpendsCoinbase, nSigOps, lp);
+        entry.AddInputColors(inputColors);
         unsigned int nSize = entry.GetTxSize();
 
+        // A transaction of a package may be paid for by its descendants in the package
+        const CAmount nPackageFees = std::max(nModifiedFees, opt.packageFeeRate.GetFee(nSize));
+
         CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
         if (opt.flags != MempoolAcceptanceFlags::BYPASSS_LIMITS
           && mempoolRejectFee > 0
-          && nModifiedFees < mempoolRejectFee) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nModifiedFees, mempoolRejectFee));
+          && nPackageFees < mempoolRejectFee) {
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nPackageFees, mempoolRejectFee));
         }
 
         // No transactions are allowed below minRelayTxFee except from disconnected blocks
         if (opt.flags != MempoolAcceptanceFlags::BYPASSS_LIMITS
-          && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met", false, strprintf("%d < %d", nModifiedFees, ::minRelayTxFee.GetFee(nSize)));
+          && nPackageFees < ::minRelayTxFee.GetFee(nSize)) {
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met", false, strprintf("%d < %d", nPackageFees, ::minRelayTxFee.GetFee(nSize)));
         }
 
         if (opt.nAbsurdFee && nFees > opt.nAbsurdFee)
@@ -786,6 +826,12 @@ static bool AcceptToMemoryPoolWorker(const CTransactionRef &ptx, CTxMempoolAccep
             return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
         }
 
+        // The transaction joins the clusters of its ancestors, which are linearized again each time they change.
+        size_t nLimitCluster = gArgs.GetArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT);
+        if (pool.CalculateClusterSize(setAncestors) > nLimitCluster) {
+            return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, strprintf("too many transactions in cluster [limit: %u]", nLimitCluster));
+        }
+
         // A transaction that spends outputs that would be replaced by it is invalid. Now
         // that we have the set of all ancestors we can detect this
         // pathological case by making sure setConflicts and setAncestors don't
@@ -936,6 +982,13 @@ static bool AcceptToMemoryPoolWorker(const CTransactionRef &ptx, CTxMempoolAccep
         const int32_t nextBlockHeight = chainActive.Tip()->nHeight + 1;
         const unsigned int tipScriptFlags = GetBlockScriptFlags(nextBlockHeight);
         const unsigned int mempoolScriptFlags = STANDARD_SCRIPT_VERIFY_FLAGS | tipScriptFlags;
+        // Scripts which failed the pre-check fail again as long as the tip, and so the flags, did not change.
+        const CTxMempoolPreCheck* precheck = opt.precheck;
+        if (precheck && precheck->fFailed && precheck->hash == hash &&
+            precheck->hashTip == chainActive.Tip()->GetBlockHash() && precheck->nFlags == mempoolScriptFlags) {
+            state = precheck->state;
+            return false;
+        }
         // Pass tipScriptFlags as mandatoryFlags so that softfork flags active at
         // nextBlockHeight are treated as mandatory even when they also appear in
         // STANDARD_SCRIPT_VERIFY_FLAGS (e.g. SCRIPT_VERIFY_CP2SH_COLORED).
@@ -945,12 +998,12 @@ static bool AcceptToMemoryPoolWorker(const CTransactionRef &ptx, CTxMempoolAccep
 
         // Cache script execution results using the same next-block flags so the
         // cache entries are valid when ConnectBlock runs at height nextBlockHeight.
-        if (!CheckInputsFromMempoolAndCache(opt.context, tx, opt.state, view, pool, tipScriptFlags, true)) {
+        if (!CheckInputsFromMempoolAndCache(opt.context, tx, opt.state, view, pool, tipScriptFlags, true, inputColors)) {
             return error("%s: BUG! PLEASE REPORT THIS! CheckInputs failed against latest-block but not STANDARD flags %s, %s",
                     __func__, hash.ToString(), FormatStateMessage(state));
         }
 
-        if (!VerifyTokenBalances(tx, opt.state, view, ::minRelayTxFee.GetFee(nSize), nullptr, chainActive.Tip()->nHeight + 1))
+        if (!VerifyTokenBalances(tx, opt.state, view, ::minRelayTxFee.GetFee(nSize), nullptr, chainActive.Tip()->nHeight + 1, &inputColors))
             return false;
 
 
@@ -991,7 +1044,7 @@ static bool AcceptToMemoryPoolWorker(const CTransactionRef &ptx, CTxMempoolAccep
         pool.addUnchecked(hash, entry, setAncestors, validForFeeEstimation);
 
         // trim mempool and check if tx was trimmed
-        if (opt.flags != MempoolAcceptanceFlags::BYPASSS_LIMITS) {
+        if (opt.flags != MempoolAcceptanceFlags::BYPASSS_LIMITS && !opt.fDeferTrim) {
             LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
             if (!pool.exists(hash))
                 return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
@@ -1007,6 +1060,9 @@ static bool AcceptToMemoryPoolWorker(const CTransactionRef &ptx, CTxMempoolAccep
 bool AcceptToMemoryPool(const CTransactionRef &tx, CTxMempoolAcceptanceOptions& opt)
 {
     opt.nAcceptTime = GetTime();
+    if (opt.precheck && opt.precheck->hash == tx->GetHashMalFix()) {
+        opt.coins_to_uncache.insert(opt.coins_to_uncache.end(), opt.precheck->coins_to_uncache.begin(), opt.precheck->coins_to_uncache.end());
+    }
     bool res = AcceptToMemoryPoolWorker(tx, opt);
     if (!res) {
         for (const COutPoint& hashTx : opt.coins_to_uncache)
@@ -1135,9 +1191,15 @@ std::optional<ScriptError> CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     ScriptError error{SCRIPT_ERR_UNKNOWN_ERROR};
     if (VerifyScript(scriptSig, m_tx_out.scriptPubKey, nFlags,
-                     CachingTransactionSignatureChecker(ptxTo, nIn, m_tx_out.nValue, cacheStore),
+                     CachingTransactionSignatureChecker(ptxTo, nIn, m_tx_out.nValue, cacheStore, txdata, m_sigbatch, m_origin),
                      colorid, &error))
         return std::nullopt;
+    // A signature assumed valid may have made the script fail where it would not have, or
+    // with another error, so the failure is only certain without deferring.
+    if (m_sigbatch && VerifyScript(scriptSig, m_tx_out.scriptPubKey, nFlags,
+                                   CachingTransactionSignatureChecker(ptxTo, nIn, m_tx_out.nValue, cacheStore, txdata),
+                                   colorid, &error))
+        return std::nullopt;
     return error;
 }
 
@@ -1151,6 +1213,49 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
 static uint256 scriptExecutionCacheNonce(GetRandHash());
 
+/**
+ * The colors of the coins spent by the colored transactions in the script execution cache, under
+ * the same entry, which commits to the transaction with its scripts and to the flags. Connecting a
+ * block of such transactions then takes the colors of their inputs from here instead of deriving
+ * them from the spent scripts again. The least recently used entries are dropped beyond the limit.
+ */
+static std::list<std::pair<uint256, std::vector<ColorIdentifier>>> scriptExecutionColorCache GUARDED_BY(cs_main);
+static std::map<uint256, decltype(scriptExecutionColorCache)::iterator> scriptExecutionColorCacheIndex GUARDED_BY(cs_main);
+static const size_t MAX_SCRIPT_EXECUTION_COLOR_CACHE_ENTRIES = 20000;
+
+static void AddScriptExecutionColors(const uint256& entry, const std::vector<ColorIdentifier>& colors) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (std::all_of(colors.begin(), colors.end(), [](const ColorIdentifier& color) { return color.type == TokenTypes::NONE; }))
+        return;
+    auto it = scriptExecutionColorCacheIndex.find(entry);
+    if (it != scriptExecutionColorCacheIndex.end()) {
+        scriptExecutionColorCache.splice(scriptExecutionColorCache.begin(), scriptExecutionColorCache, it->second);
+        return;
+    }
+    scriptExecutionColorCache.emplace_front(entry, colors);
+    scriptExecutionColorCacheIndex.emplace(entry, scriptExecutionColorCache.begin());
+    if (scriptExecutionColorCache.size() > MAX_SCRIPT_EXECUTION_COLOR_CACHE_ENTRIES) {
+        scriptExecutionColorCacheIndex.erase(scriptExecutionColorCache.back().first);
+        scriptExecutionColorCache.pop_back();
+    }
+}
+
+static bool GetScriptExecutionColors(const uint256& entry, bool erase, std::vector<ColorIdentifier>& colors) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    auto it = scriptExecutionColorCacheIndex.find(entry);
+    if (it == scriptExecutionColorCacheIndex.end())
+        return false;
+    if (erase) {
+        colors = std::move(it->second->second);
+        scriptExecutionColorCache.erase(it->second);
+        scriptExecutionColorCacheIndex.erase(it);
+    } else {
+        colors = it->second->second;
+        scriptExecutionColorCache.splice(scriptExecutionColorCache.begin(), scriptExecutionColorCache, it->second);
+    }
+    return true;
+}
+
 void InitScriptExecutionCache() {
     // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
     // setup_bytes creates the minimum possible cache (2 elements).
@@ -1160,7 +1265,67 @@ void InitScriptExecutionCache() {
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, std::vector<CScriptCheck> *pvChecks, unsigned int mandatoryFlags)
+/**
+ * Run the script checks of each input of tx, or push them onto pvChecks. This
+ * needs neither cs_main nor the script execution cache, so it is also used to
+ * check transactions for the mempool before cs_main is taken.
+ */
+static bool CheckInputScripts(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, unsigned int flags, bool cacheSigStore, std::vector<CScriptCheck> *pvChecks, unsigned int mandatoryFlags, const PrecomputedTransactionData* txdata)
+{
+    // Checks run here can share data local to this call; deferred checks can only
+    // use the caller's, which outlives them.
+    std::optional<PrecomputedTransactionData> local_txdata;
+    if (!txdata && !pvChecks && tx.vin.size() > 1) {
+        local_txdata.emplace(tx);
+        txdata = &*local_txdata;
+    }
+
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        const COutPoint &prevout = tx.vin[i].prevout;
+        const Coin& coin = inputs.AccessCoin(prevout);
+        assert(!coin.IsSpent());
+
+        // We very carefully only pass in things to CScriptCheck which
+        // are clearly committed to by tx's hash. This provides
+        // a sanity check that our caching is not introducing consensus
+        // failures through additional data in, eg, the coins being
+        // spent being checked as a part of CScriptCheck.
+
+        // Verify signature
+        CScriptCheck check(coin.out, tx, i, flags, cacheSigStore, txdata);
+        if (pvChecks) {
+            pvChecks->emplace_back(std::move(check));
+        } else if (const auto err = check()) {
+            // Flags that are in STANDARD but not in the mandatory block flags
+            // for this height are truly non-mandatory (policy-only).
+            // Flags present in mandatoryFlags are consensus-mandatory even if
+            // they also appear in STANDARD_SCRIPT_VERIFY_FLAGS (e.g.
+            // SCRIPT_VERIFY_CP2SH_COLORED after softfork activation).
+            const unsigned int nonMandatory = STANDARD_NOT_MANDATORY_VERIFY_FLAGS & ~mandatoryFlags;
+            if (flags & nonMandatory) {
+                // Check whether the failure was caused by a non-mandatory script
+                // verification flag. If check2 passes, the failure is non-mandatory
+                // → mempool rejects as non-standard without DoS.
+                // If check2 also fails, fall through to DoS.
+                CScriptCheck check2(coin.out, tx, i,
+                        flags & ~nonMandatory, cacheSigStore, txdata);
+                if (!check2().has_value()) {
+                    LogPrint(BCLog::MEMPOOLREJ, "%s: tx %s input %u flags=0x%08x non-mandatory script failure: %s\n",
+                        __func__, tx.GetHashMalFix().ToString(), i, flags, ScriptErrorString(*err));
+                    return state.Invalid(false, REJECT_NONSTANDARD,
+                        strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(*err)));
+                }
+            }
+            return state.DoS(100, error("%s: tx %s input %u flags=0x%08x script failure: %s",
+                    __func__, tx.GetHashMalFix().ToString(), i, flags, ScriptErrorString(*err)),
+                REJECT_INVALID,
+                strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(*err)));
+        }
+    }
+    return true;
+}
+
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, std::vector<CScriptCheck> *pvChecks, unsigned int mandatoryFlags, const PrecomputedTransactionData* txdata, std::vector<ColorIdentifier>* pInputColors)
 {
     if (!tx.IsCoinBase())
     {
@@ -1189,63 +1354,122 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
             AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
             if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
+                if (pInputColors && pInputColors->empty() && !GetScriptExecutionColors(hashCacheEntry, !cacheFullScriptStore, *pInputColors))
+                    *pInputColors = GetInputColorIds(tx, inputs);
                 return true;
             }
 
-            for (unsigned int i = 0; i < tx.vin.size(); i++) {
-                const COutPoint &prevout = tx.vin[i].prevout;
-                const Coin& coin = inputs.AccessCoin(prevout);
-                assert(!coin.IsSpent());
-
-                // We very carefully only pass in things to CScriptCheck which
-                // are clearly committed to by tx's hash. This provides
-                // a sanity check that our caching is not introducing consensus
-                // failures through additional data in, eg, the coins being
-                // spent being checked as a part of CScriptCheck.
-
-                // Verify signature
-                CScriptCheck check(coin.out, tx, i, flags, cacheSigStore);
-                if (pvChecks) {
-                    pvChecks->emplace_back(std::move(check));
-                } else if (const auto err = check()) {
-                    // Flags that are in STANDARD but not in the mandatory block flags
-                    // for this height are truly non-mandatory (policy-only).
-                    // Flags present in mandatoryFlags are consensus-mandatory even if
-                    // they also appear in STANDARD_SCRIPT_VERIFY_FLAGS (e.g.
-                    // SCRIPT_VERIFY_CP2SH_COLORED after softfork activation).
-                    const unsigned int nonMandatory = STANDARD_NOT_MANDATORY_VERIFY_FLAGS & ~mandatoryFlags;
-                    if (flags & nonMandatory) {
-                        // Check whether the failure was caused by a non-mandatory script
-                        // verification flag. If check2 passes, the failure is non-mandatory
-                        // → mempool rejects as non-standard without DoS.
-                        // If check2 also fails, fall through to DoS.
-                        CScriptCheck check2(coin.out, tx, i,
-                                flags & ~nonMandatory, cacheSigStore);
-                        if (!check2().has_value()) {
-                            LogPrint(BCLog::MEMPOOLREJ, "%s: tx %s input %u flags=0x%08x non-mandatory script failure: %s\n",
-                                __func__, tx.GetHashMalFix().ToString(), i, flags, ScriptErrorString(*err));
-                            return state.Invalid(false, REJECT_NONSTANDARD,
-                                strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(*err)));
-                        }
-                    }
-                    return state.DoS(100, error("%s: tx %s input %u flags=0x%08x script failure: %s",
-                            __func__, tx.GetHashMalFix().ToString(), i, flags, ScriptErrorString(*err)),
-                        REJECT_INVALID,
-                        strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(*err)));
-                }
-            }
+            if (!CheckInputScripts(tx, state, inputs, flags, cacheSigStore, pvChecks, mandatoryFlags, txdata))
+                return false;
 
             if (cacheFullScriptStore && !pvChecks) {
                 // We executed all of the provided scripts, and were told to
                 // cache the result. Do so now.
                 scriptExecutionCache.insert(hashCacheEntry);
+                if (pInputColors && pInputColors->empty())
+                    *pInputColors = GetInputColorIds(tx, inputs);
+                AddScriptExecutionColors(hashCacheEntry, pInputColors ? *pInputColors : GetInputColorIds(tx, inputs));
             }
         }
+
+        if (pInputColors && pInputColors->empty())
+            *pInputColors = GetInputColorIds(tx, inputs);
     }
 
     return true;
 }
 
+void PreCheckForMemPool(const std::vector<CTransactionRef>& txs, std::vector<CTxMempoolPreCheck>& prechecks)
+{
+    prechecks.assign(txs.size(), CTxMempoolPreCheck());
+    if (txs.empty())
+        return;
+
+    // The context-free checks AcceptToMemoryPool does before it checks any scripts
+    std::vector<bool> fCandidate(txs.size(), false);
+    for (size_t i = 0; i < txs.size(); ++i) {
+        const CTransaction& tx = *txs[i];
+        prechecks[i].hash = tx.GetHashMalFix();
+        CValidationState state;
+        std::string reason;
+        fCandidate[i] = CheckTransaction(tx, state) && !tx.IsCoinBase() && IsStandardTx(tx, reason) &&
+            ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) >= MIN_STANDARD_TX_SIZE;
+    }
+
+    // Read the spent coins at one tip. Transactions with inputs that are not
+    // known yet are left to AcceptToMemoryPool, which handles orphans.
+    CCoinsView dummy;
+    std::vector<std::unique_ptr<CCoinsViewCache>> views(txs.size());
+    {
+        LOCK2(cs_main, mempool.cs);
+        const uint256 hashTip = chainActive.Tip()->GetBlockHash();
+        const unsigned int tipScriptFlags = GetBlockScriptFlags(chainActive.Tip()->nHeight + 1);
+        CCoinsViewMemPool viewMemPool(pcoinsTip.get(), mempool);
+        for (size_t i = 0; i < txs.size(); ++i) {
+            if (!fCandidate[i] || mempool.exists(prechecks[i].hash))
+                continue;
+            const CTransaction& tx = *txs[i];
+            CTxMempoolPreCheck& precheck = prechecks[i];
+            std::unique_ptr<CCoinsViewCache> view(new CCoinsViewCache(&viewMemPool));
+            bool fHaveInputs = true;
+            for (const CTxIn& txin : tx.vin) {
+                if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+                    precheck.coins_to_uncache.push_back(txin.prevout);
+                if (!view->HaveCoin(txin.prevout)) {
+                    fHaveInputs = false;
+                    break;
+                }
+            }
+            if (!fHaveInputs || !AreInputsStandard(tx, *view))
+                continue;
+            view->SetBackend(dummy);
+            precheck.hashTip = hashTip;
+            precheck.nFlags = STANDARD_SCRIPT_VERIFY_FLAGS | tipScriptFlags;
+            precheck.nMandatoryFlags = tipScriptFlags;
+            views[i] = std::move(view);
+        }
+    }
+
+    // The scripts are checked on the script check queue, caching the
+    // signatures for the checks AcceptToMemoryPool repeats under cs_main.
+    if (nScriptCheckThreads && g_chainstate.scriptcheckqueue) {
+        std::vector<PrecomputedTransactionData> txdata;
+        txdata.reserve(txs.size());
+        CCheckQueueControl<CScriptCheck> control(g_chainstate.scriptcheckqueue.get());
+        for (size_t i = 0; i < txs.size(); ++i) {
+            if (!views[i])
+                continue;
+            CTxMempoolPreCheck& precheck = prechecks[i];
+            txdata.emplace_back(*txs[i]);
+            std::vector<CScriptCheck> vChecks;
+            CheckInputScripts(*txs[i], precheck.state, *views[i], precheck.nFlags, true, &vChecks, precheck.nMandatoryFlags, &txdata.back());
+            control.Add(std::move(vChecks));
+        }
+        if (!control.Complete().has_value())
+            return;
+        // Which transaction failed, and why, is found below. The signatures
+        // that passed on the queue are cached already.
+    }
+    for (size_t i = 0; i < txs.size(); ++i) {
+        if (!views[i])
+            continue;
+        CTxMempoolPreCheck& precheck = prechecks[i];
+        precheck.fFailed = !CheckInputScripts(*txs[i], precheck.state, *views[i], precheck.nFlags, true, nullptr, precheck.nMandatoryFlags, nullptr);
+    }
+}
+
+void UncachePreCheckedCoins(const std::vector<CTxMempoolPreCheck>& prechecks)
+{
+    AssertLockHeld(cs_main);
+    for (const CTxMempoolPreCheck& precheck : prechecks) {
+        if (mempool.exists(precheck.hash))
+            continue;
+        for (const COutPoint& outpoint : precheck.coins_to_uncache) {
+            pcoinsTip->Uncache(outpoint);
+        }
+    }
+}
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage)
 {
@@ -1267,6 +1491,9 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
 void StartScriptCheckWorkerThreads(int threads_num)
 {
     g_chainstate.scriptcheckqueue = std::make_unique< CCheckQueue<CScriptCheck> >(128, threads_num);
+    g_chainstate.blockproofcheckqueue = std::make_unique< CCheckQueue<CBlockProofCheck> >(MIN_BLOCK_PROOF_BATCH_SIZE, threads_num);
+    g_chainstate.sigcheckqueue = std::make_unique< CCheckQueue<CSignatureCheck> >(128, threads_num);
+    g_chainstate.blockcheckqueue = std::make_unique< CCheckQueue<CBlockTransactionsCheck> >(REINDEX_CHECK_BATCH_SIZE, threads_num);
 }
 
 void FlushStateToDisk() {
@@ -1301,7 +1528,15 @@ void ResetBlockFailureFlags(CBlockIndex *pindex) {
     return g_chainstate.ResetBlockFailureFlags(pindex);
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, CXFieldHistoryMap* pxfieldHistory, int nHeight, bool fCheckPOW)
+bool GetBlockHeaderWithProof(const CBlockIndex* pindex, CBlockHeader& header)
+{
+    header = pindex->GetBlockHeader();
+    if (!pblocktree->ReadBlockProof(pindex->GetBlockHash(), header.proof))
+        return error("%s: no proof for block %s", __func__, pindex->GetBlockHash().ToString());
+    return true;
+}
+
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, CXFieldHistoryMap* pxfieldHistory, int nHeight, bool fCheckPOW, const CBlockProofBatch* proofs)
 {
     //check block features
     if(block.nFeatures != CBlock::TAPYRUS_BLOCK_FEATURES)
@@ -1341,13 +1576,69 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, CXFiel
 
     const uint256 blockHash = block.GetHashForSign();
 
-    //verify signature
-    if(!aggregatePubkey.Verify_Schnorr(blockHash, block.proof))
+    //verify signature, unless it was verified together with the other headers of a batch
+    //against the same aggregate key
+    if(!(proofs && proofs->IsVerified(blockHash, aggregatePubkey, block.proof))
+        && !aggregatePubkey.Verify_Schnorr(blockHash, block.proof))
         return state.Invalid(false, REJECT_INVALID, "bad-proof", strprintf("Proof verification failed at height [%d]", nHeight));
 
     return true;
 }
 
+static bool CheckBlockMerkleRoot(const CBlock& block, CValidationState& state)
+{
+    bool mutated;
+    uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
+    if (block.hashMerkleRoot != hashMerkleRoot2)
+        return state.DoS(100, false, REJECT_INVALID, "bad-txnmrklroot", true, "hashMerkleRoot mismatch");
+
+    uint256 hashImMerkleRoot2 = BlockMerkleRoot(block, &mutated, true);
+
+    if (block.hashImMerkleRoot != hashImMerkleRoot2)
+        return state.DoS(100, false, REJECT_INVALID, "bad-txnimmrklroot", true, "hashImMerkleRoot mismatch");
+
+    // Check for merkle tree malleability (CVE-2012-2459): repeating sequences
+    // of transactions in a block without affecting the merkle root of a block,
+    // while still invalidating it.
+    if (mutated)
+        return state.DoS(100, false, REJECT_INVALID, "bad-txns-duplicate", true, "duplicate transaction");
+
+    return true;
+}
+
+static bool CheckEachTransaction(const CBlock& block, CValidationState& state)
+{
+    for (const auto& tx : block.vtx)
+    {
+        if (!CheckTransaction(*tx, state, true))
+            return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
+                                 strprintf("Transaction check failed (tx hash %s) %s", tx->GetHashMalFix().ToString(), state.GetDebugMessage()));
+    }
+    return true;
+}
+
+bool CheckBlockTransactions(const CBlock& block, CValidationState& state)
+{
+    if (block.fCheckedTransactions)
+        return true;
+
+    if (!CheckBlockMerkleRoot(block, state) || !CheckEachTransaction(block, state))
+        return false;
+
+    // Only set here: CheckBlock may run on a block that is changed afterwards, like a
+    // block template before its coinbase is final.
+    block.fCheckedTransactions = true;
+    return true;
+}
+
+std::optional<uint256> CBlockTransactionsCheck::operator()()
+{
+    CValidationState state;
+    if (!CheckBlockTransactions(*m_block, state))
+        return m_block->GetHash();
+    return std::nullopt;
+}
+
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, CXFieldHistoryMap* pxfieldHistory, int nHeight)
 {
     // These are checks that are independent of context.
@@ -1356,23 +1647,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         return true;
 
     // Check the merkle root.
-    if (fCheckMerkleRoot) {
-        bool mutated;
-        uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
-        if (block.hashMerkleRoot != hashMerkleRoot2)
-            return state.DoS(100, false, REJECT_INVALID, "bad-txnmrklroot", true, "hashMerkleRoot mismatch");
-
-        uint256 hashImMerkleRoot2 = BlockMerkleRoot(block, &mutated, true);
-
-        if (block.hashImMerkleRoot != hashImMerkleRoot2)
-            return state.DoS(100, false, REJECT_INVALID, "bad-txnimmrklroot", true, "hashImMerkleRoot mismatch");
-
-        // Check for merkle tree malleability (CVE-2012-2459): repeating sequences
-        // of transactions in a block without affecting the merkle root of a block,
-        // while still invalidating it.
-        if (mutated)
-            return state.DoS(100, false, REJECT_INVALID, "bad-txns-duplicate", true, "duplicate transaction");
-    }
+    if (fCheckMerkleRoot && !block.fCheckedTransactions && !CheckBlockMerkleRoot(block, state))
+        return false;
 
     // First transaction must be coinbase,
     if (block.vtx.empty() || !block.vtx[0]->IsCoinBase())
@@ -1425,12 +1701,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-multiple", false, "more than one coinbase");
 
     // Check transactions
-    for (const auto& tx : block.vtx)
-    {
-        if (!CheckTransaction(*tx, state, true))
-            return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
-                                 strprintf("Transaction check failed (tx hash %s) %s", tx->GetHashMalFix().ToString(), state.GetDebugMessage()));
-    }
+    if (!block.fCheckedTransactions && !CheckEachTransaction(block, state))
+        return false;
+
     unsigned int nSigOps = 0;
     for (const auto& tx : block.vtx)
     {
@@ -1511,9 +1784,35 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidatio
     if (first_invalid != nullptr) first_invalid->SetNull();
     {
         LOCK(cs_main);
+
+        // Verify the proofs of the new headers together. A header whose proof could
+        // not be verified here is checked again on its own by AcceptBlockHeader.
+        CBlockProofBatch proofs;
+        if (headers.size() >= MIN_BLOCK_PROOF_BATCH_SIZE) {
+            std::map<uint256, int> heights;
+            for (const CBlockHeader& header : headers) {
+                const uint256 hash = header.GetHash();
+                if (LookupBlockIndex(hash)) continue;
+
+                int nHeight = -1;
+                auto it = heights.find(header.hashPrevBlock);
+                if (it != heights.end()) {
+                    nHeight = it->second + 1;
+                } else if (const CBlockIndex* pindexPrev = LookupBlockIndex(header.hashPrevBlock)) {
+                    nHeight = pindexPrev->nHeight + 1;
+                }
+                if (nHeight < 0) continue;
+                heights.emplace(hash, nHeight);
+                proofs.Add(header, nHeight, &tempFieldHistory);
+            }
+            if (!proofs.Verify()) {
+                LogPrint(BCLog::NET, "%s: batch verification of %u block proofs failed, checking them one by one\n", __func__, proofs.size());
+            }
+        }
+
         for (const CBlockHeader& header : headers) {
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!g_chainstate.AcceptBlockHeader(header, state, &pindex, &tempFieldHistory)) {
+            if (!g_chainstate.AcceptBlockHeader(header, state, &pindex, &tempFieldHistory, &proofs)) {
                 if (first_invalid) *first_invalid = header;
                 return false;
             }
@@ -38,6 +38,7 @@ class CCoinsViewDB;
 class CInv;
 class CConnman;
 class CScriptCheck;
+struct PrecomputedTransactionData;
 class CBlockPolicyEstimator;
 class CTxMemPool;
 class CValidationState;
@@ -69,6 +70,8 @@ static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
 static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 /** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -limitclustercount, max number of transactions in a mempool cluster */
+static const unsigned int DEFAULT_CLUSTER_LIMIT = 100;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 336;
 /** Maximum kilobytes for transactions to store for processing during reorg */
@@ -84,6 +87,10 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of threads reading the coins of the next block */
+static const int MAX_PREFETCH_THREADS = 16;
+/** -prefetchcoins default (number of threads reading the coins of the next block, 0 = disabled) */
+static const int DEFAULT_PREFETCH_THREADS = 4;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -135,6 +142,7 @@ static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
 static const int MAX_UNCONNECTING_HEADERS = 10;
 
 static const bool DEFAULT_PEERBLOOMFILTERS = true;
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
 
 /** Default for -stopatheight */
 static const int DEFAULT_STOPATHEIGHT = 0;
@@ -157,9 +165,14 @@ extern std::unique_ptr<CIssuedColorIds> g_colorid_state;
 extern std::atomic_bool fImporting;
 extern std::atomic_bool fReindex;
 extern int nScriptCheckThreads;
+extern int nPrefetchThreads;
 extern bool fCheckBlockIndex;
+/** Whether the block index is written to a snapshot at shutdown and read from it at startup */
+extern bool fBlockIndexSnapshot;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
+/** LevelDB cache size of the chainstate database, in bytes. */
+extern int64_t nCoinDBCache;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** Absolute maximum transaction fee (in tapyrus) used by wallet and mempool (rejects high fee in sendrawtransaction) */
@@ -186,6 +199,22 @@ extern CChain& chainActive;
 /** Global variable that points to the coins database (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 
+/**
+ * This is a minimally invasive approach to shutdown on LevelDB read errors from the
+ * chainstate, while keeping user interface out of the common library, which is shared
+ * between tapyrusd, and tapyrus-qt and non-server tools.
+ */
+class CCoinsViewErrorCatcher final : public CCoinsViewBacked
+{
+public:
+    explicit CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    // Writes do not need similar protection, as failure to write is handled by the caller.
+};
+
+/** Global variable that wraps pcoinsdbview and aborts on read errors (protected by cs_main) */
+extern std::unique_ptr<CCoinsViewErrorCatcher> pcoinscatcher;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 
@@ -270,7 +299,7 @@ bool LoadBlockIndex() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 bool LoadChainTip();
 /** Unload database information */
 void UnloadBlockIndex();
-/** Run instances of script checking worker threads */
+/** Run instances of script and block proof checking worker threads */
 void StartScriptCheckWorkerThreads(int threads_num);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
@@ -299,6 +328,25 @@ void PruneBlockFilesManual(int nManualPruneHeight);
  * plTxnReplaced will be appended to with all transactions replaced from mempool **/
 bool AcceptToMemoryPool(const CTransactionRef &tx, CTxMempoolAcceptanceOptions &opt);
 
+/**
+ * Check the scripts of transactions for the mempool while holding cs_main only
+ * to read the coins they spend. The checks of several transactions run on the
+ * script check queue. Pass each result to AcceptToMemoryPool in
+ * opt.precheck: it still checks everything under cs_main, where the cached
+ * signatures make the script checks cheap. A failure is only reused if the tip
+ * did not move since the pre-check. Transactions failing the context-free
+ * checks, or whose inputs are not known, are not checked.
+ */
+void PreCheckForMemPool(const std::vector<CTransactionRef>& txs, std::vector<CTxMempoolPreCheck>& prechecks);
+
+/**
+ * Uncache the coins the pre-checks pulled into pcoinsTip for transactions
+ * that are not in the mempool. Call it on every path that does not pass a
+ * pre-checked transaction to AcceptToMemoryPool, which uncaches them itself
+ * when it rejects the transaction.
+ */
+void UncachePreCheckedCoins(const std::vector<CTxMempoolPreCheck>& prechecks) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 /** remove old transactions from mempool based on age to keep it within size limits*/
 void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age);
 
@@ -347,13 +395,21 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags,  CCoinsViewMemPool& v
  * script checks which are not necessary (eg due to script execution cache hits) are, obviously,
  * not pushed onto pvChecks/run.
  *
+ * txdata, if set, must be computed from tx and outlive the checks pushed onto pvChecks. If it is
+ * not set, checks performed inline compute it themselves.
+ *
+ * If pInputColors is set and CheckInputs succeeds, it holds the color of the coin spent by each input
+ * (see GetInputColorIds). If it is not empty on entry it must hold them already. The colors of a
+ * colored transaction are kept with its script execution cache entry, and taken from there when the
+ * scripts are found in the cache.
+ *
  * Setting cacheSigStore/cacheFullScriptStore to false will remove elements from the corresponding cache
  * which are matched. This is useful for checking blocks where we will likely never need the cache
  * entry again.
  *
  * Non-static (and re-declared) in src/test/txvalidationcache_tests.cpp
  */
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, std::vector<CScriptCheck> *pvChecks = nullptr, unsigned int mandatoryFlags = 0);
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, std::vector<CScriptCheck> *pvChecks = nullptr, unsigned int mandatoryFlags = 0, const PrecomputedTransactionData* txdata = nullptr, std::vector<ColorIdentifier>* pInputColors = nullptr);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -377,8 +433,22 @@ bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& sta
  */
 bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindexPrev);
 
-/** Context-independent header validity checks */
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, CXFieldHistoryMap* pxfieldHistory = nullptr, int nHeight = -1, bool fCheckPOW = true);
+/**
+ * The header of a block index entry with its proof, which is read from the block tree
+ * database. Returns false if the proof cannot be read; the header must not be sent then.
+ */
+bool GetBlockHeaderWithProof(const CBlockIndex* pindex, CBlockHeader& header);
+
+/** Context-independent header validity checks. The proof is not verified again if it was verified by proofs. */
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, CXFieldHistoryMap* pxfieldHistory = nullptr, int nHeight = -1, bool fCheckPOW = true, const CBlockProofBatch* proofs = nullptr);
+
+/**
+ * The checks of CheckBlock that depend only on the transactions of the block: the
+ * merkle roots and CheckTransaction. They do not need cs_main, so a block can be
+ * checked on another thread before it is accepted or connected. If they pass, the
+ * block remembers it and CheckBlock does not repeat them.
+ */
+bool CheckBlockTransactions(const CBlock& block, CValidationState& state);
 
 /** Context-independent validity checks */
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, CXFieldHistoryMap* pxfieldHistory = nullptr, int nHeight = -1);
@@ -389,13 +459,18 @@ bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex
 /** When there are blocks in the active chain with missing data, rewind the chainstate and remove them from the block index */
 bool RewindBlockIndex();
 
+/** The color of the coin spent by each input of tx, as GetColorIdFromScript derives it from the coin's script. */
+std::vector<ColorIdentifier> GetInputColorIds(const CTransaction& tx, const CCoinsViewCache& inputs);
+
 /** Verify coloured coin type related consensus rules.
- *  blockHeight is used to query the softfork manager; pass INT32_MAX to always enforce. */
-bool CheckColorIdentifierValidity(const CTransaction& tx, CValidationState& state, CCoinsViewCache &inputs, int32_t blockHeight = INT32_MAX);
+ *  blockHeight is used to query the softfork manager; pass INT32_MAX to always enforce.
+ *  inputColors, if set, must be GetInputColorIds(tx, inputs). */
+bool CheckColorIdentifierValidity(const CTransaction& tx, CValidationState& state, CCoinsViewCache &inputs, int32_t blockHeight = INT32_MAX, const std::vector<ColorIdentifier>* inputColors = nullptr);
 
 /** Check token input and output amounts within a transaction.
- *  blockHeight is used to query the softfork manager; pass INT32_MAX to always enforce. */
-bool VerifyTokenBalances(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, CAmount minrelayFee, std::set<ColorIdentifier>* newIssuances = nullptr, int32_t blockHeight = INT32_MAX);
+ *  blockHeight is used to query the softfork manager; pass INT32_MAX to always enforce.
+ *  inputColors, if set, must be GetInputColorIds(tx, inputs). */
+bool VerifyTokenBalances(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, CAmount minrelayFee, std::set<ColorIdentifier>* newIssuances = nullptr, int32_t blockHeight = INT32_MAX, const std::vector<ColorIdentifier>* inputColors = nullptr);
 
 /** Replay blocks that aren't fully applied to the database. */
 bool ReplayBlocks(CCoinsView* view);
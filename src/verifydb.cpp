@@ -69,6 +69,11 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
+        if (pindex->IsAssumedValid() && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // Blocks below a UTXO snapshot base are only downloaded by background validation.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (snapshot, no data)\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+# Copyright (c) 2024 Chaintope Inc.
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test addressindex.
+
+Test that getaddressbalance, getaddressutxos and getaddresshistory report the
+outputs of TPC and token addresses, that spent outputs record the spending
+input, and that the index is updated after a reorg and a restart.
+"""
+
+from decimal import Decimal
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+)
+
+class AddressIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [
+            [],
+            ["-addressindex"]
+        ]
+
+    def run_test(self):
+        self._test_address_index()
+        self._test_tokens()
+        self._test_reorg()
+        self._test_restart()
+        self._test_errors()
+
+    def _test_address_index(self):
+        node, index_node = self.nodes
+
+        self.log.info("Test the balance, unspent outputs and history of an address")
+        node.generate(101, self.signblockprivkey_wif)
+        self.address = index_node.getnewaddress()
+        txid1 = node.sendtoaddress(self.address, 10)
+        node.generate(1, self.signblockprivkey_wif)
+        txid2 = node.sendtoaddress(self.address, 5)
+        node.generate(1, self.signblockprivkey_wif)
+        self.sync_all()
+
+        assert_equal(index_node.getaddressbalance(self.address),
+                     [{'token': 'TPC', 'balance': Decimal('15'), 'received': Decimal('15')}])
+        utxos = index_node.getaddressutxos(self.address)
+        assert_equal([(u['txid'], u['height'], u['amount']) for u in utxos],
+                     [(txid1, 102, Decimal('10')), (txid2, 103, Decimal('5'))])
+        assert_equal(index_node.gettxout(txid1, utxos[0]['vout'])['value'], Decimal('10'))
+
+        self.log.info("Test that spent outputs record the spending input")
+        spend_txid = index_node.sendtoaddress(node.getnewaddress(), 15, "", "", True)
+        node.generate(1, self.signblockprivkey_wif)
+        self.sync_all()
+
+        assert_equal(index_node.getaddressbalance(self.address),
+                     [{'token': 'TPC', 'balance': Decimal('0'), 'received': Decimal('15')}])
+        assert_equal(index_node.getaddressutxos(self.address), [])
+        history = index_node.getaddresshistory(self.address)
+        assert_equal(len(history), 2)
+        for entry in history:
+            assert_equal(entry['spent']['txid'], spend_txid)
+            assert_equal(entry['spent']['height'], 104)
+        assert_equal(sorted(entry['spent']['vin'] for entry in history), [0, 1])
+
+        self.log.info("Test pagination")
+        assert_equal(index_node.getaddresshistory(self.address, 1), history[:1])
+        assert_equal(index_node.getaddresshistory(self.address, 1, 1), history[1:])
+        assert_equal(index_node.getaddresshistory(self.address, 10, 2), [])
+        assert_equal(index_node.getaddresshistory(self.address, 0), [])
+
+    def _test_tokens(self):
+        node, index_node = self.nodes
+
+        self.log.info("Test that token outputs are indexed under their color")
+        utxo = next(u for u in node.listunspent() if u['token'] == 'TPC')
+        self.color = node.issuetoken(2, 1000, utxo['txid'], utxo['vout'])['color']
+        node.generate(1, self.signblockprivkey_wif)
+        self.colored_address = index_node.getnewaddress("", self.color)
+        token_txid = node.sendtoaddress(self.colored_address, 300)
+        node.generate(1, self.signblockprivkey_wif)
+        self.sync_all()
+
+        assert_equal(index_node.getaddressbalance(self.colored_address),
+                     [{'token': self.color, 'balance': 300, 'received': 300}])
+        utxos = index_node.getaddressutxos(self.colored_address)
+        assert_equal(len(utxos), 1)
+        assert_equal(utxos[0]['txid'], token_txid)
+        assert_equal(utxos[0]['token'], self.color)
+        assert_equal(utxos[0]['amount'], 300)
+        assert_equal(utxos[0]['height'], 106)
+
+    def _test_reorg(self):
+        index_node = self.nodes[1]
+
+        self.log.info("Test that the index is updated after a reorg")
+        tip = index_node.getbestblockhash()
+        index_node.invalidateblock(tip)
+        assert_equal(index_node.getaddressbalance(self.colored_address), [])
+        assert_equal(index_node.getaddressutxos(self.colored_address), [])
+
+        index_node.invalidateblock(index_node.getblockhash(104))
+        assert_equal(index_node.getaddressbalance(self.address),
+                     [{'token': 'TPC', 'balance': Decimal('15'), 'received': Decimal('15')}])
+        history = index_node.getaddresshistory(self.address)
+        assert_equal(len(history), 2)
+        assert all('spent' not in entry for entry in history)
+        assert_equal(len(index_node.getaddressutxos(self.address)), 2)
+
+        index_node.reconsiderblock(index_node.getblockhash(104))
+        index_node.reconsiderblock(tip)
+        assert_equal(index_node.getbestblockhash(), tip)
+        assert_equal(index_node.getaddressbalance(self.colored_address),
+                     [{'token': self.color, 'balance': 300, 'received': 300}])
+        assert_equal(index_node.getaddressutxos(self.address), [])
+
+    def _test_restart(self):
+        self.log.info("Test that the index is consistent after a restart")
+        history = self.nodes[1].getaddresshistory(self.address)
+        self.restart_node(1, extra_args=["-addressindex"])
+        assert_equal(self.nodes[1].getaddresshistory(self.address), history)
+        assert_equal(self.nodes[1].getaddressbalance(self.colored_address),
+                     [{'token': self.color, 'balance': 300, 'received': 300}])
+
+    def _test_errors(self):
+        node, index_node = self.nodes
+
+        self.log.info("Test address index errors")
+        assert_raises_rpc_error(-1, "Address index is not enabled", node.getaddressbalance, self.address)
+        assert_raises_rpc_error(-5, "Invalid address", index_node.getaddressutxos, "invalid")
+        assert_raises_rpc_error(-8, "Negative count", index_node.getaddresshistory, self.address, -1)
+        assert_raises_rpc_error(-8, "Negative skip", index_node.getaddresshistory, self.address, 1, -1)
+
+if __name__ == '__main__':
+    AddressIndexTest().main()
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Bitcoin Core developers
+# Copyright (c) 2024 Chaintope Inc.
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test coinstatsindex across nodes.
+
+Test that the values returned by gettxoutsetinfo from the coinstats index
+match the values obtained by scanning the UTXO set, at the tip and at earlier
+heights, after a reorg and after a restart.
+"""
+
+from decimal import Decimal
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    wait_until,
+)
+
+class CoinStatsIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [
+            [],
+            ["-coinstatsindex"]
+        ]
+
+    def run_test(self):
+        self._test_coin_stats_index()
+        self._test_reorg_index()
+        self._test_restart()
+        self._test_errors()
+
+    def index_stats(self, *args):
+        """gettxoutsetinfo from the index, waiting for it to catch up."""
+        node = self.nodes[1]
+        wait_until(lambda: self._lookup_succeeds(node, *args), timeout=30)
+        return node.gettxoutsetinfo("muhash", *args)
+
+    def _lookup_succeeds(self, node, *args):
+        try:
+            node.gettxoutsetinfo("muhash", *args)
+            return True
+        except Exception:
+            return False
+
+    def scan_stats(self):
+        res = self.nodes[0].gettxoutsetinfo("muhash")
+        del res['transactions'], res['disk_size']
+        return res
+
+    def _test_coin_stats_index(self):
+        node, index_node = self.nodes
+
+        self.log.info("Test that gettxoutsetinfo() output is consistent with or without coinstatsindex option")
+        node.generate(101, self.signblockprivkey_wif)
+        self.sync_all()
+        res = self.index_stats()
+        assert 'transactions' not in res
+        del res['disk_size']
+        assert_equal(res, self.scan_stats())
+        self.stats_at_101 = res
+
+        self.log.info("Test that the index tracks the total amount of each token")
+        utxo = next(u for u in node.listunspent() if u['token'] == 'TPC')
+        color = node.issuetoken(2, 1000, utxo['txid'], utxo['vout'])['color']
+        node.generate(1, self.signblockprivkey_wif)
+        node.sendtoaddress(index_node.getnewaddress(), Decimal('10'))
+        node.generate(1, self.signblockprivkey_wif)
+        self.sync_all()
+
+        res = self.index_stats()
+        assert_equal(res['height'], 103)
+        assert_equal(res['total_amount'][color], 1000)
+        del res['disk_size']
+        assert_equal(res, self.scan_stats())
+
+        self.log.info("Test that the statistics of an earlier block can be looked up by height and by hash")
+        res = self.index_stats(101)
+        del res['disk_size']
+        assert_equal(res, self.stats_at_101)
+        res = self.index_stats(node.getblockhash(101))
+        del res['disk_size']
+        assert_equal(res, self.stats_at_101)
+        assert color not in res['total_amount']
+
+        self.log.info("Test use_index option")
+        res = index_node.gettxoutsetinfo("muhash", None, False)
+        assert 'transactions' in res
+        del res['transactions'], res['disk_size']
+        assert_equal(res, self.scan_stats())
+
+        res = index_node.gettxoutsetinfo("none")
+        assert 'muhash' not in res
+        assert_equal(res['txouts'], self.scan_stats()['txouts'])
+
+    def _test_reorg_index(self):
+        node, index_node = self.nodes
+
+        self.log.info("Test that the index is updated after a reorg")
+        stats_before = self.index_stats(102)
+        tip = index_node.getbestblockhash()
+        index_node.invalidateblock(index_node.getblockhash(103))
+        res = self.index_stats()
+        assert_equal(res['height'], 102)
+        assert_equal(res, stats_before)
+
+        # Build a competing block 103, which does not contain the transfer.
+        # The other node stays on its own block of the same height.
+        index_node.generate(1, self.signblockprivkey_wif)
+        res = self.index_stats()
+        assert_equal(res['height'], 103)
+        assert_equal(self.index_stats(102), stats_before)
+
+        # Extending the original chain makes the index node reorg back to it.
+        index_node.reconsiderblock(tip)
+        node.generate(3, self.signblockprivkey_wif)
+        self.sync_all()
+        res = self.index_stats()
+        assert_equal(res['height'], 106)
+        del res['disk_size']
+        assert_equal(res, self.scan_stats())
+
+    def _test_restart(self):
+        self.log.info("Test that the index is consistent after a restart")
+        res = self.index_stats()
+        self.restart_node(1, extra_args=["-coinstatsindex"])
+        assert_equal(self.index_stats(), res)
+
+        self.nodes[0].generate(1, self.signblockprivkey_wif)
+        self.sync_all()
+        res = self.index_stats()
+        del res['disk_size']
+        assert_equal(res, self.scan_stats())
+
+    def _test_errors(self):
+        node, index_node = self.nodes
+
+        self.log.info("Test gettxoutsetinfo errors")
+        assert_raises_rpc_error(-8, "Querying specific block heights requires coinstatsindex", node.gettxoutsetinfo, "muhash", 100)
+        assert_raises_rpc_error(-8, "hash_serialized_3 hash type cannot be queried for a specific block", index_node.gettxoutsetinfo, "hash_serialized_3", 100)
+        assert_raises_rpc_error(-8, "Cannot set use_index to false when querying for a specific block", index_node.gettxoutsetinfo, "muhash", 100, False)
+        assert_raises_rpc_error(-8, "Target block height 1000 after current tip", index_node.gettxoutsetinfo, "muhash", 1000)
+
+if __name__ == '__main__':
+    CoinStatsIndexTest().main()
@@ -1074,6 +1074,12 @@ class ColoredCoinTest(BitcoinTestFramework):
         assert_equal(tx_info['vout'][0]['token'], bytes_to_hex_str(colorId_nft))
         assert_equal(tx_info['vout'][0]['value'], 1)
 
+        # the mempool can be filtered by token
+        assert_equal(node.getrawmempool(False, bytes_to_hex_str(colorId_reissuable)), [txSuccess1.hashMalFix])
+        assert_equal(list(node.getrawmempool(True, bytes_to_hex_str(colorId_nonreissuable)).keys()), [txSuccess2.hashMalFix])
+        assert_equal(node.getrawmempool(False, bytes_to_hex_str(colorId_nft)), [txSuccess3.hashMalFix])
+        assert_raises_rpc_error(-8, "Invalid token", node.getrawmempool, False, "00")
+
         #TxFailure4 - (UTXO-1)    - split REISSUABLE - 25 + 75     (UTXO-5,6)
         #           - (UTXO-3)    - split NON-REISSUABLE - 40 + 60 (UTXO-7,8)
         #           - coinbaseTx3 - issue 100 REISSUABLE           (UTXO-9)
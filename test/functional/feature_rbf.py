@@ -26,7 +26,8 @@ class ReplaceByFeeTest(BitcoinTestFramework):
                            "-limitancestorcount=50",
                            "-limitancestorsize=101",
                            "-limitdescendantcount=200",
-                           "-limitdescendantsize=101"],
+                           "-limitdescendantsize=101",
+                           "-limitclustercount=250"],
                            ["-mempoolreplacement=0"]]
 
     def make_utxo(self, node, amount, confirmed=True, scriptPubKey=CScript([1])):
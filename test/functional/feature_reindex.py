@@ -21,6 +21,7 @@ across multiple reindex operations and that block files are not corrupted:
 - Generate 3 more blocks (B9-B11) signed with aggpubkey3.
 - Record block file sizes.
 - Reindex again (-reindex). Verify block count, aggregatePubkeys, and block file sizes are intact.
+- Reindex a third time (-reindex -reindexthreads=4) and verify the same.
 - Generate 3 more blocks to confirm no block file corruption.
 
 With --longchain option:
@@ -101,10 +102,10 @@ class ReindexTest(BitcoinTestFramework):
             if f.startswith("blk") and f.endswith(".dat")
         }
 
-    def reindex_and_verify_xfield(self, expected_aggpubkeys, expected_blockcount, sizes_before):
+    def reindex_and_verify_xfield(self, expected_aggpubkeys, expected_blockcount, sizes_before, args=[]):
         """Restart with -reindex, then verify block count, xfield history, and block file sizes."""
         self.stop_nodes()
-        self.start_nodes([["-reindex"]])
+        self.start_nodes([["-reindex"] + args])
         wait_until(lambda: self.nodes[0].getblockcount() >= expected_blockcount, timeout=TAPYRUSD_REORG_TIMEOUT)
         assert_equal(self.nodes[0].getblockcount(), expected_blockcount)
         blockchaininfo = self.nodes[0].getblockchaininfo()
@@ -243,6 +244,11 @@ class ReindexTest(BitcoinTestFramework):
         self.reindex_and_verify_xfield(expected, 23, sizes_before_second)
         self.log.info("Block file sizes unchanged after second reindex")
 
+        # Third reindex: the same, scanning the block files in parallel
+        self.log.info("Third -reindex with xfield history, scanning the block files in parallel")
+        self.reindex_and_verify_xfield(expected, 23, sizes_before_second, ["-reindexthreads=4"])
+        self.log.info("Block file sizes unchanged after third reindex")
+
         # Generate 3 more blocks to confirm the node is fully functional
         node.generate(3, self.aggprivkey_wif[2])
         assert_equal(node.getblockcount(), 26)
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+# Copyright (c) 2024 Chaintope Inc.
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test tokenindex.
+
+Test that gettokeninfo, gettokenhistory and gettokenholders report the
+issuance, the mint and burn history, the supply at earlier heights and the
+holders of tokens, including the owner of an NFT, and that the index is
+updated after a reorg.
+"""
+
+from test_framework.script import CScript, OP_DUP, OP_HASH160, OP_EQUALVERIFY, OP_CHECKSIG, hash160
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    bytes_to_hex_str,
+    hex_str_to_bytes,
+)
+
+class TokenIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [
+            [],
+            ["-tokenindex"]
+        ]
+
+    def run_test(self):
+        self._test_reissuable_token()
+        self._test_nft()
+        self._test_reorg()
+        self._test_errors()
+
+    def generate(self):
+        self.nodes[0].generate(1, self.signblockprivkey_wif)
+        self.sync_all()
+        return self.nodes[0].getblockcount()
+
+    def _test_reissuable_token(self):
+        node, index_node = self.nodes
+
+        self.log.info("Test the issuance, mint and burn history of a reissuable token")
+        node.generate(101, self.signblockprivkey_wif)
+        tpc_utxo = next(u for u in node.listunspent() if u['token'] == 'TPC')
+        pubkeyhash = hash160(hex_str_to_bytes(node.getaddressinfo(tpc_utxo['address'])['pubkey']))
+        script = CScript([OP_DUP, OP_HASH160, pubkeyhash, OP_EQUALVERIFY, OP_CHECKSIG])
+
+        res = node.issuetoken(1, 100, bytes_to_hex_str(script))
+        self.color = res['color']
+        self.issue_height = self.generate()
+        node.reissuetoken(self.color, 50)
+        self.reissue_height = self.generate()
+        burn_txid = node.burntoken(self.color, 30)
+        self.burn_height = self.generate()
+
+        info = index_node.gettokeninfo(self.color)
+        assert_equal(info['token'], self.color)
+        assert_equal(info['type'], 'REISSUABLE')
+        assert info['issuance_txid'] in res['txids']
+        assert_equal(info['issuance_height'], self.issue_height)
+        assert_equal(info['height'], self.burn_height)
+        assert_equal(info['supply'], 120)
+        assert_equal(info['events'], 3)
+
+        history = index_node.gettokenhistory(self.color)
+        assert_equal([(e['height'], e['delta'], e['supply']) for e in history],
+                     [(self.burn_height, -30, 120), (self.reissue_height, 50, 150), (self.issue_height, 100, 100)])
+        assert_equal(history[0]['txid'], burn_txid)
+        assert_equal(history[2]['txid'], info['issuance_txid'])
+
+        self.log.info("Test pagination")
+        assert_equal(index_node.gettokenhistory(self.color, 1, 1), history[1:2])
+        assert_equal(index_node.gettokenhistory(self.color, 10, 3), [])
+
+        self.log.info("Test the supply at earlier heights")
+        assert_equal(index_node.gettokeninfo(self.color, self.issue_height - 1)['supply'], 0)
+        assert_equal(index_node.gettokeninfo(self.color, self.issue_height)['supply'], 100)
+        assert_equal(index_node.gettokeninfo(self.color, node.getblockhash(self.reissue_height))['supply'], 150)
+
+        self.log.info("Test the holders of a token")
+        address = index_node.getnewaddress("", self.color)
+        node.sendtoaddress(address, 20)
+        self.generate()
+        holders = index_node.gettokenholders(self.color)
+        assert_equal(sum(h['amount'] for h in holders), 120)
+        assert_equal(index_node.gettokeninfo(self.color)['holders'], len(holders))
+        assert_equal([h['amount'] for h in holders if h['address'] == address], [20])
+
+    def _test_nft(self):
+        node, index_node = self.nodes
+
+        self.log.info("Test the owner of an NFT")
+        utxo = next(u for u in node.listunspent() if u['token'] == 'TPC')
+        res = node.issuetoken(3, 1, utxo['txid'], utxo['vout'])
+        nft = res['color']
+        self.generate()
+
+        info = index_node.gettokeninfo(nft)
+        assert_equal(info['type'], 'NFT')
+        assert_equal(info['issuance_txid'], res['txid'])
+        assert_equal(info['supply'], 1)
+        assert_equal(info['holders'], 1)
+        assert_equal([(h['address'], h['amount']) for h in index_node.gettokenholders(nft)], [(res['address'], 1)])
+
+        new_owner = index_node.getnewaddress("", nft)
+        node.sendtoaddress(new_owner, 1)
+        self.generate()
+        assert_equal([(h['address'], h['amount']) for h in index_node.gettokenholders(nft)], [(new_owner, 1)])
+        assert_equal(index_node.gettokeninfo(nft)['holders'], 1)
+        assert_equal(len(index_node.gettokenhistory(nft)), 1)
+
+    def _test_reorg(self):
+        index_node = self.nodes[1]
+
+        self.log.info("Test that the index is updated after a reorg")
+        tip = index_node.getbestblockhash()
+        index_node.invalidateblock(index_node.getblockhash(self.burn_height))
+        info = index_node.gettokeninfo(self.color)
+        assert_equal(info['supply'], 150)
+        assert_equal(info['events'], 2)
+        assert_equal(len(index_node.gettokenhistory(self.color)), 2)
+
+        index_node.invalidateblock(index_node.getblockhash(self.issue_height))
+        assert_raises_rpc_error(-5, "Token not found", index_node.gettokeninfo, self.color)
+        assert_equal(index_node.gettokenholders(self.color), [])
+
+        index_node.reconsiderblock(index_node.getblockhash(self.issue_height))
+        assert_equal(index_node.getbestblockhash(), tip)
+        info = index_node.gettokeninfo(self.color)
+        assert_equal(info['supply'], 120)
+        assert_equal(info['events'], 3)
+
+    def _test_errors(self):
+        node, index_node = self.nodes
+
+        self.log.info("Test token index errors")
+        assert_raises_rpc_error(-1, "Token index is not enabled", node.gettokeninfo, self.color)
+        assert_raises_rpc_error(-8, "Invalid token", index_node.gettokeninfo, "00")
+        assert_raises_rpc_error(-8, "Invalid token", index_node.gettokenhistory, "TPC")
+        assert_raises_rpc_error(-5, "Token not found", index_node.gettokeninfo, "c1" + "00" * 32)
+        assert_raises_rpc_error(-8, "Target block height", index_node.gettokeninfo, self.color, 10000)
+
+if __name__ == '__main__':
+    TokenIndexTest().main()
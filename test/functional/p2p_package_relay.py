@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+# Copyright (c) 2024 Chaintope Inc.
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Tests NODE_PACKAGE_RELAY.
+
+Tests that a node configured with -packagerelay signals NODE_PACKAGE_RELAY, and
+that a parent which does not pay a peer's minimum relay fee reaches the peer's
+mempool together with a child paying for it.
+"""
+
+from decimal import Decimal
+
+from test_framework.messages import NODE_PACKAGE_RELAY
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    wait_until,
+)
+
+class PackageRelayTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.num_nodes = 2
+        # Node 1 rejects the parent alone
+        self.extra_args = [
+            ["-packagerelay"],
+            ["-packagerelay", "-minrelaytxfee=0.001"],
+        ]
+
+    def run_test(self):
+        self.log.info("Check that -packagerelay signals NODE_PACKAGE_RELAY")
+        for node in self.nodes:
+            assert int(node.getnetworkinfo()['localservices'], 16) & NODE_PACKAGE_RELAY
+
+        self.log.info("Create a parent paying a low fee and a child paying for both on node 0")
+        node = self.nodes[0]
+        coin = [u for u in node.listunspent() if u['amount'] > 1][0]
+        parent_amount = coin['amount'] - Decimal("0.00001")
+        raw_parent = node.createrawtransaction([{'txid': coin['txid'], 'vout': coin['vout']}], [{node.getnewaddress(): parent_amount}])
+        parent_txid = node.sendrawtransaction(node.signrawtransactionwithwallet(raw_parent, [], "ALL", self.options.scheme)['hex'])
+
+        raw_child = node.createrawtransaction([{'txid': parent_txid, 'vout': 0}], [{node.getnewaddress(): parent_amount - Decimal("0.01")}])
+        child_txid = node.sendrawtransaction(node.signrawtransactionwithwallet(raw_child, [], "ALL", self.options.scheme)['hex'])
+
+        self.log.info("Node 1 accepts the parent and the child as a package")
+        wait_until(lambda: child_txid in self.nodes[1].getrawmempool(), timeout=30)
+        assert parent_txid in self.nodes[1].getrawmempool()
+
+        self.log.info("Both are mined")
+        node.generate(1, self.signblockprivkey_wif)
+        self.sync_all()
+        assert_equal(self.nodes[1].getrawmempool(), [])
+
+if __name__ == '__main__':
+    PackageRelayTest().main()
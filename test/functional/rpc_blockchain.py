@@ -200,6 +200,26 @@ class BlockchainTest(BitcoinTestFramework):
         del res['disk_size'], res3['disk_size']
         assert_equal(res, res3)
 
+        self.log.info("Test gettxoutsetinfo hash_type option")
+        res4 = node.gettxoutsetinfo("muhash")
+        muhash = res4['muhash']
+        assert_equal(len(muhash), 64)
+        assert 'hash_serialized_3' not in res4
+        res5 = node.gettxoutsetinfo("none")
+        assert 'hash_serialized_3' not in res5
+        assert 'muhash' not in res5
+        del res4['disk_size'], res4['muhash'], res5['disk_size']
+        del res3['hash_serialized_3']
+        assert_equal(res3, res4)
+        assert_equal(res3, res5)
+
+        node.invalidateblock(b1hash)
+        assert muhash != node.gettxoutsetinfo("muhash")['muhash']
+        node.reconsiderblock(b1hash)
+        assert_equal(node.gettxoutsetinfo("muhash")['muhash'], muhash)
+
+        assert_raises_rpc_error(-8, "foo is not a valid hash_type", node.gettxoutsetinfo, "foo")
+
     def _test_getblockheader(self):
         node = self.nodes[0]
 
@@ -17,6 +17,7 @@ from test_framework.util import (
     NetworkDirName
 )
 from test_framework.blocktools import createTestGenesisBlock
+from test_framework.messages import COIN
 import json
 import os
 import time
@@ -28,18 +29,6 @@ class GetblockstatsTest(BitcoinTestFramework):
 
     start_height = 1
     max_stat_pos = 2
-    STATS_NEED_TXINDEX = [
-        'avgfee',
-        'avgfeerate',
-        'maxfee',
-        'maxfeerate',
-        'medianfee',
-        'feerate_percentiles',
-        'minfee',
-        'minfeerate',
-        'totalfee',
-        'utxo_size_inc',
-    ]
 
     def add_options(self, parser):
         parser.add_argument('--gen-test-data', dest='gen_test_data',
@@ -137,9 +126,6 @@ class GetblockstatsTest(BitcoinTestFramework):
 
         self.sync_all()
         stats = self.get_stats()
-        expected_stats_noindex = []
-        for stat_row in stats:
-            expected_stats_noindex.append({k: v for k, v in stat_row.items() if k not in self.STATS_NEED_TXINDEX})
 
         # Make sure all valid statistics are included but nothing else is
         expected_keys = self.expected_stats[0].keys()
@@ -157,9 +143,9 @@ class GetblockstatsTest(BitcoinTestFramework):
             stats_by_hash = self.nodes[0].getblockstats(hash_or_height=blockhash)
             assert_equal(stats_by_hash, self.expected_stats[i])
 
-            # Check with the node that has no txindex
-            stats_no_txindex = self.nodes[1].getblockstats(hash_or_height=blockhash, stats=list(expected_stats_noindex[i].keys()))
-            assert_equal(stats_no_txindex, expected_stats_noindex[i])
+            # The spent outputs are read from the undo data, so the node without txindex returns every stat
+            stats_no_txindex = self.nodes[1].getblockstats(hash_or_height=blockhash)
+            assert_equal(stats_no_txindex, self.expected_stats[i])
 
         # Make sure each stat can be queried on its own
         for stat in expected_keys:
@@ -171,6 +157,29 @@ class GetblockstatsTest(BitcoinTestFramework):
                         stat, i, result[stat], self.expected_stats[i][stat]))
                 assert_equal(result[stat], self.expected_stats[i][stat])
 
+        # The spent outputs and fees reported by getblock and getrawtransaction come from the same undo data
+        for i in range(self.max_stat_pos+1):
+            blockhash = self.expected_stats[i]['blockhash']
+            block = self.nodes[1].getblock(blockhash, 3)
+            assert 'fee' not in block['tx'][0]
+            assert 'prevout' not in block['tx'][0]['vin'][0]
+            assert 'prevout' not in self.nodes[1].getblock(blockhash, 2)['tx'][-1]['vin'][0]
+
+            totalfee = 0
+            for tx in block['tx'][1:]:
+                for vin in tx['vin']:
+                    prevout = vin['prevout']
+                    assert_equal(prevout['token'], 'TPC')
+                    assert prevout['height'] <= self.expected_stats[i]['height']
+                    assert_equal(set(prevout.keys()), {'generated', 'height', 'token', 'value', 'scriptPubKey'})
+                totalfee += tx['fee']
+
+                rawtx = self.nodes[1].getrawtransaction(tx['txid'], 2, blockhash)
+                assert_equal(rawtx['fee'], tx['fee'])
+                assert_equal([vin['prevout'] for vin in rawtx['vin']], [vin['prevout'] for vin in tx['vin']])
+                assert 'fee' not in self.nodes[1].getrawtransaction(tx['txid'], 1, blockhash)
+            assert_equal(int(totalfee * COIN), self.expected_stats[i]['totalfee'])
+
         # Make sure only the selected statistics are included (more than one)
         some_stats = {'minfee', 'maxfee'}
         stats = self.nodes[0].getblockstats(hash_or_height=1, stats=list(some_stats))
@@ -199,9 +208,6 @@ class GetblockstatsTest(BitcoinTestFramework):
         assert_raises_rpc_error(-8, 'Invalid selected statistic aaa%s' % inv_sel_stat,
                                 self.nodes[0].getblockstats, hash_or_height=1, stats=['minfee' , 'aaa%s' % inv_sel_stat])
 
-        assert_raises_rpc_error(-8, 'One or more of the selected stats requires -txindex enabled',
-                                self.nodes[1].getblockstats, hash_or_height=self.start_height + self.max_stat_pos)
-
         # Mainchain's genesis block shouldn't be found on regtest
         assert_raises_rpc_error(-5, 'Block not found', self.nodes[0].getblockstats,
                                 hash_or_height='000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f')
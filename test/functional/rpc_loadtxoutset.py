@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+# Copyright (c) 2024 Chaintope Inc
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test bootstrapping a node from a UTXO snapshot using `loadtxoutset`.
+
+node0 mines a chain and writes a snapshot with dumptxoutset.
+node1 only receives the headers of that chain, loads the snapshot and
+continues syncing from the snapshot base, while the blocks below the base
+are downloaded and validated in the background.
+"""
+
+import os
+import shutil
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.messages import CBlock, CBlockHeader, FromHex, msg_headers
+from test_framework.mininode import P2PInterface
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    connect_nodes_bi,
+    get_datadir_path,
+    NetworkDirName,
+    sync_blocks,
+    wait_until,
+)
+
+FILENAME = "utxo.dat"
+SNAPSHOT_HEIGHT = 100
+
+class LoadtxoutsetTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        # Keep the nodes apart until node1 has loaded the snapshot.
+        self.setup_nodes()
+
+    def send_headers(self, node, hashes):
+        """Announce the headers of node0's blocks to node over a p2p connection."""
+        headers_message = msg_headers()
+        headers_message.headers = [CBlockHeader(FromHex(CBlock(), self.nodes[0].getblock(h, 0))) for h in hashes]
+        node.p2p.send_and_ping(headers_message)
+
+    def run_test(self):
+        node0, node1 = self.nodes
+        node0.generate(SNAPSHOT_HEIGHT, self.signblockprivkey_wif)
+
+        out = node0.dumptxoutset(FILENAME)
+        base_hash = out['base_hash']
+        txoutset_hash = out['txoutset_hash']
+        assert_equal(out['base_height'], SNAPSHOT_HEIGHT)
+
+        snapshot_path = os.path.join(get_datadir_path(self.options.tmpdir, 1), NetworkDirName(), FILENAME)
+        shutil.copyfile(out['path'], snapshot_path)
+
+        self.log.info("Reject a snapshot whose base header is not known")
+        assert_raises_rpc_error(-32603, "is not known yet", node1.loadtxoutset, FILENAME, txoutset_hash)
+
+        node1.add_p2p_connection(P2PInterface(node1.time_to_connect))
+        hashes = [node0.getblockhash(h) for h in range(1, SNAPSHOT_HEIGHT + 1)]
+        self.send_headers(node1, hashes)
+        assert_equal(node1.getblockheader(base_hash)['height'], SNAPSHOT_HEIGHT)
+        assert_equal(node1.getblockcount(), 0)
+
+        self.log.info("Reject invalid arguments")
+        assert_raises_rpc_error(-8, "Couldn't open file", node1.loadtxoutset, "nonexistent.dat", txoutset_hash)
+        assert_raises_rpc_error(-8, "txoutset_hash must be of length 64", node1.loadtxoutset, FILENAME, "00")
+
+        self.log.info("Reject a snapshot that does not match the expected hash")
+        assert_raises_rpc_error(-32603, "does not match the expected hash", node1.loadtxoutset, FILENAME, "00" * 32)
+        assert_equal(node1.getblockcount(), 0)
+
+        self.log.info("Load the snapshot")
+        res = node1.loadtxoutset(FILENAME, txoutset_hash)
+        assert_equal(res['coins_loaded'], out['coins_written'])
+        assert_equal(res['base_hash'], base_hash)
+        assert_equal(res['base_height'], SNAPSHOT_HEIGHT)
+        assert_equal(res['txoutset_hash'], txoutset_hash)
+        assert_equal(node1.getbestblockhash(), base_hash)
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_3'], txoutset_hash)
+        snapshot_validation = node1.getblockchaininfo()['snapshot_validation']
+        assert_equal(snapshot_validation['base_hash'], base_hash)
+        assert_equal(snapshot_validation['base_height'], SNAPSHOT_HEIGHT)
+        assert_equal(snapshot_validation['blocks'], 0)
+
+        assert_raises_rpc_error(-32603, "has already been loaded", node1.loadtxoutset, FILENAME, txoutset_hash)
+
+        self.log.info("Indexes cannot be enabled before the snapshot is validated")
+        node1.disconnect_p2ps()
+        self.stop_node(1)
+        node1.assert_start_raises_init_error(["-txindex"], "Error: -txindex cannot be used until the loaded UTXO snapshot is validated.")
+        self.start_node(1)
+        assert_equal(node1.getbestblockhash(), base_hash)
+        assert_equal(node1.getblockchaininfo()['snapshot_validation']['base_hash'], base_hash)
+
+        self.log.info("Sync blocks past the snapshot base")
+        node1.disconnect_p2ps()
+        connect_nodes_bi(self.nodes, 0, 1)
+        node0.generate(10, self.signblockprivkey_wif)
+        sync_blocks(self.nodes)
+        assert_equal(node1.getblockcount(), SNAPSHOT_HEIGHT + 10)
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_3'], node0.gettxoutsetinfo()['hash_serialized_3'])
+
+        self.log.info("Validate the blocks below the snapshot base in the background")
+        wait_until(lambda: 'snapshot_validation' not in node1.getblockchaininfo(), timeout=60)
+        assert_equal(node1.getblock(node0.getblockhash(1))['height'], 1)
+
+        self.log.info("The validated snapshot chainstate replaces the chainstate after a restart")
+        datadir = os.path.join(get_datadir_path(self.options.tmpdir, 1), NetworkDirName())
+        self.restart_node(1)
+        assert not os.path.exists(os.path.join(datadir, "chainstate_snapshot"))
+        assert 'snapshot_validation' not in node1.getblockchaininfo()
+        assert_equal(node1.getbestblockhash(), node0.getbestblockhash())
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_3'], node0.gettxoutsetinfo()['hash_serialized_3'])
+
+if __name__ == '__main__':
+    LoadtxoutsetTest().main()
@@ -100,6 +100,7 @@ BASE_SCRIPTS = [
     'feature_cltv.py',
     'feature_cltv.py --scheme SCHNORR',
     'rpc_scantxoutset.py',
+    'rpc_loadtxoutset.py',
     'wallet_keypool_topup.py',
     'interface_zmq.py',
     'interface_bitcoin_cli.py',
@@ -190,6 +191,9 @@ BASE_SCRIPTS = [
     'feature_help.py',
     'feature_help.py --usecli',
     'feature_coloredcoin.py',
+    'feature_coinstatsindex.py',
+    'feature_addressindex.py',
+    'feature_tokenindex.py',
     'feature_cp2sh_softfork.py',
     'rpc_dumptxoutset.py',
     'feature_reindex_outoforder_block.py'
@@ -228,6 +232,8 @@ EXTENDED_SCRIPTS = [
     'mempool_limit.py',
     'mempool_limit.py  --scheme SCHNORR',
     'p2p_node_network_limited.py',
+    'p2p_blockfilters.py',
+    'p2p_package_relay.py',
     'feature_federation_management.py',
     'feature_federation_management.py --scheme SCHNORR',
     'feature_xfield_maxblocksize.py',